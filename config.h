@@ -16,16 +16,46 @@
 
 #define QCGC_SHADOWSTACK_SIZE 163840		// Total shadowstack size
 #define QCGC_ARENA_BAG_INIT_SIZE 16			// Initial size of the arena bag
-#define QCGC_ARENA_SIZE_EXP 20				// Between 16 (64kB) and 20 (1MB)
+#ifndef QCGC_ARENA_SIZE_EXP
+#define QCGC_ARENA_SIZE_EXP 20				// Between 16 (64kB) and 22 (4MB)
+#endif
+#define QCGC_HEAP_RESERVE ((size_t) 1<<32)	// Address space reserved for
+											// arenas (0 = off)
+#define QCGC_HUGE_PAGES 0					// Back arenas with huge pages
+											// (0 = off, 1 = transparent,
+											// 2 = hugetlbfs)
 #define QCGC_LARGE_ALLOC_THRESHOLD_EXP 14	// Less than QCGC_ARENA_SIZE_EXP
-#define QCGC_MARK_LIST_SEGMENT_SIZE 64		// TODO: Tune for performance
-#define QCGC_GRAY_STACK_INIT_SIZE 128		// TODO: Tune for performance
+#define QCGC_MEDIUM_PAGE_EXP 12			// Page size of medium object segments
+#define QCGC_CARD_SIZE_EXP 9				// Card size of medium objects and huge
+											// blocks, see qcgc_write_index
+#define QCGC_DIRTY_CARD_CACHE 256			// Dirty cards qcgc_write_index can
+											// skip without the lock (power of
+											// two)
+#define QCGC_MARK_LIST_SEGMENT_SIZE 64		// Objects per gray stack segment
+#define QCGC_GRAY_POOL_KEEP 16				// Free gray stack segments kept
+											// after marking
+#define QCGC_GRAY_STACK_LIMIT 16384			// Gray stack segments in use
+											// before arenas overflow
+											// (0 = unbounded)
 #define QCGC_INC_MARK_MIN 64				// TODO: Tune for performance
+#define QCGC_MARK_THREADS 1					// Marking threads (1: no helpers)
+#define QCGC_MARK_PREFETCH 0				// Children prefetched ahead in a
+											// full mark (0 = off, at most 64)
+
+/**
+ * Returning memory to the OS
+ */
+#define QCGC_OS_PAGE_SIZE 4096				// Granularity of decommitting
+#define QCGC_FREE_ARENAS_RETAIN 2			// Free arenas kept committed
+#define QCGC_DECOMMIT_MIN_PAGES 4			// Smallest run of free pages in a
+											// live arena that is decommitted
 
 /**
  * Fit allocator
  */
 #define QCGC_LARGE_FREE_LIST_FIRST_EXP 5	// First exponent of large free list
+#define QCGC_LARGE_FREE_LIST_SPLIT_EXP 3	// Large free lists are split into
+											// 2^x second level lists
 #define QCGC_LARGE_FREE_LIST_INIT_SIZE 4	// Initial size for large free lists
 #define QCGC_SMALL_FREE_LIST_INIT_SIZE 16	// Initial size for small free lists
 
@@ -34,11 +64,63 @@
  */
 #define QCGC_INCMARK_THRESHOLD (1<<(QCGC_ARENA_SIZE_EXP-4))
 #define QCGC_INCMARK_TO_SWEEP 5
+#define QCGC_GC_PERCENT 100				// Cells allocated per full cycle in
+										// percent of the live cells (0 = off,
+										// fixed QCGC_INCMARK_THRESHOLD). Off
+										// if only the QCGC_INCMARK variable
+										// is set in the environment
+#define QCGC_PACER_MIN_CELLS (1<<(QCGC_ARENA_SIZE_EXP-4))	// Smallest
+										// allocation budget of a cycle
+#define QCGC_INCMARK_BUDGET_NS 0		// Time limit of an incremental mark
+										// step (0 = off, object count)
+#define QCGC_INCMARK_CLOCK_INTERVAL 64	// Objects marked between clock checks
+#define QCGC_GROWTH_POLICY 1			// Grow the heap before the fit
+										// allocator fails (0 = off)
+#define QCGC_GROWTH_FRAGMENTATION 50	// Fragmentation in percent of the free
+										// cells above which the heap grows
+#define QCGC_LAZY_SWEEP 0				// Sweep arenas on demand (0 = off)
+#define QCGC_BACKGROUND_SWEEP 0			// Sweep arenas in separate thread
+										// (0 = off)
+
+/**
+ * Generational mode
+ */
+#define QCGC_GENERATIONAL 0				// Minor collections (0 = off,
+										// 1 = nursery arenas, 2 = sticky
+										// mark bits, see src/generation.h)
+#define QCGC_NURSERY_ARENAS 4			// Young arenas (or arenas worth of
+										// cells allocated in sticky mode)
+										// that trigger a minor collection
+#define QCGC_MAJOR_THRESHOLD (1<<(QCGC_ARENA_SIZE_EXP-1))	// Promoted cells
+										// that trigger a full collection
+
+/**
+ * Compaction
+ */
+#define QCGC_COMPACTION 0				// Evacuate sparse arenas in full
+										// collections (0 = off, see
+										// src/compaction.h)
+#define QCGC_COMPACTION_DENSITY 25		// Live cells in percent below which
+										// an arena is evacuated
 
 /**
  * DO NOT MODIFY BELOW HERE
  */
 
+#if QCGC_ARENA_SIZE_EXP < 16 || QCGC_ARENA_SIZE_EXP > 22
+#error	"Inconsistent configuration. Arena size must be between 64kB and 4MB."
+#endif
+
+#if QCGC_CARD_SIZE_EXP > QCGC_MEDIUM_PAGE_EXP
+#error	"Inconsistent configuration. Cards must not be larger than the pages " \
+		"of medium objects."
+#endif
+
+#if QCGC_OS_PAGE_SIZE < 4096
+#error	"Inconsistent configuration. The decommitted pages of an arena are " \
+		"tracked in its header, pages must be at least 4kB."
+#endif
+
 #if QCGC_LARGE_ALLOC_THRESHOLD_EXP >= QCGC_ARENA_SIZE_EXP
 #error	"Inconsistent configuration. Huge block threshold must be smaller " \
 		"than the arena size."
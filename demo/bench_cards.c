@@ -0,0 +1,106 @@
+#include <qcgc.h>
+#include <src/collector.h>
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define LENGTH (1<<22)
+#define NODES 1024
+#define STORES 1024
+#define RUNS 5
+
+typedef struct array_s array_t;
+
+struct array_s {
+	object_t hdr;
+	size_t length;
+	array_t *items[];
+};
+
+void qcgc_trace_cb(object_t *object, void (*visit)(object_t *object)) {
+	array_t *array = (array_t *) object;
+	for (size_t i = 0; i < array->length; i++) {
+		visit((object_t *) array->items[i]);
+	}
+}
+
+void qcgc_trace_range_cb(object_t *object, size_t start, size_t end,
+		void (*visit)(object_t *object)) {
+	array_t *array = (array_t *) object;
+	size_t first = start < offsetof(array_t, items) ? 0 :
+		(start - offsetof(array_t, items)) / sizeof(array_t *);
+	size_t last = end < offsetof(array_t, items) ? 0 :
+		(end - offsetof(array_t, items)) / sizeof(array_t *);
+	for (size_t i = first; i < last && i < array->length; i++) {
+		visit((object_t *) array->items[i]);
+	}
+}
+
+static array_t *allocate_array(size_t length) {
+	array_t *array = (array_t *) qcgc_allocate(sizeof(array_t) +
+			length * sizeof(array_t *));
+	array->length = length;
+	for (size_t i = 0; i < length; i++) {
+		array->items[i] = NULL;
+	}
+	return array;
+}
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/**
+ * Time to finish marking after a few stores into a large array that was
+ * traced already.
+ */
+static double run(array_t *array, array_t **nodes, bool index) {
+	double best = 0;
+	for (size_t run = 0; run < RUNS; run++) {
+		qcgc_collect();
+		qcgc_incmark();
+		for (size_t i = 0; i < STORES; i++) {
+			size_t slot = (i * 2654435761u) % LENGTH;
+			if (index) {
+				qcgc_write_index((object_t *) array,
+						offsetof(array_t, items) + slot * sizeof(array_t *));
+			} else {
+				qcgc_write((object_t *) array);
+			}
+			array->items[slot] = nodes[i % NODES];
+		}
+		double start = now();
+		qcgc_mark();
+		double time = now() - start;
+		qcgc_sweep();
+		if (run == 0 || time < best) {
+			best = time;
+		}
+	}
+	return best;
+}
+
+int main(void) {
+	qcgc_initialize();
+
+	array_t *array = allocate_array(LENGTH);
+	qcgc_push_root((object_t *) array);
+	array_t *nodes[NODES];
+	for (size_t i = 0; i < NODES; i++) {
+		nodes[i] = allocate_array(0);
+		array->items[i] = nodes[i];
+	}
+
+	printf("qcgc_write:       %.3f ms\n", run(array, nodes, false) * 1e3);
+	printf("qcgc_write_index: %.3f ms\n", run(array, nodes, true) * 1e3);
+
+	qcgc_pop_root(1);
+	qcgc_destroy();
+	return 0;
+}
@@ -0,0 +1,71 @@
+#include <qcgc.h>
+#include <src/allocator.h>
+#include <src/gc_state.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct node_s node_t;
+
+struct node_s {
+	object_t hdr;
+	size_t value;
+	node_t *next;
+};
+
+void qcgc_trace_cb(object_t *object, void (*visit)(object_t *object)) {
+	node_t *node = (node_t *) object;
+	visit((object_t *) node->next);
+}
+
+static double cpu_time(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/**
+ * demo_list scaled up: Allocate count (default 2^24) list nodes, every
+ * keep-th (default 16) of them is appended to a list that stays alive, all
+ * others die right away. Run with QCGC_GENERATIONAL=0/1/2 and compare.
+ */
+int main(int argc, char **argv) {
+	size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 1<<24;
+	size_t keep = argc > 2 ? strtoul(argv[2], NULL, 10) : 16;
+
+	qcgc_initialize();
+	node_t *list = (node_t *) qcgc_allocate(sizeof(node_t));
+	qcgc_push_root((object_t *) list);
+	node_t *last = list;
+
+	double start = cpu_time();
+	for (size_t i = 1; i < count; i++) {
+		node_t *node = (node_t *) qcgc_allocate(sizeof(node_t));
+		node->value = i;
+		if (i % keep == 0) {
+			qcgc_write((object_t *) last);
+			last->next = node;
+			last = node;
+		}
+	}
+	double time = cpu_time() - start;
+
+	// Check structure
+	size_t length = 0;
+	for (node_t *it = list->next; it != NULL; it = it->next) {
+		length++;
+		if (it->value != length * keep) {
+			fprintf(stderr, "List broken at %zu\n", length);
+			return 1;
+		}
+	}
+
+	printf("generational: %zu, nodes: %zu, alive: %zu, cpu: %.2f s, "
+			"arenas: %zu\n", qcgc_state.generational, count, length, time,
+			qcgc_allocator_state.arenas->count);
+
+	qcgc_pop_root(1);
+	qcgc_destroy();
+	return 0;
+}
@@ -0,0 +1,78 @@
+#include <qcgc.h>
+#include <src/collector.h>
+#include <src/hugeblocktable.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define RUNS 5
+
+void qcgc_trace_cb(object_t *object, void (*visit)(object_t *object)) {
+	(void) object;
+	(void) visit;
+}
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/**
+ * Mark count rooted huge objects and look each of them up in the huge block
+ * table, as the write barrier does.
+ */
+static void bench(size_t count) {
+	object_t **objects = (object_t **) malloc(count * sizeof(object_t *));
+	for (size_t i = 0; i < count; i++) {
+		objects[i] = qcgc_allocate(1<<QCGC_LARGE_ALLOC_THRESHOLD_EXP);
+		qcgc_push_root(objects[i]);
+	}
+	qcgc_collect();
+
+	double best_mark = 0;
+	double best_lookup = 0;
+	for (size_t run = 0; run < RUNS; run++) {
+		double start = now();
+		qcgc_mark();
+		double time = now() - start;
+		if (run == 0 || time < best_mark) {
+			best_mark = time;
+		}
+
+		size_t marked = 0;
+		start = now();
+		for (size_t i = 0; i < count; i++) {
+			marked += qcgc_hbtable_is_marked(objects[i]);
+		}
+		time = now() - start;
+		if (marked != count) {
+			fprintf(stderr, "Huge object not marked\n");
+			exit(1);
+		}
+		if (run == 0 || time < best_lookup) {
+			best_lookup = time;
+		}
+		qcgc_sweep();
+	}
+
+	printf("huge objects: %6zu, mark: %8.2f ns/object, "
+			"lookup: %8.2f ns/object\n", count, best_mark / count * 1e9,
+			best_lookup / count * 1e9);
+
+	qcgc_pop_root(count);
+	qcgc_collect();
+	free(objects);
+}
+
+int main(void) {
+	qcgc_initialize();
+
+	for (size_t count = 1024; count <= 16384; count *= 2) {
+		bench(count);
+	}
+
+	qcgc_destroy();
+	return 0;
+}
@@ -0,0 +1,155 @@
+#include <qcgc.h>
+#include <src/collector.h>
+#include <src/gc_state.h>
+#include <src/heap.h>
+
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RUNS 3
+
+typedef struct node_s node_t;
+
+struct node_s {
+	object_t hdr;
+	node_t *left;
+	node_t *right;
+	size_t padding[5];
+};
+
+void qcgc_trace_cb(object_t *object, void (*visit)(object_t *object)) {
+	node_t *node = (node_t *) object;
+	visit((object_t *) node->left);
+	visit((object_t *) node->right);
+}
+
+/**
+ * Memory of this process backed by transparent huge pages in kB
+ */
+static size_t anon_huge_pages(void) {
+	size_t result = 0;
+	char line[256];
+	FILE *smaps = fopen("/proc/self/smaps_rollup", "r");
+	if (smaps == NULL) {
+		return 0;
+	}
+	while (fgets(line, sizeof(line), smaps) != NULL) {
+		if (sscanf(line, "AnonHugePages: %zu kB", &result) == 1) {
+			break;
+		}
+	}
+	fclose(smaps);
+	return result;
+}
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/**
+ * Open a counter for dTLB load misses of this thread, -1 if not available
+ */
+static int open_dtlb_counter(void) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_DTLB |
+		(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		(PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/**
+ * Mark a heap of the given size (MB, default 2048) made of a complete binary
+ * tree whose nodes are placed randomly, such that marking touches the pages
+ * in random order.
+ * Run with QCGC_HUGE_PAGES=0/1 and compare.
+ */
+int main(int argc, char **argv) {
+	size_t heap_mb = argc > 1 ? strtoul(argv[1], NULL, 10) : 2048;
+	size_t count = (heap_mb << 20) / sizeof(node_t);
+
+	qcgc_initialize();
+
+	// No collections while the objects are not linked yet
+	size_t incmark_threshold = qcgc_state.incmark_threshold;
+	qcgc_state.incmark_threshold = SIZE_MAX;
+	node_t **nodes = (node_t **) malloc(count * sizeof(node_t *));
+	for (size_t i = 0; i < count; i++) {
+		nodes[i] = (node_t *) qcgc_allocate(sizeof(node_t));
+	}
+	srand(42);
+	for (size_t i = count - 1; i > 0; i--) {
+		size_t j = ((size_t) rand() * RAND_MAX + rand()) % (i + 1);
+		node_t *tmp = nodes[i];
+		nodes[i] = nodes[j];
+		nodes[j] = tmp;
+	}
+	// Node i has children 2i+1 and 2i+2
+	qcgc_push_root((object_t *) nodes[0]);
+	for (size_t i = 1; i < count; i++) {
+		node_t *parent = nodes[(i - 1) / 2];
+		qcgc_write((object_t *) parent);
+		if (i % 2 == 1) {
+			parent->left = nodes[i];
+		} else {
+			parent->right = nodes[i];
+		}
+	}
+	free(nodes);
+	qcgc_state.incmark_threshold = incmark_threshold;
+	qcgc_collect();
+
+	int counter = open_dtlb_counter();
+	double best = 0;
+	long long misses = 0;
+	for (size_t run = 0; run < RUNS; run++) {
+		long long run_misses = 0;
+		if (counter >= 0) {
+			ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+			ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+		}
+		double start = now();
+		qcgc_mark();
+		double time = now() - start;
+		if (counter >= 0) {
+			ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+			if (read(counter, &run_misses, sizeof(run_misses)) !=
+					sizeof(run_misses)) {
+				run_misses = 0;
+			}
+		}
+		qcgc_sweep();
+		if (run == 0 || time < best) {
+			best = time;
+			misses = run_misses;
+		}
+	}
+
+	printf("arena: %d kB, huge pages: %zu (%zu MB), heap: %zu MB, "
+			"mark: %.2f ms, ", QCGC_ARENA_SIZE >> 10,
+			qcgc_heap_state.huge_pages, anon_huge_pages() >> 10, heap_mb,
+			best * 1e3);
+	if (counter >= 0) {
+		printf("dTLB load misses: %lld\n", misses);
+		close(counter);
+	} else {
+		printf("dTLB load misses: n/a\n");
+	}
+
+	qcgc_pop_root(1);
+	qcgc_destroy();
+	return 0;
+}
@@ -0,0 +1,95 @@
+#include <qcgc.h>
+#include <src/collector.h>
+#include <src/gc_state.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define DEPTH 21
+#define NODES ((1<<DEPTH) - 1)
+#define RUNS 5
+#define MAX_PAUSES (1<<20)
+
+typedef struct node_s node_t;
+
+struct node_s {
+	object_t hdr;
+	size_t value;
+	node_t *left;
+	node_t *right;
+};
+
+void qcgc_trace_cb(object_t *object, void (*visit)(object_t *object)) {
+	node_t *node = (node_t *) object;
+	visit((object_t *) node->left);
+	visit((object_t *) node->right);
+}
+
+static uint64_t now_ns(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static int compare_pauses(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *) a;
+	uint64_t y = *(const uint64_t *) b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * Mark a complete binary tree in incremental steps only and report the
+ * distribution of the step pauses. Run with QCGC_INCMARK_BUDGET_NS=0 (steps
+ * bounded by object count) and e.g. QCGC_INCMARK_BUDGET_NS=100000 and compare.
+ */
+int main(void) {
+	qcgc_initialize();
+
+	// Complete binary tree, node i has children 2i+1 and 2i+2
+	node_t **nodes = (node_t **) malloc(NODES * sizeof(node_t *));
+	nodes[0] = (node_t *) qcgc_allocate(sizeof(node_t));
+	qcgc_push_root((object_t *) nodes[0]);
+	for (size_t i = 1; i < NODES; i++) {
+		nodes[i] = (node_t *) qcgc_allocate(sizeof(node_t));
+		nodes[i]->value = i;
+		node_t *parent = nodes[(i - 1) / 2];
+		qcgc_write((object_t *) parent);
+		if (i % 2 == 1) {
+			parent->left = nodes[i];
+		} else {
+			parent->right = nodes[i];
+		}
+	}
+	free(nodes);
+	qcgc_collect();
+
+	uint64_t *pauses = (uint64_t *) malloc(MAX_PAUSES * sizeof(uint64_t));
+	size_t count = 0;
+	uint64_t total = 0;
+	for (size_t run = 0; run < RUNS; run++) {
+		while (qcgc_state.phase != GC_COLLECT && count < MAX_PAUSES) {
+			uint64_t start = now_ns();
+			qcgc_incmark();
+			pauses[count] = now_ns() - start;
+			total += pauses[count];
+			count++;
+		}
+		qcgc_mark();
+		qcgc_sweep();
+	}
+
+	qsort(pauses, count, sizeof(uint64_t), compare_pauses);
+	char *budget = getenv("QCGC_INCMARK_BUDGET_NS");
+	printf("budget: %s ns, steps: %zu, p50: %.1f us, p99: %.1f us, "
+			"max: %.1f us, mark: %.2f ms per cycle\n",
+			budget != NULL ? budget : "0", count,
+			pauses[count / 2] * 1e-3, pauses[count * 99 / 100] * 1e-3,
+			pauses[count - 1] * 1e-3, total * 1e-6 / RUNS);
+
+	free(pauses);
+	qcgc_pop_root(1);
+	qcgc_destroy();
+	return 0;
+}
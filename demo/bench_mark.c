@@ -0,0 +1,75 @@
+#include <qcgc.h>
+#include <src/collector.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define DEPTH 21
+#define NODES ((1<<DEPTH) - 1)
+#define RUNS 5
+
+typedef struct node_s node_t;
+
+struct node_s {
+	object_t hdr;
+	size_t value;
+	node_t *left;
+	node_t *right;
+};
+
+void qcgc_trace_cb(object_t *object, void (*visit)(object_t *object)) {
+	node_t *node = (node_t *) object;
+	visit((object_t *) node->left);
+	visit((object_t *) node->right);
+}
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int main(void) {
+	qcgc_initialize();
+
+	// Complete binary tree, node i has children 2i+1 and 2i+2
+	node_t **nodes = (node_t **) malloc(NODES * sizeof(node_t *));
+	nodes[0] = (node_t *) qcgc_allocate(sizeof(node_t));
+	qcgc_push_root((object_t *) nodes[0]);
+	for (size_t i = 1; i < NODES; i++) {
+		nodes[i] = (node_t *) qcgc_allocate(sizeof(node_t));
+		nodes[i]->value = i;
+		node_t *parent = nodes[(i - 1) / 2];
+		qcgc_write((object_t *) parent);
+		if (i % 2 == 1) {
+			parent->left = nodes[i];
+		} else {
+			parent->right = nodes[i];
+		}
+	}
+	free(nodes);
+	qcgc_collect();
+
+	double best = 0;
+	for (size_t run = 0; run < RUNS; run++) {
+		double start = now();
+		qcgc_mark();
+		double time = now() - start;
+		qcgc_sweep();
+		if (run == 0 || time < best) {
+			best = time;
+		}
+	}
+
+	char *threads = getenv("QCGC_MARK_THREADS");
+	printf("mark threads: %s, objects: %d, mark: %.2f ms, "
+			"throughput: %.2f Mobjects/s\n",
+			threads != NULL ? threads : "1", NODES, best * 1e3,
+			NODES / best * 1e-6);
+
+	qcgc_pop_root(1);
+	qcgc_destroy();
+	return 0;
+}
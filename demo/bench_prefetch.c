@@ -0,0 +1,91 @@
+#include <qcgc.h>
+#include <src/collector.h>
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define NODES ((1<<22) - 1)
+#define RUNS 5
+
+typedef struct node_s node_t;
+
+struct node_s {
+	object_t hdr;
+	size_t value;
+	node_t *left;
+	node_t *right;
+};
+
+void qcgc_trace_cb(object_t *object, void (*visit)(object_t *object)) {
+	node_t *node = (node_t *) object;
+	visit((object_t *) node->left);
+	visit((object_t *) node->right);
+}
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int main(void) {
+	qcgc_initialize();
+
+	// Random binary tree: Every node is attached to a random free child slot
+	// of the nodes allocated before it, so neighbors in memory are rarely
+	// neighbors in the tree and the heap does not fit in the cache
+	struct slot_s {
+		node_t *parent;
+		bool right;
+	};
+	struct slot_s *slots = (struct slot_s *) malloc((NODES + 1) *
+			sizeof(struct slot_s));
+	size_t free_slots = 0;
+	srand(42);
+
+	node_t *root = (node_t *) qcgc_allocate(sizeof(node_t));
+	qcgc_push_root((object_t *) root);
+	slots[free_slots++] = (struct slot_s) {root, false};
+	slots[free_slots++] = (struct slot_s) {root, true};
+	for (size_t i = 1; i < NODES; i++) {
+		node_t *node = (node_t *) qcgc_allocate(sizeof(node_t));
+		node->value = i;
+		size_t index = (size_t) rand() % free_slots;
+		struct slot_s slot = slots[index];
+		slots[index] = slots[--free_slots];
+		qcgc_write((object_t *) slot.parent);
+		if (slot.right) {
+			slot.parent->right = node;
+		} else {
+			slot.parent->left = node;
+		}
+		slots[free_slots++] = (struct slot_s) {node, false};
+		slots[free_slots++] = (struct slot_s) {node, true};
+	}
+	free(slots);
+	qcgc_collect();
+
+	double best = 0;
+	for (size_t run = 0; run < RUNS; run++) {
+		double start = now();
+		qcgc_mark();
+		double time = now() - start;
+		qcgc_sweep();
+		if (run == 0 || time < best) {
+			best = time;
+		}
+	}
+
+	char *prefetch = getenv("QCGC_MARK_PREFETCH");
+	printf("mark prefetch: %s, objects: %d, mark: %.2f ms, "
+			"throughput: %.2f Mobjects/s\n",
+			prefetch != NULL ? prefetch : "0", NODES, best * 1e3,
+			NODES / best * 1e-6);
+
+	qcgc_pop_root(1);
+	qcgc_destroy();
+	return 0;
+}
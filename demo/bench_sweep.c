@@ -0,0 +1,86 @@
+#include <qcgc.h>
+#include <src/allocator.h>
+#include <src/arena.h>
+#include <src/gc_state.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define RUNS 200
+
+void qcgc_trace_cb(object_t *object, void (*visit)(object_t *object)) {
+	(void) object;
+	(void) visit;
+}
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/**
+ * Fill arena with objects of 1 to max_cells cells, every object is black with
+ * probability black_percent, white otherwise.
+ */
+static void fill(arena_t *arena, size_t max_cells, int black_percent) {
+	size_t cell = QCGC_ARENA_FIRST_CELL_INDEX;
+	while (cell < QCGC_ARENA_CELLS_COUNT) {
+		size_t cells = 1 + rand() % max_cells;
+		qcgc_arena_set_blocktype(arena, cell,
+				rand() % 100 < black_percent ? BLOCK_BLACK : BLOCK_WHITE);
+		cell += cells;
+	}
+}
+
+static void bench(const char *name, size_t max_cells, int black_percent) {
+	arena_t *arena = qcgc_arena_create();
+	fill(arena, max_cells, black_percent);
+
+	uint8_t block_bitmap[QCGC_ARENA_BITMAP_SIZE];
+	uint8_t mark_bitmap[QCGC_ARENA_BITMAP_SIZE];
+	memcpy(block_bitmap, arena->block_bitmap, QCGC_ARENA_BITMAP_SIZE);
+	memcpy(mark_bitmap, arena->mark_bitmap, QCGC_ARENA_BITMAP_SIZE);
+
+	double best = 0;
+	for (size_t run = 0; run < RUNS; run++) {
+		// Only the bitmaps after the arena header are swept
+		memcpy(arena->block_bitmap + QCGC_ARENA_FIRST_CELL_INDEX / 8,
+				block_bitmap + QCGC_ARENA_FIRST_CELL_INDEX / 8,
+				QCGC_ARENA_BITMAP_SIZE - QCGC_ARENA_FIRST_CELL_INDEX / 8);
+		memcpy(arena->mark_bitmap + QCGC_ARENA_FIRST_CELL_INDEX / 8,
+				mark_bitmap + QCGC_ARENA_FIRST_CELL_INDEX / 8,
+				QCGC_ARENA_BITMAP_SIZE - QCGC_ARENA_FIRST_CELL_INDEX / 8);
+		qcgc_fit_allocator_empty_lists();
+		qcgc_state.free_cells = 0;
+
+		double start = now();
+		qcgc_arena_sweep(arena);
+		double time = now() - start;
+		if (run == 0 || time < best) {
+			best = time;
+		}
+	}
+
+	size_t cells = QCGC_ARENA_CELLS_COUNT - QCGC_ARENA_FIRST_CELL_INDEX;
+	printf("%-8s cells: %zu, sweep: %.2f us, %.2f cells/ns\n", name, cells,
+			best * 1e6, cells / (best * 1e9));
+
+	qcgc_fit_allocator_empty_lists();
+	qcgc_arena_destroy(arena);
+}
+
+int main(void) {
+	qcgc_initialize();
+	srand(42);
+
+	bench("small", 4, 50);
+	bench("medium", 64, 50);
+	bench("sparse", 64, 5);
+	bench("dense", 4, 95);
+
+	qcgc_destroy();
+	return 0;
+}
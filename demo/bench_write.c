@@ -0,0 +1,62 @@
+#include <qcgc.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define OBJECTS 1024
+#define STORES (1<<27)
+#define RUNS 5
+
+typedef struct node_s node_t;
+
+struct node_s {
+	object_t hdr;
+	node_t *next;
+};
+
+void qcgc_trace_cb(object_t *object, void (*visit)(object_t *object)) {
+	visit((object_t *) ((node_t *) object)->next);
+}
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int main(void) {
+	qcgc_initialize();
+
+	// Rooted array of objects that fits in the cache, every store goes
+	// through the barrier
+	node_t *nodes[OBJECTS];
+	for (size_t i = 0; i < OBJECTS; i++) {
+		nodes[i] = (node_t *) qcgc_allocate(sizeof(node_t));
+		qcgc_push_root((object_t *) nodes[i]);
+	}
+	// Barrier armed once per object after the collection
+	qcgc_collect();
+
+	double best = 0;
+	for (size_t run = 0; run < RUNS; run++) {
+		double start = now();
+		for (size_t i = 0; i < STORES; i++) {
+			node_t *node = nodes[i % OBJECTS];
+			qcgc_write((object_t *) node);
+			node->next = nodes[(i * 7) % OBJECTS];
+		}
+		double time = now() - start;
+		if (run == 0 || time < best) {
+			best = time;
+		}
+	}
+
+	printf("stores: %d, time: %.2f ms, per store: %.2f ns\n", STORES,
+			best * 1e3, best / STORES * 1e9);
+
+	qcgc_pop_root(OBJECTS);
+	qcgc_destroy();
+	return 0;
+}
@@ -5,11 +5,22 @@
 #include <sys/mman.h>
 
 #include "src/allocator.h"
+#include "src/cards.h"
 #include "src/collector.h"
+#include "src/compaction.h"
 #include "src/event_logger.h"
 #include "src/gc_state.h"
+#include "src/generation.h"
+#include "src/heap.h"
 #include "src/hugeblocktable.h"
+#include "src/layout.h"
+#include "src/mediumspace.h"
+#include "src/safepoint.h"
 #include "src/signal_handler.h"
+#include "src/sweeper.h"
+
+__thread struct qcgc_shadowstack _qcgc_shadowstack;
+__thread struct qcgc_bump_allocator _qcgc_bump_allocator;
 
 #define env_or_fallback(var, env_name, fallback) do {			\
 	char *env_val = getenv(env_name);							\
@@ -24,30 +35,93 @@
 
 QCGC_STATIC QCGC_INLINE void initialize_shadowstack(void);
 QCGC_STATIC QCGC_INLINE void destroy_shadowstack(void);
+QCGC_STATIC void collect(void);
+QCGC_STATIC void minor_collect(void);
+QCGC_STATIC void incmark(void);
+QCGC_STATIC bool do_work(uint64_t deadline);
+QCGC_STATIC object_t *young_allocate(size_t size);
+QCGC_STATIC void write_barrier(object_t *object);
 
 void qcgc_initialize(void) {
 	initialize_shadowstack();
+	qcgc_safepoint_initialize();
 	qcgc_state.prebuilt_objects = qcgc_object_stack_create(16); // XXX
 	qcgc_state.weakrefs = qcgc_weakref_bag_create(16); // XXX
-	qcgc_state.gp_gray_stack = qcgc_object_stack_create(16); // XXX
+	qcgc_gray_pool_initialize();
+	qcgc_state.gp_gray_stack = NULL;
+	qcgc_state.gray_overflow = false;
 	qcgc_state.gray_stack_size = 0;
 	qcgc_state.phase = GC_PAUSE;
 	qcgc_state.cells_since_incmark = 0;
 	qcgc_state.incmark_since_sweep = 0;
 	qcgc_state.free_cells = 0;
 	qcgc_state.largest_free_block = 0;
+	qcgc_state.live_cells = 0;
+	qcgc_state.heap_goal = 0;
+	qcgc_state.mark_work = 0;
+	qcgc_state.marked_objects = 0;
+	qcgc_state.incmark_cursor = 0;
+	memset(qcgc_layout_state.bitmaps, 0, sizeof(qcgc_layout_state.bitmaps));
+	memset(_qcgc_dirty_cards, 0, sizeof(_qcgc_dirty_cards));
+
+	env_or_fallback(qcgc_state.incmark_threshold,
+			"QCGC_INCMARK", QCGC_INCMARK_THRESHOLD);
+	env_or_fallback(qcgc_state.incmark_to_sweep,
+			"QCGC_INCMARK_TO_SWEEP", QCGC_INCMARK_TO_SWEEP);
+	env_or_fallback(qcgc_state.gc_percent,
+			"QCGC_GC_PERCENT", QCGC_GC_PERCENT);
+	if (getenv("QCGC_INCMARK") != NULL && getenv("QCGC_GC_PERCENT") == NULL) {
+		// An explicit threshold would be overwritten by the pacer
+		qcgc_state.gc_percent = 0;
+	}
+	env_or_fallback(qcgc_state.incmark_budget_ns,
+			"QCGC_INCMARK_BUDGET_NS", QCGC_INCMARK_BUDGET_NS);
+	env_or_fallback(qcgc_state.growth_policy,
+			"QCGC_GROWTH_POLICY", QCGC_GROWTH_POLICY);
+	env_or_fallback(qcgc_state.growth_fragmentation,
+			"QCGC_GROWTH_FRAGMENTATION", QCGC_GROWTH_FRAGMENTATION);
+	env_or_fallback(qcgc_state.lazy_sweep,
+			"QCGC_LAZY_SWEEP", QCGC_LAZY_SWEEP);
+	env_or_fallback(qcgc_state.background_sweep,
+			"QCGC_BACKGROUND_SWEEP", QCGC_BACKGROUND_SWEEP);
+	env_or_fallback(qcgc_state.mark_threads,
+			"QCGC_MARK_THREADS", QCGC_MARK_THREADS);
+	env_or_fallback(qcgc_state.mark_prefetch,
+			"QCGC_MARK_PREFETCH", QCGC_MARK_PREFETCH);
+	env_or_fallback(qcgc_gray_pool.limit,
+			"QCGC_GRAY_STACK_LIMIT", QCGC_GRAY_STACK_LIMIT);
+	env_or_fallback(qcgc_state.free_arenas_retain,
+			"QCGC_FREE_ARENAS_RETAIN", QCGC_FREE_ARENAS_RETAIN);
+	env_or_fallback(qcgc_state.heap_reserve,
+			"QCGC_HEAP_RESERVE", QCGC_HEAP_RESERVE);
+	env_or_fallback(qcgc_state.huge_pages,
+			"QCGC_HUGE_PAGES", QCGC_HUGE_PAGES);
+	env_or_fallback(qcgc_state.generational,
+			"QCGC_GENERATIONAL", QCGC_GENERATIONAL);
+	env_or_fallback(qcgc_state.nursery_arenas,
+			"QCGC_NURSERY_ARENAS", QCGC_NURSERY_ARENAS);
+	env_or_fallback(qcgc_state.major_threshold,
+			"QCGC_MAJOR_THRESHOLD", QCGC_MAJOR_THRESHOLD);
+	env_or_fallback(qcgc_state.compaction,
+			"QCGC_COMPACTION", QCGC_COMPACTION);
+	env_or_fallback(qcgc_state.compaction_density,
+			"QCGC_COMPACTION_DENSITY", QCGC_COMPACTION_DENSITY);
+
+	qcgc_heap_initialize(qcgc_state.heap_reserve, qcgc_state.huge_pages);
+	// The allocator adds its first arena to the nursery
+	qcgc_generation_initialize();
 	qcgc_allocator_initialize();
 	qcgc_hbtable_initialize();
+	qcgc_medium_initialize();
 	qcgc_event_logger_initialize();
 
 #if LOG_ALLOCATOR_SWITCH
 	qcgc_allocations = 0;
 #endif
 
-	env_or_fallback(qcgc_state.incmark_threshold,
-			"QCGC_INCMARK", QCGC_INCMARK_THRESHOLD);
-	env_or_fallback(qcgc_state.incmark_to_sweep,
-			"QCGC_INCMARK_TO_SWEEP", QCGC_INCMARK_TO_SWEEP);
+	qcgc_mark_pool_initialize();
+	qcgc_sweeper_initialize();
+	qcgc_pacer_update();
 
 	setup_signal_handler();
 }
@@ -65,58 +139,133 @@ void qcgc_destroy(void) {
 	qcgc_event_logger_log(EVENT_ALLOCATOR_SWITCH, sizeof(struct log_info_s),
 			(uint8_t *) &log_info);
 #endif
+	qcgc_sweeper_destroy();
+	qcgc_mark_pool_destroy();
 	qcgc_event_logger_destroy();
+	qcgc_medium_destroy();
 	qcgc_hbtable_destroy();
 	qcgc_allocator_destroy();
+	qcgc_generation_destroy();
+	qcgc_heap_destroy();
+	qcgc_safepoint_destroy();
 	destroy_shadowstack();
 	free(qcgc_state.prebuilt_objects);
 	free(qcgc_state.weakrefs);
-	free(qcgc_state.gp_gray_stack);
+	qcgc_gray_stack_free(qcgc_state.gp_gray_stack);
+	qcgc_gray_pool_destroy();
 }
 
 object_t *_qcgc_allocate_large(size_t size) {
 #if CHECKED
 	assert(size >= 1<<QCGC_LARGE_ALLOC_THRESHOLD_EXP);
 #endif
-	if (UNLIKELY(qcgc_state.cells_since_incmark >
-				qcgc_state.incmark_threshold)) {
-		if (qcgc_state.incmark_since_sweep == qcgc_state.incmark_to_sweep) {
-			qcgc_collect();
-		} else {
-			qcgc_incmark();
-			qcgc_state.incmark_since_sweep++;
-		}
-	}
-
 	size_t rounded_size = (size + QCGC_ARENA_SIZE - 1) & ~(QCGC_ARENA_SIZE - 1);
 	object_t *result = aligned_alloc(QCGC_ARENA_SIZE, rounded_size);
 #if QCGC_INIT_ZERO
 	memset(result, 0, size);
 #endif
-	qcgc_hbtable_insert(result);
 	result->flags = QCGC_GRAY_FLAG;
 
+	qcgc_gc_lock();
+	if (qcgc_state.generational) {
+		if (UNLIKELY(qcgc_generation_state.promoted_cells >
+					qcgc_state.major_threshold)) {
+			collect();
+		}
+	} else if (UNLIKELY(qcgc_state.cells_since_incmark >
+				qcgc_state.incmark_threshold)) {
+		if (qcgc_state.incmark_since_sweep == qcgc_state.incmark_to_sweep) {
+			collect();
+		} else {
+			incmark();
+		}
+	}
+
+	qcgc_hbtable_insert(result);
 	qcgc_state.cells_since_incmark += bytes_to_cells(size);
+	if (qcgc_state.generational) {
+		// Huge objects are old right away
+		qcgc_generation_remember(result);
+		qcgc_generation_state.promoted_cells += bytes_to_cells(size);
+	}
+	qcgc_gc_unlock();
+
+	return result;
+}
+
+object_t *_qcgc_allocate_medium(size_t size) {
+#if CHECKED
+	assert(size >= 1<<QCGC_LARGE_ALLOC_THRESHOLD_EXP);
+	assert(size <= QCGC_MEDIUM_MAX_SIZE);
+#endif
+	qcgc_gc_lock();
+	if (qcgc_state.generational) {
+		if (UNLIKELY(qcgc_generation_state.promoted_cells >
+					qcgc_state.major_threshold)) {
+			collect();
+		}
+	} else if (UNLIKELY(qcgc_state.cells_since_incmark >
+				qcgc_state.incmark_threshold)) {
+		if (qcgc_state.incmark_since_sweep == qcgc_state.incmark_to_sweep) {
+			collect();
+		} else {
+			incmark();
+		}
+	}
+
+	object_t *result = qcgc_medium_allocate(size);
+	if (result != NULL) {
+#if QCGC_INIT_ZERO
+		memset(result, 0, size);
+#endif
+		result->flags = QCGC_GRAY_FLAG;
+		qcgc_state.cells_since_incmark += bytes_to_cells(size);
+		if (qcgc_state.generational) {
+			// Medium objects are old right away
+			qcgc_generation_remember(result);
+			qcgc_generation_state.promoted_cells += bytes_to_cells(size);
+		}
+	}
+	qcgc_gc_unlock();
 
 	return result;
 }
 
 object_t *_qcgc_allocate_slowpath(size_t size) {
+	qcgc_gc_lock();
+	if (qcgc_state.generational == QCGC_GENERATIONAL_NURSERY) {
+		object_t *result = young_allocate(size);
+		qcgc_gc_unlock();
+		return result;
+	}
+
 	bool use_fit_allocator = _qcgc_bump_allocator.ptr == NULL;
 	size_t cells = bytes_to_cells(size);
 #if LOG_ALLOCATOR_SWITCH
 	bool old_use_fit_allocator = use_fit_allocator;
 #endif
 
-	if (UNLIKELY(qcgc_state.cells_since_incmark >
+	if (qcgc_state.generational == QCGC_GENERATIONAL_STICKY) {
+		if (UNLIKELY(qcgc_generation_state.allocated_cells >=
+					qcgc_state.nursery_arenas * (QCGC_ARENA_CELLS_COUNT -
+						QCGC_ARENA_FIRST_CELL_INDEX))) {
+			minor_collect();
+			if (qcgc_generation_state.promoted_cells >
+					qcgc_state.major_threshold) {
+				collect();
+			}
+			use_fit_allocator = false; // Try using bump allocator again
+		}
+	} else if (UNLIKELY(qcgc_state.cells_since_incmark >
 				qcgc_state.incmark_threshold)) {
 		if (qcgc_state.incmark_since_sweep == qcgc_state.incmark_to_sweep) {
 			qcgc_reset_bump_ptr();
-			qcgc_collect();
+			collect();
 			use_fit_allocator = false; // Try using bump allocator again
 		} else {
-			qcgc_incmark();
-			qcgc_state.incmark_since_sweep++;
+			incmark();
+			// Decide again, the budget for the rest of the cycle has changed
+			use_fit_allocator = use_fit_allocator && !qcgc_state.growth_policy;
 		}
 	}
 
@@ -158,6 +307,7 @@ object_t *_qcgc_allocate_slowpath(size_t size) {
 						(uint8_t *) &log_info);
 			}
 #endif
+			qcgc_gc_unlock();
 			return result;
 		}
 	}
@@ -166,6 +316,9 @@ object_t *_qcgc_allocate_slowpath(size_t size) {
 	result = qcgc_fit_allocate(size);
 	if (result != NULL) {
 		qcgc_state.cells_since_incmark += bytes_to_cells(size);
+		if (qcgc_state.generational == QCGC_GENERATIONAL_STICKY) {
+			qcgc_generation_record((cell_t *) result, cells);
+		}
 #if LOG_ALLOCATOR_SWITCH
 		if ((_qcgc_bump_allocator.ptr == NULL) != old_use_fit_allocator) {
 			// Allocator switched
@@ -181,6 +334,7 @@ object_t *_qcgc_allocate_slowpath(size_t size) {
 					(uint8_t *) &log_info);
 		}
 #endif
+		qcgc_gc_unlock();
 		return result;
 	}
 	qcgc_bump_allocator_renew_block(size, true);
@@ -215,6 +369,36 @@ object_t *_qcgc_allocate_slowpath(size_t size) {
 				(uint8_t *) &log_info);
 	}
 #endif
+	qcgc_gc_unlock();
+	return result;
+}
+
+QCGC_STATIC object_t *young_allocate(size_t size) {
+	if (qcgc_generation_state.young_arenas->count >=
+			qcgc_state.nursery_arenas) {
+		minor_collect();
+		if (qcgc_generation_state.promoted_cells >
+				qcgc_state.major_threshold) {
+			collect();
+		}
+	}
+
+	// Every block is a whole arena of the nursery
+	qcgc_bump_allocator_renew_block(size, true);
+
+	size_t cells = bytes_to_cells(size);
+	qcgc_arena_set_blocktype(qcgc_arena_addr(_qcgc_bump_allocator.ptr),
+			qcgc_arena_cell_index(_qcgc_bump_allocator.ptr),
+			BLOCK_WHITE);
+
+	object_t *result = (object_t *) _qcgc_bump_allocator.ptr;
+	_qcgc_bump_allocator.ptr += cells;
+
+#if QCGC_INIT_ZERO
+	memset(result, 0, cells * sizeof(cell_t));
+#endif
+
+	result->flags = QCGC_GRAY_FLAG;
 	return result;
 }
 
@@ -248,17 +432,93 @@ object_t *_qcgc_allocate_slowpath(size_t size) {
 */
 
 void qcgc_collect(void) {
+	qcgc_gc_lock();
+	collect();
+	qcgc_gc_unlock();
+}
+
+QCGC_STATIC void collect(void) {
+	qcgc_stop_the_world();
+	qcgc_safepoint_reset_bump_ptrs();
 	qcgc_mark();
+	if (qcgc_state.compaction) {
+		qcgc_compact();
+	}
 	qcgc_sweep();
 	qcgc_state.incmark_since_sweep = 0;
+	qcgc_resume_the_world();
 }
 
-void qcgc_write(object_t *object) {
-#if CHECKED
-	assert(object != NULL);
-#endif
+void qcgc_minor_collect(void) {
+	qcgc_gc_lock();
+	minor_collect();
+	qcgc_gc_unlock();
+}
+
+QCGC_STATIC void minor_collect(void) {
+	if (!qcgc_state.generational || qcgc_state.phase != GC_PAUSE) {
+		collect();
+		return;
+	}
+	qcgc_stop_the_world();
+	// Everything allocated so far is young
+	qcgc_reset_bump_ptr();
+	qcgc_safepoint_reset_bump_ptrs();
+	qcgc_generation_minor_collect();
+	qcgc_resume_the_world();
+}
+
+bool qcgc_do_work(uint64_t budget_ns) {
+	uint64_t deadline = qcgc_monotonic_ns() + budget_ns;
+	qcgc_gc_lock();
+	bool result = do_work(deadline);
+	qcgc_gc_unlock();
+	return result;
+}
+
+QCGC_STATIC bool do_work(uint64_t deadline) {
+	while (qcgc_collector_has_work()) {
+		if (qcgc_monotonic_ns() >= deadline) {
+			return true;
+		}
+		if (qcgc_state.phase == GC_MARK) {
+			qcgc_stop_the_world();
+			qcgc_incmark_until(deadline);
+			qcgc_resume_the_world();
+		} else if (qcgc_state.phase == GC_COLLECT) {
+			// Gray stacks are empty, rescan the roots and sweep
+			collect();
+		} else {
+			qcgc_lazy_sweep_step();
+		}
+	}
+	return false;
+}
+
+QCGC_STATIC void incmark(void) {
+	qcgc_stop_the_world();
+	qcgc_incmark();
+	qcgc_state.incmark_since_sweep++;
+	qcgc_resume_the_world();
+}
+
+void _qcgc_write_slowpath(object_t *object) {
+	qcgc_gc_lock();
+	write_barrier(object);
+	qcgc_gc_unlock();
+}
+
+void _qcgc_write_index_slowpath(object_t *object, size_t offset) {
+	qcgc_gc_lock();
+	if (!qcgc_cards_mark(object, offset)) {
+		write_barrier(object);
+	}
+	qcgc_gc_unlock();
+}
+
+QCGC_STATIC void write_barrier(object_t *object) {
 	if ((object->flags & QCGC_GRAY_FLAG) != 0) {
-		// Already gray, skip
+		// Another thread was faster
 		return;
 	}
 	object->flags |= QCGC_GRAY_FLAG;
@@ -271,6 +531,11 @@ void qcgc_write(object_t *object) {
 				qcgc_state.prebuilt_objects, object);
 	}
 
+	if (qcgc_state.generational && !qcgc_generation_is_young(object)) {
+		// Old object may reference young ones from now on
+		qcgc_generation_remember(object);
+	}
+
 	if (qcgc_state.phase == GC_PAUSE) {
 		return; // We are done
 	}
@@ -283,43 +548,72 @@ void qcgc_write(object_t *object) {
 		// NOTE: No mark test here, as prebuilt objects are always reachable
 		// Push prebuilt object to general purpose gray stack
 		qcgc_state.gray_stack_size++;
-		qcgc_state.gp_gray_stack = qcgc_object_stack_push(
+		qcgc_state.gp_gray_stack = qcgc_gray_stack_push(
 				qcgc_state.gp_gray_stack, object);
 	} else if ((object_t *) qcgc_arena_addr((cell_t *) object) == object) {
 		if (qcgc_hbtable_is_marked(object)) {
 			// Push huge block to general purpose gray stack
 			qcgc_state.gray_stack_size++;
-			qcgc_state.gp_gray_stack = qcgc_object_stack_push(
+			qcgc_state.gp_gray_stack = qcgc_gray_stack_push(
+					qcgc_state.gp_gray_stack, object);
+		}
+	} else if (qcgc_medium_is_segment(qcgc_arena_addr((cell_t *) object))) {
+		if (qcgc_medium_is_marked(object)) {
+			// Push medium object to general purpose gray stack
+			qcgc_state.gray_stack_size++;
+			qcgc_state.gp_gray_stack = qcgc_gray_stack_push(
 					qcgc_state.gp_gray_stack, object);
 		}
 	} else {
 		if (qcgc_arena_get_blocktype(qcgc_arena_addr((cell_t *) object),
 					qcgc_arena_cell_index((cell_t *) object)) == BLOCK_BLACK) {
 			// This was black before, push it to gray stack again
-			arena_t *arena = qcgc_arena_addr((cell_t *) object);
-			qcgc_state.gray_stack_size++;
-			arena->gray_stack = qcgc_object_stack_push(
-					arena->gray_stack, object);
+			qcgc_push_arena_object(qcgc_arena_addr((cell_t *) object),
+					object);
 		}
 	}
 }
 
+void qcgc_register_layout(uint32_t layout, uint64_t bitmap) {
+#if CHECKED
+	assert(layout > 0 && layout < QCGC_LAYOUT_COUNT);
+	assert((bitmap & 1) == 0);
+#endif
+	qcgc_layout_state.bitmaps[layout] = bitmap;
+}
+
 void qcgc_register_weakref(object_t *weakrefobj, object_t **target) {
 #if CHECKED
 	assert((weakrefobj->flags & QCGC_PREBUILT_OBJECT) == 0);
 	assert((object_t *) qcgc_arena_addr((cell_t *) weakrefobj) != weakrefobj);
+	assert(!qcgc_medium_is_segment(qcgc_arena_addr((cell_t *) weakrefobj)));
 #endif
 	// NOTE: At this point, the target must point to a pointer to a valid
 	// object. We don't register any weakrefs to prebuilt objects as they
 	// are always valid.
 	if (((*target)->flags & QCGC_PREBUILT_OBJECT) == 0) {
+		qcgc_gc_lock();
 		qcgc_state.weakrefs = qcgc_weakref_bag_add(qcgc_state.weakrefs,
 				(struct weakref_bag_item_s) {
 					.weakrefobj = weakrefobj,
 					.target = target});
+		qcgc_gc_unlock();
 	}
 }
 
+void qcgc_register_thread(void) {
+	initialize_shadowstack();
+	qcgc_safepoint_register();
+}
+
+void qcgc_unregister_thread(void) {
+	qcgc_gc_lock();
+	qcgc_reset_bump_ptr();
+	qcgc_safepoint_unregister();
+	qcgc_gc_unlock();
+	destroy_shadowstack();
+}
+
 QCGC_STATIC QCGC_INLINE void *_trap_page_addr(object_t **shadow_stack) {
 	object_t **shadow_stack_end = shadow_stack + QCGC_SHADOWSTACK_SIZE;
 	char *in_trap_page = (((char *)shadow_stack_end) + 4095);
@@ -8,6 +8,7 @@
 #include "config.h"
 
 #include <assert.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
@@ -28,11 +29,17 @@ typedef struct object_s {
 #define QCGC_GRAY_FLAG (1<<0)
 #define QCGC_PREBUILT_OBJECT (1<<1)
 #define QCGC_PREBUILT_REGISTERED (1<<2)
+#define QCGC_PINNED_FLAG (1<<3)			// See qcgc_pin
+#define QCGC_FORWARDED_FLAG (1<<4)		// See src/compaction.h
+#define QCGC_CARDS_FLAG (1<<5)			// See src/cards.h
+
+#define QCGC_LAYOUT_SHIFT 24			// Layout id, see qcgc_register_layout
+#define QCGC_LAYOUT_COUNT (1<<(32 - QCGC_LAYOUT_SHIFT))
 
 /**
- * Shadow stack
+ * Shadow stack (one per mutator thread)
  */
-struct qcgc_shadowstack {
+extern __thread struct qcgc_shadowstack {
 	object_t **top;
 	object_t **base;
 } _qcgc_shadowstack;
@@ -43,13 +50,28 @@ struct qcgc_shadowstack {
 typedef uint8_t cell_t[16];
 
 /**
- * Bump allocator
+ * Bump allocator (one per mutator thread)
  */
-struct qcgc_bump_allocator {
+extern __thread struct qcgc_bump_allocator {
 	cell_t *ptr;
 	cell_t *end;
+	cell_t *start;	// Start of the current block, see src/generation.h
 } _qcgc_bump_allocator;
 
+/**
+ * Set while a thread waits for all other mutator threads to reach a safepoint.
+ * Only accessed with __atomic builtins, stores release and loads acquire.
+ */
+bool _qcgc_safepoint_requested;
+
+/**
+ * Addresses of dirty cards, direct mapped by card number. Set when a card is
+ * dirtied and cleared when it is traced, such that qcgc_write_index skips
+ * stores into dirty cards without taking the lock (see src/cards.h). Only
+ * accessed with __atomic builtins.
+ */
+uintptr_t _qcgc_dirty_cards[QCGC_DIRTY_CARD_CACHE];
+
 /**
  * Object stack
  */
@@ -59,6 +81,16 @@ typedef struct object_stack_s {
 	object_t *items[];
 } object_stack_t;
 
+/**
+ * Gray stack segment, see src/gray_stack.h
+ */
+typedef struct gray_stack_s {
+	struct gray_stack_s *next;		// Segment below
+	size_t count;					// Objects in this segment
+	size_t below;					// Objects in all segments below
+	object_t *items[QCGC_MARK_LIST_SEGMENT_SIZE];
+} gray_stack_t;
+
 #if LOG_ALLOCATOR_SWITCH
 size_t qcgc_allocations;
 #endif
@@ -77,14 +109,35 @@ size_t qcgc_allocations;
 typedef union {
 	struct {
 		union {
-			object_stack_t *gray_stack;
+			gray_stack_t *gray_stack;
+			uintptr_t medium_tag;	// See src/mediumspace.h
 			uint8_t block_bitmap[QCGC_ARENA_BITMAP_SIZE];
 		};
-		uint8_t mark_bitmap[QCGC_ARENA_BITMAP_SIZE];
+		union {
+			struct {
+				uint8_t young;		// See src/generation.h
+				uint8_t overflowed;	// Black objects were not pushed, see
+									// QCGC_GRAY_STACK_LIMIT
+				uint8_t decommitted[QCGC_ARENA_SIZE / QCGC_OS_PAGE_SIZE / 8];
+									// Pages returned to the OS and not
+									// handed out since, see src/arena.h
+			};
+			uint8_t mark_bitmap[QCGC_ARENA_BITMAP_SIZE];
+		};
 	};
 	cell_t cells[QCGC_ARENA_CELLS_COUNT];
 } arena_t;
 
+/**
+ * Medium object segments (arena aligned, made of pages)
+ */
+
+#define QCGC_MEDIUM_PAGE_SIZE (1<<QCGC_MEDIUM_PAGE_EXP)
+#define QCGC_MEDIUM_PAGES (1<<(QCGC_ARENA_SIZE_EXP - QCGC_MEDIUM_PAGE_EXP))
+
+// Larger objects are huge blocks, the first page is the segment header
+#define QCGC_MEDIUM_MAX_SIZE ((QCGC_MEDIUM_PAGES - 1) * QCGC_MEDIUM_PAGE_SIZE)
+
 typedef enum blocktype {
 	BLOCK_EXTENT,
 	BLOCK_FREE,
@@ -105,6 +158,15 @@ typedef enum blocktype {
  */
 object_t *_qcgc_allocate_large(size_t size);
 
+/**
+ * Allocate medium object. May trigger garbage collection.
+ *
+ * @param	size	Object size in bytes
+ * @return	Pointer to memory region large enough to hold size bytes or NULL in
+ *			case of errros
+ */
+object_t *_qcgc_allocate_medium(size_t size);
+
 /**
  * Allocator slowpath. May trigger garabge collection.
  *
@@ -114,6 +176,37 @@ object_t *_qcgc_allocate_large(size_t size);
  */
 object_t *_qcgc_allocate_slowpath(size_t size);
 
+/**
+ * Safepoint slowpath. Parks the calling thread until the world is resumed.
+ */
+void _qcgc_safepoint_slowpath(void);
+
+/**
+ * Write barrier slowpath. Grays the object, registers prebuilt objects and
+ * pushes the object again if it was marked already.
+ *
+ * @param	object	Object that is updated and not gray
+ */
+void _qcgc_write_slowpath(object_t *object);
+
+/**
+ * Indexed write barrier slowpath. Dirties the card of the field if the object
+ * is a medium object or huge block that was marked already, takes the
+ * regular slowpath otherwise.
+ *
+ * @param	object	Object that is updated and not gray
+ * @param	offset	Byte offset of the updated field
+ */
+void _qcgc_write_index_slowpath(object_t *object, size_t offset);
+
+/**
+ * Dirty card cache slot of the card at the given address.
+ */
+QCGC_STATIC QCGC_INLINE uintptr_t *_qcgc_dirty_card_slot(uintptr_t card) {
+	return &_qcgc_dirty_cards[(card >> QCGC_CARD_SIZE_EXP) &
+		(QCGC_DIRTY_CARD_CACHE - 1)];
+}
+
 /**
  * Turns bytes to cells.
  */
@@ -191,6 +284,42 @@ void qcgc_initialize(void);
  */
 void qcgc_destroy(void);
 
+/**
+ * Register the calling thread as an additional mutator thread. The thread
+ * that called qcgc_initialize is registered automatically.
+ *
+ * All registered threads have to call qcgc_safepoint (or allocate) regularly,
+ * or bracket code that does not access the heap with qcgc_enter_native /
+ * qcgc_leave_native, as collections wait for every registered thread.
+ */
+void qcgc_register_thread(void);
+
+/**
+ * Unregister the calling thread. Its shadow stack is destroyed.
+ */
+void qcgc_unregister_thread(void);
+
+/**
+ * Leave the heap, e.g. before blocking. The thread counts as stopped until it
+ * calls qcgc_leave_native and must not access any objects in between.
+ */
+void qcgc_enter_native(void);
+
+/**
+ * Return to the heap after qcgc_enter_native, waits for a running collection.
+ */
+void qcgc_leave_native(void);
+
+/**
+ * Safepoint. Parks the calling thread while another thread collects.
+ */
+QCGC_STATIC QCGC_INLINE void qcgc_safepoint(void) {
+	if (UNLIKELY(__atomic_load_n(&_qcgc_safepoint_requested,
+					__ATOMIC_ACQUIRE))) {
+		_qcgc_safepoint_slowpath();
+	}
+}
+
 /**
  * Allocate a new object. May trigger garabge collection.
  *
@@ -202,6 +331,7 @@ QCGC_STATIC QCGC_INLINE object_t *qcgc_allocate(size_t size) {
 #if CHECKED
 	assert(size > 0);
 #endif
+	qcgc_safepoint();
 	size_t cells = bytes_to_cells(size);
 
 #if LOG_ALLOCATOR_SWITCH
@@ -213,6 +343,9 @@ QCGC_STATIC QCGC_INLINE object_t *qcgc_allocate(size_t size) {
 			(uint8_t *) &cells);
 #endif
 	if (UNLIKELY(size >= 1<<QCGC_LARGE_ALLOC_THRESHOLD_EXP)) {
+		if (size <= QCGC_MEDIUM_MAX_SIZE) {
+			return _qcgc_allocate_medium(size);
+		}
 		return _qcgc_allocate_large(size);
 	}
 
@@ -264,13 +397,123 @@ QCGC_STATIC QCGC_INLINE void qcgc_pop_root(size_t count) {
  *
  * @param	object	Object that is updated
  */
-void qcgc_write(object_t *object);
+QCGC_STATIC QCGC_INLINE void qcgc_write(object_t *object) {
+#if CHECKED
+	assert(object != NULL);
+#endif
+	if ((object->flags & QCGC_GRAY_FLAG) != 0) {
+		// Already gray, skip
+		return;
+	}
+	_qcgc_write_slowpath(object);
+}
+
+/**
+ * Write barrier for a single field of a large object, e.g. an element of an
+ * array. Has to be called instead of qcgc_write whenever the reference at the
+ * given offset is updated.
+ *
+ * While marking, only the card of the field is traced again instead of the
+ * whole object (see qcgc_trace_range_cb). Behaves like qcgc_write for small
+ * objects.
+ *
+ * @param	object	Object that is updated
+ * @param	offset	Byte offset of the updated field
+ */
+QCGC_STATIC QCGC_INLINE void qcgc_write_index(object_t *object, size_t offset) {
+#if CHECKED
+	assert(object != NULL);
+#endif
+	if ((object->flags & QCGC_GRAY_FLAG) != 0) {
+		// Already gray, skip
+		return;
+	}
+	if ((object->flags & QCGC_CARDS_FLAG) != 0) {
+		uintptr_t card = (uintptr_t) object +
+			(offset & ~(((size_t) 1 << QCGC_CARD_SIZE_EXP) - 1));
+		if (__atomic_load_n(_qcgc_dirty_card_slot(card), __ATOMIC_RELAXED) ==
+				card) {
+			// Card is dirty already, skip
+			return;
+		}
+	}
+	_qcgc_write_index_slowpath(object, offset);
+}
 
 /**
  * Run garbage collection.
  */
 void qcgc_collect(void);
 
+/**
+ * Run minor collection, which only collects the young objects (see
+ * QCGC_GENERATIONAL). Falls back to a full collection when the generational
+ * mode is off or marking is in progress.
+ */
+void qcgc_minor_collect(void);
+
+/**
+ * Do pending collector work for at most (roughly) the given time, e.g. while
+ * the embedder is idle. Continues an incremental mark, finishes the cycle when
+ * marking is done and sweeps arenas left over by a lazy or background sweep,
+ * which returns free arenas to the OS at its end. Does not start a new cycle.
+ *
+ * The final mark and an eager sweep (QCGC_LAZY_SWEEP=0) can not be
+ * interrupted and may overrun the budget.
+ *
+ * @param	budget_ns	Time budget in nanoseconds
+ * @return	true iff work is left
+ */
+bool qcgc_do_work(uint64_t budget_ns);
+
+/**
+ * Pin object, compaction (QCGC_COMPACTION) does not move it until it is
+ * unpinned. Needed as long as the address of the object is known to native
+ * code that is not visible to qcgc_trace_slots_cb.
+ *
+ * @param	object	The object to pin
+ */
+QCGC_STATIC QCGC_INLINE void qcgc_pin(object_t *object) {
+	object->flags |= QCGC_PINNED_FLAG;
+}
+
+/**
+ * Unpin object.
+ *
+ * @param	object	The object to unpin
+ */
+QCGC_STATIC QCGC_INLINE void qcgc_unpin(object_t *object) {
+	object->flags &= ~QCGC_PINNED_FLAG;
+}
+
+/**
+ * Layout registration. Objects with a fixed layout are traced by the
+ * collector without calling qcgc_trace_cb, which is much cheaper.
+ *
+ * Bit i of the bitmap is set iff the i-th pointer sized word of the object
+ * references another object (or is NULL). The first word holds the header, so
+ * only references within the first 63 words after it can be described.
+ *
+ * @param	layout	Layout id between 1 and QCGC_LAYOUT_COUNT - 1
+ * @param	bitmap	Reference words of objects with this layout
+ */
+void qcgc_register_layout(uint32_t layout, uint64_t bitmap);
+
+/**
+ * Set layout of an object, layout 0 means it is traced by qcgc_trace_cb
+ * (default).
+ *
+ * @param	object	The object
+ * @param	layout	Registered layout id or 0
+ */
+QCGC_STATIC QCGC_INLINE void qcgc_set_layout(object_t *object, uint32_t layout) {
+#if CHECKED
+	assert(layout < QCGC_LAYOUT_COUNT);
+#endif
+	object->flags = (object->flags & ((1u<<QCGC_LAYOUT_SHIFT) - 1)) |
+		(layout << QCGC_LAYOUT_SHIFT);
+}
+
 /**
  * Weakref registration.
  *
@@ -284,11 +527,45 @@ void qcgc_register_weakref(object_t *weakrefobj, object_t **target);
  * Tracing function.
  *
  * This used provided function has to call visit on every object the given
- * argument references.
+ * argument references. It is not called on objects with a layout (see
+ * qcgc_register_layout).
+ *
+ * With QCGC_MARK_THREADS greater than 1, the helper threads call this function
+ * (and visit) concurrently on different objects. It therefore has to be
+ * reentrant and must not modify shared state.
  *
  * @param	object	The object to trace
  * @param	visit	The function to be called on the referenced objects
  */
 extern void qcgc_trace_cb(object_t *object, void (*visit)(object_t *object));
 
+/**
+ * Slot tracing function, optional.
+ *
+ * Like qcgc_trace_cb, but visit is called on the address of every field that
+ * references an object, such that the reference can be updated. Compaction
+ * (QCGC_COMPACTION) moves objects and is only done if this function is
+ * provided.
+ *
+ * @param	object	The object to trace
+ * @param	visit	The function to be called on the reference fields
+ */
+extern void qcgc_trace_slots_cb(object_t *object,
+		void (*visit)(object_t **slot)) __attribute__((weak));
+
+/**
+ * Ranged tracing function, optional.
+ *
+ * Like qcgc_trace_cb, but visit is only called on the objects referenced by
+ * fields between the given byte offsets of a medium object or huge block.
+ * qcgc_write_index falls back to qcgc_write if this function is not provided.
+ *
+ * @param	object	The object to trace
+ * @param	start	Offset of the first byte of the range
+ * @param	end		Offset after the last byte of the range
+ * @param	visit	The function to be called on the referenced objects
+ */
+extern void qcgc_trace_range_cb(object_t *object, size_t start, size_t end,
+		void (*visit)(object_t *object)) __attribute__((weak));
+
 #endif
@@ -2,23 +2,39 @@
 
 #include <assert.h>
 #include <stdbool.h>
+#include "collector.h"
 #include "gc_state.h"
+#include "generation.h"
+#include "safepoint.h"
 
 QCGC_STATIC QCGC_INLINE void bump_allocator_assign(cell_t *ptr, size_t cells);
+QCGC_STATIC void log_growth_decision(size_t decision, bool force_arena);
 
 QCGC_STATIC QCGC_INLINE bool is_small(size_t cells);
 QCGC_STATIC QCGC_INLINE size_t small_index(size_t cells);
 QCGC_STATIC QCGC_INLINE size_t large_index(size_t cells);
+QCGC_STATIC QCGC_INLINE size_t large_split_index(size_t index, size_t cells);
 QCGC_STATIC QCGC_INLINE size_t small_index_to_cells(size_t index);
+QCGC_STATIC QCGC_INLINE size_t large_split_index_to_cells(size_t index,
+		size_t split);
+QCGC_STATIC QCGC_INLINE uint64_t map_from(size_t index);
+
+QCGC_STATIC cell_t *small_free_list_take(size_t index);
+QCGC_STATIC struct exp_free_list_item_s large_free_list_take(size_t index,
+		size_t split);
+QCGC_STATIC bool large_free_list_find(size_t *index, size_t *split);
 
 QCGC_STATIC cell_t *fit_allocator_small_first_fit(size_t index, size_t cells);
-QCGC_STATIC cell_t *fit_allocator_large_fit(size_t index, size_t cells);
-QCGC_STATIC cell_t *fit_allocator_large_first_fit(size_t index, size_t cells);
+QCGC_STATIC cell_t *fit_allocator_large_fit(size_t cells);
+QCGC_STATIC cell_t *fit_allocator_use_block(cell_t *ptr, size_t block_cells,
+		size_t cells);
 
 void qcgc_allocator_initialize(void) {
 	qcgc_allocator_state.arenas =
 		qcgc_arena_bag_create(QCGC_ARENA_BAG_INIT_SIZE);
 	qcgc_allocator_state.free_arenas = qcgc_arena_bag_create(4); // XXX
+	qcgc_allocator_state.decommitted_arenas = qcgc_arena_bag_create(4); // XXX
+	qcgc_allocator_state.unswept_arenas = qcgc_arena_bag_create(4); // XXX
 
 	// Fit Allocator
 	for (size_t i = 0; i < QCGC_SMALL_FREE_LISTS; i++) {
@@ -27,12 +43,18 @@ void qcgc_allocator_initialize(void) {
 	}
 
 	for (size_t i = 0; i < QCGC_LARGE_FREE_LISTS; i++) {
-		qcgc_allocator_state.fit_state.large_free_list[i] =
-			qcgc_exp_free_list_create(QCGC_LARGE_FREE_LIST_INIT_SIZE);
+		for (size_t j = 0; j < QCGC_LARGE_FREE_LIST_SPLIT; j++) {
+			qcgc_allocator_state.fit_state.large_free_list[i][j] =
+				qcgc_exp_free_list_create(QCGC_LARGE_FREE_LIST_INIT_SIZE);
+		}
+		qcgc_allocator_state.fit_state.large_split_map[i] = 0;
 	}
+	qcgc_allocator_state.fit_state.small_map = 0;
+	qcgc_allocator_state.fit_state.large_map = 0;
 
 	_qcgc_bump_allocator.ptr = NULL;
 	_qcgc_bump_allocator.end = NULL;
+	_qcgc_bump_allocator.start = NULL;
 	qcgc_bump_allocator_renew_block(0,true);
 }
 
@@ -43,7 +65,9 @@ void qcgc_allocator_destroy(void) {
 	}
 
 	for (size_t i = 0; i < QCGC_LARGE_FREE_LISTS; i++) {
-		free(qcgc_allocator_state.fit_state.large_free_list[i]);
+		for (size_t j = 0; j < QCGC_LARGE_FREE_LIST_SPLIT; j++) {
+			free(qcgc_allocator_state.fit_state.large_free_list[i][j]);
+		}
 	}
 
 	// Arenas
@@ -57,8 +81,15 @@ void qcgc_allocator_destroy(void) {
 		qcgc_arena_destroy(qcgc_allocator_state.free_arenas->items[i]);
 	}
 
+	arena_count = qcgc_allocator_state.decommitted_arenas->count;
+	for (size_t i = 0; i < arena_count; i++) {
+		qcgc_arena_destroy(qcgc_allocator_state.decommitted_arenas->items[i]);
+	}
+
 	free(qcgc_allocator_state.arenas);
 	free(qcgc_allocator_state.free_arenas);
+	free(qcgc_allocator_state.decommitted_arenas);
+	free(qcgc_allocator_state.unswept_arenas);
 }
 
 /*******************************************************************************
@@ -81,23 +112,28 @@ void qcgc_bump_allocator_renew_block(size_t size, bool force_arena) {
 	// Always use a huge block if there is one
 	assert(3 < QCGC_LARGE_FREE_LISTS);
 	size_t cells = bytes_to_cells(size);
-	size_t i = is_small(cells) ? 3 : MAX(3, large_index(cells) + 1);
-	for (; i < QCGC_LARGE_FREE_LISTS; i++) {
-		exp_free_list_t *free_list = qcgc_allocator_state.fit_state.
-			large_free_list[i];
-		if (free_list->count > 0) {
+	do {
+		size_t index = is_small(cells) ? 3 : MAX(3, large_index(cells) + 1);
+		size_t split = 0;
+		// Young objects must not be placed in old arenas
+		if (qcgc_state.generational != QCGC_GENERATIONAL_NURSERY &&
+				index < QCGC_LARGE_FREE_LISTS &&
+				large_free_list_find(&index, &split)) {
 			// Assign block to bump allocator
-			bump_allocator_assign(free_list->items[0].ptr,
-					free_list->items[0].size);
-			free_list = qcgc_exp_free_list_remove_index(free_list, 0);
-
-			qcgc_allocator_state.fit_state.large_free_list[i] = free_list;
-			qcgc_state.free_cells -=
-				_qcgc_bump_allocator.end - _qcgc_bump_allocator.ptr;
+			struct exp_free_list_item_s item =
+				large_free_list_take(index, split);
+			qcgc_state.free_cells -= item.size;
+			bump_allocator_assign(item.ptr, item.size);
 		}
-	}
+		// Sweep left over arenas until there is a huge block or a free arena
+	} while (_qcgc_bump_allocator.ptr == NULL &&
+			qcgc_allocator_state.free_arenas->count == 0 &&
+			qcgc_allocator_state.decommitted_arenas->count == 0 &&
+			qcgc_lazy_sweep_step());
 
+	size_t decision = QCGC_GROWTH_BUMP_BLOCK;
 	if (_qcgc_bump_allocator.ptr == NULL) {
+		decision = QCGC_GROWTH_FREE_ARENA;
 		if (qcgc_allocator_state.free_arenas->count > 0) {
 			// Reuse arena
 			arena_t *arena = qcgc_allocator_state.free_arenas->items[0];
@@ -107,18 +143,36 @@ void qcgc_bump_allocator_renew_block(size_t size, bool force_arena) {
 					QCGC_ARENA_CELLS_COUNT - QCGC_ARENA_FIRST_CELL_INDEX);
 			qcgc_allocator_state.arenas =
 				qcgc_arena_bag_add(qcgc_allocator_state.arenas, arena);
+		} else if (qcgc_allocator_state.decommitted_arenas->count > 0) {
+			// Reuse decommitted arena, its cells are committed again by the
+			// page faults of the first accesses
+			size_t count = qcgc_allocator_state.decommitted_arenas->count;
+			arena_t *arena =
+				qcgc_allocator_state.decommitted_arenas->items[count - 1];
+			qcgc_allocator_state.decommitted_arenas =
+				qcgc_arena_bag_remove_index(
+						qcgc_allocator_state.decommitted_arenas, count - 1);
+			qcgc_arena_recommit(arena);
+			bump_allocator_assign(&(arena->cells[QCGC_ARENA_FIRST_CELL_INDEX]),
+					QCGC_ARENA_CELLS_COUNT - QCGC_ARENA_FIRST_CELL_INDEX);
+			qcgc_allocator_state.arenas =
+				qcgc_arena_bag_add(qcgc_allocator_state.arenas, arena);
+		} else if (force_arena || qcgc_allocator_should_grow()) {
+			decision = QCGC_GROWTH_NEW_ARENA;
+			arena_t *arena = qcgc_arena_create();
+			bump_allocator_assign(&(arena->cells[QCGC_ARENA_FIRST_CELL_INDEX]),
+					QCGC_ARENA_CELLS_COUNT - QCGC_ARENA_FIRST_CELL_INDEX);
+			qcgc_allocator_state.arenas =
+				qcgc_arena_bag_add(qcgc_allocator_state.arenas, arena);
 		} else {
-			// FIXME: Nifty decision making whether to allocate new arena
-			bool new_arena = false;
-			if (force_arena || new_arena) {
-				arena_t *arena = qcgc_arena_create();
-				bump_allocator_assign(&(arena->cells[QCGC_ARENA_FIRST_CELL_INDEX]),
-						QCGC_ARENA_CELLS_COUNT - QCGC_ARENA_FIRST_CELL_INDEX);
-				qcgc_allocator_state.arenas =
-					qcgc_arena_bag_add(qcgc_allocator_state.arenas, arena);
-			}
+			decision = QCGC_GROWTH_FIT;
 		}
 	}
+	log_growth_decision(decision, force_arena);
+	if (qcgc_state.generational == QCGC_GENERATIONAL_NURSERY &&
+			_qcgc_bump_allocator.ptr != NULL) {
+		qcgc_generation_add_young(qcgc_arena_addr(_qcgc_bump_allocator.ptr));
+	}
 #if CHECKED
 	assert(!force_arena || _qcgc_bump_allocator.ptr != NULL);
 	if (_qcgc_bump_allocator.ptr != NULL) {
@@ -136,6 +190,72 @@ void qcgc_bump_allocator_renew_block(size_t size, bool force_arena) {
 #endif
 }
 
+bool qcgc_allocator_should_grow(void) {
+	if (!qcgc_state.growth_policy ||
+			qcgc_state.generational != QCGC_GENERATIONAL_OFF) {
+		return false;
+	}
+	size_t arena_cells = QCGC_ARENA_CELLS_COUNT - QCGC_ARENA_FIRST_CELL_INDEX;
+	if ((qcgc_allocator_state.arenas->count + 1) * arena_cells >
+			qcgc_allocator_heap_target()) {
+		return false;
+	}
+	size_t budget = qcgc_allocator_cycle_budget();
+	if (qcgc_state.free_cells < budget) {
+		// The fit allocator would run dry before the next collection
+		return true;
+	}
+	return qcgc_allocator_fragmentation() >= qcgc_state.growth_fragmentation &&
+		budget >= arena_cells;
+}
+
+size_t qcgc_allocator_heap_target(void) {
+	if (qcgc_state.heap_goal != 0) {
+		return qcgc_state.heap_goal;
+	}
+	return qcgc_state.live_cells + (qcgc_state.incmark_to_sweep + 1) *
+		qcgc_state.incmark_threshold;
+}
+
+size_t qcgc_allocator_cycle_budget(void) {
+	size_t steps = qcgc_state.incmark_to_sweep > qcgc_state.incmark_since_sweep ?
+		qcgc_state.incmark_to_sweep - qcgc_state.incmark_since_sweep : 0;
+	size_t budget = steps * qcgc_state.incmark_threshold;
+	if (qcgc_state.incmark_threshold > qcgc_state.cells_since_incmark) {
+		budget += qcgc_state.incmark_threshold - qcgc_state.cells_since_incmark;
+	}
+	return budget;
+}
+
+size_t qcgc_allocator_fragmentation(void) {
+	if (qcgc_state.free_cells == 0) {
+		return 0;
+	}
+	size_t largest = MIN(qcgc_state.largest_free_block, qcgc_state.free_cells);
+	return 100 - largest * 100 / qcgc_state.free_cells;
+}
+
+QCGC_STATIC void log_growth_decision(size_t decision, bool force_arena) {
+	struct log_info_s {
+		size_t decision;
+		bool force_arena;
+		size_t free_cells;
+		size_t largest_free_block;
+		size_t cycle_budget;
+		size_t arenas;
+	};
+	struct log_info_s log_info = {
+		decision,
+		force_arena,
+		qcgc_state.free_cells,
+		qcgc_state.largest_free_block,
+		qcgc_allocator_cycle_budget(),
+		qcgc_allocator_state.arenas->count,
+	};
+	qcgc_event_logger_log(EVENT_ALLOCATOR_DECISION, sizeof(struct log_info_s),
+			(uint8_t *) &log_info);
+}
+
 QCGC_STATIC void bump_allocator_assign(cell_t *ptr, size_t cells) {
 #if CHECKED
 	assert(qcgc_arena_get_blocktype(qcgc_arena_addr(ptr),
@@ -145,8 +265,35 @@ QCGC_STATIC void bump_allocator_assign(cell_t *ptr, size_t cells) {
 					qcgc_arena_cell_index(ptr + i)) == BLOCK_EXTENT);
 	}
 #endif
+	if (qcgc_is_multi_threaded()) {
+		// Bump allocation updates the bitmaps without holding the lock, so the
+		// block must not share bitmap bytes with memory used by other threads
+		size_t index = qcgc_arena_cell_index(ptr);
+		size_t head = (8 - index % 8) % 8;
+		size_t tail = (index + cells) % 8;
+		if (head + tail >= cells) {
+			// Nothing left after aligning, keep whole block in free lists
+			qcgc_fit_allocator_add(ptr, cells);
+			return;
+		}
+		if (head > 0) {
+			qcgc_fit_allocator_add(ptr, head);
+			ptr += head;
+			cells -= head;
+			qcgc_arena_set_blocktype(qcgc_arena_addr(ptr),
+					qcgc_arena_cell_index(ptr), BLOCK_FREE);
+		}
+		if (tail > 0) {
+			cells -= tail;
+			qcgc_arena_set_blocktype(qcgc_arena_addr(ptr + cells),
+					qcgc_arena_cell_index(ptr + cells), BLOCK_FREE);
+			qcgc_fit_allocator_add(ptr + cells, tail);
+		}
+	}
+	qcgc_arena_mark_committed(ptr, cells);
 	_qcgc_bump_allocator.ptr = ptr;
 	_qcgc_bump_allocator.end = ptr + cells;
+	_qcgc_bump_allocator.start = ptr;
 }
 
 /*******************************************************************************
@@ -160,13 +307,15 @@ object_t *qcgc_fit_allocate(size_t bytes) {
 	size_t cells = bytes_to_cells(bytes);
 	cell_t *mem;
 
-	if (is_small(cells)) {
-		size_t index = small_index(cells);
-		mem = fit_allocator_small_first_fit(index, cells);
-	} else {
-		size_t index = large_index(cells);
-		mem = fit_allocator_large_fit(index, cells);
-	}
+	do {
+		if (is_small(cells)) {
+			size_t index = small_index(cells);
+			mem = fit_allocator_small_first_fit(index, cells);
+		} else {
+			mem = fit_allocator_large_fit(cells);
+		}
+		// Sweep left over arenas one at a time until the block fits
+	} while (mem == NULL && qcgc_lazy_sweep_step());
 
 	if (mem == NULL) {
 		return NULL;
@@ -183,14 +332,48 @@ object_t *qcgc_fit_allocate(size_t bytes) {
 	return result;
 }
 
+void qcgc_allocator_free_arena(arena_t *arena) {
+	qcgc_generation_forget(arena);
+	for (size_t i = 0; i < qcgc_allocator_state.arenas->count; i++) {
+		if (qcgc_allocator_state.arenas->items[i] == arena) {
+			qcgc_allocator_state.arenas = qcgc_arena_bag_remove_index(
+					qcgc_allocator_state.arenas, i);
+			break;
+		}
+	}
+	qcgc_allocator_state.free_arenas = qcgc_arena_bag_add(
+			qcgc_allocator_state.free_arenas, arena);
+}
+
+void qcgc_allocator_decommit_free_arenas(void) {
+	while (qcgc_allocator_state.free_arenas->count >
+			qcgc_state.free_arenas_retain) {
+		size_t count = qcgc_allocator_state.free_arenas->count;
+		arena_t *arena = qcgc_allocator_state.free_arenas->items[count - 1];
+		if (!qcgc_arena_decommit_free(arena)) {
+			// Stays a free arena
+			break;
+		}
+		qcgc_allocator_state.free_arenas = qcgc_arena_bag_remove_index(
+				qcgc_allocator_state.free_arenas, count - 1);
+		qcgc_allocator_state.decommitted_arenas = qcgc_arena_bag_add(
+				qcgc_allocator_state.decommitted_arenas, arena);
+	}
+}
+
 void qcgc_fit_allocator_empty_lists(void) {
 	for (size_t i = 0; i < QCGC_SMALL_FREE_LISTS; i++) {
 		qcgc_allocator_state.fit_state.small_free_list[i]->count = 0;
 	}
 
 	for (size_t i = 0; i < QCGC_LARGE_FREE_LISTS; i++) {
-		qcgc_allocator_state.fit_state.large_free_list[i]->count = 0;
+		for (size_t j = 0; j < QCGC_LARGE_FREE_LIST_SPLIT; j++) {
+			qcgc_allocator_state.fit_state.large_free_list[i][j]->count = 0;
+		}
+		qcgc_allocator_state.fit_state.large_split_map[i] = 0;
 	}
+	qcgc_allocator_state.fit_state.small_map = 0;
+	qcgc_allocator_state.fit_state.large_map = 0;
 }
 
 void qcgc_fit_allocator_add(cell_t *ptr, size_t cells) {
@@ -203,121 +386,155 @@ void qcgc_fit_allocator_add(cell_t *ptr, size_t cells) {
 			qcgc_linear_free_list_add(
 					qcgc_allocator_state.fit_state.small_free_list[index],
 					ptr);
+		qcgc_allocator_state.fit_state.small_map |= 1ull << index;
 	} else {
 		size_t index = large_index(cells);
-		qcgc_allocator_state.fit_state.large_free_list[index] =
+		size_t split = large_split_index(index, cells);
+		qcgc_allocator_state.fit_state.large_free_list[index][split] =
 			qcgc_exp_free_list_add(
-					qcgc_allocator_state.fit_state.large_free_list[index],
+					qcgc_allocator_state.fit_state.large_free_list[index][split],
 					(struct exp_free_list_item_s) {ptr, cells});
+		qcgc_allocator_state.fit_state.large_split_map[index] |= 1ull << split;
+		qcgc_allocator_state.fit_state.large_map |= 1ull << index;
 	}
 	qcgc_state.free_cells += cells;
 }
 
-QCGC_STATIC cell_t *fit_allocator_small_first_fit(size_t index, size_t cells) {
+QCGC_STATIC cell_t *small_free_list_take(size_t index) {
+	linear_free_list_t *free_list =
+		qcgc_allocator_state.fit_state.small_free_list[index];
 #if CHECKED
-	assert(small_index_to_cells(index) >= cells);
+	assert(free_list->count > 0);
 #endif
-	cell_t *result = NULL;
-	for ( ; index < QCGC_SMALL_FREE_LISTS; index++) {
-		size_t list_cell_size = small_index_to_cells(index);
-
-		if (qcgc_allocator_state.fit_state.small_free_list[index]->count > 0) {
-			result = qcgc_allocator_state.fit_state.small_free_list[index]->
-				items[0];
-			qcgc_allocator_state.fit_state.small_free_list[index] =
-				qcgc_linear_free_list_remove_index(
-						qcgc_allocator_state.fit_state.small_free_list[index],
-						0);
-			qcgc_arena_set_blocktype(qcgc_arena_addr(result),
-					qcgc_arena_cell_index(result), BLOCK_WHITE);
-			if (list_cell_size - cells > 0) {
-				qcgc_arena_set_blocktype(qcgc_arena_addr(result + cells),
-						qcgc_arena_cell_index(result + cells), BLOCK_FREE);
-				qcgc_fit_allocator_add(result + cells, list_cell_size - cells);
-				qcgc_state.free_cells -= list_cell_size - cells;
-			}
-			return result;
-		}
+	cell_t *result = free_list->items[0];
+	free_list = qcgc_linear_free_list_remove_index(free_list, 0);
+	if (free_list->count == 0) {
+		qcgc_allocator_state.fit_state.small_map &= ~(1ull << index);
 	}
-	return fit_allocator_large_first_fit(0, cells);
+	qcgc_allocator_state.fit_state.small_free_list[index] = free_list;
+	return result;
 }
 
-QCGC_STATIC cell_t *fit_allocator_large_fit(size_t index, size_t cells) {
+QCGC_STATIC struct exp_free_list_item_s large_free_list_take(size_t index,
+		size_t split) {
+	exp_free_list_t *free_list =
+		qcgc_allocator_state.fit_state.large_free_list[index][split];
 #if CHECKED
-	assert(1u<<(index + QCGC_LARGE_FREE_LIST_FIRST_EXP) <= cells);
-	assert(1u<<(index + QCGC_LARGE_FREE_LIST_FIRST_EXP + 1) > cells);
+	assert(free_list->count > 0);
 #endif
-	size_t best_fit_index = qcgc_allocator_state.fit_state.
-		large_free_list[index]->count;
-
-	cell_t *result = NULL;
-	size_t best_fit_cells = SIZE_MAX;
-	size_t count = qcgc_allocator_state.fit_state.large_free_list[index]->count;
-	for (size_t i = 0; i < count; i++) {
-		if (qcgc_allocator_state.fit_state.large_free_list[index]->
-				items[i].size >= cells &&
-				qcgc_allocator_state.fit_state.large_free_list[index]->
-				items[i].size < best_fit_cells) {
-			result = qcgc_allocator_state.fit_state.large_free_list[index]->
-				items[i].ptr;
-			best_fit_cells = qcgc_allocator_state.fit_state.
-				large_free_list[index]->items[i].size;
-			best_fit_index = i;
-		}
-		if (best_fit_cells == cells) {
-			break;
+	struct exp_free_list_item_s result = free_list->items[0];
+	free_list = qcgc_exp_free_list_remove_index(free_list, 0);
+	if (free_list->count == 0) {
+		qcgc_allocator_state.fit_state.large_split_map[index] &=
+			~(1ull << split);
+		if (qcgc_allocator_state.fit_state.large_split_map[index] == 0) {
+			qcgc_allocator_state.fit_state.large_map &= ~(1ull << index);
 		}
 	}
+	qcgc_allocator_state.fit_state.large_free_list[index][split] = free_list;
+	return result;
+}
 
-	if (result != NULL) {
-		// Best fit was found
-		assert(best_fit_index < qcgc_allocator_state.fit_state.
-				large_free_list[index]->count);
-		qcgc_allocator_state.fit_state.large_free_list[index] =
-			qcgc_exp_free_list_remove_index(qcgc_allocator_state.fit_state.
-					large_free_list[index], best_fit_index);
-		qcgc_arena_set_blocktype(qcgc_arena_addr(result),
-				qcgc_arena_cell_index(result), BLOCK_WHITE);
-		if (best_fit_cells - cells > 0) {
-			qcgc_arena_set_blocktype(qcgc_arena_addr(result + cells),
-					qcgc_arena_cell_index(result + cells), BLOCK_FREE);
-			qcgc_fit_allocator_add(result + cells, best_fit_cells - cells);
-			qcgc_state.free_cells -= best_fit_cells - cells;
+/**
+ * Find the first non-empty large free list at or after the given one.
+ *
+ * @param	index	Large free list index, replaced by the result
+ * @param	split	Second level index, replaced by the result
+ * @return	false iff all these lists are empty
+ */
+QCGC_STATIC bool large_free_list_find(size_t *index, size_t *split) {
+#if CHECKED
+	assert(*index < QCGC_LARGE_FREE_LISTS);
+	assert(*split < QCGC_LARGE_FREE_LIST_SPLIT);
+#endif
+	uint64_t map = qcgc_allocator_state.fit_state.large_split_map[*index] &
+		map_from(*split);
+	if (map == 0) {
+		map = qcgc_allocator_state.fit_state.large_map & map_from(*index + 1);
+		if (map == 0) {
+			return false;
 		}
-	} else {
-		// No best fit, go for first fit
-		result = fit_allocator_large_first_fit(index + 1, cells);
+		*index = __builtin_ctzll(map);
+		map = qcgc_allocator_state.fit_state.large_split_map[*index];
 	}
-	return result;
+	*split = __builtin_ctzll(map);
+	return true;
 }
 
-QCGC_STATIC cell_t *fit_allocator_large_first_fit(size_t index, size_t cells) {
+QCGC_STATIC cell_t *fit_allocator_small_first_fit(size_t index, size_t cells) {
 #if CHECKED
-	assert(1u<<(index + QCGC_LARGE_FREE_LIST_FIRST_EXP) >= cells);
+	assert(small_index_to_cells(index) >= cells);
 #endif
-	for ( ; index < QCGC_LARGE_FREE_LISTS; index++) {
-		if (qcgc_allocator_state.fit_state.large_free_list[index]->count > 0) {
-			struct exp_free_list_item_s item =
-				qcgc_allocator_state.fit_state.large_free_list[index]->items[0];
-			qcgc_allocator_state.fit_state.large_free_list[index] =
-				qcgc_exp_free_list_remove_index(
-						qcgc_allocator_state.fit_state.large_free_list[index],
-						0);
-
-			qcgc_arena_set_blocktype(qcgc_arena_addr(item.ptr),
-					qcgc_arena_cell_index(item.ptr), BLOCK_WHITE);
-			if (item.size - cells > 0) {
-				qcgc_arena_set_blocktype(qcgc_arena_addr(item.ptr + cells),
-						qcgc_arena_cell_index(item.ptr + cells), BLOCK_FREE);
-				qcgc_fit_allocator_add(item.ptr + cells, item.size - cells);
-				qcgc_state.free_cells -= item.size - cells;
-			}
-			return item.ptr;
+	uint64_t map = qcgc_allocator_state.fit_state.small_map & map_from(index);
+	if (map != 0) {
+		index = __builtin_ctzll(map);
+		return fit_allocator_use_block(small_free_list_take(index),
+				small_index_to_cells(index), cells);
+	}
+
+	// Every large block fits
+	size_t split = 0;
+	index = 0;
+	if (large_free_list_find(&index, &split)) {
+		struct exp_free_list_item_s item = large_free_list_take(index, split);
+		return fit_allocator_use_block(item.ptr, item.size, cells);
+	}
+	return NULL;
+}
+
+QCGC_STATIC cell_t *fit_allocator_large_fit(size_t cells) {
+	size_t index = large_index(cells);
+	size_t split = large_split_index(index, cells);
+
+	// Round up to the next list, all blocks there are large enough
+	size_t fit_index = index;
+	size_t fit_split = split;
+	if (large_split_index_to_cells(index, split) < cells) {
+		fit_split++;
+		if (fit_split == QCGC_LARGE_FREE_LIST_SPLIT) {
+			fit_index++;
+			fit_split = 0;
 		}
 	}
+	if (fit_index < QCGC_LARGE_FREE_LISTS &&
+			large_free_list_find(&fit_index, &fit_split)) {
+		struct exp_free_list_item_s item =
+			large_free_list_take(fit_index, fit_split);
+		return fit_allocator_use_block(item.ptr, item.size, cells);
+	}
+
+	// Blocks in the own list may still fit, but only the first one is
+	// considered to keep allocation time independent of the list length
+	exp_free_list_t *free_list =
+		qcgc_allocator_state.fit_state.large_free_list[index][split];
+	if (free_list->count > 0 && free_list->items[0].size >= cells) {
+		struct exp_free_list_item_s item = large_free_list_take(index, split);
+		return fit_allocator_use_block(item.ptr, item.size, cells);
+	}
 	return NULL;
 }
 
+/**
+ * Allocate cells at the beginning of a block taken from the free lists and
+ * return the remainder to the free lists.
+ */
+QCGC_STATIC cell_t *fit_allocator_use_block(cell_t *ptr, size_t block_cells,
+		size_t cells) {
+#if CHECKED
+	assert(block_cells >= cells);
+#endif
+	qcgc_arena_set_blocktype(qcgc_arena_addr(ptr),
+			qcgc_arena_cell_index(ptr), BLOCK_WHITE);
+	qcgc_arena_mark_committed(ptr, cells);
+	if (block_cells - cells > 0) {
+		qcgc_arena_set_blocktype(qcgc_arena_addr(ptr + cells),
+				qcgc_arena_cell_index(ptr + cells), BLOCK_FREE);
+		qcgc_fit_allocator_add(ptr + cells, block_cells - cells);
+		qcgc_state.free_cells -= block_cells - cells;
+	}
+	return ptr;
+}
+
 QCGC_STATIC QCGC_INLINE bool is_small(size_t cells) {
 	return cells <= QCGC_SMALL_FREE_LISTS;
 }
@@ -348,3 +565,32 @@ QCGC_STATIC QCGC_INLINE size_t small_index_to_cells(size_t index) {
 #endif
 	return index + 1;
 }
+
+QCGC_STATIC QCGC_INLINE size_t large_split_index(size_t index, size_t cells) {
+	size_t exp = index + QCGC_LARGE_FREE_LIST_FIRST_EXP;
+	if ((cells >> (exp + 1)) > 0) {
+		// Larger blocks in the last list
+		return QCGC_LARGE_FREE_LIST_SPLIT - 1;
+	}
+	// The leading one bit selects the list, the following bits the second level
+	return (cells >> (exp - QCGC_LARGE_FREE_LIST_SPLIT_EXP)) -
+		QCGC_LARGE_FREE_LIST_SPLIT;
+}
+
+QCGC_STATIC QCGC_INLINE size_t large_split_index_to_cells(size_t index,
+		size_t split) {
+#if CHECKED
+	assert(index < QCGC_LARGE_FREE_LISTS);
+	assert(split < QCGC_LARGE_FREE_LIST_SPLIT);
+#endif
+	return (QCGC_LARGE_FREE_LIST_SPLIT + split) <<
+		(index + QCGC_LARGE_FREE_LIST_FIRST_EXP -
+		 QCGC_LARGE_FREE_LIST_SPLIT_EXP);
+}
+
+/**
+ * Mask selecting the bits index and above of a free list bitmap.
+ */
+QCGC_STATIC QCGC_INLINE uint64_t map_from(size_t index) {
+	return index < 64 ? ~0ull << index : 0;
+}
@@ -7,6 +7,8 @@
 
 #include "arena.h"
 #include "bag.h"
+#include "gc_state.h"
+#include "generation.h"
 #include "hugeblocktable.h"
 
 /**
@@ -32,18 +34,63 @@
  * (i.e. such that the last bin contains all blocks that are larger or equal
  * than the threshold for huge blocks. These blocks can be returned to the
  * bump allocator)
+ *
+ * Every large free list is split into 2^QCGC_LARGE_FREE_LIST_SPLIT_EXP second
+ * level lists of equal width, e.g. for index 0 and a split of 8:
+ *                        +-------+-------+-----+-------+
+ * second level index:    |   0   |   1   | ... |   7   |
+ *                        +-------+-------+-----+-------+
+ * minimal size (cells):  |  32   |  36   | ... |  60   |
+ *                        +-------+-------+-----+-------+
+ * The last second level list of the last bin also holds all larger blocks.
+ *
+ * For each level there is a bitmap of non-empty lists, such that a fitting
+ * list is found with a single bit scan (two-level segregated fit).
  */
 #define QCGC_LARGE_FREE_LISTS (QCGC_LARGE_ALLOC_THRESHOLD_EXP - QCGC_LARGE_FREE_LIST_FIRST_EXP - 4 + 1)
 // -4 because of turning bytes into cells, +1 because we start to count at 0
 
+#define QCGC_LARGE_FREE_LIST_SPLIT (1<<QCGC_LARGE_FREE_LIST_SPLIT_EXP)
+
 #define QCGC_SMALL_FREE_LISTS ((1<<QCGC_LARGE_FREE_LIST_FIRST_EXP) - 1)
 
+#if QCGC_SMALL_FREE_LISTS > 64 || QCGC_LARGE_FREE_LISTS > 64 || \
+	QCGC_LARGE_FREE_LIST_SPLIT > 64
+#error "Free list bitmaps are limited to 64 lists"
+#endif
+
+#if QCGC_LARGE_FREE_LIST_SPLIT_EXP > QCGC_LARGE_FREE_LIST_FIRST_EXP
+#error "Second level lists must be at least one cell wide"
+#endif
+
+/**
+ * Where the bump allocator gets a new block from (see
+ * qcgc_bump_allocator_renew_block), in the order of preference:
+ * - QCGC_GROWTH_BUMP_BLOCK: A large free block
+ * - QCGC_GROWTH_FREE_ARENA: A free or decommitted arena
+ * - QCGC_GROWTH_NEW_ARENA: A new arena, if forced or if the growth policy asks
+ *   for one (see qcgc_allocator_should_grow)
+ * - QCGC_GROWTH_FIT: Nowhere, the fit allocator serves all allocations until
+ *   the next incremental mark step or collection
+ */
+#define QCGC_GROWTH_FIT 0
+#define QCGC_GROWTH_BUMP_BLOCK 1
+#define QCGC_GROWTH_FREE_ARENA 2
+#define QCGC_GROWTH_NEW_ARENA 3
+
 struct qcgc_allocator_state {
 	arena_bag_t *arenas;
 	arena_bag_t *free_arenas;
+	arena_bag_t *decommitted_arenas;	// Free arenas returned to the OS
+	arena_bag_t *unswept_arenas;	// Arenas left over by a lazy sweep
 	struct fit_state {
 		linear_free_list_t *small_free_list[QCGC_SMALL_FREE_LISTS];
-		exp_free_list_t *large_free_list[QCGC_LARGE_FREE_LISTS];
+		exp_free_list_t *large_free_list[QCGC_LARGE_FREE_LISTS]
+			[QCGC_LARGE_FREE_LIST_SPLIT];
+		uint64_t small_map;							// Non-empty small lists
+		uint64_t large_map;							// Non-empty large lists
+		uint64_t large_split_map[QCGC_LARGE_FREE_LISTS];	// Non-empty second
+															// level lists
 	} fit_state;
 } qcgc_allocator_state;
 
@@ -67,6 +114,57 @@ void qcgc_allocator_destroy(void);
  */
 object_t *qcgc_fit_allocate(size_t bytes);
 
+/**
+ * Move arena that is empty after sweeping to the free arenas
+ *
+ * @param	arena	Empty arena
+ */
+void qcgc_allocator_free_arena(arena_t *arena);
+
+/**
+ * Return the free arenas beyond qcgc_state.free_arenas_retain to the OS. They
+ * stay mapped and are reused by the bump allocator when no committed free
+ * arena is left.
+ */
+void qcgc_allocator_decommit_free_arenas(void);
+
+/**
+ * Growth policy, decides whether a new arena is better than using the fit
+ * allocator when there is neither a large free block nor a free arena. The
+ * heap never grows beyond qcgc_allocator_heap_target this way. Below it, the
+ * heap grows if
+ * - the free cells do not suffice for the allocations that are left until
+ *   the next full collection (see qcgc_allocator_cycle_budget), or
+ * - the free cells are fragmented (see qcgc_allocator_fragmentation) beyond
+ *   qcgc_state.growth_fragmentation and a whole arena fits into the budget.
+ *
+ * Only applies if qcgc_state.growth_policy is set and the generational mode is
+ * off.
+ *
+ * @return	true iff a new arena should be allocated
+ */
+bool qcgc_allocator_should_grow(void);
+
+/**
+ * Arena cells the heap may grow to before the next full collection, the heap
+ * goal of the pacer or, with the pacer off, the live cells plus the cells
+ * allocated during a whole cycle.
+ */
+size_t qcgc_allocator_heap_target(void);
+
+/**
+ * Cells the mutator may allocate until the next full collection is due, i.e.
+ * the rest of the allocation budget set by the pacer.
+ */
+size_t qcgc_allocator_cycle_budget(void);
+
+/**
+ * Fragmentation of the free cells in percent, i.e. the share of free cells
+ * outside the largest free block. Based on qcgc_state.largest_free_block, so
+ * it reflects the last sweep.
+ */
+size_t qcgc_allocator_fragmentation(void);
+
 /**
  * Empty all free lists (used before sweep)
  */
@@ -81,20 +179,37 @@ void qcgc_fit_allocator_empty_lists(void);
 void qcgc_fit_allocator_add(cell_t *ptr, size_t cells);
 
 /**
- * Reset bump pointer
+ * Reset bump allocator, the remaining block is returned to the free lists and
+ * the used part is recorded in sticky mode
+ *
+ * @param	bump_allocator	The bump allocator to reset
  */
-QCGC_STATIC QCGC_INLINE void qcgc_reset_bump_ptr(void) {
-	if (_qcgc_bump_allocator.end > _qcgc_bump_allocator.ptr) {
+QCGC_STATIC QCGC_INLINE void qcgc_bump_allocator_reset(
+		struct qcgc_bump_allocator *bump_allocator) {
+	if (qcgc_state.generational == QCGC_GENERATIONAL_STICKY &&
+			bump_allocator->ptr > bump_allocator->start) {
+		qcgc_generation_record(bump_allocator->start,
+				bump_allocator->ptr - bump_allocator->start);
+	}
+	if (bump_allocator->end > bump_allocator->ptr) {
 		qcgc_arena_set_blocktype(
-				qcgc_arena_addr(_qcgc_bump_allocator.ptr),
+				qcgc_arena_addr(bump_allocator->ptr),
 				qcgc_arena_cell_index(
-					_qcgc_bump_allocator.ptr),
+					bump_allocator->ptr),
 				BLOCK_FREE);
-		qcgc_fit_allocator_add(_qcgc_bump_allocator.ptr,
-				_qcgc_bump_allocator.end - _qcgc_bump_allocator.ptr);
+		qcgc_fit_allocator_add(bump_allocator->ptr,
+				bump_allocator->end - bump_allocator->ptr);
 	}
-	_qcgc_bump_allocator.ptr = NULL;
-	_qcgc_bump_allocator.end = NULL;
+	bump_allocator->ptr = NULL;
+	bump_allocator->end = NULL;
+	bump_allocator->start = NULL;
+}
+
+/**
+ * Reset bump pointer of the calling thread
+ */
+QCGC_STATIC QCGC_INLINE void qcgc_reset_bump_ptr(void) {
+	qcgc_bump_allocator_reset(&_qcgc_bump_allocator);
 }
 
 /**
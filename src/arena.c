@@ -5,18 +5,74 @@
 #include <sys/mman.h>
 #include <unistd.h>
 
-#if DEBUG_ZERO_ON_SWEEP
 #include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
 #endif
 
 #include "allocator.h"
 #include "event_logger.h"
 #include "gc_state.h"
-#include "object_stack.h"
+#include "generation.h"
+#include "heap.h"
+#include "gray_stack.h"
+
+QCGC_STATIC arena_t *arena_map(void);
+QCGC_STATIC bool arena_sweep(arena_t *arena, exp_free_list_t **free_blocks);
+QCGC_STATIC void add_free_block(cell_t *ptr, size_t cells,
+		exp_free_list_t **free_blocks);
+QCGC_STATIC QCGC_INLINE bool page_decommitted(arena_t *arena, size_t page);
+QCGC_STATIC QCGC_INLINE uint64_t load_word(uint8_t *bitmap, size_t index);
+QCGC_STATIC QCGC_INLINE void store_word(uint8_t *bitmap, size_t index,
+		uint64_t word);
+QCGC_STATIC void select_sweep_kernel(void);
+QCGC_STATIC void sweep_bitmaps_generic(arena_t *arena);
+#if defined(__x86_64__)
+QCGC_STATIC void sweep_bitmaps_avx2(arena_t *arena);
+#endif
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "Sweeping reads the bitmaps as little endian words"
+#endif
+
+// Sweep kernel, selected for the CPU on first use
+QCGC_STATIC void (*sweep_bitmaps)(arena_t *arena) = NULL;
 
 arena_t *qcgc_arena_create(void) {
 	qcgc_event_logger_log(EVENT_NEW_ARENA, 0, NULL);
 
+	arena_t *result = qcgc_heap_arena_commit();
+	if (result == NULL) {
+		result = arena_map();
+		if (result == NULL) {
+			// ERROR: OUT OF MEMORY
+			return NULL;
+		}
+		qcgc_heap_advise_huge_pages(result);
+		qcgc_heap_state.outside_arenas++;
+	}
+
+	// Init bitmaps: One large free block
+	result->mark_bitmap[QCGC_ARENA_FIRST_CELL_INDEX / 8] = 1;
+
+	// Empty gray stack
+	result->gray_stack = NULL;
+	return result;
+}
+
+void qcgc_arena_destroy(arena_t *arena) {
+#if CHECKED
+	assert(arena != NULL);
+#endif
+	qcgc_gray_stack_free(arena->gray_stack);
+	if (!qcgc_heap_arena_release(arena)) {
+		munmap((void *) arena, QCGC_ARENA_SIZE);
+		qcgc_heap_state.outside_arenas--;
+	}
+}
+
+QCGC_STATIC arena_t *arena_map(void) {
 	arena_t *result;
 	// Linux: MAP_ANONYMOUS is initialized to zero
 	cell_t *mem = (cell_t *) mmap(0, 2 * QCGC_ARENA_SIZE,
@@ -41,21 +97,80 @@ arena_t *qcgc_arena_create(void) {
 		munmap((void *)((intptr_t) mem + QCGC_ARENA_SIZE), QCGC_ARENA_SIZE);
 		result = (arena_t *) mem;
 	}
+	return result;
+}
 
-	// Init bitmaps: One large free block
-	result->mark_bitmap[QCGC_ARENA_FIRST_CELL_INDEX / 8] = 1;
-
-	// Create gray stack
-	result->gray_stack = qcgc_object_stack_create(QCGC_GRAY_STACK_INIT_SIZE);
+bool qcgc_arena_decommit(cell_t *ptr, size_t cells) {
+	arena_t *arena = qcgc_arena_addr(ptr);
+	size_t offset = (uintptr_t) ptr - (uintptr_t) arena;
+	size_t page = (offset + QCGC_OS_PAGE_SIZE - 1) / QCGC_OS_PAGE_SIZE;
+	size_t end = (offset + cells * sizeof(cell_t)) / QCGC_OS_PAGE_SIZE;
+	bool result = true;
+	while (page < end) {
+		if (page_decommitted(arena, page)) {
+			page++;
+			continue;
+		}
+		size_t run_end = page + 1;
+		while (run_end < end && !page_decommitted(arena, run_end)) {
+			run_end++;
+		}
+		// Anonymous private mapping: Pages read as zero after MADV_DONTNEED
+		if (madvise((char *) arena + page * QCGC_OS_PAGE_SIZE,
+					(run_end - page) * QCGC_OS_PAGE_SIZE, MADV_DONTNEED) == 0) {
+			for (; page < run_end; page++) {
+				arena->decommitted[page / 8] |= 1 << (page % 8);
+			}
+		} else {
+			result = false;
+		}
+		page = run_end;
+	}
 	return result;
 }
 
-void qcgc_arena_destroy(arena_t *arena) {
-#if CHECKED
-	assert(arena != NULL);
-#endif
-	free(arena->gray_stack);
-	munmap((void *) arena, QCGC_ARENA_SIZE);
+void qcgc_arena_mark_committed(cell_t *ptr, size_t cells) {
+	arena_t *arena = qcgc_arena_addr(ptr);
+	size_t offset = (uintptr_t) ptr - (uintptr_t) arena;
+	size_t end = (offset + cells * sizeof(cell_t) + QCGC_OS_PAGE_SIZE - 1) /
+		QCGC_OS_PAGE_SIZE;
+	for (size_t page = offset / QCGC_OS_PAGE_SIZE; page < end; page++) {
+		if (page_decommitted(arena, page)) {
+			arena->decommitted[page / 8] &= ~(1 << (page % 8));
+		}
+	}
+}
+
+bool qcgc_arena_decommit_free(arena_t *arena) {
+	if (qcgc_heap_state.huge_pages == QCGC_HUGE_PAGES_OFF) {
+		// The arena header stays committed, it still describes one free block
+		return qcgc_arena_decommit(&(arena->cells[QCGC_ARENA_FIRST_CELL_INDEX]),
+				QCGC_ARENA_CELLS_COUNT - QCGC_ARENA_FIRST_CELL_INDEX);
+	}
+	if (QCGC_ARENA_SIZE < QCGC_HUGE_PAGE_SIZE) {
+		return false;
+	}
+	gray_stack_t *gray_stack = arena->gray_stack;
+	if (madvise(arena, QCGC_ARENA_SIZE, MADV_DONTNEED) != 0) {
+		// Explicit huge pages can not be dropped on older kernels
+		return false;
+	}
+	qcgc_gray_stack_free(gray_stack);
+	return true;
+}
+
+void qcgc_arena_recommit(arena_t *arena) {
+	if ((arena->mark_bitmap[QCGC_ARENA_FIRST_CELL_INDEX / 8] & 1) == 0) {
+		// Header was dropped with the rest of the arena, all other header
+		// fields read as zero
+		arena->mark_bitmap[QCGC_ARENA_FIRST_CELL_INDEX / 8] = 1;
+	}
+	qcgc_arena_mark_committed(&(arena->cells[QCGC_ARENA_FIRST_CELL_INDEX]),
+			QCGC_ARENA_CELLS_COUNT - QCGC_ARENA_FIRST_CELL_INDEX);
+}
+
+QCGC_STATIC QCGC_INLINE bool page_decommitted(arena_t *arena, size_t page) {
+	return (arena->decommitted[page / 8] & (1 << (page % 8))) != 0;
 }
 
 void qcgc_arena_mark_allocated(cell_t *ptr, size_t cells) {
@@ -94,110 +209,121 @@ void qcgc_arena_mark_free(cell_t *ptr) {
 bool qcgc_arena_pseudo_sweep(arena_t *arena) {
 #if CHECKED
 	assert(arena != NULL);
-	assert(qcgc_arena_is_coalesced(arena));
+	assert(qcgc_arena_is_coalesced(arena) ||
+			qcgc_state.generational == QCGC_GENERATIONAL_STICKY);
 	assert(qcgc_arena_addr(_qcgc_bump_allocator.ptr) == arena);
 #endif
 	// Ignore free cell / largest block counting here, as blocks are not
 	// registerd in free lists as well
-	for (size_t cell = QCGC_ARENA_FIRST_CELL_INDEX;
-			cell < QCGC_ARENA_CELLS_COUNT;
-			cell++) {
-		switch (qcgc_arena_get_blocktype(arena, cell)) {
-			case BLOCK_BLACK:
-				qcgc_arena_set_blocktype(arena, cell, BLOCK_WHITE);
-			case BLOCK_FREE: // Fall through
-			case BLOCK_EXTENT: // Fall through
-			case BLOCK_WHITE: // Fall through
-				break;
-		}
+	if (qcgc_state.generational != QCGC_GENERATIONAL_STICKY) {
+		qcgc_arena_unmark(arena);
 	}
+	return false;
+}
+
+void qcgc_arena_unmark(arena_t *arena) {
 #if CHECKED
-	assert(qcgc_arena_is_coalesced(arena));
+	assert(arena != NULL);
 #endif
-	return false;
+	for (size_t i = QCGC_ARENA_FIRST_CELL_INDEX / 64;
+			i < QCGC_ARENA_BITMAP_SIZE / 8;
+			i++) {
+		// Black to white, i.e. clear the mark bit of allocated cells
+		store_word(arena->mark_bitmap, i, load_word(arena->mark_bitmap, i) &
+				~load_word(arena->block_bitmap, i));
+	}
 }
 
 bool qcgc_arena_sweep(arena_t *arena) {
+	return arena_sweep(arena, NULL);
+}
+
+bool qcgc_arena_sweep_into(arena_t *arena, exp_free_list_t **free_blocks) {
+#if CHECKED
+	assert(free_blocks != NULL);
+#endif
+	return arena_sweep(arena, free_blocks);
+}
+
+QCGC_STATIC bool arena_sweep(arena_t *arena, exp_free_list_t **free_blocks) {
 #if CHECKED
 	assert(arena != NULL);
-	assert(qcgc_arena_is_coalesced(arena));
+	// Minor collections in sticky mode do not coalesce across regions
+	assert(qcgc_arena_is_coalesced(arena) ||
+			qcgc_state.generational == QCGC_GENERATIONAL_STICKY);
 #endif
 	if (qcgc_arena_addr(_qcgc_bump_allocator.ptr) == arena) {
 		return qcgc_arena_pseudo_sweep(arena);
 	}
 
+	if (UNLIKELY(sweep_bitmaps == NULL)) {
+		select_sweep_kernel();
+	}
+	// After this, the block bitmap contains the white cells and the mark
+	// bitmap the free cells, which still have to be coalesced
+	sweep_bitmaps(arena);
+
 	size_t last_free_cell = 0;
 	bool free = true;
+	// Survivors stay black in sticky mode
+	bool sticky = qcgc_state.generational == QCGC_GENERATIONAL_STICKY;
 
-	// Vectorized bitmap updates
-	for (size_t i = QCGC_ARENA_FIRST_CELL_INDEX / 8;
-			i < QCGC_ARENA_BITMAP_SIZE;
+	for (size_t i = QCGC_ARENA_FIRST_CELL_INDEX / 64;
+			i < QCGC_ARENA_BITMAP_SIZE / 8;
 			i++) {
-		uint8_t new_block = arena->block_bitmap[i] & arena->mark_bitmap[i];
-		uint8_t new_mark = arena->block_bitmap[i] ^ arena->mark_bitmap[i];
-
-		arena->block_bitmap[i] = new_block;
+		uint64_t white = load_word(arena->block_bitmap, i);
+		uint64_t free_start = load_word(arena->mark_bitmap, i);
 
-		if (new_block == new_mark) {
-			// Both are 0
+		if (white == 0) {
+			if (free_start == 0) {
+				// Only extents
+				continue;
+			}
+			if (last_free_cell != 0) {
+				// Coalesce everything with the current free block
+				store_word(arena->mark_bitmap, i, 0);
+			} else {
+				// Free block starts here and covers the rest of the word
+				size_t first = __builtin_ctzll(free_start);
+				store_word(arena->mark_bitmap, i, (uint64_t) 1 << first);
+				last_free_cell = i * 64 + first;
+			}
 			continue;
 		}
 
-		if (!new_block) {
-			// Only entries in the mark bitmap
+		// Alternate between searching for the start of the next free block
+		// and for the white cell that ends it
+		free = false;
+		uint64_t new_mark = 0;
+		size_t pos = 0;
+		while (pos < 64) {
+			uint64_t remaining = ~(uint64_t) 0 << pos;
 			if (last_free_cell != 0) {
-				// Coalesce
-				new_mark = 0;
+				uint64_t end = white & remaining;
+				if (end == 0) {
+					break;
+				}
+				size_t cell = i * 64 + __builtin_ctzll(end);
+				add_free_block(arena->cells + last_free_cell,
+						cell - last_free_cell, free_blocks);
+				last_free_cell = 0;
+				pos = __builtin_ctzll(end) + 1;
 			} else {
-				uint8_t first = __builtin_ctz(new_mark);
-				new_mark = 1 << first;
-				last_free_cell = i * 8 + first;
-			}
-		} else {
-			for (size_t j = 0; j < 8; j++) {
-				size_t cell = i * 8 + j;
-				uint8_t m = (new_mark >> j) & 0x1;
-				uint8_t b = (new_block >> j) & 0x1;
-				uint8_t mask = 1 << j;
-				if (m) {
-					// Free
-					if (last_free_cell != 0) {
-						// Coalesce
-						new_mark &= ~mask;
-					} else {
-						last_free_cell = cell;
-					}
-				} else if (b) {
-					// White
-					free = false;
-					if (last_free_cell != 0) {
-						qcgc_fit_allocator_add(arena->cells + last_free_cell,
-								cell - last_free_cell);
-#if DEBUG_ZERO_ON_SWEEP
-						memset(arena->cells + last_free_cell, 0,
-								sizeof(cell_t) * (cell - last_free_cell));
-#endif
-						qcgc_state.largest_free_block = MAX(
-								qcgc_state.largest_free_block,
-								cell - last_free_cell);
-						last_free_cell = 0;
-					}
+				uint64_t start = free_start & remaining;
+				if (start == 0) {
+					break;
 				}
+				new_mark |= start & -start;
+				last_free_cell = i * 64 + __builtin_ctzll(start);
+				pos = __builtin_ctzll(start) + 1;
 			}
 		}
-		arena->mark_bitmap[i] = new_mark;
+		store_word(arena->mark_bitmap, i, sticky ? new_mark | white : new_mark);
 	}
 
 	if (last_free_cell != 0 && !free) {
-		qcgc_fit_allocator_add(arena->cells + last_free_cell,
-				QCGC_ARENA_CELLS_COUNT - last_free_cell);
-#if DEBUG_ZERO_ON_SWEEP
-		memset(arena->cells + last_free_cell, 0,
-				sizeof(cell_t) * (QCGC_ARENA_CELLS_COUNT - last_free_cell));
-#endif
-		qcgc_state.largest_free_block = MAX(
-				qcgc_state.largest_free_block,
-				QCGC_ARENA_CELLS_COUNT - last_free_cell);
+		add_free_block(arena->cells + last_free_cell,
+				QCGC_ARENA_CELLS_COUNT - last_free_cell, free_blocks);
 	}
 #if CHECKED
 	assert(qcgc_arena_is_coalesced(arena));
@@ -206,20 +332,97 @@ bool qcgc_arena_sweep(arena_t *arena) {
 	return free;
 }
 
+QCGC_STATIC void add_free_block(cell_t *ptr, size_t cells,
+		exp_free_list_t **free_blocks) {
+#if DEBUG_ZERO_ON_SWEEP
+	memset(ptr, 0, sizeof(cell_t) * cells);
+	qcgc_arena_mark_committed(ptr, cells);
+#endif
+	if (cells * sizeof(cell_t) >=
+			(QCGC_DECOMMIT_MIN_PAGES + 1) * QCGC_OS_PAGE_SIZE &&
+			qcgc_heap_state.huge_pages == QCGC_HUGE_PAGES_OFF) {
+		// Contains at least QCGC_DECOMMIT_MIN_PAGES whole pages. Not with
+		// huge pages, which would be split up. Pages of runs that were not
+		// reused since the last sweep are skipped.
+		qcgc_arena_decommit(ptr, cells);
+	}
+	if (free_blocks != NULL) {
+		// Published to the fit allocator later
+		*free_blocks = qcgc_exp_free_list_add(*free_blocks,
+				(struct exp_free_list_item_s) {ptr, cells});
+	} else {
+		qcgc_fit_allocator_add(ptr, cells);
+		qcgc_state.largest_free_block = MAX(qcgc_state.largest_free_block,
+				cells);
+	}
+}
+
+QCGC_STATIC QCGC_INLINE uint64_t load_word(uint8_t *bitmap, size_t index) {
+	uint64_t word;
+	memcpy(&word, bitmap + index * 8, sizeof(uint64_t));
+	return word;
+}
+
+QCGC_STATIC QCGC_INLINE void store_word(uint8_t *bitmap, size_t index,
+		uint64_t word) {
+	memcpy(bitmap + index * 8, &word, sizeof(uint64_t));
+}
+
+QCGC_STATIC void select_sweep_kernel(void) {
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("avx2")) {
+		sweep_bitmaps = sweep_bitmaps_avx2;
+		return;
+	}
+#endif
+	sweep_bitmaps = sweep_bitmaps_generic;
+}
+
+QCGC_STATIC void sweep_bitmaps_generic(arena_t *arena) {
+	for (size_t i = QCGC_ARENA_FIRST_CELL_INDEX / 64;
+			i < QCGC_ARENA_BITMAP_SIZE / 8;
+			i++) {
+		uint64_t block = load_word(arena->block_bitmap, i);
+		uint64_t mark = load_word(arena->mark_bitmap, i);
+		store_word(arena->block_bitmap, i, block & mark);
+		store_word(arena->mark_bitmap, i, block ^ mark);
+	}
+}
+
+#if defined(__x86_64__)
+__attribute__ ((target ("avx2")))
+QCGC_STATIC void sweep_bitmaps_avx2(arena_t *arena) {
+	size_t i = QCGC_ARENA_FIRST_CELL_INDEX / 8;
+	// Header may end in the middle of a vector
+	for (; i % 32 != 0; i += 8) {
+		uint64_t block = load_word(arena->block_bitmap, i / 8);
+		uint64_t mark = load_word(arena->mark_bitmap, i / 8);
+		store_word(arena->block_bitmap, i / 8, block & mark);
+		store_word(arena->mark_bitmap, i / 8, block ^ mark);
+	}
+	for (; i < QCGC_ARENA_BITMAP_SIZE; i += 32) {
+		__m256i block = _mm256_loadu_si256(
+				(__m256i *) (arena->block_bitmap + i));
+		__m256i mark = _mm256_loadu_si256(
+				(__m256i *) (arena->mark_bitmap + i));
+		_mm256_storeu_si256((__m256i *) (arena->block_bitmap + i),
+				_mm256_and_si256(block, mark));
+		_mm256_storeu_si256((__m256i *) (arena->mark_bitmap + i),
+				_mm256_xor_si256(block, mark));
+	}
+}
+#endif
+
 bool qcgc_arena_is_empty(arena_t *arena) {
 #if CHECKED
 	assert(arena != NULL);
 #endif
-	for (size_t cell = QCGC_ARENA_FIRST_CELL_INDEX;
-			cell < QCGC_ARENA_CELLS_COUNT;
-			cell++) {
-		switch (qcgc_arena_get_blocktype(arena, cell)) {
-			case BLOCK_WHITE: // Fall through
-			case BLOCK_BLACK:
-				return false;
-
-			default:
-				break;
+	for (size_t i = QCGC_ARENA_FIRST_CELL_INDEX / 64;
+			i < QCGC_ARENA_BITMAP_SIZE / 8;
+			i++) {
+		if (load_word(arena->block_bitmap, i) != 0) {
+			// White or black block
+			return false;
 		}
 	}
 	return true;
@@ -230,27 +433,25 @@ bool qcgc_arena_is_coalesced(arena_t *arena) {
 #if CHECKED
 	assert(arena != NULL);
 #endif
-	bool prev_was_free = false;
-	for (size_t cell = QCGC_ARENA_FIRST_CELL_INDEX;
-			cell < QCGC_ARENA_CELLS_COUNT;
-			cell++) {
-		switch (qcgc_arena_get_blocktype(arena, cell)) {
-			case BLOCK_WHITE: // Fall through
-			case BLOCK_BLACK:
-				prev_was_free = false;
-				break;
-
-			case BLOCK_FREE:
-				if (prev_was_free) {
-					return false;
-				} else {
-					prev_was_free = true;
-				}
-				break;
+	// Adding a one right after every free cell carries over the following
+	// extents and ends up at the next block start. It is not coalesced if
+	// that is a free block again.
+	uint64_t carry = 0;
+	for (size_t i = QCGC_ARENA_FIRST_CELL_INDEX / 64;
+			i < QCGC_ARENA_BITMAP_SIZE / 8;
+			i++) {
+		uint64_t block = load_word(arena->block_bitmap, i);
+		uint64_t mark = load_word(arena->mark_bitmap, i);
+		uint64_t free = ~block & mark;
+		uint64_t start = block | mark;
 
-			case BLOCK_EXTENT:
-				break;
+		uint64_t sum;
+		bool overflow = __builtin_add_overflow(~start, free << 1, &sum);
+		overflow |= __builtin_add_overflow(sum, carry, &sum);
+		if ((sum & free) != 0) {
+			return false;
 		}
+		carry = overflow | (free >> 63);
 	}
 	return true;
 }
@@ -260,19 +461,11 @@ size_t qcgc_arena_free_blocks(arena_t *arena) {
 	assert(arena != NULL);
 #endif
 	size_t result = 0;
-	for (size_t cell = QCGC_ARENA_FIRST_CELL_INDEX;
-			cell < QCGC_ARENA_CELLS_COUNT;
-			cell++) {
-		switch (qcgc_arena_get_blocktype(arena, cell)) {
-			case BLOCK_WHITE: // Fall through
-			case BLOCK_BLACK:
-			case BLOCK_EXTENT:
-				break;
-
-			case BLOCK_FREE:
-				result++;
-				break;
-		}
+	for (size_t i = QCGC_ARENA_FIRST_CELL_INDEX / 64;
+			i < QCGC_ARENA_BITMAP_SIZE / 8;
+			i++) {
+		result += __builtin_popcountll(~load_word(arena->block_bitmap, i) &
+				load_word(arena->mark_bitmap, i));
 	}
 	return result;
 }
@@ -282,19 +475,11 @@ size_t qcgc_arena_white_blocks(arena_t *arena) {
 	assert(arena != NULL);
 #endif
 	size_t result = 0;
-	for (size_t cell = QCGC_ARENA_FIRST_CELL_INDEX;
-			cell < QCGC_ARENA_CELLS_COUNT;
-			cell++) {
-		switch (qcgc_arena_get_blocktype(arena, cell)) {
-			case BLOCK_BLACK:	// Fall through
-			case BLOCK_EXTENT:
-			case BLOCK_FREE:
-				break;
-
-			case BLOCK_WHITE:
-				result++;
-				break;
-		}
+	for (size_t i = QCGC_ARENA_FIRST_CELL_INDEX / 64;
+			i < QCGC_ARENA_BITMAP_SIZE / 8;
+			i++) {
+		result += __builtin_popcountll(load_word(arena->block_bitmap, i) &
+				~load_word(arena->mark_bitmap, i));
 	}
 	return result;
 }
@@ -304,19 +489,11 @@ size_t qcgc_arena_black_blocks(arena_t *arena) {
 	assert(arena != NULL);
 #endif
 	size_t result = 0;
-	for (size_t cell = QCGC_ARENA_FIRST_CELL_INDEX;
-			cell < QCGC_ARENA_CELLS_COUNT;
-			cell++) {
-		switch (qcgc_arena_get_blocktype(arena, cell)) {
-			case BLOCK_WHITE: // Fall through
-			case BLOCK_FREE:
-			case BLOCK_EXTENT:
-				break;
-
-			case BLOCK_BLACK:
-				result++;
-				break;
-		}
+	for (size_t i = QCGC_ARENA_FIRST_CELL_INDEX / 64;
+			i < QCGC_ARENA_BITMAP_SIZE / 8;
+			i++) {
+		result += __builtin_popcountll(load_word(arena->block_bitmap, i) &
+				load_word(arena->mark_bitmap, i));
 	}
 	return result;
 }
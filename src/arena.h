@@ -9,6 +9,8 @@
 #include <stdbool.h>
 #include <sys/types.h>
 
+struct exp_free_list_s;
+
 /**
  * Create a new arena.
  *
@@ -23,6 +25,45 @@ arena_t *qcgc_arena_create(void);
  */
 void qcgc_arena_destroy(arena_t *arena);
 
+/**
+ * Return the whole pages inside the given area to the OS. The contents of the
+ * area are lost, the pages are committed again (zeroed) on the next access.
+ * Pages are recorded in the arena header, such that pages that were already
+ * returned are skipped until qcgc_arena_mark_committed hands them out again.
+ *
+ * @param	ptr		Pointer to first cell of area
+ * @param	cells	Size in cells
+ * @return	false iff the OS refused to take some pages back
+ */
+bool qcgc_arena_decommit(cell_t *ptr, size_t cells);
+
+/**
+ * Forget that the pages overlapping the given area were decommitted. Must be
+ * called before free cells are handed out for allocation.
+ *
+ * @param	ptr		Pointer to first cell of area
+ * @param	cells	Size in cells
+ */
+void qcgc_arena_mark_committed(cell_t *ptr, size_t cells);
+
+/**
+ * Return the cells of a free arena to the OS. Without huge pages the header
+ * stays committed. With huge pages the whole arena is dropped, as returning
+ * part of it would split a huge page, and qcgc_arena_recommit rebuilds the
+ * header. Arenas that share a huge page are not decommitted at all.
+ *
+ * @param	arena	Free arena
+ * @return	false iff the arena is still committed
+ */
+bool qcgc_arena_decommit_free(arena_t *arena);
+
+/**
+ * Prepare a free or decommitted arena for reuse as one free block.
+ *
+ * @param	arena	Arena taken from the free or decommitted arenas
+ */
+void qcgc_arena_recommit(arena_t *arena);
+
 /**
  * Mark ptr as allocated area with given size.
  * DEPRECATED
@@ -49,13 +90,33 @@ void qcgc_arena_mark_free(cell_t *ptr);
 bool qcgc_arena_sweep(arena_t *arena);
 
 /**
- * Sweep given arena, but only reset black to white, no white to free
+ * Sweep given arena like qcgc_arena_sweep, but append the free blocks to
+ * free_blocks instead of adding them to the fit allocator. Touches no global
+ * state, so it can run concurrently to the mutator.
+ *
+ * @param	arena		Arena
+ * @param	free_blocks	List the free blocks are appended to
+ * @return	Whether arena is empty after sweeping
+ */
+bool qcgc_arena_sweep_into(arena_t *arena,
+		struct exp_free_list_s **free_blocks);
+
+/**
+ * Sweep given arena, but only reset black to white, no white to free (black
+ * stays black in sticky mode)
  *
  * @param	arena	Arena
  * @return	Whether arena is empty after sweeping, always false
  */
 bool qcgc_arena_pseudo_sweep(arena_t *arena);
 
+/**
+ * Turn all black blocks white
+ *
+ * @param	arena	Arena
+ */
+void qcgc_arena_unmark(arena_t *arena);
+
 
 /*******************************************************************************
  * Inline functions
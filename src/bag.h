@@ -2,6 +2,7 @@
 
 #include "../qcgc.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 
 #include "arena.h"
@@ -34,6 +35,10 @@ QCGC_STATIC name##_t *name##_shrink(name##_t *self);						\
 																			\
 name##_t *qcgc_##name##_create(size_t size) {								\
 	name##_t *result = (name##_t *) malloc(name##_size(size));				\
+	if (result == NULL) {													\
+		fprintf(stderr, "Out of memory: Can not create " #name "\n");		\
+		abort();															\
+	}																		\
 	result->size = size;													\
 	result->count = 0;														\
 	return result;															\
@@ -62,7 +67,10 @@ name##_t *qcgc_##name##_remove_index(name##_t *self, size_t index) {		\
 QCGC_STATIC name##_t *name##_grow(name##_t *self) {								\
 	name##_t *new_self = (name##_t *) realloc(self,							\
 			name##_size(self->size * 2));									\
-	assert(new_self != NULL);												\
+	if (new_self == NULL) {													\
+		fprintf(stderr, "Out of memory: Can not grow " #name "\n");			\
+		abort();															\
+	}																		\
 	self = new_self;														\
 	self->size *= 2;														\
 	return self;															\
@@ -71,7 +79,10 @@ QCGC_STATIC name##_t *name##_grow(name##_t *self) {								\
 QCGC_STATIC name##_t *name##_shrink(name##_t *self) {							\
 	name##_t *new_self = (name##_t *) realloc(self,							\
 			name##_size(self->size / 2));									\
-	assert(new_self != NULL);												\
+	if (new_self == NULL) {													\
+		/* Keep the larger block */											\
+		return self;														\
+	}																		\
 	self = new_self;														\
 	self->size /= 2;														\
 	return self;															\
@@ -86,18 +97,18 @@ struct exp_free_list_item_s {
 	size_t size;
 };
 
-struct hbtable_entry_s {
-	object_t *object;
-	bool mark_flag;
-};
-
 struct weakref_bag_item_s {
 	object_t *weakrefobj;
 	object_t **target;
 };
 
+struct thread_bag_item_s {
+	struct qcgc_shadowstack *shadowstack;
+	struct qcgc_bump_allocator *bump_allocator;
+};
+
 DECLARE_BAG(arena_bag, arena_t *);
 DECLARE_BAG(linear_free_list, cell_t *);
 DECLARE_BAG(exp_free_list, struct exp_free_list_item_s);
-DECLARE_BAG(hbbucket, struct hbtable_entry_s);
 DECLARE_BAG(weakref_bag, struct weakref_bag_item_s);
+DECLARE_BAG(thread_bag, struct thread_bag_item_s);
@@ -0,0 +1,122 @@
+#include "cards.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gc_state.h"
+#include "generation.h"
+#include "hugeblocktable.h"
+#include "mediumspace.h"
+
+QCGC_STATIC void trace_cards(object_t *object, uint8_t *cards, size_t first,
+		size_t end, void (*visit)(object_t *object));
+
+bool qcgc_cards_mark(object_t *object, size_t offset) {
+	if (qcgc_trace_range_cb == NULL ||
+			qcgc_state.generational != QCGC_GENERATIONAL_OFF ||
+			qcgc_state.phase == GC_PAUSE) {
+		return false;
+	}
+	if ((object->flags & QCGC_GRAY_FLAG) != 0) {
+		// Another thread was faster, the object is traced completely
+		return true;
+	}
+
+	arena_t *arena = qcgc_arena_addr((cell_t *) object);
+	size_t card = offset >> QCGC_CARD_SIZE_EXP;
+	if ((object_t *) arena == object) {
+		struct hbtable_entry_s *entry = qcgc_hbtable_entry(object);
+		if (entry == NULL || entry->mark_flag != qcgc_hbtable.mark_flag_ref) {
+			return false;
+		}
+		if (card / 8 >= entry->card_bytes) {
+			size_t bytes = MAX(2 * entry->card_bytes, card / 8 + 1);
+			uint8_t *cards = (uint8_t *) realloc(entry->cards, bytes);
+			if (cards == NULL) {
+				return false;
+			}
+			memset(cards + entry->card_bytes, 0, bytes - entry->card_bytes);
+			entry->cards = cards;
+			entry->card_bytes = bytes;
+		}
+		entry->cards[card / 8] |= 1 << (card % 8);
+	} else if (qcgc_medium_is_segment(arena)) {
+		if (!qcgc_medium_is_marked(object)) {
+			return false;
+		}
+		medium_segment_t *segment = (medium_segment_t *) arena;
+		size_t index = (((uintptr_t) object - (uintptr_t) segment) >>
+				QCGC_CARD_SIZE_EXP) + card;
+#if CHECKED
+		assert(index < QCGC_MEDIUM_CARDS);
+#endif
+		segment->cards[index / 8] |= 1 << (index % 8);
+	} else {
+		return false;
+	}
+	// Relaxed is enough, the cards are only traced with all mutators stopped
+	uintptr_t address = (uintptr_t) object + (card << QCGC_CARD_SIZE_EXP);
+	__atomic_store_n(_qcgc_dirty_card_slot(address), address,
+			__ATOMIC_RELAXED);
+
+	if ((object->flags & QCGC_CARDS_FLAG) == 0) {
+		object->flags |= QCGC_CARDS_FLAG;
+		qcgc_state.gray_stack_size++;
+		qcgc_state.gp_gray_stack = qcgc_gray_stack_push(
+				qcgc_state.gp_gray_stack, object);
+	}
+	// Triggered barrier, we must not collect now
+	qcgc_state.phase = GC_MARK;
+	return true;
+}
+
+void qcgc_cards_trace(object_t *object, void (*visit)(object_t *object)) {
+	object->flags &= ~QCGC_CARDS_FLAG;
+	arena_t *arena = qcgc_arena_addr((cell_t *) object);
+	if ((object_t *) arena == object) {
+		struct hbtable_entry_s *entry = qcgc_hbtable_entry(object);
+		trace_cards(object, entry->cards, 0, 8 * entry->card_bytes, visit);
+	} else {
+		medium_segment_t *segment = (medium_segment_t *) arena;
+		size_t page = ((uintptr_t) object - (uintptr_t) segment) >>
+			QCGC_MEDIUM_PAGE_EXP;
+		size_t end_page = page + 1;
+		while (end_page < QCGC_MEDIUM_PAGES &&
+				segment->pages[end_page] == BLOCK_EXTENT) {
+			end_page++;
+		}
+		size_t shift = QCGC_MEDIUM_PAGE_EXP - QCGC_CARD_SIZE_EXP;
+		trace_cards(object, segment->cards, page << shift, end_page << shift,
+				visit);
+	}
+}
+
+/**
+ * Trace and clean the dirty cards in [first, end), card first starts at the
+ * object.
+ */
+QCGC_STATIC void trace_cards(object_t *object, uint8_t *cards, size_t first,
+		size_t end, void (*visit)(object_t *object)) {
+	size_t card = first;
+	while (card < end) {
+		if (cards[card / 8] == 0) {
+			// Skip clean bytes
+			card = (card / 8 + 1) * 8;
+			continue;
+		}
+		uint8_t mask = 1 << (card % 8);
+		if ((cards[card / 8] & mask) != 0) {
+			cards[card / 8] &= ~mask;
+			size_t start = (card - first) << QCGC_CARD_SIZE_EXP;
+			uintptr_t address = (uintptr_t) object + start;
+			uintptr_t *slot = _qcgc_dirty_card_slot(address);
+			if (__atomic_load_n(slot, __ATOMIC_RELAXED) == address) {
+				__atomic_store_n(slot, 0, __ATOMIC_RELAXED);
+			}
+			qcgc_trace_range_cb(object, start,
+					start + (1 << QCGC_CARD_SIZE_EXP), visit);
+		}
+		card++;
+	}
+}
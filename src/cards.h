@@ -0,0 +1,48 @@
+/**
+ * @file	cards.h
+ */
+
+#pragma once
+
+#include "../qcgc.h"
+
+#include <stdbool.h>
+
+/**
+ * Card marking (qcgc_write_index).
+ *
+ * Medium objects and huge blocks are divided into cards of
+ * 2^QCGC_CARD_SIZE_EXP bytes. A store into such an object that was traced
+ * already in the current cycle only dirties the card of the updated field,
+ * and the object is pushed once to the general purpose gray stack with the
+ * QCGC_CARDS_FLAG. Popping it traces the dirty cards through
+ * qcgc_trace_range_cb instead of the whole object.
+ *
+ * Medium segments keep the cards of all their pages in the segment header,
+ * huge blocks a bitmap in their hbtable entry that grows with the largest
+ * dirty card. Card marking is off in generational mode, as the remembered
+ * sets need the regular barrier.
+ *
+ * Dirty cards are also entered in the direct mapped _qcgc_dirty_cards. Further
+ * stores into a dirty card hit it in qcgc_write_index and take no lock, a
+ * card that lost its slot to another one only takes the slowpath again.
+ */
+
+/**
+ * Dirty the card of a field of a traced medium object or huge block.
+ *
+ * @param	object	Object that is updated
+ * @param	offset	Byte offset of the updated field
+ * @return	false iff card marking does not apply and the regular write
+ *			barrier has to be taken
+ */
+bool qcgc_cards_mark(object_t *object, size_t offset);
+
+/**
+ * Trace the dirty cards of an object that was pushed with the
+ * QCGC_CARDS_FLAG and clean them.
+ *
+ * @param	object	Medium object or huge block
+ * @param	visit	The function to be called on the referenced objects
+ */
+void qcgc_cards_trace(object_t *object, void (*visit)(object_t *object));
@@ -1,16 +1,93 @@
 #include "collector.h"
 
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
 #include "arena.h"
 #include "allocator.h"
+#include "cards.h"
 #include "gc_state.h"
 #include "event_logger.h"
+#include "generation.h"
 #include "hugeblocktable.h"
+#include "layout.h"
+#include "mediumspace.h"
+#include "safepoint.h"
+#include "sweeper.h"
 #include "weakref.h"
 
-QCGC_STATIC QCGC_INLINE void qcgc_pop_object(object_t *object);
+QCGC_STATIC QCGC_INLINE void qcgc_pop_object(object_t *object,
+		void (*visit)(object_t *object));
 QCGC_STATIC QCGC_INLINE void qcgc_push_object(object_t *object);
+QCGC_STATIC void qcgc_push_object_prefetch(object_t *object);
+QCGC_STATIC void mark_fifo_flush(void);
+QCGC_STATIC QCGC_INLINE void mark_loop(void (*visit)(object_t *object));
 QCGC_STATIC void mark_setup(bool incremental);
 QCGC_STATIC void mark_cleanup(bool incremental);
+QCGC_STATIC void recover_overflow(void);
+QCGC_STATIC QCGC_INLINE void push_arena_object(arena_t *arena,
+		object_t *object);
+QCGC_STATIC size_t drain_gray_stack(gray_stack_t **stack, size_t to_process);
+QCGC_STATIC void incmark_timed(uint64_t deadline);
+QCGC_STATIC bool drain_gray_stack_until(gray_stack_t **stack,
+		uint64_t deadline);
+QCGC_STATIC void log_pacer_progress(void);
+QCGC_STATIC void sweep_done(void);
+
+QCGC_STATIC void parallel_mark(void);
+QCGC_STATIC void *mark_helper(void *arg);
+QCGC_STATIC void mark_worker_drain(size_t self);
+QCGC_STATIC void mark_worker_push(object_t *object);
+QCGC_STATIC bool mark_worker_push_bounded(object_t *object);
+QCGC_STATIC void mark_worker_overflow(arena_t *arena);
+QCGC_STATIC void qcgc_push_object_parallel(object_t *object);
+QCGC_STATIC bool mark_worker_claim_arena(size_t self);
+QCGC_STATIC bool mark_worker_steal(size_t self);
+QCGC_STATIC bool mark_workers_have_work(void);
+
+/**
+ * Parallel marking: Every worker owns a gray stack, takes the gray stacks of
+ * whole arenas and steals half of the stack of another worker when it runs
+ * dry. Marking terminates when all workers are idle at the same time.
+ */
+struct mark_worker_s {
+	pthread_spinlock_t lock;
+	gray_stack_t *stack;
+	size_t count;					// Copy of the stack count for thieves
+	pthread_t thread;
+};
+
+static struct {
+	struct mark_worker_s *workers;	// mark_threads workers, 0 is the collector
+	pthread_mutex_t lock;
+	pthread_cond_t start_cond;
+	pthread_cond_t done_cond;
+	size_t generation;				// Incremented for every parallel mark
+	size_t done;					// Helpers done with current generation
+	bool shutdown;
+	size_t next_arena;				// Next arena gray stack to be taken
+	size_t idle;					// Workers without work
+	pthread_mutex_t hbtable_lock;
+} mark_pool;
+
+static __thread struct mark_worker_s *current_mark_worker;
+
+/**
+ * Prefetching mark (QCGC_MARK_PREFETCH): Children found while tracing enter a
+ * FIFO instead of being pushed right away. Their header and bitmap bytes are
+ * prefetched on entry and they are pushed mark_prefetch children later, when
+ * the loads are likely done, so the misses of several children overlap.
+ */
+#define QCGC_MARK_FIFO_SIZE 64
+
+static struct {
+	object_t *items[QCGC_MARK_FIFO_SIZE];
+	size_t head;					// Oldest entry
+	size_t count;
+} mark_fifo;
 
 QCGC_STATIC void check_free_cells(void);
 QCGC_STATIC void check_largest_free_block(void);
@@ -18,75 +95,171 @@ QCGC_STATIC void check_largest_free_block(void);
 void qcgc_mark(void) {
 	mark_setup(false);
 
-	while (qcgc_state.gray_stack_size > 0) {
+	if (qcgc_state.mark_threads > 1) {
+		parallel_mark();
+	}
+
+	// Separate instances, such that the push function can be inlined
+	if (qcgc_state.mark_prefetch > 0) {
+		mark_loop(&qcgc_push_object_prefetch);
+	} else {
+		mark_loop(&qcgc_push_object);
+	}
+
+	mark_cleanup(false);
+
+#if CHECKED
+	assert(qcgc_state.phase == GC_COLLECT);
+#endif
+}
+
+/**
+ * Drain all gray stacks.
+ *
+ * @param	visit	The function to be called on the referenced objects
+ */
+QCGC_STATIC QCGC_INLINE void mark_loop(void (*visit)(object_t *object)) {
+	while (qcgc_state.gray_stack_size > 0 || qcgc_state.gray_overflow) {
 		// General purpose gray stack (prebuilt objects and huge blocks)
 
-		while (qcgc_state.gp_gray_stack->count > 0) {
-			object_t *top = qcgc_object_stack_top(qcgc_state.gp_gray_stack);
+		while (qcgc_state.gp_gray_stack != NULL) {
+			object_t *top = qcgc_gray_stack_top(qcgc_state.gp_gray_stack);
 			qcgc_state.gray_stack_size--;
-			qcgc_state.gp_gray_stack = qcgc_object_stack_pop(
+			qcgc_state.gp_gray_stack = qcgc_gray_stack_pop(
 					qcgc_state.gp_gray_stack);
-			qcgc_pop_object(top);
+			qcgc_pop_object(top, visit);
 		}
 
 		// Arena gray stacks
 		for (size_t i = 0; i < qcgc_allocator_state.arenas->count; i++) {
 			arena_t *arena = qcgc_allocator_state.arenas->items[i];
 
-			while (arena->gray_stack->count > 0) {
-				object_t *top = qcgc_object_stack_top(arena->gray_stack);
+			while (arena->gray_stack != NULL) {
+				object_t *top = qcgc_gray_stack_top(arena->gray_stack);
 				qcgc_state.gray_stack_size--;
-				arena->gray_stack = qcgc_object_stack_pop(arena->gray_stack);
-				qcgc_pop_object(top);
+				arena->gray_stack = qcgc_gray_stack_pop(arena->gray_stack);
+				qcgc_pop_object(top, visit);
 			}
 		}
-	}
 
-	mark_cleanup(false);
+		// Pending children may gray further objects
+		mark_fifo_flush();
 
-#if CHECKED
-	assert(qcgc_state.phase == GC_COLLECT);
-#endif
+		if (qcgc_state.gray_stack_size == 0) {
+			recover_overflow();
+		}
+	}
 }
 
 void qcgc_incmark(void) {
+	if (qcgc_state.incmark_budget_ns != 0) {
+		qcgc_incmark_until(qcgc_monotonic_ns() + qcgc_state.incmark_budget_ns);
+		return;
+	}
+
 	mark_setup(true);
 
-	// General purpose gray stack (prebuilt objects and huge blocks)
-	size_t to_process = MAX(qcgc_state.gp_gray_stack->count / 2,
-			QCGC_INC_MARK_MIN);
+	// With the pacer, every step marks its share of the objects the last full
+	// collection marked. Otherwise it marks half of every gray stack.
+	bool paced = qcgc_state.gc_percent != 0;
+	size_t budget = MAX(qcgc_state.mark_work /
+			MAX(qcgc_state.incmark_to_sweep, 1), QCGC_INC_MARK_MIN);
 
-	while (to_process > 0 && qcgc_state.gp_gray_stack->count > 0) {
-		object_t *top = qcgc_object_stack_top(qcgc_state.gp_gray_stack);
-		qcgc_state.gray_stack_size--;
-		qcgc_state.gp_gray_stack = qcgc_object_stack_pop(
-				qcgc_state.gp_gray_stack);
-		qcgc_pop_object(top);
-		to_process--;
+	// General purpose gray stack (prebuilt objects and huge blocks)
+	size_t to_process = paced ? budget :
+		MAX(qcgc_gray_stack_count(qcgc_state.gp_gray_stack) / 2,
+				QCGC_INC_MARK_MIN);
+	size_t processed = drain_gray_stack(&qcgc_state.gp_gray_stack, to_process);
+	if (paced) {
+		budget -= processed;
 	}
 
 	// Arena gray stacks
 	for (size_t i = 0; i < qcgc_allocator_state.arenas->count; i++) {
 		arena_t *arena = qcgc_allocator_state.arenas->items[i];
-		to_process = MAX(arena->gray_stack->count / 2, QCGC_INC_MARK_MIN);
-
-		while (to_process > 0 && arena->gray_stack->count > 0) {
-			object_t *top = qcgc_object_stack_top(arena->gray_stack);
-			qcgc_state.gray_stack_size--;
-			arena->gray_stack = qcgc_object_stack_pop(arena->gray_stack);
-			qcgc_pop_object(top);
-			to_process--;
+		to_process = paced ? budget :
+			MAX(qcgc_gray_stack_count(arena->gray_stack) / 2,
+					QCGC_INC_MARK_MIN);
+		processed = drain_gray_stack(&arena->gray_stack, to_process);
+		if (paced) {
+			budget -= processed;
 		}
 	}
 
+	mark_cleanup(true);
+#if CHECKED
+	assert(qcgc_state.phase != GC_PAUSE);
+#endif
+}
 
+QCGC_STATIC size_t drain_gray_stack(gray_stack_t **stack, size_t to_process) {
+	size_t processed = 0;
+	while (processed < to_process && *stack != NULL) {
+		object_t *top = qcgc_gray_stack_top(*stack);
+		qcgc_state.gray_stack_size--;
+		*stack = qcgc_gray_stack_pop(*stack);
+		qcgc_pop_object(top, &qcgc_push_object);
+		processed++;
+	}
+	return processed;
+}
+
+void qcgc_incmark_until(uint64_t deadline) {
+	mark_setup(true);
+	incmark_timed(deadline);
 	mark_cleanup(true);
 #if CHECKED
 	assert(qcgc_state.phase != GC_PAUSE);
 #endif
 }
 
+/**
+ * Drain the gray stacks until they are empty or the deadline passed. The
+ * arena the time ran out in is the first one of the next step, such that all
+ * arenas make progress.
+ */
+QCGC_STATIC void incmark_timed(uint64_t deadline) {
+	// General purpose gray stack (prebuilt objects and huge blocks)
+	if (drain_gray_stack_until(&qcgc_state.gp_gray_stack, deadline)) {
+		return;
+	}
+
+	// Arena gray stacks
+	size_t count = qcgc_allocator_state.arenas->count;
+	for (size_t n = 0; n < count; n++) {
+		size_t i = (qcgc_state.incmark_cursor + n) % count;
+		arena_t *arena = qcgc_allocator_state.arenas->items[i];
+		if (drain_gray_stack_until(&arena->gray_stack, deadline)) {
+			qcgc_state.incmark_cursor = i;
+			return;
+		}
+	}
+}
+
+/**
+ * @return	true iff the deadline passed
+ */
+QCGC_STATIC bool drain_gray_stack_until(gray_stack_t **stack,
+		uint64_t deadline) {
+	while (*stack != NULL) {
+		drain_gray_stack(stack, QCGC_INCMARK_CLOCK_INTERVAL);
+		if (qcgc_monotonic_ns() >= deadline) {
+			return true;
+		}
+	}
+	return false;
+}
+
+uint64_t qcgc_monotonic_ns(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
 QCGC_STATIC void mark_setup(bool incremental) {
+	// Marks of arenas that were not swept yet are still needed
+	qcgc_lazy_sweep_finish();
+
 	{
 		struct log_info_s {
 			bool incremental;
@@ -96,6 +269,7 @@ QCGC_STATIC void mark_setup(bool incremental) {
 		qcgc_event_logger_log(EVENT_MARK_START, sizeof(struct log_info_s),
 				(uint8_t *) &log_info);
 	}
+	log_pacer_progress();
 
 	qcgc_state.cells_since_incmark = 0;
 
@@ -104,10 +278,15 @@ QCGC_STATIC void mark_setup(bool incremental) {
 		// If we do this for the first time, push all prebuilt objects.
 		// All further changes to prebuilt objects will go to the gp_gray_stack
 		// because of the write barrier
+		if (qcgc_state.generational == QCGC_GENERATIONAL_STICKY) {
+			// Old objects are black until now
+			qcgc_generation_unmark();
+		}
+
 		size_t count = qcgc_state.prebuilt_objects->count;
 		for (size_t i = 0; i < count; i++) {
 			qcgc_state.gray_stack_size++;
-			qcgc_state.gp_gray_stack = qcgc_object_stack_push(
+			qcgc_state.gp_gray_stack = qcgc_gray_stack_push(
 					qcgc_state.gp_gray_stack,
 					qcgc_state.prebuilt_objects->items[i]);
 		}
@@ -116,17 +295,28 @@ QCGC_STATIC void mark_setup(bool incremental) {
 	qcgc_state.phase = GC_MARK;
 
 	// Always push all roots to make shadowstack pushes faster
-	for (object_t **it = _qcgc_shadowstack.base;
-		it < _qcgc_shadowstack.top;
-		it++) {
-		qcgc_push_object(*it);
+	size_t threads = qcgc_safepoint_state.threads->count;
+	for (size_t i = 0; i < threads; i++) {
+		struct qcgc_shadowstack *shadowstack =
+			qcgc_safepoint_state.threads->items[i].shadowstack;
+		for (object_t **it = shadowstack->base;
+			it < shadowstack->top;
+			it++) {
+			qcgc_push_object(*it);
+		}
 	}
 
 }
 
 QCGC_STATIC void mark_cleanup(bool incremental) {
+	if (qcgc_state.gray_stack_size == 0) {
+		// Objects of overflowed arenas are drained by the next step
+		recover_overflow();
+	}
 	if (qcgc_state.gray_stack_size == 0) {
 		qcgc_state.phase = GC_COLLECT;
+		// Segments of the peak are not needed until the next cycle
+		qcgc_gray_pool_trim();
 	}
 
 	{
@@ -140,19 +330,32 @@ QCGC_STATIC void mark_cleanup(bool incremental) {
 	}
 }
 
-QCGC_STATIC QCGC_INLINE void qcgc_pop_object(object_t *object) {
+QCGC_STATIC QCGC_INLINE void qcgc_pop_object(object_t *object,
+		void (*visit)(object_t *object)) {
+	if ((object->flags & QCGC_CARDS_FLAG) != 0) {
+		// Traced before, only the dirty cards changed since
+		qcgc_cards_trace(object, visit);
+		return;
+	}
 #if CHECKED
 	assert(object != NULL);
 	assert((object->flags & QCGC_PREBUILT_OBJECT) == QCGC_PREBUILT_OBJECT ||
 			(object->flags & QCGC_GRAY_FLAG) == QCGC_GRAY_FLAG);
 	if (((object->flags & QCGC_PREBUILT_OBJECT) == 0) &&
 		((object_t *) qcgc_arena_addr((cell_t *) object) != object)) {
-		assert(qcgc_arena_get_blocktype(qcgc_arena_addr((cell_t *) object),
-					qcgc_arena_cell_index((cell_t *) object)) == BLOCK_BLACK);
+		if (qcgc_medium_is_segment(qcgc_arena_addr((cell_t *) object))) {
+			assert(qcgc_medium_is_marked(object));
+		} else {
+			assert(qcgc_arena_get_blocktype(
+						qcgc_arena_addr((cell_t *) object),
+						qcgc_arena_cell_index((cell_t *) object))
+					== BLOCK_BLACK);
+		}
 	}
 #endif
 	object->flags &= ~QCGC_GRAY_FLAG;
-	qcgc_trace_cb(object, &qcgc_push_object);
+	qcgc_state.marked_objects++;
+	qcgc_trace_object(object, visit);
 }
 
 QCGC_STATIC void qcgc_push_object(object_t *object) {
@@ -166,7 +369,7 @@ QCGC_STATIC void qcgc_push_object(object_t *object) {
 				// Did mark it / was white before
 				object->flags |= QCGC_GRAY_FLAG;
 				qcgc_state.gray_stack_size++;
-				qcgc_state.gp_gray_stack = qcgc_object_stack_push(
+				qcgc_state.gp_gray_stack = qcgc_gray_stack_push(
 						qcgc_state.gp_gray_stack, object);
 			}
 			return;
@@ -174,14 +377,126 @@ QCGC_STATIC void qcgc_push_object(object_t *object) {
 		if ((object->flags & QCGC_PREBUILT_OBJECT) != 0) {
 			return;
 		}
+		if (qcgc_medium_is_segment(arena)) {
+			if (qcgc_medium_mark(object)) {
+				object->flags |= QCGC_GRAY_FLAG;
+				qcgc_state.gray_stack_size++;
+				qcgc_state.gp_gray_stack = qcgc_gray_stack_push(
+						qcgc_state.gp_gray_stack, object);
+			}
+			return;
+		}
 		size_t index = qcgc_arena_cell_index((cell_t *) object);
 		if (qcgc_arena_get_blocktype(arena, index) == BLOCK_WHITE) {
 			object->flags |= QCGC_GRAY_FLAG;
 			qcgc_arena_set_blocktype(arena, index, BLOCK_BLACK);
-			qcgc_state.gray_stack_size++;
-			arena->gray_stack = qcgc_object_stack_push(arena->gray_stack, object);
+			push_arena_object(arena, object);
+		}
+	}
+}
+
+void qcgc_push_arena_object(arena_t *arena, object_t *object) {
+	push_arena_object(arena, object);
+}
+
+/**
+ * Inlined into the mark loop, see qcgc_push_arena_object
+ */
+QCGC_STATIC QCGC_INLINE void push_arena_object(arena_t *arena,
+		object_t *object) {
+	if (LIKELY(qcgc_gray_stack_push_bounded(&arena->gray_stack, object))) {
+		qcgc_state.gray_stack_size++;
+	} else {
+		arena->overflowed = true;
+		qcgc_state.gray_overflow = true;
+	}
+}
+
+/**
+ * Push the objects that did not fit on the gray stacks, i.e. the black
+ * objects of overflowed arenas that are still gray flagged. Must only be
+ * called with all gray stacks empty, such that no object is pushed twice.
+ * Stops when the gray stacks are full again, the arena stays overflowed then.
+ */
+QCGC_STATIC void recover_overflow(void) {
+	if (!qcgc_state.gray_overflow) {
+		return;
+	}
+#if CHECKED
+	assert(qcgc_state.gray_stack_size == 0);
+#endif
+	qcgc_state.gray_overflow = false;
+	size_t recovered = 0;
+	for (size_t i = 0; i < qcgc_allocator_state.arenas->count; i++) {
+		arena_t *arena = qcgc_allocator_state.arenas->items[i];
+		if (!arena->overflowed) {
+			continue;
+		}
+		arena->overflowed = false;
+		for (size_t j = QCGC_ARENA_FIRST_CELL_INDEX / 64;
+				j < QCGC_ARENA_BITMAP_SIZE / 8;
+				j++) {
+			uint64_t block_word, mark_word;
+			memcpy(&block_word, arena->block_bitmap + j * 8, sizeof(uint64_t));
+			memcpy(&mark_word, arena->mark_bitmap + j * 8, sizeof(uint64_t));
+			uint64_t black = block_word & mark_word;
+			while (black != 0) {
+				object_t *object = (object_t *)
+					&arena->cells[j * 64 + __builtin_ctzll(black)];
+				black &= black - 1;
+				if ((object->flags & QCGC_GRAY_FLAG) == 0) {
+					continue;
+				}
+				push_arena_object(arena, object);
+				if (arena->overflowed) {
+					// Full again, the rest waits for the next round
+					goto done;
+				}
+				recovered++;
+			}
 		}
 	}
+done:
+	{
+		struct log_info_s {
+			size_t recovered;
+			bool overflow;
+		};
+		struct log_info_s log_info = {recovered, qcgc_state.gray_overflow};
+		qcgc_event_logger_log(EVENT_MARK_OVERFLOW, sizeof(struct log_info_s),
+				(uint8_t *) &log_info);
+	}
+}
+
+QCGC_STATIC void qcgc_push_object_prefetch(object_t *object) {
+	if (object == NULL) {
+		return;
+	}
+	// Prefetches never fault, the bitmap addresses of huge blocks, medium and
+	// prebuilt objects are just useless
+	arena_t *arena = qcgc_arena_addr((cell_t *) object);
+	size_t index = qcgc_arena_cell_index((cell_t *) object);
+	__builtin_prefetch(object, 1);
+	__builtin_prefetch(&arena->block_bitmap[index / 8], 0);
+	__builtin_prefetch(&arena->mark_bitmap[index / 8], 1);
+
+	if (mark_fifo.count == MIN(qcgc_state.mark_prefetch, QCGC_MARK_FIFO_SIZE)) {
+		qcgc_push_object(mark_fifo.items[mark_fifo.head]);
+		mark_fifo.head = (mark_fifo.head + 1) % QCGC_MARK_FIFO_SIZE;
+		mark_fifo.count--;
+	}
+	mark_fifo.items[(mark_fifo.head + mark_fifo.count) % QCGC_MARK_FIFO_SIZE] =
+		object;
+	mark_fifo.count++;
+}
+
+QCGC_STATIC void mark_fifo_flush(void) {
+	while (mark_fifo.count > 0) {
+		object_t *object = mark_fifo.items[mark_fifo.head];
+		mark_fifo.head = (mark_fifo.head + 1) % QCGC_MARK_FIFO_SIZE;
+		mark_fifo.count--;
+		qcgc_push_object(object);
+	}
 }
 
 void qcgc_sweep(void) {
@@ -202,12 +517,41 @@ void qcgc_sweep(void) {
 				(uint8_t *) &log_info);
 	}
 
+	// Weakrefs are updated according to the marks, before anything is swept
+	update_weakrefs();
+	if (qcgc_state.generational) {
+		qcgc_generation_sweep();
+	}
 	qcgc_hbtable_sweep();
+	qcgc_medium_sweep();
 	size_t i = 0;
 	qcgc_state.free_cells = 0;
 	qcgc_state.largest_free_block = 0;
 
 	qcgc_fit_allocator_empty_lists();
+	if (qcgc_state.lazy_sweep || qcgc_state.background_sweep) {
+		// Only the arena that contains the bump pointer is swept right away,
+		// the sweeper thread or the allocator (when it needs memory) sweep
+		// the remaining arenas
+		for (i = 0; i < qcgc_allocator_state.arenas->count; i++) {
+			arena_t *arena = qcgc_allocator_state.arenas->items[i];
+			if (qcgc_arena_addr(_qcgc_bump_allocator.ptr) == arena) {
+				qcgc_arena_pseudo_sweep(arena);
+			} else if (qcgc_state.background_sweep) {
+				qcgc_sweeper_add_arena(arena);
+			} else {
+				qcgc_allocator_state.unswept_arenas = qcgc_arena_bag_add(
+						qcgc_allocator_state.unswept_arenas, arena);
+			}
+		}
+		qcgc_state.phase = GC_PAUSE;
+		if (qcgc_state.background_sweep ? !qcgc_sweeper_state.sweeping :
+				qcgc_allocator_state.unswept_arenas->count == 0) {
+			sweep_done();
+		}
+		return;
+	}
+
 	while (i < qcgc_allocator_state.arenas->count) {
 		arena_t *arena = qcgc_allocator_state.arenas->items[i];
 		// The arena that contains the bump pointer is autmatically skipped
@@ -217,6 +561,7 @@ void qcgc_sweep(void) {
 					qcgc_allocator_state.arenas, i);
 			qcgc_allocator_state.free_arenas = qcgc_arena_bag_add(
 					qcgc_allocator_state.free_arenas, arena);
+			qcgc_generation_forget(arena);
 			// NO i++
 		} else {
 			// Not free
@@ -224,15 +569,81 @@ void qcgc_sweep(void) {
 		}
 	}
 	qcgc_state.phase = GC_PAUSE;
+	sweep_done();
+}
+
+bool qcgc_lazy_sweep_step(void) {
+	if (qcgc_state.background_sweep) {
+		if (!qcgc_sweeper_state.sweeping) {
+			return false;
+		}
+		if (qcgc_sweeper_step()) {
+			return true;
+		}
+		// Last results were just published
+		qcgc_sweeper_state.sweeping = false;
+		sweep_done();
+		return false;
+	}
+
+	size_t count = qcgc_allocator_state.unswept_arenas->count;
+	if (count == 0) {
+		return false;
+	}
+	arena_t *arena = qcgc_allocator_state.unswept_arenas->items[count - 1];
+	qcgc_allocator_state.unswept_arenas = qcgc_arena_bag_remove_index(
+			qcgc_allocator_state.unswept_arenas, count - 1);
+
+	if (qcgc_arena_sweep(arena)) {
+		// Free
+		qcgc_allocator_free_arena(arena);
+	}
+
+	if (qcgc_allocator_state.unswept_arenas->count == 0) {
+		sweep_done();
+	}
+	return true;
+}
+
+void qcgc_lazy_sweep_finish(void) {
+	while (qcgc_lazy_sweep_step()) {
+		// Sweep next arena
+	}
+}
+
+bool qcgc_collector_has_work(void) {
+	if (qcgc_state.phase != GC_PAUSE) {
+		return true;
+	}
+	if (qcgc_state.background_sweep) {
+		return qcgc_sweeper_state.sweeping;
+	}
+	return qcgc_allocator_state.unswept_arenas->count > 0;
+}
+
+QCGC_STATIC void sweep_done(void) {
+	qcgc_allocator_decommit_free_arenas();
+
+	// Everything that is not free is live, including the blocks of the bump
+	// allocators and memory allocated while sweeping lazily. Huge blocks are
+	// not counted.
+	qcgc_state.live_cells = qcgc_allocator_state.arenas->count *
+		(QCGC_ARENA_CELLS_COUNT - QCGC_ARENA_FIRST_CELL_INDEX) -
+		qcgc_state.free_cells + qcgc_medium_used_cells();
+	qcgc_state.mark_work = qcgc_state.marked_objects;
+	qcgc_state.marked_objects = 0;
+	qcgc_pacer_update();
 
 	// Determine whether fragmentation is too high
 	// Fragmenation = 1 - (largest block / total free space)
 	// Use bump allocator when fragmentation < 50%
 #if CHECKED
 	check_free_cells();
-	check_largest_free_block();
+	if (!qcgc_state.lazy_sweep && !qcgc_state.background_sweep) {
+		// Allocations during a deferred sweep invalidate the largest block
+		check_largest_free_block();
+	}
 #endif
-	update_weakrefs();
 
 	{
 		struct log_info_s {
@@ -263,14 +674,389 @@ void qcgc_sweep(void) {
 					sizeof(struct log_info_s), (uint8_t *) &log_info);
 		}
 		for (size_t i = 0; i < QCGC_LARGE_FREE_LISTS; i++) {
-			log_info = (struct log_info_s){
-				1<<(QCGC_LARGE_FREE_LIST_FIRST_EXP + i),
-				qcgc_allocator_state.fit_state.large_free_list[i]->count};
-			qcgc_event_logger_log(EVENT_FREELIST_DUMP,
-					sizeof(struct log_info_s), (uint8_t *) &log_info);
+			for (size_t j = 0; j < QCGC_LARGE_FREE_LIST_SPLIT; j++) {
+				log_info = (struct log_info_s){
+					(QCGC_LARGE_FREE_LIST_SPLIT + j) <<
+						(QCGC_LARGE_FREE_LIST_FIRST_EXP + i -
+						 QCGC_LARGE_FREE_LIST_SPLIT_EXP),
+					qcgc_allocator_state.fit_state.large_free_list[i][j]
+						->count};
+				qcgc_event_logger_log(EVENT_FREELIST_DUMP,
+						sizeof(struct log_info_s), (uint8_t *) &log_info);
+			}
+		}
+	}
+#endif
+}
+
+void qcgc_pacer_update(void) {
+	if (qcgc_state.gc_percent == 0) {
+		return;
+	}
+	size_t budget = MAX(qcgc_state.live_cells * qcgc_state.gc_percent / 100,
+			QCGC_PACER_MIN_CELLS);
+	qcgc_state.heap_goal = qcgc_state.live_cells + budget;
+	// The incremental steps and the final collection are spread evenly, the
+	// last one is due right at the goal
+	qcgc_state.incmark_threshold = budget / (qcgc_state.incmark_to_sweep + 1);
+
+	struct log_info_s {
+		size_t live_cells;
+		size_t heap_goal;
+		size_t incmark_threshold;
+	};
+	struct log_info_s log_info = {
+		qcgc_state.live_cells,
+		qcgc_state.heap_goal,
+		qcgc_state.incmark_threshold,
+	};
+	qcgc_event_logger_log(EVENT_PACER_GOAL, sizeof(struct log_info_s),
+			(uint8_t *) &log_info);
+}
+
+QCGC_STATIC void log_pacer_progress(void) {
+	if (qcgc_state.gc_percent == 0) {
+		return;
+	}
+	struct log_info_s {
+		size_t heap;			// Live and allocated cells
+		size_t heap_goal;
+		size_t marked_objects;
+		size_t mark_work;
+	};
+	struct log_info_s log_info = {
+		qcgc_state.live_cells + qcgc_state.incmark_since_sweep *
+			qcgc_state.incmark_threshold + qcgc_state.cells_since_incmark,
+		qcgc_state.heap_goal,
+		qcgc_state.marked_objects,
+		qcgc_state.mark_work,
+	};
+	qcgc_event_logger_log(EVENT_PACER_PROGRESS, sizeof(struct log_info_s),
+			(uint8_t *) &log_info);
+}
+
+void qcgc_mark_pool_initialize(void) {
+	mark_pool.workers = NULL;
+	if (qcgc_state.mark_threads <= 1) {
+		return;
+	}
+	mark_pool.workers = (struct mark_worker_s *) malloc(
+			qcgc_state.mark_threads * sizeof(struct mark_worker_s));
+	if (mark_pool.workers == NULL) {
+		// Mark on the mutator thread only
+		qcgc_state.mark_threads = 1;
+		return;
+	}
+	pthread_mutex_init(&mark_pool.lock, NULL);
+	pthread_cond_init(&mark_pool.start_cond, NULL);
+	pthread_cond_init(&mark_pool.done_cond, NULL);
+	pthread_mutex_init(&mark_pool.hbtable_lock, NULL);
+	mark_pool.generation = 0;
+	mark_pool.done = 0;
+	mark_pool.shutdown = false;
+
+	for (size_t i = 0; i < qcgc_state.mark_threads; i++) {
+		pthread_spin_init(&mark_pool.workers[i].lock,
+				PTHREAD_PROCESS_PRIVATE);
+		mark_pool.workers[i].stack = NULL;
+		mark_pool.workers[i].count = 0;
+	}
+	for (size_t i = 1; i < qcgc_state.mark_threads; i++) {
+		if (pthread_create(&mark_pool.workers[i].thread, NULL, &mark_helper,
+					(void *) i) != 0) {
+			// Continue with the helpers we have
+			qcgc_state.mark_threads = i;
+			break;
+		}
+	}
+}
+
+void qcgc_mark_pool_destroy(void) {
+	if (mark_pool.workers == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&mark_pool.lock);
+	mark_pool.shutdown = true;
+	pthread_cond_broadcast(&mark_pool.start_cond);
+	pthread_mutex_unlock(&mark_pool.lock);
+
+	for (size_t i = 0; i < qcgc_state.mark_threads; i++) {
+		if (i > 0) {
+			pthread_join(mark_pool.workers[i].thread, NULL);
+		}
+		pthread_spin_destroy(&mark_pool.workers[i].lock);
+		qcgc_gray_stack_free(mark_pool.workers[i].stack);
+	}
+	free(mark_pool.workers);
+	mark_pool.workers = NULL;
+	pthread_mutex_destroy(&mark_pool.hbtable_lock);
+	pthread_cond_destroy(&mark_pool.done_cond);
+	pthread_cond_destroy(&mark_pool.start_cond);
+	pthread_mutex_destroy(&mark_pool.lock);
+}
+
+QCGC_STATIC void parallel_mark(void) {
+	// Prebuilt objects and huge blocks go to the collecting worker
+	struct mark_worker_s *self = &mark_pool.workers[0];
+#if CHECKED
+	assert(self->stack == NULL);
+#endif
+	self->stack = qcgc_state.gp_gray_stack;
+	qcgc_state.gp_gray_stack = NULL;
+	self->count = qcgc_gray_stack_count(self->stack);
+	mark_pool.next_arena = 0;
+	mark_pool.idle = 0;
+
+	pthread_mutex_lock(&mark_pool.lock);
+	mark_pool.done = 0;
+	mark_pool.generation++;
+	pthread_cond_broadcast(&mark_pool.start_cond);
+	pthread_mutex_unlock(&mark_pool.lock);
+
+	mark_worker_drain(0);
+
+	pthread_mutex_lock(&mark_pool.lock);
+	while (mark_pool.done + 1 < qcgc_state.mark_threads) {
+		pthread_cond_wait(&mark_pool.done_cond, &mark_pool.lock);
+	}
+	pthread_mutex_unlock(&mark_pool.lock);
+
+	// All gray stacks were drained
+	qcgc_state.gray_stack_size = 0;
+}
+
+QCGC_STATIC void *mark_helper(void *arg) {
+	size_t self = (size_t) arg;
+	size_t generation = 0;
+
+	pthread_mutex_lock(&mark_pool.lock);
+	while (true) {
+		while (!mark_pool.shutdown && mark_pool.generation == generation) {
+			pthread_cond_wait(&mark_pool.start_cond, &mark_pool.lock);
+		}
+		if (mark_pool.shutdown) {
+			break;
+		}
+		generation = mark_pool.generation;
+		pthread_mutex_unlock(&mark_pool.lock);
+
+		mark_worker_drain(self);
+
+		pthread_mutex_lock(&mark_pool.lock);
+		mark_pool.done++;
+		pthread_cond_signal(&mark_pool.done_cond);
+	}
+	pthread_mutex_unlock(&mark_pool.lock);
+	return NULL;
+}
+
+QCGC_STATIC void mark_worker_drain(size_t self) {
+	struct mark_worker_s *worker = &mark_pool.workers[self];
+	current_mark_worker = worker;
+	size_t marked_objects = 0;
+
+	while (true) {
+		object_t *top = NULL;
+		pthread_spin_lock(&worker->lock);
+		if (worker->stack != NULL) {
+			top = qcgc_gray_stack_top(worker->stack);
+			worker->stack = qcgc_gray_stack_pop(worker->stack);
+			__atomic_store_n(&worker->count,
+					qcgc_gray_stack_count(worker->stack), __ATOMIC_RELAXED);
+		}
+		pthread_spin_unlock(&worker->lock);
+
+		if (top != NULL && (top->flags & QCGC_CARDS_FLAG) != 0) {
+			qcgc_cards_trace(top, &qcgc_push_object_parallel);
+			continue;
+		}
+		if (top != NULL) {
+#if CHECKED
+			assert((top->flags & QCGC_PREBUILT_OBJECT) == QCGC_PREBUILT_OBJECT ||
+					(top->flags & QCGC_GRAY_FLAG) == QCGC_GRAY_FLAG);
+#endif
+			top->flags &= ~QCGC_GRAY_FLAG;
+			marked_objects++;
+			qcgc_trace_object(top, &qcgc_push_object_parallel);
+			continue;
+		}
+
+		if (mark_worker_claim_arena(self) || mark_worker_steal(self)) {
+			continue;
+		}
+
+		// Idle: Nobody can produce work once all workers are idle
+		__atomic_add_fetch(&mark_pool.idle, 1, __ATOMIC_SEQ_CST);
+		while (true) {
+			if (__atomic_load_n(&mark_pool.idle, __ATOMIC_SEQ_CST) ==
+					qcgc_state.mark_threads) {
+				__atomic_add_fetch(&qcgc_state.marked_objects, marked_objects,
+						__ATOMIC_RELAXED);
+				current_mark_worker = NULL;
+				return;
+			}
+			if (mark_workers_have_work()) {
+				__atomic_sub_fetch(&mark_pool.idle, 1, __ATOMIC_SEQ_CST);
+				break;
+			}
+			sched_yield();
 		}
 	}
+}
+
+QCGC_STATIC bool mark_worker_claim_arena(size_t self) {
+	struct mark_worker_s *worker = &mark_pool.workers[self];
+	size_t count = qcgc_allocator_state.arenas->count;
+	while (true) {
+		size_t i = __atomic_fetch_add(&mark_pool.next_arena, 1,
+				__ATOMIC_RELAXED);
+		if (i >= count) {
+			return false;
+		}
+		arena_t *arena = qcgc_allocator_state.arenas->items[i];
+		if (arena->gray_stack == NULL) {
+			continue;
+		}
+		// Only idle workers claim arenas, so the segments are handed over
+		// as they are
+		pthread_spin_lock(&worker->lock);
+#if CHECKED
+		assert(worker->stack == NULL);
 #endif
+		worker->stack = arena->gray_stack;
+		__atomic_store_n(&worker->count, qcgc_gray_stack_count(worker->stack),
+				__ATOMIC_RELAXED);
+		pthread_spin_unlock(&worker->lock);
+		arena->gray_stack = NULL;
+		return true;
+	}
+}
+
+QCGC_STATIC bool mark_worker_steal(size_t self) {
+	struct mark_worker_s *worker = &mark_pool.workers[self];
+	for (size_t k = 1; k < qcgc_state.mark_threads; k++) {
+		struct mark_worker_s *victim =
+			&mark_pool.workers[(self + k) % qcgc_state.mark_threads];
+		if (__atomic_load_n(&victim->count, __ATOMIC_RELAXED) == 0) {
+			continue;
+		}
+
+		object_t *stolen[QCGC_MARK_LIST_SEGMENT_SIZE];
+		size_t n = 0;
+		pthread_spin_lock(&victim->lock);
+		n = MIN((qcgc_gray_stack_count(victim->stack) + 1) / 2,
+				QCGC_MARK_LIST_SEGMENT_SIZE);
+		for (size_t i = 0; i < n; i++) {
+			stolen[i] = qcgc_gray_stack_top(victim->stack);
+			victim->stack = qcgc_gray_stack_pop(victim->stack);
+		}
+		__atomic_store_n(&victim->count, qcgc_gray_stack_count(victim->stack),
+				__ATOMIC_RELAXED);
+		pthread_spin_unlock(&victim->lock);
+
+		if (n > 0) {
+			pthread_spin_lock(&worker->lock);
+			for (size_t i = 0; i < n; i++) {
+				arena_t *arena = qcgc_arena_addr((cell_t *) stolen[i]);
+				if ((object_t *) arena == stolen[i] ||
+						(stolen[i]->flags & QCGC_PREBUILT_OBJECT) != 0 ||
+						qcgc_medium_is_segment(arena)) {
+					worker->stack = qcgc_gray_stack_push(worker->stack,
+							stolen[i]);
+				} else if (!qcgc_gray_stack_push_bounded(&worker->stack,
+							stolen[i])) {
+					// Still gray flagged, recovered like an arena object
+					// that was never pushed
+					mark_worker_overflow(arena);
+				}
+			}
+			__atomic_store_n(&worker->count,
+					qcgc_gray_stack_count(worker->stack), __ATOMIC_RELAXED);
+			pthread_spin_unlock(&worker->lock);
+			return true;
+		}
+	}
+	return false;
+}
+
+QCGC_STATIC bool mark_workers_have_work(void) {
+	for (size_t i = 0; i < qcgc_state.mark_threads; i++) {
+		if (__atomic_load_n(&mark_pool.workers[i].count,
+					__ATOMIC_RELAXED) > 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+QCGC_STATIC void mark_worker_push(object_t *object) {
+	struct mark_worker_s *worker = current_mark_worker;
+	pthread_spin_lock(&worker->lock);
+	worker->stack = qcgc_gray_stack_push(worker->stack, object);
+	__atomic_store_n(&worker->count, qcgc_gray_stack_count(worker->stack),
+			__ATOMIC_RELAXED);
+	pthread_spin_unlock(&worker->lock);
+}
+
+/**
+ * @return	false iff the gray stacks are full, see qcgc_push_arena_object
+ */
+QCGC_STATIC bool mark_worker_push_bounded(object_t *object) {
+	struct mark_worker_s *worker = current_mark_worker;
+	pthread_spin_lock(&worker->lock);
+	bool pushed = qcgc_gray_stack_push_bounded(&worker->stack, object);
+	__atomic_store_n(&worker->count, qcgc_gray_stack_count(worker->stack),
+			__ATOMIC_RELAXED);
+	pthread_spin_unlock(&worker->lock);
+	return pushed;
+}
+
+QCGC_STATIC void qcgc_push_object_parallel(object_t *object) {
+	if (object != NULL) {
+		arena_t *arena = qcgc_arena_addr((cell_t *) object);
+		if ((object_t *) arena == object) {
+			pthread_mutex_lock(&mark_pool.hbtable_lock);
+			bool marked = qcgc_hbtable_mark(object);
+			pthread_mutex_unlock(&mark_pool.hbtable_lock);
+			if (marked) {
+				// Did mark it / was white before
+				object->flags |= QCGC_GRAY_FLAG;
+				mark_worker_push(object);
+			}
+			return;
+		}
+		if ((object->flags & QCGC_PREBUILT_OBJECT) != 0) {
+			return;
+		}
+		if (qcgc_medium_is_segment(arena)) {
+			if (qcgc_medium_mark(object)) {
+				object->flags |= QCGC_GRAY_FLAG;
+				mark_worker_push(object);
+			}
+			return;
+		}
+		// Claim the cell: Setting the mark bit of a white block makes it
+		// black, only the thread that set it pushes the object
+		size_t index = qcgc_arena_cell_index((cell_t *) object);
+		uint8_t mask = 0x1 << (index % 8);
+		uint8_t old = __atomic_fetch_or(&arena->mark_bitmap[index / 8], mask,
+				__ATOMIC_RELAXED);
+		if ((old & mask) == 0) {
+			object->flags |= QCGC_GRAY_FLAG;
+			if (!mark_worker_push_bounded(object)) {
+				mark_worker_overflow(arena);
+			}
+		}
+	}
+}
+
+/**
+ * Flag arena as overflowed, its gray flagged black objects are recovered by
+ * the serial mark loop afterwards
+ */
+QCGC_STATIC void mark_worker_overflow(arena_t *arena) {
+	__atomic_store_n(&arena->overflowed, true, __ATOMIC_RELAXED);
+	__atomic_store_n(&qcgc_state.gray_overflow, true, __ATOMIC_RELAXED);
 }
 
 void check_free_cells(void) {
@@ -278,13 +1064,22 @@ void check_free_cells(void) {
 		for (size_t i = 0; i < QCGC_SMALL_FREE_LISTS; i++) {
 			free_cells += qcgc_allocator_state.fit_state.small_free_list[i]
 				->count * (i + 1);
+			assert((qcgc_allocator_state.fit_state.small_free_list[i]->count
+						> 0) ==
+					((qcgc_allocator_state.fit_state.small_map >> i) & 1));
 		}
 		for (size_t i = 0; i < QCGC_LARGE_FREE_LISTS; i++) {
-			for (size_t j = 0; j < qcgc_allocator_state.fit_state.
-					large_free_list[i]->count; j++) {
-				free_cells += qcgc_allocator_state.fit_state.large_free_list[i]
-					->items[j].size;
+			for (size_t j = 0; j < QCGC_LARGE_FREE_LIST_SPLIT; j++) {
+				exp_free_list_t *free_list =
+					qcgc_allocator_state.fit_state.large_free_list[i][j];
+				for (size_t k = 0; k < free_list->count; k++) {
+					free_cells += free_list->items[k].size;
+				}
+				assert((free_list->count > 0) == ((qcgc_allocator_state.
+								fit_state.large_split_map[i] >> j) & 1));
 			}
+			assert((qcgc_allocator_state.fit_state.large_split_map[i] != 0) ==
+					((qcgc_allocator_state.fit_state.large_map >> i) & 1));
 		}
 	assert(free_cells == qcgc_state.free_cells);
 	assert(free_cells <= qcgc_allocator_state.arenas->count * (QCGC_ARENA_CELLS_COUNT - QCGC_ARENA_FIRST_CELL_INDEX));
@@ -301,11 +1096,13 @@ void check_largest_free_block(void) {
 			}
 		}
 		for (size_t i = 0; i < QCGC_LARGE_FREE_LISTS; i++) {
-			for (size_t j = 0; j < qcgc_allocator_state.fit_state.
-					large_free_list[i]->count; j++) {
-				largest_free_block = MAX(largest_free_block,
-					qcgc_allocator_state.fit_state.large_free_list[i]
-					->items[j].size);
+			for (size_t j = 0; j < QCGC_LARGE_FREE_LIST_SPLIT; j++) {
+				exp_free_list_t *free_list =
+					qcgc_allocator_state.fit_state.large_free_list[i][j];
+				for (size_t k = 0; k < free_list->count; k++) {
+					largest_free_block = MAX(largest_free_block,
+						free_list->items[k].size);
+				}
 			}
 		}
 	assert(largest_free_block == qcgc_state.largest_free_block);
@@ -3,7 +3,59 @@
 #include "../qcgc.h"
 
 #include <stdbool.h>
+#include <stdint.h>
 
+void qcgc_mark_pool_initialize(void);
+void qcgc_mark_pool_destroy(void);
 void qcgc_incmark(void);
+
+/**
+ * Incremental mark step that drains the gray stacks until the deadline.
+ *
+ * @param	deadline	Point in time (see qcgc_monotonic_ns) to stop at
+ */
+void qcgc_incmark_until(uint64_t deadline);
 void qcgc_mark(void);
 void qcgc_sweep(void);
+
+/**
+ * Push a black object to the gray stack of its arena. If the gray stacks are
+ * full (QCGC_GRAY_STACK_LIMIT), the object stays gray flagged and the arena
+ * overflows instead, marking finds the object again by scanning the arena
+ * once all gray stacks are empty.
+ *
+ * @param	arena	Arena of the object
+ * @param	object	Black object with gray flag
+ */
+void qcgc_push_arena_object(arena_t *arena, object_t *object);
+
+/**
+ * Set the heap goal of the next full collection from the live cells and
+ * spread the incremental steps over the allocation budget (see
+ * QCGC_GC_PERCENT). Does nothing if the pacer is off.
+ */
+void qcgc_pacer_update(void);
+
+/**
+ * Sweep one arena left over by a lazy sweep.
+ *
+ * @return	false iff there was no arena left to sweep
+ */
+bool qcgc_lazy_sweep_step(void);
+
+/**
+ * Sweep all arenas left over by a lazy sweep.
+ */
+void qcgc_lazy_sweep_finish(void);
+
+/**
+ * @return	true iff a collection is in progress or arenas are left to sweep
+ */
+bool qcgc_collector_has_work(void);
+
+/**
+ * Monotonic clock used for the time budgets of the collector.
+ *
+ * @return	Current time in nanoseconds
+ */
+uint64_t qcgc_monotonic_ns(void);
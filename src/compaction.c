@@ -0,0 +1,282 @@
+#include "compaction.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "allocator.h"
+#include "arena.h"
+#include "bag.h"
+#include "gc_state.h"
+#include "hugeblocktable.h"
+#include "layout.h"
+#include "mediumspace.h"
+#include "safepoint.h"
+
+QCGC_STATIC size_t next_block(arena_t *arena, size_t index);
+QCGC_STATIC arena_t *take_arena(void);
+QCGC_STATIC bool evacuate(arena_t *arena, cell_t **cursor, cell_t **end);
+QCGC_STATIC void forward_slot(object_t **slot);
+QCGC_STATIC void update_references(void);
+QCGC_STATIC void update_weakref_slots(void);
+
+void qcgc_compact(void) {
+	qcgc_compaction_state.evacuated_arenas = 0;
+	qcgc_compaction_state.evacuated_objects = 0;
+	qcgc_compaction_state.evacuated_cells = 0;
+	if (qcgc_trace_slots_cb == NULL ||
+			qcgc_state.generational != QCGC_GENERATIONAL_OFF) {
+		return;
+	}
+#if CHECKED
+	assert(qcgc_state.phase == GC_COLLECT);
+#endif
+
+	// Select the sparse arenas before any fresh arena is added
+	size_t usable_cells = QCGC_ARENA_CELLS_COUNT - QCGC_ARENA_FIRST_CELL_INDEX;
+	arena_bag_t *candidates = qcgc_arena_bag_create(4); // XXX
+	for (size_t i = 0; i < qcgc_allocator_state.arenas->count; i++) {
+		arena_t *arena = qcgc_allocator_state.arenas->items[i];
+		if (_qcgc_bump_allocator.ptr != NULL &&
+				qcgc_arena_addr(_qcgc_bump_allocator.ptr) == arena) {
+			continue;
+		}
+		bool pinned;
+		size_t live_cells = qcgc_compaction_live_cells(arena, &pinned);
+		if (!pinned && live_cells > 0 && live_cells * 100 <
+				qcgc_state.compaction_density * usable_cells) {
+			candidates = qcgc_arena_bag_add(candidates, arena);
+		}
+	}
+
+	if (candidates->count > 0) {
+		cell_t *cursor = NULL;
+		cell_t *end = NULL;
+		for (size_t i = 0; i < candidates->count; i++) {
+			if (!evacuate(candidates->items[i], &cursor, &end)) {
+				break;
+			}
+			qcgc_compaction_state.evacuated_arenas++;
+		}
+		if (cursor != NULL && cursor < end) {
+			// Rest of the last fresh arena is one free block
+			qcgc_arena_set_blocktype(qcgc_arena_addr(cursor),
+					qcgc_arena_cell_index(cursor), BLOCK_FREE);
+		}
+		update_references();
+	}
+	free(candidates);
+
+	struct log_info_s {
+		size_t arenas;
+		size_t objects;
+		size_t cells;
+	};
+	struct log_info_s log_info = {
+		qcgc_compaction_state.evacuated_arenas,
+		qcgc_compaction_state.evacuated_objects,
+		qcgc_compaction_state.evacuated_cells,
+	};
+	qcgc_event_logger_log(EVENT_COMPACTION, sizeof(struct log_info_s),
+			(uint8_t *) &log_info);
+}
+
+size_t qcgc_compaction_live_cells(arena_t *arena, bool *pinned) {
+	size_t result = 0;
+	*pinned = false;
+	size_t index = next_block(arena, QCGC_ARENA_FIRST_CELL_INDEX);
+	while (index < QCGC_ARENA_CELLS_COUNT) {
+		size_t next = next_block(arena, index + 1);
+		if (qcgc_arena_get_blocktype(arena, index) == BLOCK_BLACK) {
+			result += next - index;
+			if ((((object_t *) &arena->cells[index])->flags &
+						QCGC_PINNED_FLAG) != 0) {
+				*pinned = true;
+			}
+		}
+		index = next;
+	}
+	return result;
+}
+
+/**
+ * Copy all black objects of the arena to the fresh block [cursor, end), the
+ * next fresh arena is taken when it is full.
+ *
+ * @return	false iff no fresh arena was available, the arena is unchanged then
+ */
+QCGC_STATIC bool evacuate(arena_t *arena, cell_t **cursor, cell_t **end) {
+	bool pinned;
+	size_t live_cells = qcgc_compaction_live_cells(arena, &pinned);
+	if (*cursor == NULL || (size_t) (*end - *cursor) < live_cells) {
+		// Objects of an arena are never split across two fresh arenas, that
+		// keeps this all or nothing
+		if (*cursor != NULL && *cursor < *end) {
+			qcgc_arena_set_blocktype(qcgc_arena_addr(*cursor),
+					qcgc_arena_cell_index(*cursor), BLOCK_FREE);
+		}
+		arena_t *fresh = take_arena();
+		if (fresh == NULL) {
+			*cursor = NULL;
+			return false;
+		}
+		*cursor = &fresh->cells[QCGC_ARENA_FIRST_CELL_INDEX];
+		*end = &fresh->cells[QCGC_ARENA_CELLS_COUNT];
+	}
+
+	size_t index = next_block(arena, QCGC_ARENA_FIRST_CELL_INDEX);
+	while (index < QCGC_ARENA_CELLS_COUNT) {
+		size_t next = next_block(arena, index + 1);
+		if (qcgc_arena_get_blocktype(arena, index) == BLOCK_BLACK) {
+			size_t cells = next - index;
+			object_t *object = (object_t *) &arena->cells[index];
+			object_t *copy = (object_t *) *cursor;
+			// The cells of a fresh arena are one free block, only the start
+			// of every copy needs a blocktype
+			memcpy(copy, object, cells * sizeof(cell_t));
+			qcgc_arena_set_blocktype(qcgc_arena_addr(*cursor),
+					qcgc_arena_cell_index(*cursor), BLOCK_BLACK);
+			*cursor += cells;
+
+			object->flags |= QCGC_FORWARDED_FLAG;
+			((object_t **) object)[1] = copy;
+			qcgc_arena_set_blocktype(arena, index, BLOCK_WHITE);
+			qcgc_compaction_state.evacuated_objects++;
+			qcgc_compaction_state.evacuated_cells += cells;
+		}
+		index = next;
+	}
+	return true;
+}
+
+/**
+ * Take a free arena or create a new one, the arena is one free block.
+ */
+QCGC_STATIC arena_t *take_arena(void) {
+	arena_t *arena;
+	size_t count = qcgc_allocator_state.free_arenas->count;
+	if (count > 0) {
+		arena = qcgc_allocator_state.free_arenas->items[count - 1];
+		qcgc_allocator_state.free_arenas = qcgc_arena_bag_remove_index(
+				qcgc_allocator_state.free_arenas, count - 1);
+	} else if (qcgc_allocator_state.decommitted_arenas->count > 0) {
+		count = qcgc_allocator_state.decommitted_arenas->count;
+		arena = qcgc_allocator_state.decommitted_arenas->items[count - 1];
+		qcgc_allocator_state.decommitted_arenas = qcgc_arena_bag_remove_index(
+				qcgc_allocator_state.decommitted_arenas, count - 1);
+	} else {
+		arena = qcgc_arena_create();
+		if (arena == NULL) {
+			return NULL;
+		}
+	}
+	qcgc_arena_recommit(arena);
+	qcgc_allocator_state.arenas =
+		qcgc_arena_bag_add(qcgc_allocator_state.arenas, arena);
+	return arena;
+}
+
+/**
+ * Index of the next block start (any blocktype but extent) at or after index.
+ */
+QCGC_STATIC size_t next_block(arena_t *arena, size_t index) {
+	while (index < QCGC_ARENA_CELLS_COUNT) {
+		uint64_t block_word, mark_word;
+		memcpy(&block_word, arena->block_bitmap + index / 64 * 8,
+				sizeof(uint64_t));
+		memcpy(&mark_word, arena->mark_bitmap + index / 64 * 8,
+				sizeof(uint64_t));
+		uint64_t word = (block_word | mark_word) & (~(uint64_t) 0 << (index % 64));
+		if (word != 0) {
+			return index / 64 * 64 + __builtin_ctzll(word);
+		}
+		index = (index / 64 + 1) * 64;
+	}
+	return QCGC_ARENA_CELLS_COUNT;
+}
+
+QCGC_STATIC void forward_slot(object_t **slot) {
+	// All referenced objects are alive, so their flags can be read
+	if (*slot != NULL && ((*slot)->flags & QCGC_FORWARDED_FLAG) != 0) {
+		*slot = ((object_t **) *slot)[1];
+	}
+}
+
+/**
+ * Update every reference of a surviving object and of the roots. The
+ * originals are white by now, so only copies and objects that did not move
+ * are traced.
+ */
+QCGC_STATIC void update_references(void) {
+	// Arena objects
+	for (size_t i = 0; i < qcgc_allocator_state.arenas->count; i++) {
+		arena_t *arena = qcgc_allocator_state.arenas->items[i];
+		size_t index = next_block(arena, QCGC_ARENA_FIRST_CELL_INDEX);
+		while (index < QCGC_ARENA_CELLS_COUNT) {
+			if (qcgc_arena_get_blocktype(arena, index) == BLOCK_BLACK) {
+				qcgc_trace_object_slots((object_t *) &arena->cells[index],
+						&forward_slot);
+			}
+			index = next_block(arena, index + 1);
+		}
+	}
+
+	// Huge blocks
+	for (size_t i = 0; i < qcgc_hbtable.size; i++) {
+		object_t *object = qcgc_hbtable.entries[i].object;
+		if (object != NULL && qcgc_hbtable_is_marked(object)) {
+			qcgc_trace_object_slots(object, &forward_slot);
+		}
+	}
+
+	// Medium objects
+	for (size_t i = 0; i < qcgc_medium_state.segments->count; i++) {
+		medium_segment_t *segment =
+			(medium_segment_t *) qcgc_medium_state.segments->items[i];
+		for (size_t page = QCGC_MEDIUM_FIRST_PAGE; page < QCGC_MEDIUM_PAGES;
+				page++) {
+			if (segment->pages[page] == BLOCK_BLACK) {
+				qcgc_trace_object_slots((object_t *) ((uintptr_t) segment +
+							page * QCGC_MEDIUM_PAGE_SIZE), &forward_slot);
+			}
+		}
+	}
+
+	// Prebuilt objects, only registered ones can reference the heap
+	for (size_t i = 0; i < qcgc_state.prebuilt_objects->count; i++) {
+		qcgc_trace_object_slots(qcgc_state.prebuilt_objects->items[i],
+				&forward_slot);
+	}
+
+	// Shadow stacks
+	for (size_t i = 0; i < qcgc_safepoint_state.threads->count; i++) {
+		struct qcgc_shadowstack *shadowstack =
+			qcgc_safepoint_state.threads->items[i].shadowstack;
+		for (object_t **it = shadowstack->base; it < shadowstack->top; it++) {
+			forward_slot(it);
+		}
+	}
+
+	update_weakref_slots();
+}
+
+QCGC_STATIC void update_weakref_slots(void) {
+	for (size_t i = 0; i < qcgc_state.weakrefs->count; i++) {
+		struct weakref_bag_item_s *item = &qcgc_state.weakrefs->items[i];
+		object_t *weakrefobj = item->weakrefobj;
+		if ((weakrefobj->flags & QCGC_FORWARDED_FLAG) != 0) {
+			// The target slot usually lies in the weakref itself
+			object_t *copy = ((object_t **) weakrefobj)[1];
+			arena_t *arena = qcgc_arena_addr((cell_t *) weakrefobj);
+			size_t index = qcgc_arena_cell_index((cell_t *) weakrefobj);
+			cell_t *block_end = &arena->cells[next_block(arena, index + 1)];
+			if ((cell_t *) item->target >= (cell_t *) weakrefobj &&
+					(cell_t *) item->target < block_end) {
+				item->target = (object_t **) ((uintptr_t) copy +
+						((uintptr_t) item->target - (uintptr_t) weakrefobj));
+			}
+			item->weakrefobj = copy;
+		}
+		forward_slot(item->target);
+	}
+}
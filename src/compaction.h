@@ -0,0 +1,51 @@
+/**
+ * @file	compaction.h
+ */
+
+#pragma once
+
+#include "../qcgc.h"
+
+#include <stdbool.h>
+
+/**
+ * Compaction (QCGC_COMPACTION).
+ *
+ * After the mark phase of a full collection, arenas whose live cells are below
+ * QCGC_COMPACTION_DENSITY percent are evacuated: Their black objects are
+ * copied into fresh arenas and the originals turn white, such that the
+ * following sweep moves the source arenas to the free arenas.
+ *
+ * Every original keeps a forwarding pointer in its second word (every object
+ * is at least one cell large) and gets the QCGC_FORWARDED_FLAG. References
+ * are updated through the layouts (qcgc_register_layout) or
+ * qcgc_trace_slots_cb on all black objects, huge blocks, medium objects and
+ * registered prebuilt objects, as well as on the shadow stacks and the
+ * weakrefs. Compaction is skipped if the embedder does not
+ * provide qcgc_trace_slots_cb.
+ *
+ * Arenas that contain a pinned object (qcgc_pin) or the block of the bump
+ * allocator are never evacuated. Objects outside of arenas never move.
+ * Compaction only runs while the generational mode is off, as the remembered
+ * sets hold object addresses.
+ */
+struct qcgc_compaction_state {
+	size_t evacuated_arenas;		// Statistics of the last compaction
+	size_t evacuated_objects;
+	size_t evacuated_cells;
+} qcgc_compaction_state;
+
+/**
+ * Evacuate sparse arenas and update all references, must be called with the
+ * world stopped between qcgc_mark and qcgc_sweep.
+ */
+void qcgc_compact(void);
+
+/**
+ * Live cells of the black objects in an arena.
+ *
+ * @param	arena	Marked arena
+ * @param	pinned	Set to true iff the arena contains a pinned black object
+ * @return	Cells of all black objects of the arena
+ */
+size_t qcgc_compaction_live_cells(arena_t *arena, bool *pinned);
@@ -25,6 +25,15 @@ enum event_e {
 	EVENT_FREELIST_DUMP,
 
 	EVENT_ALLOCATOR_SWITCH,
+
+	EVENT_PACER_GOAL,			// = 10
+	EVENT_PACER_PROGRESS,
+
+	EVENT_ALLOCATOR_DECISION,
+
+	EVENT_COMPACTION,
+
+	EVENT_MARK_OVERFLOW,
 };
 
 /**
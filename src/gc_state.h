@@ -5,6 +5,7 @@
 #include <stddef.h>
 
 #include "bag.h"
+#include "gray_stack.h"
 #include "object_stack.h"
 
 /**
@@ -28,14 +29,40 @@ typedef enum gc_phase {
 struct qcgc_state {
 	object_stack_t *prebuilt_objects;
 	weakref_bag_t *weakrefs;
-	object_stack_t *gp_gray_stack;
+	gray_stack_t *gp_gray_stack;
 	size_t gray_stack_size;
+	bool gray_overflow;			// Some arenas overflowed, see
+								// qcgc_push_arena_object
 	gc_phase_t phase;
 
 	size_t cells_since_incmark;
 	size_t incmark_since_sweep;
 	size_t incmark_threshold;
 	size_t incmark_to_sweep;
+	size_t gc_percent;			// Pacer, see QCGC_GC_PERCENT
+	size_t live_cells;			// Cells alive after the last full collection
+	size_t heap_goal;			// Live and allocated cells at which the next
+								// full collection is due
+	size_t mark_work;			// Objects marked by the last full collection
+	size_t marked_objects;		// Objects marked by the current one
+	size_t incmark_budget_ns;	// See QCGC_INCMARK_BUDGET_NS
+	size_t incmark_cursor;		// Arena the next timed incremental mark step
+								// starts with
+	size_t growth_policy;		// See QCGC_GROWTH_POLICY
+	size_t growth_fragmentation;	// See QCGC_GROWTH_FRAGMENTATION
+	size_t mark_threads;		// Threads draining the gray stacks in a full
+								// mark, including the collecting thread
+	size_t mark_prefetch;		// See QCGC_MARK_PREFETCH
+	size_t lazy_sweep;			// Sweep arenas on demand in the allocator
+	size_t background_sweep;	// Sweep arenas in a separate thread
+	size_t free_arenas_retain;	// Free arenas kept committed after a sweep
+	size_t heap_reserve;		// Bytes of address space reserved for arenas
+	size_t huge_pages;			// Huge page mode, see QCGC_HUGE_PAGES
+	size_t generational;		// Generational mode, see QCGC_GENERATIONAL
+	size_t nursery_arenas;		// Young arenas before a minor collection
+	size_t major_threshold;		// Promoted cells before a full collection
+	size_t compaction;			// Evacuate sparse arenas, see QCGC_COMPACTION
+	size_t compaction_density;	// See QCGC_COMPACTION_DENSITY
 
 	size_t free_cells;			// Overall amount of free cells without huge
 								// blocks and free areans. Valid right after sweep
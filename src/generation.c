@@ -0,0 +1,274 @@
+#include "generation.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "allocator.h"
+#include "arena.h"
+#include "collector.h"
+#include "gc_state.h"
+#include "hugeblocktable.h"
+#include "layout.h"
+#include "safepoint.h"
+#include "weakref.h"
+
+QCGC_STATIC void push_young(object_t *object);
+QCGC_STATIC void mark_young(void);
+QCGC_STATIC void sweep_young(void);
+QCGC_STATIC void sweep_regions(void);
+QCGC_STATIC void sweep_region(cell_t *ptr, size_t cells);
+QCGC_STATIC size_t next_object(arena_t *arena, size_t index, size_t end);
+QCGC_STATIC void add_region_free_block(arena_t *arena, size_t index, size_t cells);
+QCGC_STATIC bool survives_full_sweep(object_t *object);
+
+void qcgc_generation_initialize(void) {
+	qcgc_generation_state.young_arenas = qcgc_arena_bag_create(4); // XXX
+	qcgc_generation_state.remembered_set = qcgc_object_stack_create(16); // XXX
+	qcgc_generation_state.regions = qcgc_exp_free_list_create(16); // XXX
+	qcgc_generation_state.allocated_cells = 0;
+	qcgc_generation_state.promoted_cells = 0;
+}
+
+void qcgc_generation_destroy(void) {
+	free(qcgc_generation_state.young_arenas);
+	free(qcgc_generation_state.remembered_set);
+	free(qcgc_generation_state.regions);
+}
+
+void qcgc_generation_add_young(arena_t *arena) {
+	if (arena->young == 0) {
+		arena->young = 1;
+		qcgc_generation_state.young_arenas = qcgc_arena_bag_add(
+				qcgc_generation_state.young_arenas, arena);
+	}
+}
+
+void qcgc_generation_forget(arena_t *arena) {
+	if (arena->young == 0) {
+		return;
+	}
+	arena->young = 0;
+	for (size_t i = 0; i < qcgc_generation_state.young_arenas->count; i++) {
+		if (qcgc_generation_state.young_arenas->items[i] == arena) {
+			qcgc_generation_state.young_arenas = qcgc_arena_bag_remove_index(
+					qcgc_generation_state.young_arenas, i);
+			break;
+		}
+	}
+}
+
+void qcgc_generation_record(cell_t *ptr, size_t cells) {
+#if CHECKED
+	assert(qcgc_state.generational == QCGC_GENERATIONAL_STICKY);
+	assert(cells > 0);
+#endif
+	qcgc_generation_state.regions = qcgc_exp_free_list_add(
+			qcgc_generation_state.regions,
+			(struct exp_free_list_item_s) {ptr, cells});
+	qcgc_generation_state.allocated_cells += cells;
+}
+
+void qcgc_generation_remember(object_t *object) {
+#if CHECKED
+	assert(!qcgc_generation_is_young(object));
+#endif
+	qcgc_generation_state.remembered_set = qcgc_object_stack_push(
+			qcgc_generation_state.remembered_set, object);
+}
+
+void qcgc_generation_minor_collect(void) {
+#if CHECKED
+	assert(qcgc_state.phase == GC_PAUSE);
+	assert(qcgc_state.gray_stack_size == 0);
+	assert(_qcgc_bump_allocator.ptr == NULL);
+#endif
+	// Marks of young arenas that were not swept yet are still needed
+	qcgc_lazy_sweep_finish();
+	qcgc_state.phase = GC_MARK;
+
+	size_t threads = qcgc_safepoint_state.threads->count;
+	for (size_t i = 0; i < threads; i++) {
+		struct qcgc_shadowstack *shadowstack =
+			qcgc_safepoint_state.threads->items[i].shadowstack;
+		for (object_t **it = shadowstack->base;
+			it < shadowstack->top;
+			it++) {
+			push_young(*it);
+		}
+	}
+
+	// Old objects are not marked, only their references into the nursery.
+	// Clearing the gray flag re-arms the write barrier.
+	object_stack_t *remembered_set = qcgc_generation_state.remembered_set;
+	for (size_t i = 0; i < remembered_set->count; i++) {
+		object_t *object = remembered_set->items[i];
+		object->flags &= ~QCGC_GRAY_FLAG;
+		qcgc_trace_object(object, &push_young);
+	}
+	remembered_set->count = 0;
+
+	mark_young();
+	update_young_weakrefs();
+	if (qcgc_state.generational == QCGC_GENERATIONAL_STICKY) {
+		sweep_regions();
+	} else {
+		sweep_young();
+	}
+	qcgc_state.phase = GC_PAUSE;
+	qcgc_allocator_decommit_free_arenas();
+}
+
+void qcgc_generation_unmark(void) {
+	for (size_t i = 0; i < qcgc_allocator_state.arenas->count; i++) {
+		qcgc_arena_unmark(qcgc_allocator_state.arenas->items[i]);
+	}
+}
+
+void qcgc_generation_sweep(void) {
+	qcgc_generation_state.promoted_cells = 0;
+	if (qcgc_state.generational == QCGC_GENERATIONAL_STICKY) {
+		// All survivors are black afterwards, the regions may be coalesced
+		// with their neighbours
+		qcgc_generation_state.remembered_set->count = 0;
+		qcgc_generation_state.regions->count = 0;
+		qcgc_generation_state.allocated_cells = 0;
+		return;
+	}
+
+	object_stack_t *remembered_set = qcgc_generation_state.remembered_set;
+	size_t count = 0;
+	for (size_t i = 0; i < remembered_set->count; i++) {
+		object_t *object = remembered_set->items[i];
+		if (survives_full_sweep(object)) {
+			remembered_set->items[count] = object;
+			count++;
+		}
+	}
+	remembered_set->count = count;
+}
+
+QCGC_STATIC void push_young(object_t *object) {
+#if CHECKED
+	assert(qcgc_state.phase == GC_MARK);
+#endif
+	if (object != NULL && qcgc_generation_is_young(object)) {
+		arena_t *arena = qcgc_arena_addr((cell_t *) object);
+		size_t index = qcgc_arena_cell_index((cell_t *) object);
+		if (qcgc_arena_get_blocktype(arena, index) == BLOCK_WHITE) {
+			object->flags |= QCGC_GRAY_FLAG;
+			qcgc_arena_set_blocktype(arena, index, BLOCK_BLACK);
+			qcgc_state.gray_stack_size++;
+			qcgc_state.gp_gray_stack = qcgc_gray_stack_push(
+					qcgc_state.gp_gray_stack, object);
+		}
+	}
+}
+
+QCGC_STATIC void mark_young(void) {
+	// Young objects are scattered over the heap in sticky mode, so they all
+	// go to the general purpose gray stack
+	while (qcgc_state.gp_gray_stack != NULL) {
+		object_t *top = qcgc_gray_stack_top(qcgc_state.gp_gray_stack);
+		qcgc_state.gray_stack_size--;
+		qcgc_state.gp_gray_stack = qcgc_gray_stack_pop(
+				qcgc_state.gp_gray_stack);
+		top->flags &= ~QCGC_GRAY_FLAG;
+		qcgc_trace_object(top, &push_young);
+	}
+}
+
+QCGC_STATIC void sweep_young(void) {
+	for (size_t i = 0; i < qcgc_generation_state.young_arenas->count; i++) {
+		arena_t *arena = qcgc_generation_state.young_arenas->items[i];
+		arena->young = 0;
+		if (qcgc_arena_sweep(arena)) {
+			qcgc_allocator_free_arena(arena);
+		} else {
+			// Promote, its free blocks are not reused until it is empty
+			qcgc_generation_state.promoted_cells +=
+				QCGC_ARENA_CELLS_COUNT - QCGC_ARENA_FIRST_CELL_INDEX;
+		}
+	}
+	qcgc_generation_state.young_arenas->count = 0;
+
+	// The free lists are not used in nursery mode, they hold blocks
+	// of old arenas and the remainders of the bump allocators
+	qcgc_fit_allocator_empty_lists();
+	qcgc_state.free_cells = 0;
+	qcgc_state.largest_free_block = 0;
+}
+
+QCGC_STATIC void sweep_regions(void) {
+	exp_free_list_t *regions = qcgc_generation_state.regions;
+	for (size_t i = 0; i < regions->count; i++) {
+		sweep_region(regions->items[i].ptr, regions->items[i].size);
+	}
+	regions->count = 0;
+	qcgc_generation_state.allocated_cells = 0;
+}
+
+QCGC_STATIC void sweep_region(cell_t *ptr, size_t cells) {
+	arena_t *arena = qcgc_arena_addr(ptr);
+	size_t end = qcgc_arena_cell_index(ptr) + cells;
+	size_t free_cell = 0;
+	size_t free_cells = 0;
+
+	// White objects are dead, black ones survive and stay black
+	for (size_t i = next_object(arena, qcgc_arena_cell_index(ptr), end);
+			i < end;
+			i = next_object(arena, i + 1, end)) {
+		if (qcgc_arena_get_blocktype(arena, i) == BLOCK_BLACK) {
+			if (free_cell != 0) {
+				add_region_free_block(arena, free_cell, i - free_cell);
+				free_cells += i - free_cell;
+				free_cell = 0;
+			}
+		} else if (free_cell == 0) {
+			qcgc_arena_set_blocktype(arena, i, BLOCK_FREE);
+			free_cell = i;
+		} else {
+			qcgc_arena_set_blocktype(arena, i, BLOCK_EXTENT);
+		}
+	}
+	if (free_cell != 0) {
+		add_region_free_block(arena, free_cell, end - free_cell);
+		free_cells += end - free_cell;
+	}
+	qcgc_generation_state.promoted_cells += cells - free_cells;
+}
+
+QCGC_STATIC size_t next_object(arena_t *arena, size_t index, size_t end) {
+	// Objects start at the set bits of the block bitmap
+	while (index < end) {
+		uint64_t word;
+		memcpy(&word, arena->block_bitmap + index / 64 * 8, sizeof(uint64_t));
+		word &= ~(uint64_t) 0 << (index % 64);
+		if (word != 0) {
+			return MIN(index / 64 * 64 + __builtin_ctzll(word), end);
+		}
+		index = (index / 64 + 1) * 64;
+	}
+	return end;
+}
+
+QCGC_STATIC void add_region_free_block(arena_t *arena, size_t index, size_t cells) {
+	qcgc_fit_allocator_add(arena->cells + index, cells);
+	qcgc_state.largest_free_block = MAX(qcgc_state.largest_free_block,
+			cells);
+}
+
+QCGC_STATIC bool survives_full_sweep(object_t *object) {
+	if ((object->flags & QCGC_PREBUILT_OBJECT) != 0) {
+		return true;
+	}
+	arena_t *arena = qcgc_arena_addr((cell_t *) object);
+	if ((object_t *) arena == object) {
+		return qcgc_hbtable_is_marked(object);
+	}
+	if (qcgc_medium_is_segment(arena)) {
+		return qcgc_medium_is_marked(object);
+	}
+	return qcgc_arena_get_blocktype(arena,
+			qcgc_arena_cell_index((cell_t *) object)) == BLOCK_BLACK;
+}
@@ -0,0 +1,150 @@
+/**
+ * @file	generation.h
+ */
+
+#pragma once
+
+#include "../qcgc.h"
+
+#include <stdbool.h>
+
+#include "arena.h"
+#include "bag.h"
+#include "gc_state.h"
+#include "mediumspace.h"
+#include "object_stack.h"
+
+#define QCGC_GENERATIONAL_OFF 0
+#define QCGC_GENERATIONAL_NURSERY 1
+#define QCGC_GENERATIONAL_STICKY 2
+
+/**
+ * Generational modes (qcgc_state.generational).
+ *
+ * Nursery mode:
+ *
+ * New objects are only bump allocated into whole arenas, the young arenas
+ * form the nursery. Once there are qcgc_state.nursery_arenas of them, a minor
+ * collection marks the young objects reachable from the shadow stacks and
+ * the remembered set and sweeps only the young arenas. Afterwards the empty
+ * ones are free and all others are old, i.e. survivors are promoted in place.
+ *
+ * The remembered set holds the old objects (prebuilt, huge, medium or in an
+ * old arena) written since the last minor collection. The write barrier
+ * fires once per object until the next collection clears QCGC_GRAY_FLAG, so
+ * it records at most one entry per object. Huge and medium objects start
+ * gray and are remembered when they are allocated.
+ *
+ * Full collections are unchanged. They drop dead objects from the remembered
+ * set and leave the young arenas young. Free blocks of old arenas are not
+ * reused in nursery mode, only arenas that become empty are.
+ *
+ * arena_t.young overlays the mark bits of the arena header cells, which are
+ * never used.
+ *
+ * Sticky mode:
+ *
+ * Mark bits are sticky, i.e. survivors stay black after a sweep and white
+ * objects are the ones allocated since the last cycle. The bump allocators
+ * record the regions they used and fit allocated objects are recorded as
+ * regions of their own. Once nursery_arenas arenas worth of cells were
+ * allocated, a minor collection marks the white objects reachable from the
+ * shadow stacks and the remembered set and sweeps only the recorded regions.
+ * Their free blocks go to the fit allocator right away, so free space is
+ * reused anywhere in the heap. Free blocks are not coalesced across region
+ * boundaries until the next full collection.
+ *
+ * Old objects are black, so the remembered set and the write barrier work as
+ * in nursery mode. A full collection turns all marks white first, its sweep
+ * keeps survivors black and afterwards the remembered set and the regions are
+ * empty.
+ */
+struct qcgc_generation_state {
+	arena_bag_t *young_arenas;
+	object_stack_t *remembered_set;
+	exp_free_list_t *regions;		// Sticky mode: Regions allocated since the
+									// last cycle
+	size_t allocated_cells;			// Sticky mode: Cells in regions
+	size_t promoted_cells;			// Cells of arenas promoted and of objects
+									// allocated old since the last full
+									// collection
+} qcgc_generation_state;
+
+/**
+ * Initialize generational mode
+ */
+void qcgc_generation_initialize(void);
+
+/**
+ * Destroy generational mode
+ */
+void qcgc_generation_destroy(void);
+
+/**
+ * Add arena that was assigned to a bump allocator to the nursery
+ *
+ * @param	arena	Arena
+ */
+void qcgc_generation_add_young(arena_t *arena);
+
+/**
+ * Remove arena from the nursery (if it is young) as it is free now
+ *
+ * @param	arena	Empty arena
+ */
+void qcgc_generation_forget(arena_t *arena);
+
+/**
+ * Record region allocated since the last cycle (sticky mode)
+ *
+ * @param	ptr		First cell of the region, an object
+ * @param	cells	Size of the region in cells, only objects
+ */
+void qcgc_generation_record(cell_t *ptr, size_t cells);
+
+/**
+ * Add old object to the remembered set
+ *
+ * @param	object	Object that was written or allocated old
+ */
+void qcgc_generation_remember(object_t *object);
+
+/**
+ * Mark the young objects and sweep the young arenas, which become old or
+ * free, or the recorded regions in sticky mode. Must be called in GC_PAUSE
+ * with all mutators stopped and their bump allocators reset.
+ */
+void qcgc_generation_minor_collect(void);
+
+/**
+ * Turn the marks of old objects white before a full mark (sticky mode)
+ */
+void qcgc_generation_unmark(void);
+
+/**
+ * Drop objects that do not survive the current full collection from the
+ * remembered set. Called after marking, before anything is swept.
+ */
+void qcgc_generation_sweep(void);
+
+/**
+ * Check whether object is young, i.e. lives in a young arena or is white in
+ * sticky mode
+ *
+ * @param	object	Object
+ * @return	true iff object is young
+ */
+QCGC_STATIC QCGC_INLINE bool qcgc_generation_is_young(object_t *object) {
+	if ((object->flags & QCGC_PREBUILT_OBJECT) != 0) {
+		return false;
+	}
+	arena_t *arena = qcgc_arena_addr((cell_t *) object);
+	if ((object_t *) arena == object || qcgc_medium_is_segment(arena)) {
+		return false;
+	}
+	if (qcgc_state.generational == QCGC_GENERATIONAL_STICKY) {
+		return qcgc_arena_get_blocktype(arena,
+				qcgc_arena_cell_index((cell_t *) object)) == BLOCK_WHITE;
+	}
+	return arena->young != 0;
+}
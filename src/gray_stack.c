@@ -0,0 +1,117 @@
+#include "gray_stack.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+QCGC_STATIC gray_stack_t *take_segment(gray_stack_t *stack, bool bounded);
+
+void qcgc_gray_pool_initialize(void) {
+	pthread_spin_init(&qcgc_gray_pool.lock, PTHREAD_PROCESS_PRIVATE);
+	qcgc_gray_pool.free = NULL;
+	qcgc_gray_pool.free_count = 0;
+	qcgc_gray_pool.segments = 0;
+	qcgc_gray_pool.limit = 0;
+	qcgc_gray_pool.peak = 0;
+}
+
+void qcgc_gray_pool_destroy(void) {
+	while (qcgc_gray_pool.free != NULL) {
+		gray_stack_t *segment = qcgc_gray_pool.free;
+		qcgc_gray_pool.free = segment->next;
+		free(segment);
+	}
+	qcgc_gray_pool.free_count = 0;
+	qcgc_gray_pool.segments = 0;
+	pthread_spin_destroy(&qcgc_gray_pool.lock);
+}
+
+void qcgc_gray_pool_trim(void) {
+	pthread_spin_lock(&qcgc_gray_pool.lock);
+	while (qcgc_gray_pool.free_count > QCGC_GRAY_POOL_KEEP) {
+		gray_stack_t *segment = qcgc_gray_pool.free;
+		qcgc_gray_pool.free = segment->next;
+		qcgc_gray_pool.free_count--;
+		qcgc_gray_pool.segments--;
+		free(segment);
+	}
+	pthread_spin_unlock(&qcgc_gray_pool.lock);
+}
+
+void qcgc_gray_stack_free(gray_stack_t *stack) {
+	while (stack != NULL) {
+		stack->count = 0;
+		stack = gray_stack_segment_pop(stack);
+	}
+}
+
+/**
+ * Put a new segment on top of a full (or empty) stack. Aborts if no memory is
+ * left, as huge blocks, medium and prebuilt objects can not be found again.
+ */
+gray_stack_t *gray_stack_segment_push(gray_stack_t *stack) {
+	gray_stack_t *segment = take_segment(stack, false);
+	if (segment == NULL) {
+		fprintf(stderr, "Out of memory: No gray stack segment left\n");
+		abort();
+	}
+	return segment;
+}
+
+/**
+ * Like gray_stack_segment_push, but NULL if the limit is reached or no
+ * memory is left.
+ */
+gray_stack_t *gray_stack_segment_push_bounded(gray_stack_t *stack) {
+	return take_segment(stack, true);
+}
+
+QCGC_STATIC gray_stack_t *take_segment(gray_stack_t *stack, bool bounded) {
+	pthread_spin_lock(&qcgc_gray_pool.lock);
+	size_t in_use = qcgc_gray_pool.segments - qcgc_gray_pool.free_count;
+	if (bounded && qcgc_gray_pool.limit != 0 &&
+			in_use >= qcgc_gray_pool.limit) {
+		pthread_spin_unlock(&qcgc_gray_pool.lock);
+		return NULL;
+	}
+	gray_stack_t *segment = qcgc_gray_pool.free;
+	if (segment != NULL) {
+		qcgc_gray_pool.free = segment->next;
+		qcgc_gray_pool.free_count--;
+	} else {
+		// Reserve the segment, allocate it outside of the lock
+		qcgc_gray_pool.segments++;
+	}
+	qcgc_gray_pool.peak = MAX(qcgc_gray_pool.peak, in_use + 1);
+	pthread_spin_unlock(&qcgc_gray_pool.lock);
+
+	if (segment == NULL) {
+		segment = (gray_stack_t *) malloc(sizeof(gray_stack_t));
+		if (segment == NULL) {
+			pthread_spin_lock(&qcgc_gray_pool.lock);
+			qcgc_gray_pool.segments--;
+			pthread_spin_unlock(&qcgc_gray_pool.lock);
+			return NULL;
+		}
+	}
+	segment->next = stack;
+	segment->count = 0;
+	segment->below = qcgc_gray_stack_count(stack);
+	return segment;
+}
+
+/**
+ * Return the empty top segment to the pool.
+ */
+gray_stack_t *gray_stack_segment_pop(gray_stack_t *stack) {
+#if CHECKED
+	assert(stack->count == 0);
+#endif
+	gray_stack_t *next = stack->next;
+	pthread_spin_lock(&qcgc_gray_pool.lock);
+	stack->next = qcgc_gray_pool.free;
+	qcgc_gray_pool.free = stack;
+	qcgc_gray_pool.free_count++;
+	pthread_spin_unlock(&qcgc_gray_pool.lock);
+	return next;
+}
@@ -0,0 +1,112 @@
+/**
+ * @file	gray_stack.h
+ */
+
+#pragma once
+
+#include "../qcgc.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+
+/**
+ * Gray stacks.
+ *
+ * A gray stack is a list of segments of QCGC_MARK_LIST_SEGMENT_SIZE objects,
+ * referenced by its top segment. The empty stack is NULL, so idle arenas hold
+ * no stack memory. Segments are taken from and returned to a shared pool,
+ * pushing and popping never moves any object. Whole segments can be handed
+ * over between stacks, e.g. from an arena to a marking thread.
+ *
+ * Bounded pushes fail instead of taking a segment once limit segments are in
+ * use (QCGC_GRAY_STACK_LIMIT), the collector leaves such objects gray flagged
+ * in their arena and finds them again later. Only the arena gray stacks are
+ * bounded, as huge blocks, medium and prebuilt objects can not be found by
+ * scanning the arenas.
+ */
+struct qcgc_gray_pool {
+	pthread_spinlock_t lock;		// Protects the pool, see mark threads
+	gray_stack_t *free;				// Free segments, linked through next
+	size_t free_count;
+	size_t segments;				// All segments, free or in use
+	size_t limit;					// Segments in use for bounded pushes
+									// (0 = unbounded)
+	size_t peak;					// Most segments in use at once
+} qcgc_gray_pool;
+
+void qcgc_gray_pool_initialize(void);
+void qcgc_gray_pool_destroy(void);
+
+/**
+ * Release free segments of the pool down to QCGC_GRAY_POOL_KEEP.
+ */
+void qcgc_gray_pool_trim(void);
+
+/**
+ * Return all segments of a stack to the pool.
+ */
+void qcgc_gray_stack_free(gray_stack_t *stack);
+
+__attribute__ ((warn_unused_result))
+gray_stack_t *gray_stack_segment_push(gray_stack_t *stack);
+
+__attribute__ ((warn_unused_result))
+gray_stack_t *gray_stack_segment_push_bounded(gray_stack_t *stack);
+
+__attribute__ ((warn_unused_result))
+gray_stack_t *gray_stack_segment_pop(gray_stack_t *stack);
+
+QCGC_STATIC QCGC_INLINE size_t qcgc_gray_stack_count(gray_stack_t *stack) {
+	return stack == NULL ? 0 : stack->count + stack->below;
+}
+
+__attribute__ ((warn_unused_result))
+QCGC_STATIC QCGC_INLINE gray_stack_t *qcgc_gray_stack_push(
+		gray_stack_t *stack, object_t *item) {
+	if (stack == NULL || stack->count == QCGC_MARK_LIST_SEGMENT_SIZE) {
+		stack = gray_stack_segment_push(stack);
+	}
+	stack->items[stack->count] = item;
+	stack->count++;
+	return stack;
+}
+
+/**
+ * Push unless a new segment is needed and the limit is reached.
+ *
+ * @param	stack	Stack to push to, updated
+ * @param	item	Object to push
+ * @return	false iff the object was not pushed
+ */
+__attribute__ ((warn_unused_result))
+QCGC_STATIC QCGC_INLINE bool qcgc_gray_stack_push_bounded(
+		gray_stack_t **stack, object_t *item) {
+	gray_stack_t *top = *stack;
+	if (top == NULL || top->count == QCGC_MARK_LIST_SEGMENT_SIZE) {
+		top = gray_stack_segment_push_bounded(top);
+		if (top == NULL) {
+			return false;
+		}
+		*stack = top;
+	}
+	top->items[top->count] = item;
+	top->count++;
+	return true;
+}
+
+QCGC_STATIC QCGC_INLINE object_t *qcgc_gray_stack_top(gray_stack_t *stack) {
+#if CHECKED
+	assert(stack != NULL && stack->count != 0);
+#endif
+	return stack->items[stack->count - 1];
+}
+
+__attribute__ ((warn_unused_result))
+QCGC_STATIC QCGC_INLINE gray_stack_t *qcgc_gray_stack_pop(
+		gray_stack_t *stack) {
+	stack->count--;
+	if (stack->count == 0) {
+		stack = gray_stack_segment_pop(stack);
+	}
+	return stack;
+}
@@ -0,0 +1,142 @@
+#include "heap.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+QCGC_STATIC bool commit_huge_pages(arena_t *arena);
+
+void qcgc_heap_initialize(size_t size, size_t huge_pages) {
+	if (huge_pages == QCGC_HUGE_PAGES_EXPLICIT &&
+			QCGC_ARENA_SIZE < QCGC_HUGE_PAGE_SIZE) {
+		// Explicit huge pages can not be split up among arenas
+		huge_pages = QCGC_HUGE_PAGES_TRANSPARENT;
+	}
+	qcgc_heap_state.huge_pages = huge_pages;
+	qcgc_heap_state.base = NULL;
+	qcgc_heap_state.size = 0;
+	qcgc_heap_state.arena_table = NULL;
+	qcgc_heap_state.next_free = 0;
+	qcgc_heap_state.outside_arenas = 0;
+
+	size &= ~((size_t) QCGC_ARENA_SIZE - 1);
+	if (size == 0) {
+		return;
+	}
+
+	// Reserve one more arena to align the reservation
+	char *mem = (char *) mmap(NULL, size + QCGC_ARENA_SIZE, PROT_NONE,
+			MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+	if (mem == MAP_FAILED) {
+		// Fall back to mapping every arena on its own
+		return;
+	}
+	char *base = (char *) (((uintptr_t) mem + QCGC_ARENA_SIZE - 1) &
+			~((uintptr_t) QCGC_ARENA_SIZE - 1));
+	if (base > mem) {
+		munmap(mem, base - mem);
+	}
+	munmap(base + size, mem + QCGC_ARENA_SIZE - base);
+
+	uint8_t *arena_table = (uint8_t *) calloc(size >> QCGC_ARENA_SIZE_EXP,
+			sizeof(uint8_t));
+	if (arena_table == NULL) {
+		// Fall back to mapping every arena on its own
+		munmap(base, size);
+		return;
+	}
+
+	qcgc_heap_state.base = (cell_t *) base;
+	qcgc_heap_state.size = size;
+	qcgc_heap_state.arena_table = arena_table;
+}
+
+void qcgc_heap_destroy(void) {
+	// Unmaps arenas that are still in use as well
+	if (qcgc_heap_state.base != NULL) {
+		munmap(qcgc_heap_state.base, qcgc_heap_state.size);
+	}
+	free(qcgc_heap_state.arena_table);
+	qcgc_heap_state.base = NULL;
+	qcgc_heap_state.size = 0;
+	qcgc_heap_state.arena_table = NULL;
+}
+
+arena_t *qcgc_heap_arena_commit(void) {
+	size_t count = qcgc_heap_state.size >> QCGC_ARENA_SIZE_EXP;
+	size_t index = qcgc_heap_state.next_free;
+	while (index < count && qcgc_heap_state.arena_table[index] != 0) {
+		index++;
+	}
+	if (index == count) {
+		qcgc_heap_state.next_free = count;
+		return NULL;
+	}
+
+	arena_t *arena = (arena_t *) ((char *) qcgc_heap_state.base +
+			(index << QCGC_ARENA_SIZE_EXP));
+	if (!commit_huge_pages(arena)) {
+		if (mprotect(arena, QCGC_ARENA_SIZE, PROT_READ | PROT_WRITE) != 0) {
+			return NULL;
+		}
+		qcgc_heap_advise_huge_pages(arena);
+	}
+	qcgc_heap_state.arena_table[index] = 1;
+	qcgc_heap_state.next_free = index + 1;
+	return arena;
+}
+
+void qcgc_heap_advise_huge_pages(arena_t *arena) {
+#ifdef MADV_HUGEPAGE
+	if (qcgc_heap_state.huge_pages != QCGC_HUGE_PAGES_OFF) {
+		madvise(arena, QCGC_ARENA_SIZE, MADV_HUGEPAGE);
+	}
+#else
+	UNUSED(arena);
+#endif
+}
+
+bool qcgc_heap_arena_release(arena_t *arena) {
+	uintptr_t offset = (uintptr_t) arena - (uintptr_t) qcgc_heap_state.base;
+	if (offset >= qcgc_heap_state.size) {
+		return false;
+	}
+	size_t index = offset >> QCGC_ARENA_SIZE_EXP;
+#if CHECKED
+	assert(qcgc_heap_state.arena_table[index] != 0);
+#endif
+	// Drops the pages and the access rights in one go, the arena reads as
+	// zero when it is committed again
+	mmap(arena, QCGC_ARENA_SIZE, PROT_NONE,
+			MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE | MAP_FIXED, -1, 0);
+	qcgc_heap_state.arena_table[index] = 0;
+	qcgc_heap_state.next_free = MIN(qcgc_heap_state.next_free, index);
+	return true;
+}
+
+/**
+ * Commit arena with explicit huge pages.
+ *
+ * @param	arena	Arena of the reservation
+ * @return	false iff explicit huge pages are off or not available
+ */
+QCGC_STATIC bool commit_huge_pages(arena_t *arena) {
+#ifdef MAP_HUGETLB
+	if (qcgc_heap_state.huge_pages != QCGC_HUGE_PAGES_EXPLICIT) {
+		return false;
+	}
+	if (mmap(arena, QCGC_ARENA_SIZE, PROT_READ | PROT_WRITE,
+				MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED | MAP_HUGETLB,
+				-1, 0) != MAP_FAILED) {
+		return true;
+	}
+	// No huge pages available. The failed mapping may have dropped the
+	// reservation of the arena, restore it.
+	mmap(arena, QCGC_ARENA_SIZE, PROT_NONE,
+			MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE | MAP_FIXED, -1, 0);
+	qcgc_heap_state.huge_pages = QCGC_HUGE_PAGES_TRANSPARENT;
+#else
+	UNUSED(arena);
+#endif
+	return false;
+}
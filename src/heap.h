@@ -0,0 +1,89 @@
+/**
+ * @file	heap.h
+ */
+
+#pragma once
+
+#include "../qcgc.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Heap reservation.
+ *
+ * Address space for qcgc_state.heap_reserve bytes of arenas is reserved up
+ * front (without access rights, so it costs no memory). Arenas are carved
+ * from it by index and only have to be committed. The arena table holds a
+ * byte for every arena of the reservation that is in use, such that checking
+ * whether a pointer points into an arena is a range check and a table load.
+ *
+ * When there is no reservation or it is exhausted, arenas are mapped one by
+ * one as before and only counted in outside_arenas.
+ *
+ * Arenas of 2MB and more can be backed by huge pages. Explicit huge pages
+ * (hugetlbfs) are only used for the reservation, when none are available the
+ * heap falls back to transparent huge pages for good.
+ */
+#define QCGC_HUGE_PAGES_OFF 0
+#define QCGC_HUGE_PAGES_TRANSPARENT 1
+#define QCGC_HUGE_PAGES_EXPLICIT 2
+
+#define QCGC_HUGE_PAGE_SIZE (1<<21)
+
+struct qcgc_heap_state {
+	cell_t *base;			// Start of the reservation, NULL if there is none
+	size_t size;			// Size of the reservation in bytes
+	uint8_t *arena_table;	// Nonzero for every arena in use
+	size_t next_free;		// No free arena table entry below this index
+	size_t outside_arenas;	// Arenas mapped outside of the reservation
+	size_t huge_pages;		// Huge page mode in use
+} qcgc_heap_state;
+
+/**
+ * Reserve address space for the arenas
+ *
+ * @param	size		Bytes to reserve, rounded down to whole arenas (0: none)
+ * @param	huge_pages	Huge page mode, one of QCGC_HUGE_PAGES_*
+ */
+void qcgc_heap_initialize(size_t size, size_t huge_pages);
+
+/**
+ * Release the reservation including all arenas carved from it
+ */
+void qcgc_heap_destroy(void);
+
+/**
+ * Commit an unused arena of the reservation.
+ *
+ * @return	Zeroed arena, NULL if the reservation is exhausted or missing
+ */
+arena_t *qcgc_heap_arena_commit(void);
+
+/**
+ * Advise the OS to back a committed arena with transparent huge pages, if
+ * huge pages are enabled.
+ *
+ * @param	arena	Arena
+ */
+void qcgc_heap_advise_huge_pages(arena_t *arena);
+
+/**
+ * Return arena to the reservation.
+ *
+ * @param	arena	Arena
+ * @return	false iff arena is not part of the reservation
+ */
+bool qcgc_heap_arena_release(arena_t *arena);
+
+/**
+ * Check whether pointer points into an arena of the reservation.
+ *
+ * @param	ptr		Pointer
+ * @return	true iff ptr is inside an arena of the reservation in use
+ */
+QCGC_STATIC QCGC_INLINE bool qcgc_heap_contains(void *ptr) {
+	uintptr_t offset = (uintptr_t) ptr - (uintptr_t) qcgc_heap_state.base;
+	return offset < qcgc_heap_state.size &&
+		qcgc_heap_state.arena_table[offset >> QCGC_ARENA_SIZE_EXP] != 0;
+}
@@ -1,89 +1,159 @@
 #include "hugeblocktable.h"
 
 #include <assert.h>
+#include <stdlib.h>
+
+#include "gc_state.h"
+#include "sweeper.h"
 
 QCGC_STATIC size_t bucket(object_t *object);
+QCGC_STATIC struct hbtable_entry_s *lookup(object_t *object);
+QCGC_STATIC void grow(void);
+QCGC_STATIC void remove_slot(size_t i);
 
 void qcgc_hbtable_initialize(void) {
 	qcgc_hbtable.mark_flag_ref = false;
-	for (size_t i = 0; i < QCGC_HBTABLE_BUCKETS; i++) {
-		qcgc_hbtable.bucket[i] = qcgc_hbbucket_create(4);
-	}
+	qcgc_hbtable.size = QCGC_HBTABLE_INIT_SIZE;
+	qcgc_hbtable.count = 0;
+	qcgc_hbtable.entries = (struct hbtable_entry_s *) calloc(
+			qcgc_hbtable.size, sizeof(struct hbtable_entry_s));
 }
 
 void qcgc_hbtable_destroy(void) {
-	for (size_t i = 0; i < QCGC_HBTABLE_BUCKETS; i++) {
-		free(qcgc_hbtable.bucket[i]);
+	for (size_t i = 0; i < qcgc_hbtable.size; i++) {
+		free(qcgc_hbtable.entries[i].cards);
 	}
+	free(qcgc_hbtable.entries);
 }
 
 void qcgc_hbtable_insert(object_t *object) {
-	size_t i = bucket(object);
-	qcgc_hbtable.bucket[i] = qcgc_hbbucket_add(qcgc_hbtable.bucket[i],
-			(struct hbtable_entry_s) {
-				.object = object,
-				.mark_flag = !qcgc_hbtable.mark_flag_ref});
+	if (2 * (qcgc_hbtable.count + 1) > qcgc_hbtable.size) {
+		grow();
+	}
+	struct hbtable_entry_s *entry = lookup(object);
+#if CHECKED
+	assert(entry->object == NULL);
+#endif
+	*entry = (struct hbtable_entry_s) {
+		.object = object,
+		.mark_flag = !qcgc_hbtable.mark_flag_ref,
+		.card_bytes = 0,
+		.cards = NULL};
+	qcgc_hbtable.count++;
 }
 
 bool qcgc_hbtable_mark(object_t *object) {
-	hbbucket_t *b = qcgc_hbtable.bucket[bucket(object)];
-	size_t count = b->count;
-	for (size_t i = 0; i < count; i++) {
-		if (b->items[i].object == object) {
-			if (b->items[i].mark_flag != qcgc_hbtable.mark_flag_ref) {
-				b->items[i].mark_flag = qcgc_hbtable.mark_flag_ref;
-				return true;
-			}
-			return false;
-		}
-	}
+	struct hbtable_entry_s *entry = lookup(object);
 #if CHECKED
-	assert(false);
+	assert(entry->object == object);
 #endif
+	if (entry->object == object &&
+			entry->mark_flag != qcgc_hbtable.mark_flag_ref) {
+		entry->mark_flag = qcgc_hbtable.mark_flag_ref;
+		return true;
+	}
 	return false;
 }
 
 bool qcgc_hbtable_has(object_t *object) {
-	hbbucket_t *b = qcgc_hbtable.bucket[bucket(object)];
-	size_t count = b->count;
-	for (size_t i = 0; i < count; i++) {
-		if (b->items[i].object == object) {
-			return true;
-		}
-	}
-	return false;
+	return lookup(object)->object == object;
 }
 
 bool qcgc_hbtable_is_marked(object_t *object) {
-	hbbucket_t *b = qcgc_hbtable.bucket[bucket(object)];
-	size_t count = b->count;
-	for (size_t i = 0; i < count; i++) {
-		if (b->items[i].object == object) {
-			return b->items[i].mark_flag == qcgc_hbtable.mark_flag_ref;
-		}
-	}
-	return false;
+	struct hbtable_entry_s *entry = lookup(object);
+	return entry->object == object &&
+		entry->mark_flag == qcgc_hbtable.mark_flag_ref;
+}
+
+/**
+ * @return	Entry of the huge block, NULL if object is no huge block
+ */
+struct hbtable_entry_s *qcgc_hbtable_entry(object_t *object) {
+	struct hbtable_entry_s *entry = lookup(object);
+	return entry->object == object ? entry : NULL;
 }
 
 void qcgc_hbtable_sweep(void) {
-	for (size_t i = 0; i < QCGC_HBTABLE_BUCKETS; i++) {
-		hbbucket_t *b = qcgc_hbtable.bucket[i];
-		size_t j = 0;
-		while(j < b->count) {
-			if (b->items[j].mark_flag != qcgc_hbtable.mark_flag_ref) {
-				// White object
-				free(b->items[j].object);
-				b = qcgc_hbbucket_remove_index(b, j);
+	size_t mask = qcgc_hbtable.size - 1;
+	// Start right after an empty slot, such that entries are only moved to
+	// slots that were visited before
+	size_t start = 0;
+	while (qcgc_hbtable.entries[start].object != NULL) {
+		start++;
+	}
+	for (size_t n = 1; n <= qcgc_hbtable.size; n++) {
+		size_t i = (start + n) & mask;
+		while (qcgc_hbtable.entries[i].object != NULL &&
+				qcgc_hbtable.entries[i].mark_flag !=
+				qcgc_hbtable.mark_flag_ref) {
+			// White object
+			if (qcgc_state.background_sweep) {
+				qcgc_sweeper_free_huge_block(qcgc_hbtable.entries[i].object);
 			} else {
-				// Black object
-				j++;
+				free(qcgc_hbtable.entries[i].object);
 			}
+			free(qcgc_hbtable.entries[i].cards);
+			// Moves a later entry into slot i, check it again
+			remove_slot(i);
 		}
-		qcgc_hbtable.bucket[i] = b;
 	}
 	qcgc_hbtable.mark_flag_ref = !qcgc_hbtable.mark_flag_ref;
 }
 
 QCGC_STATIC size_t bucket(object_t *object) {
-	return ((uintptr_t) object >> (QCGC_ARENA_SIZE_EXP)) % QCGC_HBTABLE_BUCKETS;
+	// Fibonacci hashing of the arena number
+	uint64_t key = (uintptr_t) object >> QCGC_ARENA_SIZE_EXP;
+	return (key * 0x9e3779b97f4a7c15ull) >>
+		(64 - __builtin_ctzl(qcgc_hbtable.size));
+}
+
+/**
+ * Find slot of object or the empty slot where it belongs.
+ */
+QCGC_STATIC struct hbtable_entry_s *lookup(object_t *object) {
+	size_t mask = qcgc_hbtable.size - 1;
+	size_t i = bucket(object);
+	while (qcgc_hbtable.entries[i].object != NULL &&
+			qcgc_hbtable.entries[i].object != object) {
+		i = (i + 1) & mask;
+	}
+	return &qcgc_hbtable.entries[i];
+}
+
+QCGC_STATIC void grow(void) {
+	struct hbtable_entry_s *entries = qcgc_hbtable.entries;
+	size_t size = qcgc_hbtable.size;
+
+	qcgc_hbtable.size = 2 * size;
+	qcgc_hbtable.entries = (struct hbtable_entry_s *) calloc(
+			qcgc_hbtable.size, sizeof(struct hbtable_entry_s));
+	for (size_t i = 0; i < size; i++) {
+		if (entries[i].object != NULL) {
+			*lookup(entries[i].object) = entries[i];
+		}
+	}
+	free(entries);
+}
+
+/**
+ * Empty slot i and move later entries of the probe sequence back, such that
+ * lookups never stop early at the new hole (backward shift deletion).
+ */
+QCGC_STATIC void remove_slot(size_t i) {
+	size_t mask = qcgc_hbtable.size - 1;
+	size_t j = i;
+	while (true) {
+		j = (j + 1) & mask;
+		if (qcgc_hbtable.entries[j].object == NULL) {
+			break;
+		}
+		size_t home = bucket(qcgc_hbtable.entries[j].object);
+		// Entry j may move to i iff i lies cyclically within [home, j)
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			qcgc_hbtable.entries[i] = qcgc_hbtable.entries[j];
+			i = j;
+		}
+	}
+	qcgc_hbtable.entries[i] = (struct hbtable_entry_s) {.object = NULL};
+	qcgc_hbtable.count--;
 }
@@ -4,14 +4,30 @@
 
 #include <stdbool.h>
 
-#include "bag.h"
+#define QCGC_HBTABLE_INIT_SIZE 64	// Power of two
 
-// Choosing a prime number, hoping for good results
-#define QCGC_HBTABLE_BUCKETS 61
+struct hbtable_entry_s {
+	object_t *object;				// NULL for empty slots
+	bool mark_flag;
+	size_t card_bytes;				// Size of cards
+	uint8_t *cards;					// Dirty cards, see src/cards.h
+};
 
+/**
+ * Huge blocks, open addressing hash table with linear probing.
+ *
+ * Huge blocks are aligned to the arena size, so the key is the arena number
+ * of the block. The table is grown such that at most half of the slots are
+ * used, which keeps probe sequences short.
+ *
+ * A block is marked iff its mark_flag equals mark_flag_ref. Flipping
+ * mark_flag_ref after sweeping turns all survivors white again.
+ */
 struct hbtable_s {
 	bool mark_flag_ref;
-	hbbucket_t *bucket[QCGC_HBTABLE_BUCKETS];
+	size_t size;					// Number of slots
+	size_t count;					// Number of used slots
+	struct hbtable_entry_s *entries;
 } qcgc_hbtable;
 
 void qcgc_hbtable_initialize(void);
@@ -20,4 +36,5 @@ void qcgc_hbtable_insert(object_t *object);
 bool qcgc_hbtable_mark(object_t *object);
 bool qcgc_hbtable_has(object_t *object);
 bool qcgc_hbtable_is_marked(object_t *object);
+struct hbtable_entry_s *qcgc_hbtable_entry(object_t *object);
 void qcgc_hbtable_sweep(void);
@@ -0,0 +1,62 @@
+/**
+ * @file	layout.h
+ */
+
+#pragma once
+
+#include "../qcgc.h"
+
+#include <stdint.h>
+
+/**
+ * Layout descriptors (qcgc_register_layout).
+ *
+ * Objects with a layout id in their flags are traced by the collector itself:
+ * The layout maps the id to a bitmap of the pointer sized words of the object
+ * that reference other objects. All other objects are traced by qcgc_trace_cb.
+ */
+struct qcgc_layout_state {
+	uint64_t bitmaps[QCGC_LAYOUT_COUNT];	// Reference words per layout id
+} qcgc_layout_state;
+
+/**
+ * Call visit on every object the given object references.
+ *
+ * @param	object	The object to trace
+ * @param	visit	The function to be called on the referenced objects
+ */
+QCGC_STATIC QCGC_INLINE void qcgc_trace_object(object_t *object,
+		void (*visit)(object_t *object)) {
+	uint32_t layout = object->flags >> QCGC_LAYOUT_SHIFT;
+	if (layout == 0) {
+		qcgc_trace_cb(object, visit);
+		return;
+	}
+	object_t **words = (object_t **) object;
+	uint64_t bitmap = qcgc_layout_state.bitmaps[layout];
+	while (bitmap != 0) {
+		visit(words[__builtin_ctzll(bitmap)]);
+		bitmap &= bitmap - 1;
+	}
+}
+
+/**
+ * Call visit on the address of every reference of the given object.
+ *
+ * @param	object	The object to trace
+ * @param	visit	The function to be called on the reference fields
+ */
+QCGC_STATIC QCGC_INLINE void qcgc_trace_object_slots(object_t *object,
+		void (*visit)(object_t **slot)) {
+	uint32_t layout = object->flags >> QCGC_LAYOUT_SHIFT;
+	if (layout == 0) {
+		qcgc_trace_slots_cb(object, visit);
+		return;
+	}
+	object_t **words = (object_t **) object;
+	uint64_t bitmap = qcgc_layout_state.bitmaps[layout];
+	while (bitmap != 0) {
+		visit(&words[__builtin_ctzll(bitmap)]);
+		bitmap &= bitmap - 1;
+	}
+}
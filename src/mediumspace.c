@@ -0,0 +1,193 @@
+#include "mediumspace.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gc_state.h"
+#include "sweeper.h"
+
+#if QCGC_MEDIUM_PAGES + QCGC_MEDIUM_CARDS / 8 + 16 > QCGC_MEDIUM_PAGE_SIZE
+#error "Segment header does not fit into the first page"
+#endif
+
+QCGC_STATIC QCGC_INLINE size_t page_index(object_t *object);
+QCGC_STATIC medium_segment_t *segment_create(void);
+QCGC_STATIC object_t *segment_allocate(medium_segment_t *segment,
+		size_t pages);
+QCGC_STATIC bool segment_sweep(medium_segment_t *segment);
+
+void qcgc_medium_initialize(void) {
+	qcgc_medium_state.segments = qcgc_arena_bag_create(4); // XXX
+}
+
+void qcgc_medium_destroy(void) {
+	for (size_t i = 0; i < qcgc_medium_state.segments->count; i++) {
+		free(qcgc_medium_state.segments->items[i]);
+	}
+	free(qcgc_medium_state.segments);
+}
+
+object_t *qcgc_medium_allocate(size_t size) {
+#if CHECKED
+	assert(size <= QCGC_MEDIUM_MAX_SIZE);
+#endif
+	size_t pages = (size + QCGC_MEDIUM_PAGE_SIZE - 1) >> QCGC_MEDIUM_PAGE_EXP;
+
+	// Newest segments first, older ones are usually full
+	for (size_t i = qcgc_medium_state.segments->count; i > 0; i--) {
+		medium_segment_t *segment =
+			(medium_segment_t *) qcgc_medium_state.segments->items[i - 1];
+		if (segment->free_pages >= pages) {
+			object_t *result = segment_allocate(segment, pages);
+			if (result != NULL) {
+				return result;
+			}
+		}
+	}
+
+	medium_segment_t *segment = segment_create();
+	if (segment == NULL) {
+		return NULL;
+	}
+	qcgc_medium_state.segments = qcgc_arena_bag_add(
+			qcgc_medium_state.segments, (arena_t *) segment);
+	return segment_allocate(segment, pages);
+}
+
+bool qcgc_medium_mark(object_t *object) {
+	medium_segment_t *segment =
+		(medium_segment_t *) qcgc_arena_addr((cell_t *) object);
+	uint8_t expected = BLOCK_WHITE;
+	return __atomic_compare_exchange_n(&segment->pages[page_index(object)],
+			&expected, BLOCK_BLACK, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+bool qcgc_medium_is_marked(object_t *object) {
+	medium_segment_t *segment =
+		(medium_segment_t *) qcgc_arena_addr((cell_t *) object);
+	return segment->pages[page_index(object)] == BLOCK_BLACK;
+}
+
+bool qcgc_medium_contains(object_t *object) {
+	arena_t *arena = qcgc_arena_addr((cell_t *) object);
+	for (size_t i = 0; i < qcgc_medium_state.segments->count; i++) {
+		if (qcgc_medium_state.segments->items[i] == arena) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void qcgc_medium_sweep(void) {
+	size_t i = 0;
+	while (i < qcgc_medium_state.segments->count) {
+		medium_segment_t *segment =
+			(medium_segment_t *) qcgc_medium_state.segments->items[i];
+		if (segment_sweep(segment)) {
+			qcgc_medium_state.segments = qcgc_arena_bag_remove_index(
+					qcgc_medium_state.segments, i);
+			if (qcgc_state.background_sweep) {
+				qcgc_sweeper_free_huge_block((object_t *) segment);
+			} else {
+				free(segment);
+			}
+			// NO i++
+		} else {
+			i++;
+		}
+	}
+}
+
+size_t qcgc_medium_used_cells(void) {
+	size_t pages = 0;
+	for (size_t i = 0; i < qcgc_medium_state.segments->count; i++) {
+		medium_segment_t *segment =
+			(medium_segment_t *) qcgc_medium_state.segments->items[i];
+		pages += QCGC_MEDIUM_PAGES - QCGC_MEDIUM_FIRST_PAGE -
+			segment->free_pages;
+	}
+	return pages * (QCGC_MEDIUM_PAGE_SIZE / sizeof(cell_t));
+}
+
+QCGC_STATIC QCGC_INLINE size_t page_index(object_t *object) {
+	size_t index = ((uintptr_t) object & (QCGC_ARENA_SIZE - 1)) >>
+		QCGC_MEDIUM_PAGE_EXP;
+#if CHECKED
+	assert(((uintptr_t) object & (QCGC_MEDIUM_PAGE_SIZE - 1)) == 0);
+	assert(index >= QCGC_MEDIUM_FIRST_PAGE);
+#endif
+	return index;
+}
+
+QCGC_STATIC medium_segment_t *segment_create(void) {
+	medium_segment_t *segment = (medium_segment_t *) aligned_alloc(
+			QCGC_ARENA_SIZE, QCGC_ARENA_SIZE);
+	if (segment == NULL) {
+		return NULL;
+	}
+	segment->tag = QCGC_MEDIUM_TAG;
+	segment->free_pages = QCGC_MEDIUM_PAGES - QCGC_MEDIUM_FIRST_PAGE;
+	memset(segment->cards, 0, sizeof(segment->cards));
+	for (size_t i = 0; i < QCGC_MEDIUM_FIRST_PAGE; i++) {
+		segment->pages[i] = BLOCK_EXTENT;
+	}
+	for (size_t i = QCGC_MEDIUM_FIRST_PAGE; i < QCGC_MEDIUM_PAGES; i++) {
+		segment->pages[i] = BLOCK_FREE;
+	}
+	return segment;
+}
+
+/**
+ * First fit of a span of free pages.
+ */
+QCGC_STATIC object_t *segment_allocate(medium_segment_t *segment,
+		size_t pages) {
+	size_t run = 0;
+	for (size_t i = QCGC_MEDIUM_FIRST_PAGE; i < QCGC_MEDIUM_PAGES; i++) {
+		if (segment->pages[i] != BLOCK_FREE) {
+			run = 0;
+			continue;
+		}
+		run++;
+		if (run == pages) {
+			size_t first = i + 1 - pages;
+			segment->pages[first] = BLOCK_WHITE;
+			for (size_t j = first + 1; j <= i; j++) {
+				segment->pages[j] = BLOCK_EXTENT;
+			}
+			segment->free_pages -= pages;
+			return (object_t *) ((uintptr_t) segment +
+					(first << QCGC_MEDIUM_PAGE_EXP));
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @return	Whether segment is empty after sweeping
+ */
+QCGC_STATIC bool segment_sweep(medium_segment_t *segment) {
+	size_t i = QCGC_MEDIUM_FIRST_PAGE;
+	while (i < QCGC_MEDIUM_PAGES) {
+		switch (segment->pages[i]) {
+			case BLOCK_BLACK:
+				segment->pages[i] = BLOCK_WHITE;
+				i++;
+				break;
+			case BLOCK_WHITE:
+				// Free first page and all extent pages of the object
+				do {
+					segment->pages[i] = BLOCK_FREE;
+					segment->free_pages++;
+					i++;
+				} while (i < QCGC_MEDIUM_PAGES &&
+						segment->pages[i] == BLOCK_EXTENT);
+				break;
+			default:
+				i++;
+				break;
+		}
+	}
+	return segment->free_pages == QCGC_MEDIUM_PAGES - QCGC_MEDIUM_FIRST_PAGE;
+}
@@ -0,0 +1,103 @@
+/**
+ * @file	mediumspace.h
+ */
+
+#pragma once
+
+#include "../qcgc.h"
+
+#include <stdbool.h>
+
+#include "bag.h"
+
+#define QCGC_MEDIUM_FIRST_PAGE 1	// Page 0 holds the segment header
+#define QCGC_MEDIUM_CARDS (1<<(QCGC_ARENA_SIZE_EXP - QCGC_CARD_SIZE_EXP))
+
+/**
+ * Medium object segment.
+ *
+ * Objects between 2^QCGC_LARGE_ALLOC_THRESHOLD_EXP and QCGC_MEDIUM_MAX_SIZE
+ * bytes are allocated as spans of pages inside of arena aligned segments.
+ * Every page has a blocktype: The first page of an object is white or black,
+ * all further pages of the object are extent and unused pages are free.
+ *
+ * The tag overlays arena_t.gray_stack, it is odd for segments and always even
+ * (NULL or an aligned pointer) for arenas.
+ */
+typedef struct medium_segment_s {
+	uintptr_t tag;
+	size_t free_pages;
+	uint8_t pages[QCGC_MEDIUM_PAGES];	// blocktype_t of every page
+	uint8_t cards[QCGC_MEDIUM_CARDS / 8];	// Dirty cards, see src/cards.h
+} medium_segment_t;
+
+#define QCGC_MEDIUM_TAG 1
+
+struct qcgc_medium_state {
+	arena_bag_t *segments;
+} qcgc_medium_state;
+
+/**
+ * Initialize medium object space
+ */
+void qcgc_medium_initialize(void);
+
+/**
+ * Destroy medium object space, all segments are returned to the OS
+ */
+void qcgc_medium_destroy(void);
+
+/**
+ * Allocate medium object, the object is white.
+ *
+ * @param	size	Object size in bytes, at most QCGC_MEDIUM_MAX_SIZE
+ * @return	Pointer to page aligned memory, NULL in case of errors
+ */
+object_t *qcgc_medium_allocate(size_t size);
+
+/**
+ * Mark medium object, may be called by several marking threads at once.
+ *
+ * @param	object	Medium object
+ * @return	true iff object was white before
+ */
+bool qcgc_medium_mark(object_t *object);
+
+/**
+ * Check whether medium object is marked.
+ *
+ * @param	object	Medium object
+ * @return	true iff object is black
+ */
+bool qcgc_medium_is_marked(object_t *object);
+
+/**
+ * Check whether pointer points into a medium object segment without reading
+ * the memory it points to.
+ *
+ * @param	object	Any pointer
+ * @return	true iff object lies in one of the segments
+ */
+bool qcgc_medium_contains(object_t *object);
+
+/**
+ * Free white objects, turn black objects white and free empty segments.
+ */
+void qcgc_medium_sweep(void);
+
+/**
+ * Count cells of the pages used by medium objects.
+ *
+ * @return	Used cells of all segments
+ */
+size_t qcgc_medium_used_cells(void);
+
+/**
+ * Check whether arena aligned memory is a medium object segment.
+ *
+ * @param	arena	Arena or segment
+ * @return	true iff arena is a segment
+ */
+QCGC_STATIC QCGC_INLINE bool qcgc_medium_is_segment(arena_t *arena) {
+	return (arena->medium_tag & QCGC_MEDIUM_TAG) != 0;
+}
@@ -0,0 +1,157 @@
+#include "safepoint.h"
+
+#include <assert.h>
+
+#include "allocator.h"
+
+QCGC_STATIC void park(void);
+QCGC_STATIC bool safepoint_requested(void);
+QCGC_STATIC size_t thread_index(void);
+
+void qcgc_safepoint_initialize(void) {
+	pthread_mutex_init(&qcgc_safepoint_state.lock, NULL);
+	pthread_cond_init(&qcgc_safepoint_state.parked_cond, NULL);
+	pthread_cond_init(&qcgc_safepoint_state.resume_cond, NULL);
+	qcgc_safepoint_state.threads = qcgc_thread_bag_create(4); // XXX
+	qcgc_safepoint_state.parked = 0;
+	__atomic_store_n(&_qcgc_safepoint_requested, false, __ATOMIC_RELEASE);
+
+	qcgc_safepoint_state.threads = qcgc_thread_bag_add(
+			qcgc_safepoint_state.threads,
+			(struct thread_bag_item_s) {
+				.shadowstack = &_qcgc_shadowstack,
+				.bump_allocator = &_qcgc_bump_allocator});
+}
+
+void qcgc_safepoint_destroy(void) {
+#if CHECKED
+	assert(!safepoint_requested());
+	assert(qcgc_safepoint_state.threads->count == 1);
+	assert(qcgc_safepoint_state.parked == 0);
+#endif
+	free(qcgc_safepoint_state.threads);
+	pthread_cond_destroy(&qcgc_safepoint_state.resume_cond);
+	pthread_cond_destroy(&qcgc_safepoint_state.parked_cond);
+	pthread_mutex_destroy(&qcgc_safepoint_state.lock);
+}
+
+void qcgc_safepoint_register(void) {
+	pthread_mutex_lock(&qcgc_safepoint_state.lock);
+	// Not registered yet, so we must not be counted as parked
+	while (safepoint_requested()) {
+		pthread_cond_wait(&qcgc_safepoint_state.resume_cond,
+				&qcgc_safepoint_state.lock);
+	}
+	qcgc_safepoint_state.threads = qcgc_thread_bag_add(
+			qcgc_safepoint_state.threads,
+			(struct thread_bag_item_s) {
+				.shadowstack = &_qcgc_shadowstack,
+				.bump_allocator = &_qcgc_bump_allocator});
+
+	if (qcgc_safepoint_state.threads->count == 2) {
+		// Switching to multiple mutators: Bump blocks handed out from now on
+		// do not share bitmap bytes, but the block of the first thread might.
+		qcgc_stop_the_world();
+		qcgc_safepoint_reset_bump_ptrs();
+		qcgc_resume_the_world();
+	}
+	pthread_mutex_unlock(&qcgc_safepoint_state.lock);
+}
+
+void qcgc_safepoint_unregister(void) {
+	size_t i = thread_index();
+	qcgc_safepoint_state.threads = qcgc_thread_bag_remove_index(
+			qcgc_safepoint_state.threads, i);
+}
+
+void qcgc_gc_lock(void) {
+	pthread_mutex_lock(&qcgc_safepoint_state.lock);
+	while (safepoint_requested()) {
+		park();
+	}
+}
+
+void qcgc_gc_unlock(void) {
+	pthread_mutex_unlock(&qcgc_safepoint_state.lock);
+}
+
+void qcgc_stop_the_world(void) {
+#if CHECKED
+	assert(!safepoint_requested());
+#endif
+	__atomic_store_n(&_qcgc_safepoint_requested, true, __ATOMIC_RELEASE);
+	while (qcgc_safepoint_state.parked + 1 <
+			qcgc_safepoint_state.threads->count) {
+		pthread_cond_wait(&qcgc_safepoint_state.parked_cond,
+				&qcgc_safepoint_state.lock);
+	}
+}
+
+void qcgc_resume_the_world(void) {
+#if CHECKED
+	assert(safepoint_requested());
+#endif
+	__atomic_store_n(&_qcgc_safepoint_requested, false, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&qcgc_safepoint_state.resume_cond);
+}
+
+void qcgc_safepoint_reset_bump_ptrs(void) {
+	size_t count = qcgc_safepoint_state.threads->count;
+	for (size_t i = 0; i < count; i++) {
+		struct qcgc_bump_allocator *bump_allocator =
+			qcgc_safepoint_state.threads->items[i].bump_allocator;
+		if (bump_allocator != &_qcgc_bump_allocator) {
+			qcgc_bump_allocator_reset(bump_allocator);
+		}
+	}
+}
+
+void _qcgc_safepoint_slowpath(void) {
+	qcgc_gc_lock();
+	qcgc_gc_unlock();
+}
+
+void qcgc_enter_native(void) {
+	pthread_mutex_lock(&qcgc_safepoint_state.lock);
+	qcgc_safepoint_state.parked++;
+	pthread_cond_signal(&qcgc_safepoint_state.parked_cond);
+	pthread_mutex_unlock(&qcgc_safepoint_state.lock);
+}
+
+void qcgc_leave_native(void) {
+	pthread_mutex_lock(&qcgc_safepoint_state.lock);
+	while (safepoint_requested()) {
+		pthread_cond_wait(&qcgc_safepoint_state.resume_cond,
+				&qcgc_safepoint_state.lock);
+	}
+	qcgc_safepoint_state.parked--;
+	pthread_mutex_unlock(&qcgc_safepoint_state.lock);
+}
+
+QCGC_STATIC void park(void) {
+	qcgc_safepoint_state.parked++;
+	pthread_cond_signal(&qcgc_safepoint_state.parked_cond);
+	while (safepoint_requested()) {
+		pthread_cond_wait(&qcgc_safepoint_state.resume_cond,
+				&qcgc_safepoint_state.lock);
+	}
+	qcgc_safepoint_state.parked--;
+}
+
+QCGC_STATIC bool safepoint_requested(void) {
+	return __atomic_load_n(&_qcgc_safepoint_requested, __ATOMIC_ACQUIRE);
+}
+
+QCGC_STATIC size_t thread_index(void) {
+	size_t count = qcgc_safepoint_state.threads->count;
+	for (size_t i = 0; i < count; i++) {
+		if (qcgc_safepoint_state.threads->items[i].shadowstack ==
+				&_qcgc_shadowstack) {
+			return i;
+		}
+	}
+#if CHECKED
+	assert(false);
+#endif
+	return count;
+}
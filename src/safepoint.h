@@ -0,0 +1,82 @@
+/**
+ * @file	safepoint.h
+ */
+
+#pragma once
+
+#include "../qcgc.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "bag.h"
+
+/**
+ * @var qcgc_safepoint_state
+ *
+ * Registered mutator threads and the stop-the-world protocol.
+ *
+ * The lock protects the shared allocator and collector state, i.e. it has to
+ * be held in every slowpath. A thread that acquires the lock while a stop is
+ * requested parks until the world is resumed.
+ */
+struct qcgc_safepoint_state {
+	pthread_mutex_t lock;
+	pthread_cond_t parked_cond;		// Signaled whenever a thread parks
+	pthread_cond_t resume_cond;		// Broadcasted when the world resumes
+	thread_bag_t *threads;			// All registered mutator threads
+	size_t parked;					// Threads parked or in native code
+} qcgc_safepoint_state;
+
+/**
+ * Initialize safepoint state and register the calling thread.
+ */
+void qcgc_safepoint_initialize(void);
+
+/**
+ * Destroy safepoint state.
+ */
+void qcgc_safepoint_destroy(void);
+
+/**
+ * Register the calling thread. Must not hold the lock.
+ */
+void qcgc_safepoint_register(void);
+
+/**
+ * Unregister the calling thread. Must hold the lock.
+ */
+void qcgc_safepoint_unregister(void);
+
+/**
+ * Acquire the lock, parking while a stop is requested.
+ */
+void qcgc_gc_lock(void);
+
+/**
+ * Release the lock.
+ */
+void qcgc_gc_unlock(void);
+
+/**
+ * Stop all other registered threads. Must hold the lock.
+ */
+void qcgc_stop_the_world(void);
+
+/**
+ * Resume all threads stopped by qcgc_stop_the_world. Must hold the lock.
+ */
+void qcgc_resume_the_world(void);
+
+/**
+ * Return the bump blocks of all other (stopped) threads to the fit allocator.
+ * Must be called before sweeping.
+ */
+void qcgc_safepoint_reset_bump_ptrs(void);
+
+/**
+ * Whether more than one mutator thread is registered.
+ */
+QCGC_STATIC QCGC_INLINE bool qcgc_is_multi_threaded(void) {
+	return qcgc_safepoint_state.threads->count > 1;
+}
@@ -7,6 +7,7 @@
 
 #include "arena.h"
 #include "allocator.h"
+#include "heap.h"
 
 QCGC_STATIC void handle_error(int signo, siginfo_t *siginfo, void *context);
 QCGC_STATIC bool is_stack_overflow(void *addr);
@@ -49,6 +50,12 @@ QCGC_STATIC bool is_stack_overflow(void *addr) {
 }
 
 QCGC_STATIC bool is_in_arena(void *addr) {
+	if (qcgc_heap_contains(addr)) {
+		return true;
+	}
+	if (qcgc_heap_state.outside_arenas == 0) {
+		return false;
+	}
 	arena_t *arena = qcgc_arena_addr((cell_t *) addr);
 	size_t count = qcgc_allocator_state.arenas->count;
 	for (size_t i = 0; i < count; i++) {
@@ -0,0 +1,182 @@
+#include "sweeper.h"
+
+#include <assert.h>
+
+#include "allocator.h"
+#include "arena.h"
+#include "gc_state.h"
+#include "object_stack.h"
+
+QCGC_STATIC void *sweeper_main(void *arg);
+QCGC_STATIC bool have_work(void);
+QCGC_STATIC void publish(void);
+
+void qcgc_sweeper_initialize(void) {
+	qcgc_sweeper_state.sweeping = false;
+	if (!qcgc_state.background_sweep) {
+		return;
+	}
+	pthread_mutex_init(&qcgc_sweeper_state.lock, NULL);
+	pthread_cond_init(&qcgc_sweeper_state.work_cond, NULL);
+	pthread_cond_init(&qcgc_sweeper_state.done_cond, NULL);
+	qcgc_sweeper_state.free_blocks = qcgc_exp_free_list_create(16); // XXX
+	qcgc_sweeper_state.empty_arenas = qcgc_arena_bag_create(4); // XXX
+	qcgc_sweeper_state.huge_blocks = qcgc_object_stack_create(16); // XXX
+	qcgc_sweeper_state.busy = 0;
+	qcgc_sweeper_state.shutdown = false;
+	pthread_create(&qcgc_sweeper_state.thread, NULL, sweeper_main, NULL);
+}
+
+void qcgc_sweeper_destroy(void) {
+	if (!qcgc_state.background_sweep) {
+		return;
+	}
+	while (qcgc_sweeper_step()) {
+		// Publish everything, as the allocator is destroyed afterwards
+	}
+	qcgc_sweeper_state.sweeping = false;
+	pthread_mutex_lock(&qcgc_sweeper_state.lock);
+	qcgc_sweeper_state.shutdown = true;
+	pthread_cond_signal(&qcgc_sweeper_state.work_cond);
+	pthread_mutex_unlock(&qcgc_sweeper_state.lock);
+	// Sweeper frees all remaining huge blocks before it terminates
+	pthread_join(qcgc_sweeper_state.thread, NULL);
+
+	free(qcgc_sweeper_state.free_blocks);
+	free(qcgc_sweeper_state.empty_arenas);
+	free(qcgc_sweeper_state.huge_blocks);
+	pthread_cond_destroy(&qcgc_sweeper_state.done_cond);
+	pthread_cond_destroy(&qcgc_sweeper_state.work_cond);
+	pthread_mutex_destroy(&qcgc_sweeper_state.lock);
+}
+
+void qcgc_sweeper_add_arena(arena_t *arena) {
+#if CHECKED
+	assert(qcgc_state.background_sweep);
+#endif
+	pthread_mutex_lock(&qcgc_sweeper_state.lock);
+	qcgc_allocator_state.unswept_arenas = qcgc_arena_bag_add(
+			qcgc_allocator_state.unswept_arenas, arena);
+	qcgc_sweeper_state.sweeping = true;
+	pthread_cond_signal(&qcgc_sweeper_state.work_cond);
+	pthread_mutex_unlock(&qcgc_sweeper_state.lock);
+}
+
+void qcgc_sweeper_free_huge_block(object_t *object) {
+	pthread_mutex_lock(&qcgc_sweeper_state.lock);
+	qcgc_sweeper_state.huge_blocks = qcgc_object_stack_push(
+			qcgc_sweeper_state.huge_blocks, object);
+	pthread_cond_signal(&qcgc_sweeper_state.work_cond);
+	pthread_mutex_unlock(&qcgc_sweeper_state.lock);
+}
+
+bool qcgc_sweeper_step(void) {
+	pthread_mutex_lock(&qcgc_sweeper_state.lock);
+	if (qcgc_sweeper_state.free_blocks->count > 0 ||
+			qcgc_sweeper_state.empty_arenas->count > 0) {
+		publish();
+		pthread_mutex_unlock(&qcgc_sweeper_state.lock);
+		return true;
+	}
+
+	size_t count = qcgc_allocator_state.unswept_arenas->count;
+	if (count > 0) {
+		// Do not wait for the sweeper, sweep an arena ourselves
+		arena_t *arena = qcgc_allocator_state.unswept_arenas->items[count - 1];
+		qcgc_allocator_state.unswept_arenas = qcgc_arena_bag_remove_index(
+				qcgc_allocator_state.unswept_arenas, count - 1);
+		pthread_mutex_unlock(&qcgc_sweeper_state.lock);
+
+		if (qcgc_arena_sweep(arena)) {
+			qcgc_allocator_free_arena(arena);
+		}
+		return true;
+	}
+
+	if (qcgc_sweeper_state.busy > 0) {
+		pthread_cond_wait(&qcgc_sweeper_state.done_cond,
+				&qcgc_sweeper_state.lock);
+		pthread_mutex_unlock(&qcgc_sweeper_state.lock);
+		return true;
+	}
+
+	pthread_mutex_unlock(&qcgc_sweeper_state.lock);
+	return false;
+}
+
+QCGC_STATIC void *sweeper_main(void *arg) {
+	(void) arg;
+	// Only accessed by the sweeper thread
+	exp_free_list_t *free_blocks = qcgc_exp_free_list_create(16); // XXX
+
+	pthread_mutex_lock(&qcgc_sweeper_state.lock);
+	while (true) {
+		while (!qcgc_sweeper_state.shutdown && !have_work()) {
+			pthread_cond_wait(&qcgc_sweeper_state.work_cond,
+					&qcgc_sweeper_state.lock);
+		}
+		if (!have_work()) {
+			// Shutdown
+			break;
+		}
+
+		if (qcgc_sweeper_state.huge_blocks->count > 0) {
+			object_t *object = qcgc_object_stack_top(
+					qcgc_sweeper_state.huge_blocks);
+			qcgc_sweeper_state.huge_blocks = qcgc_object_stack_pop(
+					qcgc_sweeper_state.huge_blocks);
+			pthread_mutex_unlock(&qcgc_sweeper_state.lock);
+			free(object);
+			pthread_mutex_lock(&qcgc_sweeper_state.lock);
+			continue;
+		}
+
+		size_t count = qcgc_allocator_state.unswept_arenas->count;
+		arena_t *arena = qcgc_allocator_state.unswept_arenas->items[count - 1];
+		qcgc_allocator_state.unswept_arenas = qcgc_arena_bag_remove_index(
+				qcgc_allocator_state.unswept_arenas, count - 1);
+		qcgc_sweeper_state.busy++;
+		pthread_mutex_unlock(&qcgc_sweeper_state.lock);
+
+		bool empty = qcgc_arena_sweep_into(arena, &free_blocks);
+
+		pthread_mutex_lock(&qcgc_sweeper_state.lock);
+		if (empty) {
+			qcgc_sweeper_state.empty_arenas = qcgc_arena_bag_add(
+					qcgc_sweeper_state.empty_arenas, arena);
+		} else {
+			for (size_t i = 0; i < free_blocks->count; i++) {
+				qcgc_sweeper_state.free_blocks = qcgc_exp_free_list_add(
+						qcgc_sweeper_state.free_blocks, free_blocks->items[i]);
+			}
+		}
+		free_blocks->count = 0;
+		qcgc_sweeper_state.busy--;
+		pthread_cond_broadcast(&qcgc_sweeper_state.done_cond);
+	}
+	pthread_mutex_unlock(&qcgc_sweeper_state.lock);
+
+	free(free_blocks);
+	return NULL;
+}
+
+QCGC_STATIC bool have_work(void) {
+	return qcgc_sweeper_state.huge_blocks->count > 0 ||
+		qcgc_allocator_state.unswept_arenas->count > 0;
+}
+
+QCGC_STATIC void publish(void) {
+	for (size_t i = 0; i < qcgc_sweeper_state.free_blocks->count; i++) {
+		struct exp_free_list_item_s item =
+			qcgc_sweeper_state.free_blocks->items[i];
+		qcgc_fit_allocator_add(item.ptr, item.size);
+		qcgc_state.largest_free_block = MAX(qcgc_state.largest_free_block,
+				item.size);
+	}
+	qcgc_sweeper_state.free_blocks->count = 0;
+
+	for (size_t i = 0; i < qcgc_sweeper_state.empty_arenas->count; i++) {
+		qcgc_allocator_free_arena(qcgc_sweeper_state.empty_arenas->items[i]);
+	}
+	qcgc_sweeper_state.empty_arenas->count = 0;
+}
@@ -0,0 +1,69 @@
+/**
+ * @file	sweeper.h
+ */
+
+#pragma once
+
+#include "../qcgc.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "bag.h"
+
+/**
+ * @var qcgc_sweeper_state
+ *
+ * Background sweeper thread.
+ *
+ * The sweeper takes arenas from qcgc_allocator_state.unswept_arenas, sweeps
+ * them without touching the fit allocator and appends the resulting free
+ * blocks and empty arenas to the result lists. The mutator publishes these
+ * results to the allocator whenever it needs memory. The lock protects the
+ * unswept arenas and everything below it.
+ */
+struct qcgc_sweeper_state {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;		// Signaled when there is new work
+	pthread_cond_t done_cond;		// Broadcasted when an arena was swept
+	exp_free_list_t *free_blocks;	// Swept, not published yet
+	arena_bag_t *empty_arenas;		// Swept, not published yet
+	object_stack_t *huge_blocks;	// Dead huge blocks to free
+	size_t busy;					// Arenas currently swept by the sweeper
+	bool shutdown;
+	bool sweeping;					// Results of a sweep not published yet,
+									// only accessed by the mutator
+} qcgc_sweeper_state;
+
+/**
+ * Start sweeper thread, if enabled.
+ */
+void qcgc_sweeper_initialize(void);
+
+/**
+ * Finish all work and stop sweeper thread.
+ */
+void qcgc_sweeper_destroy(void);
+
+/**
+ * Hand arena to the sweeper thread.
+ *
+ * @param	arena	Arena to sweep
+ */
+void qcgc_sweeper_add_arena(arena_t *arena);
+
+/**
+ * Free huge block in the sweeper thread.
+ *
+ * @param	object	Dead huge block
+ */
+void qcgc_sweeper_free_huge_block(object_t *object);
+
+/**
+ * Publish results of the sweeper to the allocator, or sweep one arena in the
+ * calling thread if there are none, or wait for the sweeper.
+ *
+ * @return	false iff all arenas are swept and published
+ */
+bool qcgc_sweeper_step(void);
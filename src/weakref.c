@@ -1,64 +1,110 @@
 #include "weakref.h"
 
 #include <assert.h>
+#include <stdbool.h>
 
 #include "arena.h"
 #include "bag.h"
 #include "gc_state.h"
+#include "generation.h"
+#include "heap.h"
 #include "hugeblocktable.h"
+#include "mediumspace.h"
+
+QCGC_STATIC bool survives_sweep(cell_t *ptr);
 
 void update_weakrefs(void) {
+	// Called before the arenas are swept, so only black objects and white
+	// objects in the arena of the bump allocator (which is only pseudo-swept)
+	// survive
 	size_t i = 0;
 	while (i < qcgc_state.weakrefs->count) {
 		struct weakref_bag_item_s item = qcgc_state.weakrefs->items[i];
 		// Check whether weakref object itself was collected
 		// We know the weakref object is a normal object
-		switch (qcgc_arena_get_blocktype(
-					qcgc_arena_addr((cell_t *) item.weakrefobj),
-					qcgc_arena_cell_index((cell_t *) item.weakrefobj))) {
-			case BLOCK_EXTENT: // Fall through
-			case BLOCK_FREE:
-				// Weakref itself was collected, forget it
-				qcgc_state.weakrefs = qcgc_weakref_bag_remove_index(
-						qcgc_state.weakrefs, i);
-				continue;
-			case BLOCK_BLACK:
-			case BLOCK_WHITE:
-				// Weakref object is still valid, continue
-				break;
+		if (!survives_sweep((cell_t *) item.weakrefobj)) {
+			// Weakref itself was collected, forget it
+			qcgc_state.weakrefs = qcgc_weakref_bag_remove_index(
+					qcgc_state.weakrefs, i);
+			continue;
 		}
 
 		// Check whether the weakref target is still valid
 		object_t *points_to = *item.target;
-		if ((object_t *) qcgc_arena_addr((cell_t *) points_to) ==
-				points_to) {
+		bool valid;
+		// Only table lookups until the target is known to be our memory
+		if (points_to == NULL) {
+			valid = false;
+		} else if (qcgc_hbtable_has(points_to)) {
 			// Huge object
-			if (qcgc_hbtable_has(points_to)) {
-				// Still valid
-				i++;
-			} else {
-				// Invalid
-				*(item.target) = NULL;
-				qcgc_state.weakrefs = qcgc_weakref_bag_remove_index(
-						qcgc_state.weakrefs, i);
-			}
+			valid = qcgc_hbtable_is_marked(points_to);
+		} else if (qcgc_heap_state.outside_arenas == 0 &&
+				!qcgc_heap_contains(points_to) &&
+				!qcgc_medium_contains(points_to)) {
+			// Not in any arena, i.e. prebuilt
+			valid = true;
+		} else if (qcgc_medium_is_segment(
+					qcgc_arena_addr((cell_t *) points_to))) {
+			valid = qcgc_medium_is_marked(points_to);
 		} else {
 			// Normal object
-			switch (qcgc_arena_get_blocktype(
-						qcgc_arena_addr((cell_t *) points_to),
-						qcgc_arena_cell_index((cell_t *) points_to))) {
-				case BLOCK_BLACK: // Still valid
-				case BLOCK_WHITE:
-					i++;
-					break;
-				case BLOCK_EXTENT: // Fall through
-				case BLOCK_FREE:
-					// Invalid
-					*(item.target) = NULL;
-					qcgc_state.weakrefs = qcgc_weakref_bag_remove_index(
-							qcgc_state.weakrefs, i);
-					break;
-			}
+			valid = survives_sweep((cell_t *) points_to);
+		}
+
+		if (valid) {
+			i++;
+		} else {
+			*(item.target) = NULL;
+			qcgc_state.weakrefs = qcgc_weakref_bag_remove_index(
+					qcgc_state.weakrefs, i);
+		}
+	}
+}
+
+void update_young_weakrefs(void) {
+	// Called before the young arenas are swept by a minor collection, all
+	// bump allocators are reset, so only black young objects survive
+	size_t i = 0;
+	while (i < qcgc_state.weakrefs->count) {
+		struct weakref_bag_item_s item = qcgc_state.weakrefs->items[i];
+		if (qcgc_generation_is_young(item.weakrefobj) &&
+				!survives_sweep((cell_t *) item.weakrefobj)) {
+			// Weakref itself was collected, forget it
+			qcgc_state.weakrefs = qcgc_weakref_bag_remove_index(
+					qcgc_state.weakrefs, i);
+			continue;
+		}
+
+		object_t *points_to = *item.target;
+		if (points_to == NULL) {
+			// Target was cleared, forget the weakref like update_weakrefs
+			qcgc_state.weakrefs = qcgc_weakref_bag_remove_index(
+					qcgc_state.weakrefs, i);
+			continue;
+		}
+
+		// Old targets are always valid
+		if (qcgc_generation_is_young(points_to) &&
+				!survives_sweep((cell_t *) points_to)) {
+			*(item.target) = NULL;
+			qcgc_state.weakrefs = qcgc_weakref_bag_remove_index(
+					qcgc_state.weakrefs, i);
+		} else {
+			i++;
 		}
 	}
 }
+
+QCGC_STATIC bool survives_sweep(cell_t *ptr) {
+	arena_t *arena = qcgc_arena_addr(ptr);
+	switch (qcgc_arena_get_blocktype(arena, qcgc_arena_cell_index(ptr))) {
+		case BLOCK_BLACK:
+			return true;
+		case BLOCK_WHITE:
+			return qcgc_arena_addr(_qcgc_bump_allocator.ptr) == arena;
+		case BLOCK_EXTENT: // Fall through
+		case BLOCK_FREE:
+			return false;
+	}
+	return false;
+}
@@ -3,3 +3,4 @@
 #include "../qcgc.h"
 
 void update_weakrefs(void);
+void update_young_weakrefs(void);
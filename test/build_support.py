@@ -1,19 +1,30 @@
 from cffi import FFI
+import os
 
 ffi = FFI()
 
+# Arena size can be overridden to run the tests with other sizes
+arena_size_exp = int(os.environ.get("QCGC_ARENA_SIZE_EXP", 20))
+
 ################################################################################
 # config.h                                                                     #
 ################################################################################
 ffi.cdef("""
-        #define QCGC_ARENA_SIZE_EXP 20	// Between 16 (64kB) and 20 (1MB)
+        #define QCGC_ARENA_SIZE_EXP %d	// Between 16 (64kB) and 22 (4MB)
         #define QCGC_MARK_LIST_SEGMENT_SIZE 64
         #define QCGC_INC_MARK_MIN 64	// TODO: Tune for performance
         #define QCGC_LARGE_FREE_LIST_FIRST_EXP 5
+        #define QCGC_LARGE_FREE_LIST_SPLIT_EXP 3
         #define QCGC_LARGE_FREE_LIST_INIT_SIZE 4
         #define QCGC_SMALL_FREE_LIST_INIT_SIZE 16
         #define QCGC_LARGE_ALLOC_THRESHOLD_EXP 14
-        """)
+        #define QCGC_OS_PAGE_SIZE 4096
+        #define QCGC_FREE_ARENAS_RETAIN 2
+        #define QCGC_DECOMMIT_MIN_PAGES 4
+        #define QCGC_NURSERY_ARENAS 4
+        #define QCGC_GC_PERCENT 100
+        #define QCGC_INCMARK_CLOCK_INTERVAL 64
+        """ % arena_size_exp)
 
 ################################################################################
 # event_logger                                                                 #
@@ -43,6 +54,11 @@ ffi.cdef("""
 ffi.cdef("""
         #define QCGC_GRAY_FLAG 0x1
         #define QCGC_PREBUILT_OBJECT 0x2
+        #define QCGC_PINNED_FLAG 0x8
+        #define QCGC_FORWARDED_FLAG 0x10
+        #define QCGC_CARDS_FLAG 0x20
+        #define QCGC_LAYOUT_SHIFT 24
+        #define QCGC_LAYOUT_COUNT 256
 
         typedef struct object_s {
                 uint32_t flags;
@@ -66,6 +82,38 @@ ffi.cdef("""
         object_stack_t *qcgc_object_stack_pop(object_stack_t *stack);
         """)
 
+################################################################################
+# gray_stack                                                                   #
+################################################################################
+ffi.cdef("""
+        #define QCGC_GRAY_POOL_KEEP 16
+        #define QCGC_GRAY_STACK_LIMIT 16384
+
+        typedef struct gray_stack_s {
+                struct gray_stack_s *next;
+                size_t count;
+                size_t below;
+                object_t *items[QCGC_MARK_LIST_SEGMENT_SIZE];
+        } gray_stack_t;
+
+        struct qcgc_gray_pool {
+                gray_stack_t *free;
+                size_t free_count;
+                size_t segments;
+                size_t limit;
+                size_t peak;
+                ...;
+        } qcgc_gray_pool;
+
+        void qcgc_gray_pool_trim(void);
+        void qcgc_gray_stack_free(gray_stack_t *stack);
+        size_t qcgc_gray_stack_count(gray_stack_t *stack);
+        gray_stack_t *qcgc_gray_stack_push(gray_stack_t *stack, object_t *item);
+        bool qcgc_gray_stack_push_bounded(gray_stack_t **stack, object_t *item);
+        object_t *qcgc_gray_stack_top(gray_stack_t *stack);
+        gray_stack_t *qcgc_gray_stack_pop(gray_stack_t *stack);
+        """)
+
 ################################################################################
 # arena                                                                        #
 ################################################################################
@@ -88,10 +136,17 @@ ffi.cdef(""" const size_t qcgc_arena_size;
         cell_t *arena_cells(arena_t *arena);
         uint8_t *arena_mark_bitmap(arena_t *arena);
         uint8_t *arena_block_bitmap(arena_t *arena);
-        object_stack_t *arena_gray_stack(arena_t *arena);
+        gray_stack_t *arena_gray_stack(arena_t *arena);
+        uint8_t arena_young(arena_t *arena);
+        uint8_t arena_overflowed(arena_t *arena);
+        uint8_t *arena_decommitted(arena_t *arena);
 
         arena_t *qcgc_arena_create(void);
         void qcgc_arena_destroy(arena_t *arena);
+        bool qcgc_arena_decommit(cell_t *ptr, size_t cells);
+        void qcgc_arena_mark_committed(cell_t *ptr, size_t cells);
+        bool qcgc_arena_decommit_free(arena_t *arena);
+        void qcgc_arena_recommit(arena_t *arena);
 
         arena_t *qcgc_arena_addr(cell_t *);
         size_t qcgc_arena_cell_index(cell_t *);
@@ -109,8 +164,14 @@ ffi.cdef(""" const size_t qcgc_arena_size;
         size_t qcgc_arena_black_blocks(arena_t *arena);
 
         bool qcgc_arena_pseudo_sweep(arena_t *arena);
+        void qcgc_arena_unmark(arena_t *arena);
         bool qcgc_arena_sweep(arena_t *arena);
 
+        // Sweep kernels
+        void (*sweep_bitmaps)(arena_t *arena);
+        void sweep_bitmaps_generic(arena_t *arena);
+        void sweep_bitmaps_avx2(arena_t *arena);
+
         size_t qcgc_arena_sizeof(void);
         """)
 
@@ -158,23 +219,6 @@ ffi.cdef("""
         exp_free_list_t *qcgc_exp_free_list_remove_index(
                 exp_free_list_t *self, size_t index);
 
-        struct hbtable_entry_s {
-            object_t *object;
-            bool mark_flag;
-        };
-
-        typedef struct hbbucket_s {
-            size_t size;
-            size_t count;
-            struct hbtable_entry_s items[];
-        } hbbucket_t;
-
-        hbbucket_t *qcgc_hbbucket_create(size_t size);
-        hbbucket_t *qcgc_hbbucket_add(hbbucket_t *self,
-                struct hbtable_entry_s item);
-        hbbucket_t *qcgc_hbbucket_remove_index(
-                hbbucket_t *self, size_t index);
-
         struct weakref_bag_item_s {
                 object_t *weakrefobj;
                 object_t **target;
@@ -192,11 +236,20 @@ ffi.cdef("""
 # hugeblocktable                                                               #
 ################################################################################
 ffi.cdef("""
-        #define QCGC_HBTABLE_BUCKETS 61
+        #define QCGC_HBTABLE_INIT_SIZE 64
+
+        struct hbtable_entry_s {
+            object_t *object;
+            bool mark_flag;
+            size_t card_bytes;
+            uint8_t *cards;
+        };
 
         struct hbtable_s {
                 bool mark_flag_ref;
-                hbbucket_t *bucket[QCGC_HBTABLE_BUCKETS];
+                size_t size;
+                size_t count;
+                struct hbtable_entry_s *entries;
         } qcgc_hbtable;
 
         void qcgc_hbtable_initialize(void);
@@ -204,10 +257,92 @@ ffi.cdef("""
         void qcgc_hbtable_insert(object_t *object);
         bool qcgc_hbtable_mark(object_t *object);
         bool qcgc_hbtable_is_marked(object_t *object);
+        bool qcgc_hbtable_has(object_t *object);
+        struct hbtable_entry_s *qcgc_hbtable_entry(object_t *object);
         void qcgc_hbtable_sweep(void);
         size_t bucket(object_t *object);
         """)
 
+################################################################################
+# heap                                                                         #
+################################################################################
+ffi.cdef("""
+        #define QCGC_HUGE_PAGES_OFF 0
+        #define QCGC_HUGE_PAGES_TRANSPARENT 1
+        #define QCGC_HUGE_PAGES_EXPLICIT 2
+
+        struct qcgc_heap_state {
+            cell_t *base;
+            size_t size;
+            uint8_t *arena_table;
+            size_t next_free;
+            size_t outside_arenas;
+            size_t huge_pages;
+        } qcgc_heap_state;
+
+        void qcgc_heap_initialize(size_t size, size_t huge_pages);
+        void qcgc_heap_destroy(void);
+        arena_t *qcgc_heap_arena_commit(void);
+        void qcgc_heap_advise_huge_pages(arena_t *arena);
+        bool qcgc_heap_arena_release(arena_t *arena);
+        bool qcgc_heap_contains(void *ptr);
+        bool is_in_arena(void *addr);
+        """)
+
+################################################################################
+# mediumspace                                                                  #
+################################################################################
+ffi.cdef("""
+        #define QCGC_MEDIUM_PAGE_EXP 12
+        #define QCGC_MEDIUM_FIRST_PAGE 1
+
+        const size_t qcgc_medium_page_size;
+        const size_t qcgc_medium_pages;
+        const size_t qcgc_medium_max_size;
+
+        typedef struct medium_segment_s {
+            uintptr_t tag;
+            size_t free_pages;
+            uint8_t pages[...];
+            uint8_t cards[...];
+        } medium_segment_t;
+
+        struct qcgc_medium_state {
+            arena_bag_t *segments;
+        } qcgc_medium_state;
+
+        object_t *_qcgc_allocate_medium(size_t size);
+        object_t *qcgc_medium_allocate(size_t size);
+        bool qcgc_medium_mark(object_t *object);
+        bool qcgc_medium_is_marked(object_t *object);
+        void qcgc_medium_sweep(void);
+        bool qcgc_medium_is_segment(arena_t *arena);
+        """)
+
+################################################################################
+# generation                                                                   #
+################################################################################
+ffi.cdef("""
+        #define QCGC_GENERATIONAL_OFF 0
+        #define QCGC_GENERATIONAL_NURSERY 1
+        #define QCGC_GENERATIONAL_STICKY 2
+
+        struct qcgc_generation_state {
+            arena_bag_t *young_arenas;
+            object_stack_t *remembered_set;
+            exp_free_list_t *regions;
+            size_t allocated_cells;
+            size_t promoted_cells;
+        } qcgc_generation_state;
+
+        void qcgc_generation_add_young(arena_t *arena);
+        void qcgc_generation_forget(arena_t *arena);
+        void qcgc_generation_record(cell_t *ptr, size_t cells);
+        void qcgc_generation_remember(object_t *object);
+        void qcgc_generation_minor_collect(void);
+        bool qcgc_generation_is_young(object_t *object);
+        """)
+
 ################################################################################
 # gc_state                                                                     #
 ################################################################################
@@ -226,13 +361,35 @@ ffi.cdef("""
         struct qcgc_state {
                 object_stack_t *prebuilt_objects;
                 weakref_bag_t *weakrefs;
-                object_stack_t *gp_gray_stack;
+                gray_stack_t *gp_gray_stack;
                 size_t gray_stack_size;
+                bool gray_overflow;
                 gc_phase_t phase;
                 size_t cells_since_incmark;
                 size_t incmark_since_sweep;
                 size_t incmark_threshold;
                 size_t incmark_to_sweep;
+                size_t gc_percent;
+                size_t live_cells;
+                size_t heap_goal;
+                size_t mark_work;
+                size_t marked_objects;
+                size_t incmark_budget_ns;
+                size_t incmark_cursor;
+                size_t growth_policy;
+                size_t growth_fragmentation;
+                size_t mark_threads;
+                size_t mark_prefetch;
+                size_t lazy_sweep;
+                size_t background_sweep;
+                size_t free_arenas_retain;
+                size_t heap_reserve;
+                size_t huge_pages;
+                size_t generational;
+                size_t nursery_arenas;
+                size_t major_threshold;
+                size_t compaction;
+                size_t compaction_density;
                 size_t free_cells;
                 size_t largest_free_block;
         } qcgc_state;
@@ -246,12 +403,18 @@ ffi.cdef("""
         //
         const size_t qcgc_small_free_lists;
         const size_t qcgc_large_free_lists;
+        const size_t qcgc_large_free_list_split;
 
         // Access functions for state
         arena_bag_t *arenas(void);
         arena_bag_t *free_arenas(void);
+        arena_bag_t *decommitted_arenas(void);
+        arena_bag_t *unswept_arenas(void);
         linear_free_list_t *small_free_list(size_t index);
-        exp_free_list_t *large_free_list(size_t index);
+        exp_free_list_t *large_free_list(size_t index, size_t split);
+        uint64_t small_map(void);
+        uint64_t large_map(void);
+        uint64_t large_split_map(size_t index);
 
         void bump_ptr_reset(void);
         void qcgc_reset_bump_ptr(void);
@@ -260,6 +423,17 @@ ffi.cdef("""
         void qcgc_allocator_destroy(void);
         object_t *qcgc_fit_allocate(size_t bytes);
         void qcgc_fit_allocator_add(cell_t *ptr, size_t cells);
+        void qcgc_fit_allocator_empty_lists(void);
+        void qcgc_allocator_decommit_free_arenas(void);
+
+        #define QCGC_GROWTH_FIT 0
+        #define QCGC_GROWTH_BUMP_BLOCK 1
+        #define QCGC_GROWTH_FREE_ARENA 2
+        #define QCGC_GROWTH_NEW_ARENA 3
+        bool qcgc_allocator_should_grow(void);
+        size_t qcgc_allocator_heap_target(void);
+        size_t qcgc_allocator_cycle_budget(void);
+        size_t qcgc_allocator_fragmentation(void);
 
         // static functions
         size_t bytes_to_cells(size_t bytes);
@@ -270,11 +444,12 @@ ffi.cdef("""
         bool is_small(size_t cells);
         size_t small_index(size_t cells);
         size_t large_index(size_t cells);
+        size_t large_split_index(size_t index, size_t cells);
         size_t small_index_to_cells(size_t index);
+        size_t large_split_index_to_cells(size_t index, size_t split);
 
         cell_t *fit_allocator_small_first_fit(size_t index, size_t cells);
-        cell_t *fit_allocator_large_fit(size_t index, size_t cells);
-        cell_t *fit_allocator_large_first_fit(size_t index, size_t cells);
+        cell_t *fit_allocator_large_fit(size_t cells);
 
         bool valid_block(cell_t *ptr, size_t cells);
         """)
@@ -286,18 +461,34 @@ ffi.cdef("""
         struct qcgc_bump_allocator {
                 cell_t *ptr;
                 cell_t *end;
+                cell_t *start;
         } _qcgc_bump_allocator;
 
         void qcgc_initialize(void);
         void qcgc_destroy(void);
         void qcgc_write(object_t *object);
+        void _qcgc_write_slowpath(object_t *object);
+        void qcgc_write_index(object_t *object, size_t offset);
+        void _qcgc_write_index_slowpath(object_t *object, size_t offset);
         object_t *qcgc_allocate(size_t size);
         void qcgc_collect(void);
+        void qcgc_minor_collect(void);
+        bool qcgc_do_work(uint64_t budget_ns);
+        void qcgc_pin(object_t *object);
+        void qcgc_unpin(object_t *object);
+        void qcgc_register_layout(uint32_t layout, uint64_t bitmap);
+        void qcgc_set_layout(object_t *object, uint32_t layout);
 
         void qcgc_push_root(object_t *object);
         void qcgc_pop_root(size_t count);
 
         object_t *_qcgc_allocate_large(size_t bytes);
+
+        void qcgc_register_thread(void);
+        void qcgc_unregister_thread(void);
+        void qcgc_enter_native(void);
+        void qcgc_leave_native(void);
+        void qcgc_safepoint(void);
         """)
 
 ################################################################################
@@ -307,6 +498,11 @@ ffi.cdef("""
         void qcgc_mark(void);
         void qcgc_incmark(void);
         void qcgc_sweep(void);
+        void qcgc_pacer_update(void);
+        bool qcgc_lazy_sweep_step(void);
+        void qcgc_lazy_sweep_finish(void);
+        bool qcgc_collector_has_work(void);
+        void qcgc_push_arena_object(arena_t *arena, object_t *object);
         """)
 
 ################################################################################
@@ -316,6 +512,42 @@ ffi.cdef("""
         void qcgc_register_weakref(object_t *weakrefobj, object_t **target);
         """)
 
+################################################################################
+# layout                                                                       #
+################################################################################
+ffi.cdef("""
+        struct qcgc_layout_state {
+                uint64_t bitmaps[256];
+        } qcgc_layout_state;
+        """)
+
+################################################################################
+# compaction                                                                   #
+################################################################################
+ffi.cdef("""
+        struct qcgc_compaction_state {
+                size_t evacuated_arenas;
+                size_t evacuated_objects;
+                size_t evacuated_cells;
+        } qcgc_compaction_state;
+
+        void qcgc_compact(void);
+        size_t qcgc_compaction_live_cells(arena_t *arena, bool *pinned);
+        """)
+
+################################################################################
+# cards                                                                        #
+################################################################################
+ffi.cdef("""
+        #define QCGC_CARD_SIZE_EXP 9
+        #define QCGC_DIRTY_CARD_CACHE 256
+
+        uintptr_t _qcgc_dirty_cards[QCGC_DIRTY_CARD_CACHE];
+
+        bool qcgc_cards_mark(object_t *object, size_t offset);
+        void qcgc_cards_trace(object_t *object, void (*visit)(object_t *object));
+        """)
+
 ################################################################################
 # utilities                                                                    #
 ################################################################################
@@ -336,6 +568,8 @@ ffi.cdef("""
         void _set_type_id(object_t *obj, uint32_t id);
         uint32_t _get_type_id(object_t *obj);
 
+        bool _cpu_supports_avx2(void);
+
         typedef enum mark_color {
             MARK_COLOR_WHITE,
             MARK_COLOR_LIGHT_GRAY,
@@ -356,6 +590,7 @@ ffi.cdef("""
 ffi.set_source("support",
         """
         #include "../config.h"
+        #include <stdbool.h>
         #include <stddef.h>
         #include <stdint.h>
 
@@ -364,6 +599,11 @@ ffi.set_source("support",
         #define QCGC_GRAY_FLAG (1<<0)
         #define QCGC_PREBUILT_OBJECT (1<<1)
         #define QCGC_PREBUILT_REGISTERED (1<<2)
+        #define QCGC_PINNED_FLAG (1<<3)
+        #define QCGC_FORWARDED_FLAG (1<<4)
+        #define QCGC_CARDS_FLAG (1<<5)
+        #define QCGC_LAYOUT_SHIFT 24
+        #define QCGC_LAYOUT_COUNT (1<<(32 - QCGC_LAYOUT_SHIFT))
 
         typedef struct object_s {
                 uint32_t flags;
@@ -371,16 +611,19 @@ ffi.set_source("support",
 
         typedef uint8_t cell_t[16];
 
-        struct qcgc_shadowstack {
+        extern __thread struct qcgc_shadowstack {
                 object_t **top;
                 object_t **base;
         } _qcgc_shadowstack;
 
-        struct qcgc_bump_allocator {
+        extern __thread struct qcgc_bump_allocator {
             cell_t *ptr;
             cell_t *end;
+            cell_t *start;
         } _qcgc_bump_allocator;
 
+        extern uintptr_t _qcgc_dirty_cards[QCGC_DIRTY_CARD_CACHE];
+
         void qcgc_initialize(void);
         void qcgc_destroy(void);
         object_t *qcgc_allocate(size_t size);
@@ -388,8 +631,22 @@ ffi.set_source("support",
         void qcgc_push_root(object_t *object);
         void qcgc_pop_root(size_t count);
         void qcgc_write(object_t *object);
+        void _qcgc_write_slowpath(object_t *object);
+        void qcgc_write_index(object_t *object, size_t offset);
+        void _qcgc_write_index_slowpath(object_t *object, size_t offset);
         void qcgc_collect(void);
+        void qcgc_minor_collect(void);
+        bool qcgc_do_work(uint64_t budget_ns);
+        void qcgc_pin(object_t *object);
+        void qcgc_unpin(object_t *object);
+        void qcgc_register_layout(uint32_t layout, uint64_t bitmap);
+        void qcgc_set_layout(object_t *object, uint32_t layout);
         void qcgc_register_weakref(object_t *weakrefobj, object_t **target);
+        void qcgc_register_thread(void);
+        void qcgc_unregister_thread(void);
+        void qcgc_enter_native(void);
+        void qcgc_leave_native(void);
+        void qcgc_safepoint(void);
 
 
 /******************************************************************************/
@@ -415,6 +672,43 @@ ffi.set_source("support",
         __attribute__ ((warn_unused_result))
         object_stack_t *qcgc_object_stack_pop(object_stack_t *stack);
 
+/******************************************************************************/
+        // gray_stack.h
+        #include <pthread.h>
+
+        typedef struct gray_stack_s {
+                struct gray_stack_s *next;
+                size_t count;
+                size_t below;
+                object_t *items[QCGC_MARK_LIST_SEGMENT_SIZE];
+        } gray_stack_t;
+
+        struct qcgc_gray_pool {
+                pthread_spinlock_t lock;
+                gray_stack_t *free;
+                size_t free_count;
+                size_t segments;
+                size_t limit;
+                size_t peak;
+        } qcgc_gray_pool;
+
+        void qcgc_gray_pool_initialize(void);
+        void qcgc_gray_pool_destroy(void);
+        void qcgc_gray_pool_trim(void);
+        void qcgc_gray_stack_free(gray_stack_t *stack);
+        size_t qcgc_gray_stack_count(gray_stack_t *stack);
+
+        __attribute__ ((warn_unused_result))
+        gray_stack_t *qcgc_gray_stack_push(gray_stack_t *stack, object_t *item);
+
+        __attribute__ ((warn_unused_result))
+        bool qcgc_gray_stack_push_bounded(gray_stack_t **stack, object_t *item);
+
+        object_t *qcgc_gray_stack_top(gray_stack_t *stack);
+
+        __attribute__ ((warn_unused_result))
+        gray_stack_t *qcgc_gray_stack_pop(gray_stack_t *stack);
+
 /******************************************************************************/
         // arena.h
         #include <stdbool.h>
@@ -428,14 +722,27 @@ ffi.set_source("support",
         typedef union {
             struct {
                 union {
-                    object_stack_t *gray_stack;
+                    gray_stack_t *gray_stack;
+                    uintptr_t medium_tag;
                     uint8_t block_bitmap[QCGC_ARENA_BITMAP_SIZE];
                 };
-                uint8_t mark_bitmap[QCGC_ARENA_BITMAP_SIZE];
+                union {
+                    struct {
+                        uint8_t young;
+                        uint8_t overflowed;
+                        uint8_t decommitted[QCGC_ARENA_SIZE / QCGC_OS_PAGE_SIZE / 8];
+                    };
+                    uint8_t mark_bitmap[QCGC_ARENA_BITMAP_SIZE];
+                };
             };
             cell_t cells[QCGC_ARENA_CELLS_COUNT];
         } arena_t;
 
+        #define QCGC_MEDIUM_PAGE_SIZE (1<<QCGC_MEDIUM_PAGE_EXP)
+        #define QCGC_MEDIUM_PAGES (1<<(QCGC_ARENA_SIZE_EXP - QCGC_MEDIUM_PAGE_EXP))
+        #define QCGC_MEDIUM_MAX_SIZE ((QCGC_MEDIUM_PAGES - 1) * QCGC_MEDIUM_PAGE_SIZE)
+        #define QCGC_MEDIUM_CARDS (1<<(QCGC_ARENA_SIZE_EXP - QCGC_CARD_SIZE_EXP))
+
         typedef enum blocktype {
             BLOCK_EXTENT,
             BLOCK_FREE,
@@ -445,10 +752,18 @@ ffi.set_source("support",
 
         arena_t *qcgc_arena_create(void);
         void qcgc_arena_destroy(arena_t *arena);
+        bool qcgc_arena_decommit(cell_t *ptr, size_t cells);
+        void qcgc_arena_mark_committed(cell_t *ptr, size_t cells);
+        bool qcgc_arena_decommit_free(arena_t *arena);
+        void qcgc_arena_recommit(arena_t *arena);
         void qcgc_arena_mark_allocated(cell_t *ptr, size_t cells);
         void qcgc_arena_mark_free(cell_t *ptr);
         bool qcgc_arena_sweep(arena_t *arena);
         bool qcgc_arena_pseudo_sweep(arena_t *arena);
+        void qcgc_arena_unmark(arena_t *arena);
+        void (*sweep_bitmaps)(arena_t *arena);
+        void sweep_bitmaps_generic(arena_t *arena);
+        void sweep_bitmaps_avx2(arena_t *arena);
 
         arena_t *qcgc_arena_addr(cell_t *ptr);
         size_t qcgc_arena_cell_index(cell_t *ptr);
@@ -484,11 +799,6 @@ ffi.set_source("support",
             size_t size;
         };
 
-        struct hbtable_entry_s {
-            object_t *object;
-            bool mark_flag;
-        };
-
         struct weakref_bag_item_s {
             object_t *weakrefobj;
             object_t **target;
@@ -497,16 +807,24 @@ ffi.set_source("support",
         DECLARE_BAG(arena_bag, arena_t *);
         DECLARE_BAG(linear_free_list, cell_t *);
         DECLARE_BAG(exp_free_list, struct exp_free_list_item_s);
-        DECLARE_BAG(hbbucket, struct hbtable_entry_s);
         DECLARE_BAG(weakref_bag, struct weakref_bag_item_s);
 
 /******************************************************************************/
         // hugeblocktable.h
-        #define QCGC_HBTABLE_BUCKETS 61
+        #define QCGC_HBTABLE_INIT_SIZE 64
+
+        struct hbtable_entry_s {
+            object_t *object;
+            bool mark_flag;
+            size_t card_bytes;
+            uint8_t *cards;
+        };
 
         struct hbtable_s {
                 bool mark_flag_ref;
-                hbbucket_t *bucket[QCGC_HBTABLE_BUCKETS];
+                size_t size;
+                size_t count;
+                struct hbtable_entry_s *entries;
         } qcgc_hbtable;
 
         void qcgc_hbtable_initialize(void);
@@ -514,9 +832,80 @@ ffi.set_source("support",
         void qcgc_hbtable_insert(object_t *object);
         bool qcgc_hbtable_mark(object_t *object);
         bool qcgc_hbtable_is_marked(object_t *object);
+        bool qcgc_hbtable_has(object_t *object);
+        struct hbtable_entry_s *qcgc_hbtable_entry(object_t *object);
         void qcgc_hbtable_sweep(void);
         size_t bucket(object_t *object);
 
+/******************************************************************************/
+        // heap.h
+        #define QCGC_HUGE_PAGES_OFF 0
+        #define QCGC_HUGE_PAGES_TRANSPARENT 1
+        #define QCGC_HUGE_PAGES_EXPLICIT 2
+
+        struct qcgc_heap_state {
+            cell_t *base;
+            size_t size;
+            uint8_t *arena_table;
+            size_t next_free;
+            size_t outside_arenas;
+            size_t huge_pages;
+        } qcgc_heap_state;
+
+        void qcgc_heap_initialize(size_t size, size_t huge_pages);
+        void qcgc_heap_destroy(void);
+        arena_t *qcgc_heap_arena_commit(void);
+        void qcgc_heap_advise_huge_pages(arena_t *arena);
+        bool qcgc_heap_arena_release(arena_t *arena);
+        bool qcgc_heap_contains(void *ptr);
+
+/******************************************************************************/
+        // signal_handler.c
+        bool is_in_arena(void *addr);
+
+/******************************************************************************/
+        // mediumspace.h
+        #define QCGC_MEDIUM_FIRST_PAGE 1
+
+        typedef struct medium_segment_s {
+            uintptr_t tag;
+            size_t free_pages;
+            uint8_t pages[QCGC_MEDIUM_PAGES];
+            uint8_t cards[QCGC_MEDIUM_CARDS / 8];
+        } medium_segment_t;
+
+        struct qcgc_medium_state {
+            arena_bag_t *segments;
+        } qcgc_medium_state;
+
+        object_t *_qcgc_allocate_medium(size_t size);
+        object_t *qcgc_medium_allocate(size_t size);
+        bool qcgc_medium_mark(object_t *object);
+        bool qcgc_medium_is_marked(object_t *object);
+        void qcgc_medium_sweep(void);
+        bool qcgc_medium_is_segment(arena_t *arena);
+
+/******************************************************************************/
+        // generation.h
+        #define QCGC_GENERATIONAL_OFF 0
+        #define QCGC_GENERATIONAL_NURSERY 1
+        #define QCGC_GENERATIONAL_STICKY 2
+
+        struct qcgc_generation_state {
+            arena_bag_t *young_arenas;
+            object_stack_t *remembered_set;
+            exp_free_list_t *regions;
+            size_t allocated_cells;
+            size_t promoted_cells;
+        } qcgc_generation_state;
+
+        void qcgc_generation_add_young(arena_t *arena);
+        void qcgc_generation_forget(arena_t *arena);
+        void qcgc_generation_record(cell_t *ptr, size_t cells);
+        void qcgc_generation_remember(object_t *object);
+        void qcgc_generation_minor_collect(void);
+        bool qcgc_generation_is_young(object_t *object);
+
 /******************************************************************************/
         // gc_state.h
         typedef enum gc_phase {
@@ -528,13 +917,35 @@ ffi.set_source("support",
         struct qcgc_state {
                 object_stack_t *prebuilt_objects;
                 weakref_bag_t *weakrefs;
-                object_stack_t *gp_gray_stack;
+                gray_stack_t *gp_gray_stack;
                 size_t gray_stack_size;
+                bool gray_overflow;
                 gc_phase_t phase;
                 size_t cells_since_incmark;
                 size_t incmark_since_sweep;
                 size_t incmark_threshold;
                 size_t incmark_to_sweep;
+                size_t gc_percent;
+                size_t live_cells;
+                size_t heap_goal;
+                size_t mark_work;
+                size_t marked_objects;
+                size_t incmark_budget_ns;
+                size_t incmark_cursor;
+                size_t growth_policy;
+                size_t growth_fragmentation;
+                size_t mark_threads;
+                size_t mark_prefetch;
+                size_t lazy_sweep;
+                size_t background_sweep;
+                size_t free_arenas_retain;
+                size_t heap_reserve;
+                size_t huge_pages;
+                size_t generational;
+                size_t nursery_arenas;
+                size_t major_threshold;
+                size_t compaction;
+                size_t compaction_density;
                 size_t free_cells;
                 size_t largest_free_block;
         } qcgc_state;
@@ -543,14 +954,22 @@ ffi.set_source("support",
         // allocator.h
         #define QCGC_LARGE_FREE_LISTS (QCGC_LARGE_ALLOC_THRESHOLD_EXP - QCGC_LARGE_FREE_LIST_FIRST_EXP - 4 + 1)
 
+        #define QCGC_LARGE_FREE_LIST_SPLIT (1<<QCGC_LARGE_FREE_LIST_SPLIT_EXP)
+
         #define QCGC_SMALL_FREE_LISTS ((1<<QCGC_LARGE_FREE_LIST_FIRST_EXP) - 1)
 
         struct qcgc_allocator_state {
             arena_bag_t *arenas;
             arena_bag_t *free_arenas;
+            arena_bag_t *decommitted_arenas;
+            arena_bag_t *unswept_arenas;
             struct fit_state {
                 linear_free_list_t *small_free_list[QCGC_SMALL_FREE_LISTS];
-                exp_free_list_t *large_free_list[QCGC_LARGE_FREE_LISTS];
+                exp_free_list_t *large_free_list[QCGC_LARGE_FREE_LISTS]
+                    [QCGC_LARGE_FREE_LIST_SPLIT];
+                uint64_t small_map;
+                uint64_t large_map;
+                uint64_t large_split_map[QCGC_LARGE_FREE_LISTS];
             } fit_state;
         } qcgc_allocator_state;
 
@@ -559,19 +978,57 @@ ffi.set_source("support",
         object_t *qcgc_fit_allocate(size_t bytes);
         void qcgc_fit_allocator_empty_lists(void);
         void qcgc_fit_allocator_add(cell_t *ptr, size_t cells);
+        void qcgc_fit_allocator_empty_lists(void);
         void qcgc_bump_allocator_renew_block(size_t size, bool force);
+        void qcgc_allocator_decommit_free_arenas(void);
         void qcgc_reset_bump_ptr(void);
 
+        #define QCGC_GROWTH_FIT 0
+        #define QCGC_GROWTH_BUMP_BLOCK 1
+        #define QCGC_GROWTH_FREE_ARENA 2
+        #define QCGC_GROWTH_NEW_ARENA 3
+        bool qcgc_allocator_should_grow(void);
+        size_t qcgc_allocator_heap_target(void);
+        size_t qcgc_allocator_cycle_budget(void);
+        size_t qcgc_allocator_fragmentation(void);
+
 /******************************************************************************/
         // collector.h
         void qcgc_mark(void);
         void qcgc_incmark(void);
         void qcgc_sweep(void);
+        void qcgc_pacer_update(void);
+        bool qcgc_lazy_sweep_step(void);
+        void qcgc_lazy_sweep_finish(void);
+        bool qcgc_collector_has_work(void);
+        void qcgc_push_arena_object(arena_t *arena, object_t *object);
 
 /******************************************************************************/
         // weakref.h
         void qcgc_register_weakref(object_t *weakrefobj, object_t **target);
 
+/******************************************************************************/
+        // layout.h
+        struct qcgc_layout_state {
+                uint64_t bitmaps[QCGC_LAYOUT_COUNT];
+        } qcgc_layout_state;
+
+/******************************************************************************/
+        // compaction.h
+        struct qcgc_compaction_state {
+                size_t evacuated_arenas;
+                size_t evacuated_objects;
+                size_t evacuated_cells;
+        } qcgc_compaction_state;
+
+        void qcgc_compact(void);
+        size_t qcgc_compaction_live_cells(arena_t *arena, bool *pinned);
+
+/******************************************************************************/
+        // cards.h
+        bool qcgc_cards_mark(object_t *object, size_t offset);
+        void qcgc_cards_trace(object_t *object, void (*visit)(object_t *object));
+
 /******************************************************************************/
 /******************************************************************************/
 /******************************************************************************/
@@ -583,6 +1040,11 @@ ffi.set_source("support",
         const size_t qcgc_arena_cells_count = QCGC_ARENA_CELLS_COUNT;
         const size_t qcgc_arena_first_cell_index = QCGC_ARENA_FIRST_CELL_INDEX;
 
+        // mediumspace.h - Macro replacements
+        const size_t qcgc_medium_page_size = QCGC_MEDIUM_PAGE_SIZE;
+        const size_t qcgc_medium_pages = QCGC_MEDIUM_PAGES;
+        const size_t qcgc_medium_max_size = QCGC_MEDIUM_MAX_SIZE;
+
         // event_logger.h - Macro replacements
         const char *logfile = LOGFILE;
 
@@ -592,6 +1054,7 @@ ffi.set_source("support",
         // allocator.h - Macro replacements
         const size_t qcgc_small_free_lists = QCGC_SMALL_FREE_LISTS;
         const size_t qcgc_large_free_lists = QCGC_LARGE_FREE_LISTS;
+        const size_t qcgc_large_free_list_split = QCGC_LARGE_FREE_LIST_SPLIT;
 
         // allocator.c internals prototypes
         size_t bytes_to_cells(size_t bytes);
@@ -602,11 +1065,12 @@ ffi.set_source("support",
         bool is_small(size_t cells);
         size_t small_index(size_t cells);
         size_t large_index(size_t cells);
+        size_t large_split_index(size_t index, size_t cells);
         size_t small_index_to_cells(size_t index);
+        size_t large_split_index_to_cells(size_t index, size_t split);
 
         cell_t *fit_allocator_small_first_fit(size_t index, size_t cells);
-        cell_t *fit_allocator_large_fit(size_t index, size_t cells);
-        cell_t *fit_allocator_large_first_fit(size_t index, size_t cells);
+        cell_t *fit_allocator_large_fit(size_t cells);
 
         bool valid_block(cell_t *ptr, size_t cells);
 
@@ -633,10 +1097,22 @@ ffi.set_source("support",
             return arena->block_bitmap;
         }
 
-        object_stack_t *arena_gray_stack(arena_t *arena) {
+        gray_stack_t *arena_gray_stack(arena_t *arena) {
             return arena->gray_stack;
         }
 
+        uint8_t arena_young(arena_t *arena) {
+            return arena->young;
+        }
+
+        uint8_t arena_overflowed(arena_t *arena) {
+            return arena->overflowed;
+        }
+
+        uint8_t *arena_decommitted(arena_t *arena) {
+            return arena->decommitted;
+        }
+
         size_t qcgc_arena_sizeof(void) {
             return sizeof(arena_t);
         }
@@ -650,12 +1126,32 @@ ffi.set_source("support",
             return qcgc_allocator_state.free_arenas;
         }
 
+        arena_bag_t *decommitted_arenas(void) {
+            return qcgc_allocator_state.decommitted_arenas;
+        }
+
+        arena_bag_t *unswept_arenas(void) {
+            return qcgc_allocator_state.unswept_arenas;
+        }
+
         linear_free_list_t *small_free_list(size_t index) {
             return qcgc_allocator_state.fit_state.small_free_list[index];
         }
 
-        exp_free_list_t *large_free_list(size_t index) {
-            return qcgc_allocator_state.fit_state.large_free_list[index];
+        exp_free_list_t *large_free_list(size_t index, size_t split) {
+            return qcgc_allocator_state.fit_state.large_free_list[index][split];
+        }
+
+        uint64_t small_map(void) {
+            return qcgc_allocator_state.fit_state.small_map;
+        }
+
+        uint64_t large_map(void) {
+            return qcgc_allocator_state.fit_state.large_map;
+        }
+
+        uint64_t large_split_map(size_t index) {
+            return qcgc_allocator_state.fit_state.large_split_map[index];
         }
 
         void bump_ptr_reset(void) {
@@ -712,6 +1208,12 @@ ffi.set_source("support",
             return ((myobject_t *) object)->type_id;
         }
 
+        bool _cpu_supports_avx2(void);
+
+        bool _cpu_supports_avx2(void) {
+            return __builtin_cpu_supports("avx2");
+        }
+
         typedef enum mark_color {
             MARK_COLOR_WHITE,
             MARK_COLOR_LIGHT_GRAY,
@@ -751,10 +1253,31 @@ ffi.set_source("support",
             }
         }
 
+        void qcgc_trace_slots_cb(object_t *object,
+                void (*visit)(object_t **)) {
+            myobject_t *o = (myobject_t *) object;
+            for (size_t i = 0; i < o->type_id; i++) {
+                visit((object_t **) &o->refs[i]);
+            }
+        }
+
+        void qcgc_trace_range_cb(object_t *object, size_t start, size_t end,
+                void (*visit)(object_t *)) {
+            myobject_t *o = (myobject_t *) object;
+            for (size_t i = 0; i < o->type_id; i++) {
+                size_t offset = offsetof(myobject_t, refs) +
+                    i * sizeof(myobject_t *);
+                if (offset >= start && offset < end) {
+                    visit((object_t *)o->refs[i]);
+                }
+            }
+        }
+
         """, sources=['lib.c'],
         extra_compile_args=['-Wall', '-Wextra', '--coverage', '-std=gnu11',
-                '-UNDEBUG', '-DTESTING', '-O0', '-g'],
-        extra_link_args=['--coverage', '-lrt'])
+                '-UNDEBUG', '-DTESTING', '-O0', '-g',
+                '-DQCGC_ARENA_SIZE_EXP=%d' % arena_size_exp],
+        extra_link_args=['--coverage', '-lrt', '-lpthread'])
 
 if __name__ == "__main__":
     ffi.compile()
@@ -2,9 +2,17 @@
 #include "../src/allocator.c"
 #include "../src/arena.c"
 #include "../src/bag.c"
+#include "../src/cards.c"
 #include "../src/collector.c"
+#include "../src/compaction.c"
 #include "../src/event_logger.c"
+#include "../src/generation.c"
+#include "../src/gray_stack.c"
+#include "../src/heap.c"
 #include "../src/hugeblocktable.c"
+#include "../src/mediumspace.c"
 #include "../src/object_stack.c"
+#include "../src/safepoint.c"
 #include "../src/signal_handler.c"
+#include "../src/sweeper.c"
 #include "../src/weakref.c"
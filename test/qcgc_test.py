@@ -3,6 +3,9 @@ import unittest
 
 class QCGCTest(unittest.TestCase):
     header_size = ffi.sizeof("myobject_t")
+    # Objects of 1/256 arena, as long as they are not medium objects
+    arena_object_size = min(lib.qcgc_arena_size // 256,
+            2**lib.QCGC_LARGE_ALLOC_THRESHOLD_EXP - 2 * header_size)
 
     def setUp(self):
         lib.qcgc_initialize()
@@ -58,11 +61,16 @@ class QCGCTest(unittest.TestCase):
         assert ffi.cast("myobject_t *", obj).type_id > index
         ffi.cast("myobject_t *", obj).refs[index] = ffi.cast("myobject_t *", ref)
 
+    def gray_stack_items(self, stack):
+        """All objects of a segmented gray stack, bottom first"""
+        items = list()
+        while stack != ffi.NULL:
+            items = [stack.items[i] for i in range(stack.count)] + items
+            stack = stack.next
+        return items
+
     def gp_gray_stack_has(self, obj):
-        for i in range(lib.qcgc_state.gp_gray_stack.count):
-            if (lib.qcgc_state.gp_gray_stack.items[i] == obj):
-                return True
-        return False
+        return obj in self.gray_stack_items(lib.qcgc_state.gp_gray_stack)
 
     def bump_allocate(self, size):
         if self.bump_remaining_cells() < lib.bytes_to_cells(size):
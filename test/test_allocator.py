@@ -14,8 +14,9 @@ class AllocatorTest(QCGCTest):
             l = lib.small_free_list(i)
             self.assertNotEqual(ffi.NULL, l)
         for i in range(lib.qcgc_large_free_lists):
-            l = lib.large_free_list(i)
-            self.assertNotEqual(ffi.NULL, l)
+            for j in range(lib.qcgc_large_free_list_split):
+                l = lib.large_free_list(i, j)
+                self.assertNotEqual(ffi.NULL, l)
 
     def test_large_allocate(self):
         p = self.allocate(2**22)
@@ -4,10 +4,15 @@ import unittest
 
 class AllocatorSwitchTest(QCGCTest):
     def test_simple_switch(self):
+        # Chain the objects, one root per cell does not fit on the shadow
+        # stack for large arenas
         objs = list()
         for _ in range(lib.qcgc_arena_cells_count - lib.qcgc_arena_first_cell_index - 1):
-            o = self.allocate(1)
-            self.push_root(o)
+            o = self.allocate_ref(1)
+            if objs:
+                self.set_ref(objs[-1], 0, o)
+            else:
+                self.push_root(o)
             objs.append(o)
         #
         for o in objs:
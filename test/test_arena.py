@@ -112,6 +112,49 @@ class ArenaTestCase(QCGCTest):
         lib.qcgc_arena_mark_free(p)
         self.assertFalse(lib.qcgc_arena_is_coalesced(arena))
 
+    def test_is_coalesced_across_words(self):
+        arena = lib.qcgc_arena_create()
+        i = lib.qcgc_arena_first_cell_index
+        # New arenas are one free block
+        self.set_blocktype(ffi.addressof(lib.arena_cells(arena)[i]),
+                lib.BLOCK_WHITE)
+
+        def check(layout, coalesced):
+            for b in layout:
+                p = ffi.addressof(lib.arena_cells(arena)[i + b[0]])
+                self.set_blocktype(p, b[1])
+            self.assertEqual(lib.qcgc_arena_is_coalesced(arena), coalesced)
+            for b in layout:
+                p = ffi.addressof(lib.arena_cells(arena)[i + b[0]])
+                self.set_blocktype(p, lib.BLOCK_EXTENT)
+
+        check([(63, lib.BLOCK_FREE), (64, lib.BLOCK_FREE)], False)
+        check([(10, lib.BLOCK_FREE), (200, lib.BLOCK_FREE)], False)
+        check([(10, lib.BLOCK_FREE), (130, lib.BLOCK_WHITE),
+            (200, lib.BLOCK_FREE)], True)
+        check([(0, lib.BLOCK_FREE), (63, lib.BLOCK_BLACK),
+            (64, lib.BLOCK_FREE), (127, lib.BLOCK_WHITE),
+            (128, lib.BLOCK_FREE)], True)
+
+    def test_block_counting_across_words(self):
+        arena = lib.qcgc_arena_create()
+        i = lib.qcgc_arena_first_cell_index
+
+        counts = {lib.BLOCK_BLACK: 0, lib.BLOCK_WHITE: 0, lib.BLOCK_FREE: 0}
+        types = [lib.BLOCK_BLACK, lib.BLOCK_WHITE, lib.BLOCK_FREE]
+        for j in range(0, lib.qcgc_arena_cells_count - i, 37):
+            t = types[j % 3]
+            p = ffi.addressof(lib.arena_cells(arena)[i + j])
+            self.set_blocktype(p, t)
+            counts[t] += 1
+
+        self.assertEqual(lib.qcgc_arena_black_blocks(arena),
+                counts[lib.BLOCK_BLACK])
+        self.assertEqual(lib.qcgc_arena_white_blocks(arena),
+                counts[lib.BLOCK_WHITE])
+        self.assertEqual(lib.qcgc_arena_free_blocks(arena),
+                counts[lib.BLOCK_FREE])
+
     ############################################################################
     # Misc                                                                     #
     ############################################################################
@@ -0,0 +1,92 @@
+from support import lib,ffi
+from qcgc_test import QCGCTest
+import os
+import unittest
+
+class BackgroundSweepTestCase(QCGCTest):
+    def setUp(self):
+        os.environ["QCGC_BACKGROUND_SWEEP"] = "1"
+        super(BackgroundSweepTestCase, self).setUp()
+
+    def tearDown(self):
+        super(BackgroundSweepTestCase, self).tearDown()
+        del os.environ["QCGC_BACKGROUND_SWEEP"]
+
+    def fill_arenas(self):
+        """Spread alive and dead objects over several arenas"""
+        alive = list()
+        dead = list()
+        for i in range(600):
+            p = self.allocate(self.arena_object_size)
+            if i % 2 == 0:
+                self.push_root(p)
+                alive.append(p)
+            else:
+                dead.append(p)
+        self.assertGreater(lib.arenas().count, 2)
+        return alive, dead
+
+    def test_knob(self):
+        self.assertEqual(lib.qcgc_state.background_sweep, 1)
+
+    def test_sweep(self):
+        alive, dead = self.fill_arenas()
+        lib.bump_ptr_reset()
+        lib.qcgc_mark()
+        lib.qcgc_sweep()
+        self.assertEqual(lib.qcgc_state.phase, lib.GC_PAUSE)
+
+        lib.qcgc_lazy_sweep_finish()
+
+        self.assertEqual(lib.unswept_arenas().count, 0)
+        for p in alive:
+            self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)),
+                    lib.BLOCK_WHITE)
+        for p in dead:
+            self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)),
+                    lib.BLOCK_FREE)
+        self.assertGreater(lib.qcgc_state.free_cells, 0)
+
+    def test_empty_arenas_freed(self):
+        self.fill_arenas()
+        # Finish the cycle the pacer may have started, it keeps the objects
+        # that were black already
+        lib.qcgc_collect()
+        for _ in range(300):
+            self.pop_root()
+        arenas = lib.arenas().count
+        lib.bump_ptr_reset()
+        lib.qcgc_collect()
+        lib.qcgc_lazy_sweep_finish()
+
+        self.assertEqual(lib.arenas().count + lib.free_arenas().count +
+                lib.decommitted_arenas().count, arenas)
+        self.assertEqual(lib.arenas().count, 0)
+
+    def test_huge_blocks(self):
+        alive = self.allocate(lib.qcgc_arena_size)
+        self.push_root(alive)
+        dead = self.allocate(lib.qcgc_arena_size)
+        lib.qcgc_collect()
+
+        self.assertTrue(lib.qcgc_hbtable_has(ffi.cast("object_t *", alive)))
+        self.assertFalse(lib.qcgc_hbtable_has(ffi.cast("object_t *", dead)))
+
+    def test_allocate_while_sweeping(self):
+        alive, dead = self.fill_arenas()
+        lib.bump_ptr_reset()
+        lib.qcgc_collect()
+        objects = list()
+        for i in range(300):
+            p = self.allocate(self.arena_object_size)
+            self.push_root(p)
+            objects.append(p)
+        lib.qcgc_collect()
+        lib.qcgc_lazy_sweep_finish()
+
+        for p in alive + objects:
+            self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)),
+                    lib.BLOCK_WHITE)
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,156 @@
+from support import lib,ffi
+from qcgc_test import QCGCTest
+import unittest
+
+class CardsTestCase(QCGCTest):
+    refs_per_card = 2**lib.QCGC_CARD_SIZE_EXP // ffi.sizeof("myobject_t *")
+
+    def offset(self, index):
+        return ffi.offsetof("myobject_t", "refs") + \
+                index * ffi.sizeof("myobject_t *")
+
+    def set_ref_index(self, obj, index, ref):
+        lib.qcgc_write_index(ffi.cast("object_t *", obj), self.offset(index))
+        ffi.cast("myobject_t *", obj).refs[index] = ffi.cast("myobject_t *", ref)
+
+    def allocate_array(self, size):
+        o = self.allocate_ref(size)
+        for i in range(size):
+            o.refs[i] = ffi.NULL
+        self.push_root(o)
+        return o
+
+    def medium_cards(self, o):
+        segment = ffi.cast("medium_segment_t *",
+                lib.qcgc_arena_addr(ffi.cast("cell_t *", o)))
+        return [segment.cards[i] for i in range(len(segment.cards))]
+
+    def gray_stack_count(self, o):
+        return self.gray_stack_items(lib.qcgc_state.gp_gray_stack).count(o)
+
+    def check_dirty_range(self, o, size):
+        lib.qcgc_incmark()
+        obj = ffi.cast("object_t *", o)
+        if lib.qcgc_hbtable_has(obj):
+            self.assertTrue(lib.qcgc_hbtable_is_marked(obj))
+        else:
+            self.assertTrue(lib.qcgc_medium_is_marked(obj))
+        self.assertEqual(o.hdr.flags & lib.QCGC_GRAY_FLAG, 0)
+
+        p = self.allocate(1)
+        q = self.allocate(1)
+        r = self.allocate(1)
+        self.set_ref_index(o, 0, p)
+        self.set_ref_index(o, size - 1, q)
+        # Stored without barrier in a clean card, must not be traced
+        o.refs[self.refs_per_card * 2] = ffi.cast("myobject_t *", r)
+
+        self.assertEqual(o.hdr.flags & lib.QCGC_GRAY_FLAG, 0)
+        self.assertNotEqual(o.hdr.flags & lib.QCGC_CARDS_FLAG, 0)
+        self.assertEqual(self.gray_stack_count(o), 1)
+
+        lib.qcgc_mark()
+        self.assertEqual(o.hdr.flags & lib.QCGC_CARDS_FLAG, 0)
+        for x in [p, q]:
+            self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", x)),
+                    lib.BLOCK_BLACK)
+        self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", r)),
+                lib.BLOCK_WHITE)
+        o.refs[self.refs_per_card * 2] = ffi.NULL
+
+    def test_medium(self):
+        size = 2**lib.QCGC_LARGE_ALLOC_THRESHOLD_EXP // ffi.sizeof("myobject_t *")
+        o = self.allocate_array(size)
+        self.assertTrue(lib.qcgc_medium_is_segment(
+            lib.qcgc_arena_addr(ffi.cast("cell_t *", o))))
+        self.check_dirty_range(o, size)
+        self.assertEqual(self.medium_cards(o), [0] * len(self.medium_cards(o)))
+        lib.qcgc_sweep()
+
+    def test_huge(self):
+        size = lib.qcgc_medium_max_size // ffi.sizeof("myobject_t *") + 1
+        o = self.allocate_array(size)
+        self.assertTrue(lib.qcgc_hbtable_has(ffi.cast("object_t *", o)))
+        self.check_dirty_range(o, size)
+        entry = lib.qcgc_hbtable_entry(ffi.cast("object_t *", o))
+        self.assertGreater(entry.card_bytes, (size - 1) // self.refs_per_card // 8)
+        for i in range(entry.card_bytes):
+            self.assertEqual(entry.cards[i], 0)
+        lib.qcgc_sweep()
+
+    def test_dirty_twice(self):
+        size = 2**lib.QCGC_LARGE_ALLOC_THRESHOLD_EXP // ffi.sizeof("myobject_t *")
+        o = self.allocate_array(size)
+        lib.qcgc_incmark()
+        p = self.allocate(1)
+        for i in range(size):
+            self.set_ref_index(o, i, p)
+        self.assertEqual(self.gray_stack_count(o), 1)
+        self.assertEqual(lib.qcgc_state.gray_stack_size, 1)
+        lib.qcgc_mark()
+        self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)),
+                lib.BLOCK_BLACK)
+
+    def dirty_card_cached(self, o, index):
+        card = int(ffi.cast("uintptr_t", o)) + \
+                self.offset(index) // 2**lib.QCGC_CARD_SIZE_EXP * \
+                2**lib.QCGC_CARD_SIZE_EXP
+        slot = card // 2**lib.QCGC_CARD_SIZE_EXP % lib.QCGC_DIRTY_CARD_CACHE
+        return lib._qcgc_dirty_cards[slot] == card
+
+    def test_dirty_card_skips_slowpath(self):
+        size = 2**lib.QCGC_LARGE_ALLOC_THRESHOLD_EXP // ffi.sizeof("myobject_t *")
+        o = self.allocate_array(size)
+        lib.qcgc_incmark()
+        p = self.allocate(1)
+        self.set_ref_index(o, 0, p)
+        self.assertTrue(self.dirty_card_cached(o, 0))
+
+        # The slowpath would take the regular barrier and gray the object now
+        lib.qcgc_state.phase = lib.GC_PAUSE
+        for i in range(self.refs_per_card):
+            if self.offset(i) < 2**lib.QCGC_CARD_SIZE_EXP:
+                self.set_ref_index(o, i, p)
+        self.assertEqual(o.hdr.flags & lib.QCGC_GRAY_FLAG, 0)
+        # Clean card
+        self.set_ref_index(o, self.refs_per_card, p)
+        self.assertNotEqual(o.hdr.flags & lib.QCGC_GRAY_FLAG, 0)
+        lib.qcgc_state.phase = lib.GC_MARK
+
+        lib.qcgc_mark()
+        self.assertFalse(self.dirty_card_cached(o, 0))
+        self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)),
+                lib.BLOCK_BLACK)
+
+    def test_pause_takes_regular_barrier(self):
+        size = 2**lib.QCGC_LARGE_ALLOC_THRESHOLD_EXP // ffi.sizeof("myobject_t *")
+        o = self.allocate_array(size)
+        self.assertEqual(lib.qcgc_state.phase, lib.GC_PAUSE)
+        lib.qcgc_write_index(ffi.cast("object_t *", o), self.offset(0))
+        self.assertNotEqual(o.hdr.flags & lib.QCGC_GRAY_FLAG, 0)
+        self.assertEqual(o.hdr.flags & lib.QCGC_CARDS_FLAG, 0)
+
+    def test_small_takes_regular_barrier(self):
+        o = self.allocate_array(4)
+        lib.qcgc_incmark()
+        p = self.allocate(1)
+        self.set_ref_index(o, 3, p)
+        self.assertNotEqual(o.hdr.flags & lib.QCGC_GRAY_FLAG, 0)
+        self.assertEqual(o.hdr.flags & lib.QCGC_CARDS_FLAG, 0)
+        lib.qcgc_mark()
+        self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)),
+                lib.BLOCK_BLACK)
+
+    def test_white_takes_regular_barrier(self):
+        size = 2**lib.QCGC_LARGE_ALLOC_THRESHOLD_EXP // ffi.sizeof("myobject_t *")
+        o = self.allocate_array(size)
+        self.pop_root()
+        # Traced in an earlier cycle
+        o.hdr.flags &= ~lib.QCGC_GRAY_FLAG
+        lib.qcgc_incmark()
+        self.assertFalse(lib.qcgc_medium_is_marked(ffi.cast("object_t *", o)))
+        self.assertFalse(lib.qcgc_cards_mark(ffi.cast("object_t *", o),
+            self.offset(0)))
+
+if __name__ == "__main__":
+    unittest.main()
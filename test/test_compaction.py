@@ -0,0 +1,208 @@
+from support import lib,ffi
+from qcgc_test import QCGCTest
+import os
+import unittest
+
+class CompactionTestCase(QCGCTest):
+    def setUp(self):
+        os.environ["QCGC_COMPACTION"] = "1"
+        super(CompactionTestCase, self).setUp()
+
+    def tearDown(self):
+        super(CompactionTestCase, self).tearDown()
+        del os.environ["QCGC_COMPACTION"]
+
+    def allocate_node(self, prev):
+        """Object of arena_object_size bytes with one reference"""
+        o = lib.qcgc_allocate(self.header_size + self.arena_object_size)
+        self.assertNotEqual(o, ffi.NULL)
+        lib._set_type_id(o, 1)
+        o = ffi.cast("myobject_t *", o)
+        o.refs[0] = ffi.cast("myobject_t *", prev)
+        return o
+
+    def fill(self, keep_every, arenas=3):
+        """Fill arenas such that every keep_every-th object survives, the
+        survivors form a list from the root back to the first one. The
+        object that opens the next arena is garbage, so that arena holds no
+        survivors."""
+        count = 0
+        i = 0
+        prev = ffi.NULL
+        while True:
+            if i % keep_every == 0:
+                o = self.allocate_node(prev)
+            else:
+                o = self.allocate_node(ffi.NULL)
+            if lib.arenas().count > arenas:
+                break
+            if i % keep_every == 0:
+                prev = o
+                count += 1
+            i += 1
+        self.push_root(prev)
+        lib.bump_ptr_reset()
+        return count
+
+    def root(self, index=0):
+        return ffi.cast("myobject_t *", lib._qcgc_shadowstack.base[index])
+
+    def list_length(self, o):
+        length = 0
+        while o != ffi.NULL:
+            self.assertEqual(o.type_id, 1)
+            self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", o)),
+                    lib.BLOCK_WHITE)
+            o = o.refs[0]
+            length += 1
+        return length
+
+    def test_knobs(self):
+        self.assertEqual(lib.qcgc_state.compaction, 1)
+        self.assertEqual(lib.qcgc_state.compaction_density, 25)
+
+    def test_live_cells(self):
+        count = self.fill(2, 1)
+        lib.qcgc_mark()
+        cells = lib.bytes_to_cells(self.header_size + self.arena_object_size)
+        pinned = ffi.new("bool *")
+        live = sum(lib.qcgc_compaction_live_cells(lib.arenas().items[i], pinned)
+                for i in range(lib.arenas().count))
+        self.assertEqual(live, count * cells)
+        self.assertFalse(pinned[0])
+        lib.qcgc_sweep()
+
+    def test_evacuate_sparse_arenas(self):
+        count = self.fill(8)
+        arenas = lib.arenas().count
+        old_root = self.root()
+
+        lib.qcgc_collect()
+
+        self.assertGreaterEqual(lib.qcgc_compaction_state.evacuated_arenas, 3)
+        self.assertEqual(lib.qcgc_compaction_state.evacuated_objects, count)
+        self.assertNotEqual(self.root(), old_root)
+        self.assertEqual(self.list_length(self.root()), count)
+        self.assertLess(lib.arenas().count, arenas)
+
+        # Nothing left to evacuate
+        lib.qcgc_collect()
+        self.assertEqual(lib.qcgc_compaction_state.evacuated_objects, 0)
+        self.assertEqual(self.list_length(self.root()), count)
+
+    def test_dense_arenas_stay(self):
+        count = self.fill(2)
+        old_root = self.root()
+        lib.qcgc_collect()
+        self.assertEqual(lib.qcgc_compaction_state.evacuated_arenas, 0)
+        self.assertEqual(self.root(), old_root)
+        self.assertEqual(self.list_length(self.root()), count)
+
+    def test_pinned(self):
+        count = self.fill(8)
+        # Pin the last object of the list, i.e. the first allocated one
+        o = self.root()
+        while o.refs[0] != ffi.NULL:
+            o = o.refs[0]
+        lib.qcgc_pin(ffi.cast("object_t *", o))
+
+        lib.qcgc_collect()
+
+        self.assertGreater(lib.qcgc_compaction_state.evacuated_arenas, 0)
+        last = self.root()
+        while last.refs[0] != ffi.NULL:
+            last = last.refs[0]
+        self.assertEqual(last, o)
+        self.assertEqual(self.list_length(self.root()), count)
+
+        lib.qcgc_unpin(ffi.cast("object_t *", o))
+        self.assertEqual(o.hdr.flags & lib.QCGC_PINNED_FLAG, 0)
+
+    def test_prebuilt_and_huge_references(self):
+        prebuilt = self.allocate_prebuilt_ref(1)
+        huge = self.allocate_ref(lib.qcgc_arena_size // 8)
+        for i in range(lib.qcgc_arena_size // 8):
+            huge.refs[i] = ffi.NULL
+        self.push_root(huge)
+        count = self.fill(8)
+        self.set_ref(prebuilt, 0, self.root(1))
+        self.set_ref(huge, 0, self.root(1))
+
+        lib.qcgc_collect()
+
+        self.assertGreater(lib.qcgc_compaction_state.evacuated_objects, 0)
+        self.assertEqual(self.get_ref(prebuilt, 0), self.root(1))
+        self.assertEqual(self.get_ref(huge, 0), self.root(1))
+        self.assertEqual(self.list_length(self.root(1)), count)
+
+    def test_weakrefs(self):
+        count = self.fill(8)
+        alive = self.root()
+        dead = self.allocate_node(ffi.NULL)
+        wr_alive = self.allocate_weakref(alive)
+        self.push_root(wr_alive)
+        wr_dead = self.allocate_weakref(dead)
+        self.push_root(wr_dead)
+        lib.bump_ptr_reset()
+
+        lib.qcgc_collect()
+
+        self.assertGreater(lib.qcgc_compaction_state.evacuated_objects, 0)
+        self.assertEqual(self.get_ref(self.root(1), 0), self.root())
+        self.assertEqual(self.get_ref(self.root(2), 0), ffi.NULL)
+        self.assertEqual(self.list_length(self.root()), count)
+
+        # Entries still valid
+        lib.qcgc_collect()
+        self.assertEqual(self.get_ref(self.root(1), 0), self.root())
+
+    def test_weakref_moves(self):
+        # Weakref objects in sparse arenas move themselves
+        target = self.allocate_node(ffi.NULL)
+        self.push_root(target)
+        weakrefs = list()
+        i = 0
+        while lib.arenas().count <= 3:
+            if i % 8 == 0:
+                wr = self.allocate_weakref(target)
+                self.push_root(wr)
+                weakrefs.append(wr)
+            self.allocate(self.arena_object_size)
+            i += 1
+        lib.bump_ptr_reset()
+
+        lib.qcgc_collect()
+
+        self.assertGreater(lib.qcgc_compaction_state.evacuated_objects, 0)
+        for i in range(len(weakrefs)):
+            wr = self.root(i + 1)
+            self.assertEqual(self.get_ref(wr, 0), self.root(0))
+        self.assertEqual(lib.qcgc_state.weakrefs.count, len(weakrefs))
+        for i in range(lib.qcgc_state.weakrefs.count):
+            item = lib.qcgc_state.weakrefs.items[i]
+            self.assertEqual(item.target[0], self.root(0))
+
+    def test_generational_mode_does_not_move(self):
+        lib.qcgc_state.generational = 2
+        self.fill(8)
+        old_root = self.root()
+        lib.qcgc_collect()
+        self.assertEqual(lib.qcgc_compaction_state.evacuated_objects, 0)
+        self.assertEqual(self.root(), old_root)
+        lib.qcgc_state.generational = 0
+
+class CompactionOffTestCase(QCGCTest):
+    def test_off(self):
+        self.assertEqual(lib.qcgc_state.compaction, 0)
+        p = self.allocate(1)
+        self.push_root(p)
+        for _ in range(1000):
+            self.allocate(self.arena_object_size)
+        lib.bump_ptr_reset()
+        lib.qcgc_collect()
+        self.assertEqual(lib.qcgc_compaction_state.evacuated_objects, 0)
+        self.assertEqual(lib._qcgc_shadowstack.base[0],
+                ffi.cast("object_t *", p))
+
+if __name__ == "__main__":
+    unittest.main()
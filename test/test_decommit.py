@@ -0,0 +1,249 @@
+from support import lib,ffi
+from qcgc_test import QCGCTest
+import os
+import unittest
+
+class DecommitTestCase(QCGCTest):
+    def setUp(self):
+        os.environ["QCGC_FREE_ARENAS_RETAIN"] = "1"
+        super(DecommitTestCase, self).setUp()
+
+    def tearDown(self):
+        super(DecommitTestCase, self).tearDown()
+        del os.environ["QCGC_FREE_ARENAS_RETAIN"]
+
+    def data(self, o):
+        return ffi.cast("char *", o) + self.header_size
+
+    def fill(self, o, size):
+        ffi.memmove(self.data(o), b"\xff" * size, size)
+
+    def is_filled(self, o, size):
+        return ffi.buffer(self.data(o), size)[:] == b"\xff" * size
+
+    def is_zero(self, ptr, size):
+        return ffi.buffer(ffi.cast("char *", ptr), size)[:] == b"\0" * size
+
+    def fill_arenas(self):
+        size = self.arena_object_size
+        objects = list()
+        for _ in range(600):
+            o = self.allocate(size)
+            self.fill(o, size)
+            objects.append(o)
+        self.assertGreater(lib.arenas().count, 2)
+        return objects, size
+
+    def test_knob(self):
+        self.assertEqual(lib.qcgc_state.free_arenas_retain, 1)
+
+    def test_free_arenas_decommitted(self):
+        objects, size = self.fill_arenas()
+        arenas = lib.arenas().count
+        lib.bump_ptr_reset()
+        lib.qcgc_collect()
+
+        self.assertEqual(lib.arenas().count, 0)
+        self.assertEqual(lib.free_arenas().count, 1)
+        self.assertEqual(lib.decommitted_arenas().count, arenas - 1)
+
+        retained = lib.free_arenas().items[0]
+        for o in objects:
+            arena = lib.qcgc_arena_addr(ffi.cast("cell_t *", o))
+            if arena == retained:
+                self.assertTrue(self.is_filled(o, size))
+
+        page = lib.QCGC_OS_PAGE_SIZE
+        for i in range(lib.decommitted_arenas().count):
+            arena = lib.decommitted_arenas().items[i]
+            first_cell = lib.arena_cells(arena) + \
+                    lib.qcgc_arena_first_cell_index
+            # Whole pages after the header are zero
+            start = -(-int(ffi.cast("uintptr_t", first_cell)) // page) * page
+            end = int(ffi.cast("uintptr_t", arena)) + lib.qcgc_arena_size
+            self.assertTrue(self.is_zero(ffi.cast("char *", start),
+                end - start))
+            # Arena headers survive, decommitted arenas are one free block
+            self.assertEqual(self.get_blocktype(first_cell), lib.BLOCK_FREE)
+
+    def test_decommitted_arenas_reused(self):
+        objects, size = self.fill_arenas()
+        arenas = lib.arenas().count
+        lib.bump_ptr_reset()
+        lib.qcgc_collect()
+
+        for _ in range(600):
+            o = self.allocate(size)
+            self.push_root(o)
+            self.assertTrue(self.is_zero(self.data(o), size))
+        self.assertEqual(lib.free_arenas().count, 0)
+        self.assertEqual(lib.decommitted_arenas().count, 0)
+        self.assertEqual(lib.arenas().count, arenas)
+
+    def test_free_runs_decommitted(self):
+        size = 1024
+        before = self.allocate(size)
+        self.push_root(before)
+        run = list()
+        for _ in range((lib.QCGC_DECOMMIT_MIN_PAGES + 2) *
+                lib.QCGC_OS_PAGE_SIZE // size):
+            o = self.allocate(size)
+            self.fill(o, size)
+            run.append(o)
+        after = self.allocate(size)
+        self.push_root(after)
+        short = self.allocate(size)
+        self.fill(short, size)
+        last = self.allocate(size)
+        self.push_root(last)
+        self.fill(before, size)
+        self.fill(after, size)
+
+        lib.bump_ptr_reset()
+        lib.qcgc_collect()
+
+        # Whole pages of the long free run are returned to the OS
+        start = int(ffi.cast("uintptr_t", run[0]))
+        end = int(ffi.cast("uintptr_t", after))
+        page = lib.QCGC_OS_PAGE_SIZE
+        first_page = (start + page - 1) // page * page
+        last_page = end // page * page
+        self.assertGreaterEqual(last_page - first_page,
+                lib.QCGC_DECOMMIT_MIN_PAGES * page)
+        self.assertTrue(self.is_zero(ffi.cast("char *", first_page),
+            last_page - first_page))
+
+        # Live objects and short free runs keep their contents
+        self.assertTrue(self.is_filled(before, size))
+        self.assertTrue(self.is_filled(after, size))
+        self.assertTrue(self.is_filled(short, size))
+
+    def decommitted_pages(self, start, end):
+        arena = lib.qcgc_arena_addr(ffi.cast("cell_t *", start))
+        base = int(ffi.cast("uintptr_t", arena))
+        page = lib.QCGC_OS_PAGE_SIZE
+        bits = lib.arena_decommitted(arena)
+        return [(bits[i // 8] >> (i % 8)) & 1 == 1
+                for i in range((start - base) // page, (end - base) // page)]
+
+    def test_free_runs_decommitted_once(self):
+        size = 1024
+        self.push_root(self.allocate(size))
+        run = list()
+        for _ in range((lib.QCGC_DECOMMIT_MIN_PAGES + 2) *
+                lib.QCGC_OS_PAGE_SIZE // size):
+            run.append(self.allocate(size))
+        after = self.allocate(size)
+        self.push_root(after)
+
+        lib.bump_ptr_reset()
+        lib.qcgc_collect()
+
+        page = lib.QCGC_OS_PAGE_SIZE
+        start = int(ffi.cast("uintptr_t", run[0]))
+        end = int(ffi.cast("uintptr_t", after))
+        first_page = (start + page - 1) // page * page
+        last_page = end // page * page
+        self.assertTrue(all(self.decommitted_pages(first_page, last_page)))
+
+        # Still recorded after the next sweep, the run was not reused
+        lib.qcgc_collect()
+        self.assertTrue(all(self.decommitted_pages(first_page, last_page)))
+        self.assertTrue(self.is_zero(ffi.cast("char *", first_page),
+            last_page - first_page))
+
+    def test_decommit_skips_recorded_pages(self):
+        arena = lib.arenas().items[0]
+        page = lib.QCGC_OS_PAGE_SIZE
+        base = int(ffi.cast("uintptr_t", arena))
+        start = ffi.cast("cell_t *", base + lib.qcgc_arena_size // 2)
+        cells = 4 * page // 16
+
+        self.assertTrue(lib.qcgc_arena_decommit(start, cells))
+        self.assertEqual(self.decommitted_pages(
+            base + lib.qcgc_arena_size // 2,
+            base + lib.qcgc_arena_size // 2 + 4 * page), [True] * 4)
+
+        # Handing out the middle of the area forgets the overlapped pages
+        lib.qcgc_arena_mark_committed(start + cells // 2, 1)
+        self.assertEqual(self.decommitted_pages(
+            base + lib.qcgc_arena_size // 2,
+            base + lib.qcgc_arena_size // 2 + 4 * page),
+            [True, True, False, True])
+
+        # Decommitting again only returns the forgotten page
+        self.assertTrue(lib.qcgc_arena_decommit(start, cells))
+        self.assertEqual(self.decommitted_pages(
+            base + lib.qcgc_arena_size // 2,
+            base + lib.qcgc_arena_size // 2 + 4 * page), [True] * 4)
+
+        lib.qcgc_arena_recommit(arena)
+        self.assertFalse(any(self.decommitted_pages(base,
+            base + lib.qcgc_arena_size)))
+
+class HugePagesDecommitTestCase(QCGCTest):
+    def setUp(self):
+        os.environ["QCGC_FREE_ARENAS_RETAIN"] = "1"
+        os.environ["QCGC_HUGE_PAGES"] = str(lib.QCGC_HUGE_PAGES_TRANSPARENT)
+        super(HugePagesDecommitTestCase, self).setUp()
+
+    def tearDown(self):
+        super(HugePagesDecommitTestCase, self).tearDown()
+        del os.environ["QCGC_FREE_ARENAS_RETAIN"]
+        del os.environ["QCGC_HUGE_PAGES"]
+
+    def fill_arenas(self):
+        size = self.arena_object_size
+        for _ in range(600):
+            o = self.allocate(size)
+            ffi.memmove(ffi.cast("char *", o) + self.header_size,
+                    b"\xff" * size, size)
+        self.assertGreater(lib.arenas().count, 2)
+
+    def test_free_arenas_decommitted_whole(self):
+        self.fill_arenas()
+        arenas = lib.arenas().count
+        lib.bump_ptr_reset()
+        lib.qcgc_collect()
+
+        self.assertEqual(lib.arenas().count, 0)
+        if lib.qcgc_arena_size < 2**21:
+            # Arenas share huge pages, none is decommitted
+            self.assertEqual(lib.free_arenas().count, arenas)
+            self.assertEqual(lib.decommitted_arenas().count, 0)
+            return
+
+        self.assertEqual(lib.free_arenas().count, 1)
+        self.assertEqual(lib.decommitted_arenas().count, arenas - 1)
+        for i in range(lib.decommitted_arenas().count):
+            arena = lib.decommitted_arenas().items[i]
+            # Header is dropped as well
+            self.assertEqual(ffi.buffer(ffi.cast("char *", arena),
+                lib.qcgc_arena_size)[:], b"\0" * lib.qcgc_arena_size)
+
+    def test_decommitted_arenas_reused(self):
+        self.fill_arenas()
+        arenas = lib.arenas().count
+        lib.bump_ptr_reset()
+        lib.qcgc_collect()
+
+        size = self.arena_object_size
+        objects = list()
+        for _ in range(600):
+            o = self.allocate(size)
+            self.push_root(o)
+            objects.append(o)
+            self.assertEqual(ffi.buffer(ffi.cast("char *", o) +
+                self.header_size, size)[:], b"\0" * size)
+        self.assertEqual(lib.free_arenas().count, 0)
+        self.assertEqual(lib.decommitted_arenas().count, 0)
+        self.assertEqual(lib.arenas().count, arenas)
+
+        lib.bump_ptr_reset()
+        lib.qcgc_collect()
+        for o in objects:
+            self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", o)),
+                    lib.BLOCK_WHITE)
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,89 @@
+from support import lib,ffi
+from qcgc_test import QCGCTest
+import os
+import unittest
+
+class DoWorkTestCase(QCGCTest):
+    def fill(self, count=100):
+        alive = list()
+        dead = list()
+        for i in range(count):
+            p = self.allocate(10)
+            if i % 2 == 0:
+                self.push_root(p)
+                alive.append(p)
+            else:
+                dead.append(p)
+        lib.bump_ptr_reset()
+        return alive, dead
+
+    def test_no_work(self):
+        self.assertFalse(lib.qcgc_collector_has_work())
+        self.assertFalse(lib.qcgc_do_work(10**9))
+        self.assertEqual(lib.qcgc_state.phase, lib.GC_PAUSE)
+
+    def test_zero_budget(self):
+        self.fill(1000)
+        lib.qcgc_incmark()
+        self.assertEqual(lib.qcgc_state.phase, lib.GC_MARK)
+        self.assertTrue(lib.qcgc_do_work(0))
+        self.assertEqual(lib.qcgc_state.phase, lib.GC_MARK)
+
+    def test_finish_cycle(self):
+        alive, dead = self.fill()
+        lib.qcgc_incmark()
+        lib.qcgc_state.incmark_since_sweep = 1
+
+        self.assertFalse(lib.qcgc_do_work(10**9))
+        self.assertEqual(lib.qcgc_state.phase, lib.GC_PAUSE)
+        self.assertEqual(lib.qcgc_state.incmark_since_sweep, 0)
+        for p in alive:
+            self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)),
+                    lib.BLOCK_WHITE)
+        for p in dead:
+            self.assertIn(self.get_blocktype(ffi.cast("cell_t *", p)),
+                    [lib.BLOCK_FREE, lib.BLOCK_EXTENT])
+
+    def test_marked_objects_survive(self):
+        alive, _ = self.fill()
+        lib.qcgc_incmark()
+        # New objects are reachable after the first step
+        young = self.allocate(10)
+        self.push_root(young)
+        lib.bump_ptr_reset()
+
+        self.assertFalse(lib.qcgc_do_work(10**9))
+        for p in alive + [young]:
+            self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)),
+                    lib.BLOCK_WHITE)
+
+class DoWorkLazySweepTestCase(QCGCTest):
+    def setUp(self):
+        os.environ["QCGC_LAZY_SWEEP"] = "1"
+        super(DoWorkLazySweepTestCase, self).setUp()
+
+    def tearDown(self):
+        super(DoWorkLazySweepTestCase, self).tearDown()
+        del os.environ["QCGC_LAZY_SWEEP"]
+
+    def test_sweep(self):
+        for i in range(600):
+            p = self.allocate(self.arena_object_size)
+            if i % 2 == 0:
+                self.push_root(p)
+        self.assertGreater(lib.arenas().count, 2)
+        lib.bump_ptr_reset()
+        lib.qcgc_mark()
+        lib.qcgc_sweep()
+        self.assertGreater(lib.unswept_arenas().count, 0)
+        self.assertTrue(lib.qcgc_collector_has_work())
+
+        self.assertTrue(lib.qcgc_do_work(0))
+        self.assertGreater(lib.unswept_arenas().count, 0)
+
+        self.assertFalse(lib.qcgc_do_work(10**9))
+        self.assertEqual(lib.unswept_arenas().count, 0)
+        self.assertFalse(lib.qcgc_collector_has_work())
+
+if __name__ == "__main__":
+    unittest.main()
@@ -17,9 +17,12 @@ class FitAllocatorTest(QCGCTest):
             self.assertEqual(0, lib.small_free_list(i).count)
             self.assertNotEqual(ffi.NULL, lib.small_free_list(i).items)
         for i in range(lib.qcgc_large_free_lists):
-            self.assertEqual(lib.QCGC_LARGE_FREE_LIST_INIT_SIZE, lib.large_free_list(i).size)
-            self.assertEqual(0, lib.large_free_list(i).count)
-            self.assertNotEqual(ffi.NULL, lib.large_free_list(i).items)
+            for j in range(lib.qcgc_large_free_list_split):
+                self.assertEqual(lib.QCGC_LARGE_FREE_LIST_INIT_SIZE, lib.large_free_list(i, j).size)
+                self.assertEqual(0, lib.large_free_list(i, j).count)
+                self.assertNotEqual(ffi.NULL, lib.large_free_list(i, j).items)
+        self.assertEqual(0, lib.small_map())
+        self.assertEqual(0, lib.large_map())
 
     def test_macro_consistency(self):
         self.assertEqual(2**lib.QCGC_LARGE_FREE_LIST_FIRST_EXP, lib.qcgc_small_free_lists + 1)
@@ -43,6 +46,23 @@ class FitAllocatorTest(QCGCTest):
             self.assertEqual(index, lib.large_index(i))
             self.assertLess(lib.large_index(i), lib.qcgc_large_free_lists)
 
+    def test_large_split_index(self):
+        for index in range(lib.qcgc_large_free_lists):
+            for split in range(lib.qcgc_large_free_list_split):
+                cells = lib.large_split_index_to_cells(index, split)
+                self.assertEqual(index, lib.large_index(cells))
+                self.assertEqual(split, lib.large_split_index(index, cells))
+                if cells > 2**lib.QCGC_LARGE_FREE_LIST_FIRST_EXP:
+                    # Previous list ends right before
+                    self.assertNotEqual((index, split),
+                            (lib.large_index(cells - 1),
+                                lib.large_split_index(
+                                    lib.large_index(cells - 1), cells - 1)))
+        # Blocks larger than the last list go to its last second level list
+        index = lib.qcgc_large_free_lists - 1
+        self.assertEqual(lib.qcgc_large_free_list_split - 1,
+                lib.large_split_index(index, lib.qcgc_arena_cells_count))
+
     def test_block_validity_check(self):
         arena = lib.qcgc_arena_create()
         first = ffi.addressof(lib.arena_cells(arena)[lib.qcgc_arena_first_cell_index])
@@ -79,7 +99,7 @@ class FitAllocatorTest(QCGCTest):
 
         for i in range(lib.qcgc_large_free_lists):
             size = 2**(i + lib.QCGC_LARGE_FREE_LIST_FIRST_EXP)
-            l = lib.large_free_list(i)
+            l = lib.large_free_list(i, 0)
             self.assertEqual(l.count, 1)
             self.assertEqual(blocks[i], l.items[0].ptr)
             self.assertEqual(size, l.items[0].size)
@@ -108,6 +128,48 @@ class FitAllocatorTest(QCGCTest):
             q = self.fit_allocate(size)
             self.assertNotEqual(p, q)
 
+    def test_maps(self):
+        p = self.bump_allocate_cells(3)
+        lib.qcgc_arena_mark_free(p)
+        lib.qcgc_fit_allocator_add(p, 3)
+        size = 2**(1 + lib.QCGC_LARGE_FREE_LIST_FIRST_EXP) + 9
+        q = self.bump_allocate_cells(size)
+        lib.qcgc_arena_mark_free(q)
+        lib.qcgc_fit_allocator_add(q, size)
+
+        split = lib.large_split_index(1, size)
+        self.assertEqual(1 << 2, lib.small_map())
+        self.assertEqual(1 << 1, lib.large_map())
+        self.assertEqual(1 << split, lib.large_split_map(1))
+
+        self.assertEqual(p, self.fit_allocate(3))
+        self.assertEqual(0, lib.small_map())
+        self.assertEqual(q, self.fit_allocate(size))
+        self.assertEqual(0, lib.large_map())
+        self.assertEqual(0, lib.large_split_map(1))
+
+    def test_allocate_good_fit(self):
+        "Test that large allocations use a block of a close size"
+        sizes = [2**lib.QCGC_LARGE_FREE_LIST_FIRST_EXP * 8,
+                2**lib.QCGC_LARGE_FREE_LIST_FIRST_EXP * 2 + 12,
+                2**lib.QCGC_LARGE_FREE_LIST_FIRST_EXP * 2]
+        blocks = list()
+        for size in sizes:
+            p = self.bump_allocate_cells(size)
+            lib.qcgc_arena_mark_free(p)
+            lib.qcgc_fit_allocator_add(p, size)
+            blocks.append(p)
+
+        # Rounded up to the next second level list
+        q = self.fit_allocate(2**lib.QCGC_LARGE_FREE_LIST_FIRST_EXP * 2 + 1)
+        self.assertEqual(blocks[1], q)
+        # Exact match in own list
+        q = self.fit_allocate(2**lib.QCGC_LARGE_FREE_LIST_FIRST_EXP * 2)
+        self.assertEqual(blocks[2], q)
+        # Only the first block of the own list is checked
+        q = self.fit_allocate(2**lib.QCGC_LARGE_FREE_LIST_FIRST_EXP * 2 + 12)
+        self.assertEqual(blocks[0], q)
+
     def test_allocate_no_block(self):
         "Test allocate when no block is available"
 
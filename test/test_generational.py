@@ -0,0 +1,405 @@
+from support import lib,ffi
+from qcgc_test import QCGCTest
+import os
+import unittest
+
+class GenerationalTestCase(QCGCTest):
+    def setUp(self):
+        os.environ["QCGC_GENERATIONAL"] = "1"
+        super(GenerationalTestCase, self).setUp()
+
+    def tearDown(self):
+        super(GenerationalTestCase, self).tearDown()
+        del os.environ["QCGC_GENERATIONAL"]
+
+    def arena(self, o):
+        return lib.qcgc_arena_addr(ffi.cast("cell_t *", o))
+
+    def is_young(self, o):
+        return lib.qcgc_generation_is_young(ffi.cast("object_t *", o))
+
+    def remembered(self, o):
+        remembered_set = lib.qcgc_generation_state.remembered_set
+        return any(remembered_set.items[i] == o
+                for i in range(remembered_set.count))
+
+    def test_knobs(self):
+        self.assertEqual(lib.qcgc_state.generational, 1)
+        self.assertEqual(lib.qcgc_state.nursery_arenas,
+                lib.QCGC_NURSERY_ARENAS)
+
+    def test_nursery(self):
+        o = self.allocate(1)
+        self.assertTrue(self.is_young(o))
+        self.assertEqual(lib.arena_young(self.arena(o)), 1)
+        self.assertEqual(lib.qcgc_generation_state.young_arenas.count, 1)
+        self.assertEqual(lib.qcgc_generation_state.young_arenas.items[0],
+                self.arena(o))
+
+        self.assertFalse(self.is_young(self.allocate(lib.qcgc_arena_size)))
+        self.assertFalse(self.is_young(self.allocate(
+            2**lib.QCGC_LARGE_ALLOC_THRESHOLD_EXP)))
+        self.assertFalse(self.is_young(self.allocate_prebuilt(1)))
+
+    def test_minor_collect(self):
+        alive = self.allocate(1)
+        self.push_root(alive)
+        dead = self.allocate(1)
+        arena = self.arena(alive)
+
+        lib.qcgc_minor_collect()
+
+        self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", alive)),
+                lib.BLOCK_WHITE)
+        self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", dead)),
+                lib.BLOCK_FREE)
+        # Promoted
+        self.assertFalse(self.is_young(alive))
+        self.assertEqual(lib.arena_young(arena), 0)
+        self.assertEqual(lib.qcgc_generation_state.young_arenas.count, 0)
+        self.assertGreater(lib.qcgc_generation_state.promoted_cells, 0)
+        self.assertEqual(lib.qcgc_state.phase, lib.GC_PAUSE)
+
+        # Allocation continues in a new young arena
+        o = self.allocate(1)
+        self.assertTrue(self.is_young(o))
+        self.assertNotEqual(self.arena(o), arena)
+
+    def test_empty_arenas_freed(self):
+        arena = self.arena(self.allocate(1))
+        lib.qcgc_minor_collect()
+        self.assertEqual(lib.arena_young(arena), 0)
+        self.assertEqual(lib.arenas().count, 0)
+        self.assertEqual(lib.free_arenas().count, 1)
+        self.assertEqual(lib.qcgc_generation_state.promoted_cells, 0)
+
+        # Reused as young arena
+        o = self.allocate(1)
+        self.assertEqual(self.arena(o), arena)
+        self.assertTrue(self.is_young(o))
+
+    def test_old_objects_survive_minor(self):
+        old = self.allocate(1)
+        self.push_root(old)
+        lib.qcgc_minor_collect()
+        self.pop_root()
+
+        lib.qcgc_minor_collect()
+        self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", old)),
+                lib.BLOCK_WHITE)
+
+        lib.qcgc_collect()
+        self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", old)),
+                lib.BLOCK_FREE)
+
+    def test_remembered_set(self):
+        old = self.allocate_ref(2)
+        self.push_root(old)
+        lib.qcgc_minor_collect()
+        self.assertEqual(old.hdr.flags & lib.QCGC_GRAY_FLAG, 0)
+
+        young = self.allocate_ref(1)
+        self.set_ref(old, 0, young)
+        self.assertTrue(self.remembered(old))
+        # Young objects are never remembered
+        self.set_ref(young, 0, self.allocate(1))
+        self.assertFalse(self.remembered(young))
+        # Once per collection
+        self.set_ref(old, 1, self.allocate(1))
+        self.assertEqual(lib.qcgc_generation_state.remembered_set.count, 1)
+
+        lib.qcgc_minor_collect()
+
+        self.assertEqual(lib.qcgc_generation_state.remembered_set.count, 0)
+        self.assertEqual(old.hdr.flags & lib.QCGC_GRAY_FLAG, 0)
+        for o in [young, self.get_ref(young, 0), self.get_ref(old, 1)]:
+            self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", o)),
+                    lib.BLOCK_WHITE)
+            self.assertFalse(self.is_young(o))
+
+        # The write barrier fires again
+        self.set_ref(old, 0, ffi.NULL)
+        self.assertTrue(self.remembered(old))
+
+    def test_prebuilt_references(self):
+        prebuilt = self.allocate_prebuilt_ref(1)
+        lib.qcgc_minor_collect()
+        young = self.allocate(1)
+        self.set_ref(prebuilt, 0, young)
+        self.assertTrue(self.remembered(prebuilt))
+
+        lib.qcgc_minor_collect()
+        self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", young)),
+                lib.BLOCK_WHITE)
+
+    def test_huge_and_medium_references(self):
+        huge = self.allocate_ref(lib.qcgc_arena_size // ffi.sizeof("myobject_t *"))
+        medium = self.allocate_ref(2**lib.QCGC_LARGE_ALLOC_THRESHOLD_EXP
+                // ffi.sizeof("myobject_t *"))
+        self.push_root(huge)
+        self.push_root(medium)
+        # Remembered on allocation, they start gray
+        self.assertTrue(self.remembered(huge))
+        self.assertTrue(self.remembered(medium))
+        p = self.allocate(1)
+        q = self.allocate(1)
+        self.set_ref(huge, 0, p)
+        self.set_ref(medium, 0, q)
+
+        lib.qcgc_minor_collect()
+        for o in [p, q]:
+            self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", o)),
+                    lib.BLOCK_WHITE)
+
+    def test_full_collection(self):
+        old = self.allocate_ref(1)
+        self.push_root(old)
+        dead = self.allocate_ref(1)
+        self.push_root(dead)
+        lib.qcgc_minor_collect()
+        self.pop_root()
+        self.set_ref(old, 0, ffi.NULL)
+        self.set_ref(dead, 0, ffi.NULL)
+        self.assertEqual(lib.qcgc_generation_state.remembered_set.count, 2)
+        young = self.allocate(1)
+        self.push_root(young)
+
+        lib.qcgc_collect()
+
+        # Dead objects are forgotten, young objects stay young
+        self.assertTrue(self.remembered(old))
+        self.assertFalse(self.remembered(dead))
+        self.assertEqual(lib.qcgc_generation_state.promoted_cells, 0)
+        self.assertTrue(self.is_young(young))
+        self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", young)),
+                lib.BLOCK_WHITE)
+
+        lib.qcgc_minor_collect()
+        self.assertFalse(self.is_young(young))
+
+    def test_weakrefs(self):
+        old = self.allocate(1)
+        self.push_root(old)
+        lib.qcgc_minor_collect()
+
+        wr_to_old = self.allocate_weakref(old)
+        wr_to_dead = self.allocate_weakref(self.allocate(1))
+        self.push_root(wr_to_old)
+        self.push_root(wr_to_dead)
+        self.allocate_weakref(old) # Dead weakref
+        wr_to_null = self.allocate_weakref(old)
+        self.push_root(wr_to_null)
+        ffi.cast("myobject_t *", wr_to_null).refs[0] = ffi.NULL # Cleared
+
+        lib.qcgc_minor_collect()
+
+        self.assertEqual(self.get_ref(wr_to_old, 0), old)
+        self.assertEqual(self.get_ref(wr_to_dead, 0), ffi.NULL)
+        self.assertEqual(self.get_ref(wr_to_null, 0), ffi.NULL)
+        self.assertEqual(lib.qcgc_state.weakrefs.count, 1)
+
+    def test_automatic_minor_collections(self):
+        size = self.arena_object_size
+        root = self.allocate_ref(1)
+        self.push_root(root)
+        count = 3 * lib.qcgc_state.nursery_arenas * \
+                lib.qcgc_arena_size // size
+        for _ in range(count):
+            o = self.allocate_ref(1)
+            self.set_ref(o, 0, root)
+            self.set_ref(root, 0, o)
+            self.assertLessEqual(lib.qcgc_generation_state.young_arenas.count,
+                    lib.qcgc_state.nursery_arenas)
+            self.allocate(size)
+
+        # Only the chain survives, the other objects were swept with their
+        # young arenas
+        self.assertLess(lib.arenas().count, count * size // lib.qcgc_arena_size)
+        self.assertGreater(lib.arenas().count, 0)
+        o = self.get_ref(root, 0)
+        self.assertEqual(self.get_ref(o, 0), root)
+
+class StickyTestCase(QCGCTest):
+    def setUp(self):
+        os.environ["QCGC_GENERATIONAL"] = "2"
+        super(StickyTestCase, self).setUp()
+
+    def tearDown(self):
+        super(StickyTestCase, self).tearDown()
+        del os.environ["QCGC_GENERATIONAL"]
+
+    def is_young(self, o):
+        return lib.qcgc_generation_is_young(ffi.cast("object_t *", o))
+
+    def remembered(self, o):
+        remembered_set = lib.qcgc_generation_state.remembered_set
+        return any(remembered_set.items[i] == o
+                for i in range(remembered_set.count))
+
+    def blocktype(self, o):
+        return self.get_blocktype(ffi.cast("cell_t *", o))
+
+    def test_knobs(self):
+        self.assertEqual(lib.qcgc_state.generational,
+                lib.QCGC_GENERATIONAL_STICKY)
+
+    def test_regions(self):
+        o = self.allocate(1)
+        p = self.allocate(1)
+        self.assertTrue(self.is_young(o))
+        self.assertEqual(lib.qcgc_generation_state.regions.count, 0)
+        lib.qcgc_reset_bump_ptr()
+        regions = lib.qcgc_generation_state.regions
+        self.assertEqual(regions.count, 1)
+        self.assertEqual(regions.items[0].ptr, ffi.cast("cell_t *", o))
+        self.assertEqual(regions.items[0].size,
+                ffi.cast("cell_t *", p) - ffi.cast("cell_t *", o) +
+                lib.bytes_to_cells(ffi.sizeof("myobject_t")))
+        self.assertEqual(lib.qcgc_generation_state.allocated_cells,
+                regions.items[0].size)
+
+        # Fit allocated objects are regions of their own
+        q = self.allocate(1)
+        self.assertEqual(regions.count, 2)
+        self.assertEqual(regions.items[1].ptr, ffi.cast("cell_t *", q))
+
+        self.assertFalse(self.is_young(self.allocate(lib.qcgc_arena_size)))
+        self.assertFalse(self.is_young(self.allocate(
+            2**lib.QCGC_LARGE_ALLOC_THRESHOLD_EXP)))
+        self.assertFalse(self.is_young(self.allocate_prebuilt(1)))
+
+    def test_minor_collect(self):
+        alive = self.allocate(1)
+        self.push_root(alive)
+        dead = self.allocate(1)
+        free_cells = lib.qcgc_state.free_cells
+
+        lib.qcgc_minor_collect()
+
+        # Survivors stay black
+        self.assertEqual(self.blocktype(alive), lib.BLOCK_BLACK)
+        self.assertEqual(self.blocktype(dead), lib.BLOCK_FREE)
+        self.assertFalse(self.is_young(alive))
+        self.assertEqual(lib.qcgc_generation_state.regions.count, 0)
+        self.assertEqual(lib.qcgc_generation_state.allocated_cells, 0)
+        self.assertGreater(lib.qcgc_generation_state.promoted_cells, 0)
+        self.assertGreater(lib.qcgc_state.free_cells, free_cells)
+        self.assertEqual(lib.qcgc_state.phase, lib.GC_PAUSE)
+
+        # The free block is reused right away
+        o = self.allocate(1)
+        self.assertEqual(o, dead)
+        self.assertTrue(self.is_young(o))
+
+    def test_old_objects_not_swept(self):
+        old = self.allocate(1)
+        self.push_root(old)
+        lib.qcgc_minor_collect()
+        self.pop_root()
+
+        lib.qcgc_minor_collect()
+        self.assertEqual(self.blocktype(old), lib.BLOCK_BLACK)
+
+        alive = self.allocate(1)
+        self.push_root(alive)
+        lib.qcgc_reset_bump_ptr()
+        lib.qcgc_collect()
+        self.assertEqual(self.blocktype(old), lib.BLOCK_FREE)
+        self.assertEqual(self.blocktype(alive), lib.BLOCK_BLACK)
+
+    def test_remembered_set(self):
+        old = self.allocate_ref(2)
+        self.push_root(old)
+        lib.qcgc_minor_collect()
+        self.pop_root()
+        self.assertEqual(old.hdr.flags & lib.QCGC_GRAY_FLAG, 0)
+
+        young = self.allocate_ref(1)
+        self.set_ref(old, 0, young)
+        self.assertTrue(self.remembered(old))
+        # Young objects are never remembered
+        self.set_ref(young, 0, self.allocate(1))
+        self.assertFalse(self.remembered(young))
+        self.set_ref(old, 1, self.allocate(1))
+        self.assertEqual(lib.qcgc_generation_state.remembered_set.count, 1)
+
+        # Reachable through the remembered set only
+        lib.qcgc_minor_collect()
+
+        self.assertEqual(lib.qcgc_generation_state.remembered_set.count, 0)
+        self.assertEqual(old.hdr.flags & lib.QCGC_GRAY_FLAG, 0)
+        for o in [young, self.get_ref(young, 0), self.get_ref(old, 1)]:
+            self.assertEqual(self.blocktype(o), lib.BLOCK_BLACK)
+            self.assertFalse(self.is_young(o))
+
+        # The write barrier fires again
+        self.set_ref(old, 0, ffi.NULL)
+        self.assertTrue(self.remembered(old))
+
+    def test_full_collection(self):
+        old = self.allocate_ref(1)
+        self.push_root(old)
+        lib.qcgc_minor_collect()
+        self.set_ref(old, 0, self.allocate(1))
+        self.assertEqual(lib.qcgc_generation_state.remembered_set.count, 1)
+
+        lib.qcgc_reset_bump_ptr()
+        lib.qcgc_collect()
+
+        self.assertEqual(lib.qcgc_generation_state.remembered_set.count, 0)
+        self.assertEqual(lib.qcgc_generation_state.regions.count, 0)
+        self.assertEqual(lib.qcgc_generation_state.promoted_cells, 0)
+        for o in [old, self.get_ref(old, 0)]:
+            self.assertEqual(self.blocktype(o), lib.BLOCK_BLACK)
+            self.assertEqual(o.hdr.flags & lib.QCGC_GRAY_FLAG, 0)
+
+        # Old objects are marked again by the next full collection
+        self.pop_root()
+        lib.qcgc_collect()
+        self.assertEqual(self.blocktype(old), lib.BLOCK_FREE)
+
+    def test_weakrefs(self):
+        old = self.allocate(1)
+        self.push_root(old)
+        lib.qcgc_minor_collect()
+
+        wr_to_old = self.allocate_weakref(old)
+        wr_to_dead = self.allocate_weakref(self.allocate(1))
+        self.push_root(wr_to_old)
+        self.push_root(wr_to_dead)
+        self.allocate_weakref(old) # Dead weakref
+        wr_to_null = self.allocate_weakref(old)
+        self.push_root(wr_to_null)
+        ffi.cast("myobject_t *", wr_to_null).refs[0] = ffi.NULL # Cleared
+
+        lib.qcgc_minor_collect()
+
+        self.assertEqual(self.get_ref(wr_to_old, 0), old)
+        self.assertEqual(self.get_ref(wr_to_dead, 0), ffi.NULL)
+        self.assertEqual(self.get_ref(wr_to_null, 0), ffi.NULL)
+        self.assertEqual(lib.qcgc_state.weakrefs.count, 1)
+
+    def test_automatic_minor_collections(self):
+        size = self.arena_object_size
+        root = self.allocate_ref(1)
+        self.push_root(root)
+        count = 3 * lib.qcgc_state.nursery_arenas * \
+                lib.qcgc_arena_size // size
+        for _ in range(count):
+            o = self.allocate_ref(1)
+            self.set_ref(o, 0, root)
+            self.set_ref(root, 0, o)
+            # Checked when a block is used up
+            self.assertLessEqual(lib.qcgc_generation_state.allocated_cells,
+                    (lib.qcgc_state.nursery_arenas + 1) *
+                    lib.qcgc_arena_size // 16)
+            self.allocate(size)
+
+        # The free space of the dead objects is reused
+        self.assertLessEqual(lib.arenas().count,
+                lib.qcgc_state.nursery_arenas + 2)
+        o = self.get_ref(root, 0)
+        self.assertEqual(self.get_ref(o, 0), root)
+
+if __name__ == "__main__":
+    unittest.main()
@@ -1,77 +1,83 @@
+import unittest
 from support import lib,ffi
 from qcgc_test import QCGCTest
 
 class GrayStackTestCase(QCGCTest):
-    def test_create(self):
-        """Test creation"""
-        for i in range(100):
-            s = lib.qcgc_object_stack_create(i)
-            self.assertEqual(s.size, i)
-            self.assertEqual(s.count, 0)
+    segment_size = lib.QCGC_MARK_LIST_SEGMENT_SIZE
 
-    def test_push_pop(self):
-        """Test push/pop"""
-        stack = lib.qcgc_object_stack_create(1000)
-        pythonstack = list()
-
-        for i in range(1000):
-            stack = lib.qcgc_object_stack_push(stack, ffi.cast("object_t *", i))
-            pythonstack.append(ffi.cast("object_t *", i))
-
-        self.assertEqual(stack.count, 1000)
-
-        while pythonstack:
-            p = lib.qcgc_object_stack_top(stack);
-            self.assertEqual(p, pythonstack.pop())
-            stack = lib.qcgc_object_stack_pop(stack);
-
-        self.assertEqual(stack.count, 0)
-
-    def test_grow(self):
-        """Test automatic growing"""
-        stack = lib.qcgc_object_stack_create(10)
-        pythonstack = list()
-
-        for i in range(1000):
-            stack = lib.qcgc_object_stack_push(stack, ffi.cast("object_t *", i))
-            pythonstack.append(ffi.cast("object_t *", i))
-
-        self.assertEqual(stack.count, 1000)
-
-        while pythonstack:
-            p = lib.qcgc_object_stack_top(stack);
-            self.assertEqual(p, pythonstack.pop())
-            stack = lib.qcgc_object_stack_pop(stack);
+    def fill(self, count):
+        stack = ffi.NULL
+        for i in range(count):
+            stack = lib.qcgc_gray_stack_push(stack, ffi.cast("object_t *", i + 1))
+        return stack
 
-        self.assertEqual(stack.count, 0)
-
-    def test_grow_shrink(self):
-        """Test automatic growing/shrinking"""
-        stack = lib.qcgc_object_stack_create(10)
-        pythonstack = list()
-
-        for i in range(1000):
-            stack = lib.qcgc_object_stack_push(stack, ffi.cast("object_t *", i))
-            pythonstack.append(ffi.cast("object_t *", i))
-
-        self.assertEqual(stack.count, 1000)
-
-        while pythonstack:
-            p = lib.qcgc_object_stack_top(stack);
-            self.assertEqual(p, pythonstack.pop())
-            stack = lib.qcgc_object_stack_pop(stack);
-
-        self.assertEqual(stack.count, 0)
+    def test_empty(self):
+        self.assertEqual(lib.qcgc_gray_stack_count(ffi.NULL), 0)
+        self.assertEqual(lib.qcgc_state.gp_gray_stack, ffi.NULL)
 
+    def test_push_pop(self):
+        count = 3 * self.segment_size + 5
+        stack = self.fill(count)
+        self.assertEqual(lib.qcgc_gray_stack_count(stack), count)
+        self.assertEqual(stack.count, 5)
+        self.assertEqual(stack.below, 3 * self.segment_size)
+        self.assertEqual(lib.qcgc_gray_pool.segments, 4)
+
+        for i in reversed(range(count)):
+            self.assertEqual(lib.qcgc_gray_stack_top(stack),
+                    ffi.cast("object_t *", i + 1))
+            stack = lib.qcgc_gray_stack_pop(stack)
+            self.assertEqual(lib.qcgc_gray_stack_count(stack), i)
+        self.assertEqual(stack, ffi.NULL)
+        self.assertEqual(lib.qcgc_gray_pool.free_count, 4)
+
+    def test_segments_reused(self):
+        stack = self.fill(2 * self.segment_size)
+        lib.qcgc_gray_stack_free(stack)
+        self.assertEqual(lib.qcgc_gray_pool.free_count, 2)
+
+        stack = self.fill(2 * self.segment_size)
+        self.assertEqual(lib.qcgc_gray_pool.segments, 2)
+        self.assertEqual(lib.qcgc_gray_pool.free_count, 0)
+        lib.qcgc_gray_stack_free(stack)
+
+    def test_segment_boundary(self):
+        stack = self.fill(self.segment_size)
+        self.assertEqual(stack.next, ffi.NULL)
+        stack = lib.qcgc_gray_stack_push(stack, ffi.cast("object_t *", 1))
+        self.assertNotEqual(stack.next, ffi.NULL)
+        stack = lib.qcgc_gray_stack_pop(stack)
+        # The emptied segment went back to the pool
+        self.assertEqual(stack.next, ffi.NULL)
+        self.assertEqual(stack.count, self.segment_size)
+        self.assertEqual(lib.qcgc_gray_pool.free_count, 1)
+        lib.qcgc_gray_stack_free(stack)
+
+    def test_trim(self):
+        count = (lib.QCGC_GRAY_POOL_KEEP + 4) * self.segment_size
+        lib.qcgc_gray_stack_free(self.fill(count))
+        self.assertEqual(lib.qcgc_gray_pool.free_count,
+                lib.QCGC_GRAY_POOL_KEEP + 4)
+        lib.qcgc_gray_pool_trim()
+        self.assertEqual(lib.qcgc_gray_pool.free_count, lib.QCGC_GRAY_POOL_KEEP)
+        self.assertEqual(lib.qcgc_gray_pool.segments, lib.QCGC_GRAY_POOL_KEEP)
+
+    def test_idle_arenas_hold_no_segments(self):
+        root = self.allocate_ref(1000)
+        self.push_root(root)
         for i in range(1000):
-            stack = lib.qcgc_object_stack_push(stack, ffi.cast("object_t *", i))
-            pythonstack.append(ffi.cast("object_t *", i))
-
-        self.assertEqual(stack.count, 1000)
-
-        while pythonstack:
-            p = lib.qcgc_object_stack_top(stack);
-            self.assertEqual(p, pythonstack.pop())
-            stack = lib.qcgc_object_stack_pop(stack);
-
-        self.assertEqual(stack.count, 0)
+            self.set_ref(root, i, self.allocate(1))
+        lib.bump_ptr_reset()
+        lib.qcgc_mark()
+        for i in range(lib.arenas().count):
+            self.assertEqual(lib.arena_gray_stack(lib.arenas().items[i]),
+                    ffi.NULL)
+        self.assertEqual(lib.qcgc_state.gp_gray_stack, ffi.NULL)
+        self.assertEqual(lib.qcgc_gray_pool.free_count,
+                lib.qcgc_gray_pool.segments)
+        self.assertLessEqual(lib.qcgc_gray_pool.segments,
+                lib.QCGC_GRAY_POOL_KEEP)
+        lib.qcgc_sweep()
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,135 @@
+from support import lib,ffi
+from qcgc_test import QCGCTest
+import os
+import unittest
+
+class GrowthPolicyTestCase(QCGCTest):
+    arena_cells = lib.qcgc_arena_cells_count - lib.qcgc_arena_first_cell_index
+
+    def fragment(self, arenas):
+        """Fill arenas with alternating live and dead objects and collect"""
+        i = 0
+        while lib.arenas().count < arenas:
+            p = self.allocate(self.arena_object_size)
+            if i % 2 == 0:
+                self.push_root(p)
+            i += 1
+        lib.qcgc_reset_bump_ptr()
+        lib.qcgc_collect()
+        # Leave neither large free blocks nor free arenas
+        lib.qcgc_fit_allocator_empty_lists()
+        self.assertEqual(lib.free_arenas().count, 0)
+        # Room to grow
+        lib.qcgc_state.heap_goal = 2 * lib.qcgc_state.heap_goal
+
+    def renew_block(self):
+        arenas = lib.arenas().count
+        lib.qcgc_bump_allocator_renew_block(16, False)
+        return lib.arenas().count - arenas
+
+    def test_knobs(self):
+        self.assertEqual(lib.qcgc_state.growth_policy, 1)
+        self.assertEqual(lib.qcgc_state.growth_fragmentation, 50)
+
+    def test_cycle_budget(self):
+        lib.qcgc_state.incmark_threshold = 1000
+        lib.qcgc_state.incmark_to_sweep = 5
+        lib.qcgc_state.incmark_since_sweep = 2
+        lib.qcgc_state.cells_since_incmark = 300
+        self.assertEqual(lib.qcgc_allocator_cycle_budget(), 3 * 1000 + 700)
+
+        lib.qcgc_state.incmark_since_sweep = 5
+        lib.qcgc_state.cells_since_incmark = 2000
+        self.assertEqual(lib.qcgc_allocator_cycle_budget(), 0)
+
+    def test_fragmentation(self):
+        lib.qcgc_state.free_cells = 0
+        lib.qcgc_state.largest_free_block = 0
+        self.assertEqual(lib.qcgc_allocator_fragmentation(), 0)
+
+        lib.qcgc_state.free_cells = 1000
+        lib.qcgc_state.largest_free_block = 1000
+        self.assertEqual(lib.qcgc_allocator_fragmentation(), 0)
+
+        lib.qcgc_state.largest_free_block = 250
+        self.assertEqual(lib.qcgc_allocator_fragmentation(), 75)
+
+        # Stale after allocations
+        lib.qcgc_state.largest_free_block = 2000
+        self.assertEqual(lib.qcgc_allocator_fragmentation(), 0)
+
+    def test_grow_when_free_cells_short(self):
+        self.fragment(3)
+        lib.qcgc_state.free_cells = lib.qcgc_allocator_cycle_budget() - 1
+        lib.qcgc_state.largest_free_block = lib.qcgc_state.free_cells
+        self.assertTrue(lib.qcgc_allocator_should_grow())
+        self.assertEqual(self.renew_block(), 1)
+        self.assertNotEqual(lib._qcgc_bump_allocator.ptr, ffi.NULL)
+
+    def test_grow_when_fragmented(self):
+        self.fragment(3)
+        budget = lib.qcgc_allocator_cycle_budget()
+        self.assertGreaterEqual(budget, self.arena_cells)
+        lib.qcgc_state.free_cells = 2 * budget
+        lib.qcgc_state.largest_free_block = budget // 10
+        self.assertTrue(lib.qcgc_allocator_should_grow())
+        self.assertEqual(self.renew_block(), 1)
+
+    def test_fit_when_not_fragmented(self):
+        self.fragment(3)
+        lib.qcgc_state.free_cells = 2 * lib.qcgc_allocator_cycle_budget()
+        lib.qcgc_state.largest_free_block = lib.qcgc_state.free_cells
+        self.assertFalse(lib.qcgc_allocator_should_grow())
+        self.assertEqual(self.renew_block(), 0)
+        self.assertEqual(lib._qcgc_bump_allocator.ptr, ffi.NULL)
+
+    def test_fit_when_budget_spent(self):
+        self.fragment(3)
+        lib.qcgc_state.incmark_since_sweep = lib.qcgc_state.incmark_to_sweep
+        lib.qcgc_state.cells_since_incmark = lib.qcgc_state.incmark_threshold
+        lib.qcgc_state.free_cells = 1000
+        lib.qcgc_state.largest_free_block = 10
+        self.assertFalse(lib.qcgc_allocator_should_grow())
+
+    def test_heap_target(self):
+        lib.qcgc_state.heap_goal = 0
+        lib.qcgc_state.live_cells = 1000
+        lib.qcgc_state.incmark_threshold = 100
+        lib.qcgc_state.incmark_to_sweep = 5
+        self.assertEqual(lib.qcgc_allocator_heap_target(), 1600)
+
+        lib.qcgc_state.heap_goal = 5000
+        self.assertEqual(lib.qcgc_allocator_heap_target(), 5000)
+
+    def test_no_growth_beyond_target(self):
+        self.fragment(3)
+        lib.qcgc_state.free_cells = 0
+        lib.qcgc_state.largest_free_block = 0
+        self.assertTrue(lib.qcgc_allocator_should_grow())
+        lib.qcgc_state.heap_goal = lib.arenas().count * self.arena_cells
+        self.assertFalse(lib.qcgc_allocator_should_grow())
+
+    def test_forced(self):
+        self.fragment(3)
+        lib.qcgc_state.free_cells = 2 * lib.qcgc_allocator_cycle_budget()
+        lib.qcgc_state.largest_free_block = lib.qcgc_state.free_cells
+        arenas = lib.arenas().count
+        lib.qcgc_bump_allocator_renew_block(16, True)
+        self.assertEqual(lib.arenas().count, arenas + 1)
+
+class GrowthPolicyOffTestCase(QCGCTest):
+    def setUp(self):
+        os.environ["QCGC_GROWTH_POLICY"] = "0"
+        super(GrowthPolicyOffTestCase, self).setUp()
+
+    def tearDown(self):
+        super(GrowthPolicyOffTestCase, self).tearDown()
+        del os.environ["QCGC_GROWTH_POLICY"]
+
+    def test_never_grows(self):
+        lib.qcgc_state.free_cells = 0
+        self.assertGreater(lib.qcgc_allocator_cycle_budget(), 0)
+        self.assertFalse(lib.qcgc_allocator_should_grow())
+
+if __name__ == "__main__":
+    unittest.main()
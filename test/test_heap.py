@@ -0,0 +1,113 @@
+from support import lib,ffi
+from qcgc_test import QCGCTest
+import os
+import unittest
+
+class HeapTestCase(QCGCTest):
+    def test_reservation(self):
+        base = int(ffi.cast("uintptr_t", lib.qcgc_heap_state.base))
+        self.assertNotEqual(base, 0)
+        self.assertEqual(base % lib.qcgc_arena_size, 0)
+        self.assertEqual(lib.qcgc_heap_state.size, lib.qcgc_state.heap_reserve)
+        self.assertEqual(lib.qcgc_heap_state.outside_arenas, 0)
+
+    def test_arenas_in_reservation(self):
+        arena = lib.arenas().items[0]
+        self.assertEqual(ffi.cast("cell_t *", arena), lib.qcgc_heap_state.base)
+        self.assertEqual(lib.qcgc_heap_state.arena_table[0], 1)
+        self.assertEqual(lib.qcgc_heap_state.next_free, 1)
+
+    def test_contains(self):
+        o = self.allocate(1)
+        self.assertTrue(lib.qcgc_heap_contains(o))
+        self.assertTrue(lib.is_in_arena(o))
+
+        huge = self.allocate(lib.qcgc_arena_size)
+        self.assertFalse(lib.qcgc_heap_contains(huge))
+        self.assertFalse(lib.qcgc_heap_contains(ffi.NULL))
+        # Reserved, but no arena yet
+        self.assertFalse(lib.qcgc_heap_contains(
+            ffi.cast("char *", lib.qcgc_heap_state.base) + lib.qcgc_arena_size))
+
+    def test_release(self):
+        arena = lib.qcgc_arena_create()
+        index = (ffi.cast("char *", arena) -
+                ffi.cast("char *", lib.qcgc_heap_state.base)) \
+                        // lib.qcgc_arena_size
+        cell = lib.arena_cells(arena) + lib.qcgc_arena_first_cell_index
+        ffi.cast("char *", cell)[0] = b"x"
+        lib.qcgc_arena_destroy(arena)
+
+        self.assertEqual(lib.qcgc_heap_state.arena_table[index], 0)
+        self.assertEqual(lib.qcgc_heap_state.next_free, index)
+        self.assertFalse(lib.qcgc_heap_contains(cell))
+
+        # Same arena again, zeroed
+        self.assertEqual(lib.qcgc_arena_create(), arena)
+        self.assertEqual(ffi.cast("char *", cell)[0], b"\0")
+
+class SmallHeapTestCase(QCGCTest):
+    def setUp(self):
+        os.environ["QCGC_HEAP_RESERVE"] = str(2 * lib.qcgc_arena_size)
+        super(SmallHeapTestCase, self).setUp()
+
+    def tearDown(self):
+        super(SmallHeapTestCase, self).tearDown()
+        del os.environ["QCGC_HEAP_RESERVE"]
+
+    def test_exhausted(self):
+        lib.qcgc_arena_create()
+        self.assertEqual(lib.qcgc_heap_state.outside_arenas, 0)
+        arena = lib.qcgc_arena_create()
+        self.assertNotEqual(arena, ffi.NULL)
+        self.assertEqual(lib.qcgc_heap_state.outside_arenas, 1)
+        self.assertFalse(lib.qcgc_heap_contains(arena))
+
+        lib.qcgc_arena_destroy(arena)
+        self.assertEqual(lib.qcgc_heap_state.outside_arenas, 0)
+
+class NoHeapTestCase(QCGCTest):
+    def setUp(self):
+        os.environ["QCGC_HEAP_RESERVE"] = "0"
+        super(NoHeapTestCase, self).setUp()
+
+    def tearDown(self):
+        super(NoHeapTestCase, self).tearDown()
+        del os.environ["QCGC_HEAP_RESERVE"]
+
+    def test_no_reservation(self):
+        self.assertEqual(lib.qcgc_heap_state.base, ffi.NULL)
+        self.assertEqual(lib.qcgc_heap_state.outside_arenas, 1)
+
+        o = self.allocate(1)
+        self.assertFalse(lib.qcgc_heap_contains(o))
+        self.assertTrue(lib.is_in_arena(o))
+
+class HugePagesTestCase(QCGCTest):
+    def setUp(self):
+        os.environ["QCGC_HUGE_PAGES"] = str(lib.QCGC_HUGE_PAGES_EXPLICIT)
+        super(HugePagesTestCase, self).setUp()
+
+    def tearDown(self):
+        super(HugePagesTestCase, self).tearDown()
+        del os.environ["QCGC_HUGE_PAGES"]
+
+    def test_fallback(self):
+        # Without explicit huge pages the heap uses transparent ones
+        self.assertIn(lib.qcgc_heap_state.huge_pages,
+                [lib.QCGC_HUGE_PAGES_TRANSPARENT, lib.QCGC_HUGE_PAGES_EXPLICIT])
+        if lib.qcgc_arena_size < 2**21:
+            self.assertEqual(lib.qcgc_heap_state.huge_pages,
+                    lib.QCGC_HUGE_PAGES_TRANSPARENT)
+
+        arena = lib.qcgc_arena_create()
+        self.assertTrue(lib.qcgc_heap_contains(arena))
+        self.assertEqual(lib.qcgc_heap_state.outside_arenas, 0)
+        o = self.allocate(1)
+        self.push_root(o)
+        lib.qcgc_collect()
+        self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", o)),
+                lib.BLOCK_WHITE)
+
+if __name__ == "__main__":
+    unittest.main()
@@ -3,14 +3,19 @@ from support import lib,ffi
 from qcgc_test import QCGCTest
 
 class HugeBlockTableTestCase(QCGCTest):
+    def setUp(self):
+        super(HugeBlockTableTestCase, self).setUp()
+        # The objects are not rooted, allocation must not collect them
+        lib.qcgc_state.incmark_threshold = 2**62
+
     def test_create_destroy(self):
-        for i in range(lib.QCGC_HBTABLE_BUCKETS):
-            self.assertNotEqual(ffi.NULL, lib.qcgc_hbtable.bucket[i])
+        self.assertNotEqual(ffi.NULL, lib.qcgc_hbtable.entries)
+        self.assertEqual(lib.QCGC_HBTABLE_INIT_SIZE, lib.qcgc_hbtable.size)
+        self.assertEqual(0, lib.qcgc_hbtable.count)
 
     def test_add(self):
         o = lib._qcgc_allocate_large(2**lib.QCGC_LARGE_ALLOC_THRESHOLD_EXP)
         #
-        b = lib.bucket(o)
         self.assertTrue(self.hbtable_has(o))
         self.assertFalse(lib.qcgc_hbtable_is_marked(o))
 
@@ -18,7 +23,6 @@ class HugeBlockTableTestCase(QCGCTest):
         o = lib._qcgc_allocate_large(2**lib.QCGC_LARGE_ALLOC_THRESHOLD_EXP)
         lib.qcgc_hbtable_mark(o)
         #
-        b = lib.bucket(o)
         self.assertTrue(self.hbtable_has(o))
         self.assertTrue(lib.qcgc_hbtable_is_marked(o))
 
@@ -29,7 +33,6 @@ class HugeBlockTableTestCase(QCGCTest):
         #
         lib.qcgc_hbtable_sweep()
         #
-        b = lib.bucket(o)
         self.assertTrue(self.hbtable_has(o))
         self.assertFalse(lib.qcgc_hbtable_is_marked(o))
 
@@ -40,12 +43,42 @@ class HugeBlockTableTestCase(QCGCTest):
         self.assertFalse(lib.qcgc_hbtable_mark(o))
         self.assertTrue(lib.qcgc_hbtable_is_marked(o))
 
+    def test_grow(self):
+        objects = list()
+        for _ in range(lib.QCGC_HBTABLE_INIT_SIZE):
+            o = lib._qcgc_allocate_large(2**lib.QCGC_LARGE_ALLOC_THRESHOLD_EXP)
+            objects.append(o)
+            if len(objects) % 2 == 0:
+                lib.qcgc_hbtable_mark(o)
+        #
+        self.assertGreater(lib.qcgc_hbtable.size, lib.QCGC_HBTABLE_INIT_SIZE)
+        self.assertLessEqual(2 * lib.qcgc_hbtable.count, lib.qcgc_hbtable.size)
+        for i, o in enumerate(objects):
+            self.assertTrue(self.hbtable_has(o))
+            self.assertEqual(i % 2 == 1, lib.qcgc_hbtable_is_marked(o))
+
+    def test_sweep_many(self):
+        alive = list()
+        dead = list()
+        for i in range(3 * lib.QCGC_HBTABLE_INIT_SIZE):
+            o = lib._qcgc_allocate_large(2**lib.QCGC_LARGE_ALLOC_THRESHOLD_EXP)
+            if i % 3 == 0:
+                lib.qcgc_hbtable_mark(o)
+                alive.append(o)
+            else:
+                dead.append(int(ffi.cast("uintptr_t", o)))
+        #
+        lib.qcgc_hbtable_sweep()
+        #
+        self.assertEqual(len(alive), lib.qcgc_hbtable.count)
+        for o in alive:
+            self.assertTrue(self.hbtable_has(o))
+            self.assertFalse(lib.qcgc_hbtable_is_marked(o))
+        for o in dead:
+            self.assertFalse(self.hbtable_has(ffi.cast("object_t *", o)))
+
     def hbtable_has(self, o):
-        b = lib.bucket(o)
-        for i in range(lib.qcgc_hbtable.bucket[b].count):
-            if (lib.qcgc_hbtable.bucket[b].items[i].object == o):
-                return True
-        return False
+        return lib.qcgc_hbtable_has(o)
 
 if __name__ == "__main__":
     unittest.main()
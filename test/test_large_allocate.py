@@ -115,18 +115,10 @@ class LargeAllocateTestCase(QCGCTest):
             ffi.cast("cell_t *", q)), lib.BLOCK_BLACK)
 
     def hbtable_has(self, o):
-        b = lib.bucket(o)
-        for i in range(lib.qcgc_hbtable.bucket[b].count):
-            if (lib.qcgc_hbtable.bucket[b].items[i].object == o):
-                return True
-        return False
+        return lib.qcgc_hbtable_has(o)
 
     def hbtable_marked(self, o):
-        b = lib.bucket(o)
-        for i in range(lib.qcgc_hbtable.bucket[b].count):
-            if (lib.qcgc_hbtable.bucket[b].items[i].object == o):
-                return (lib.qcgc_hbtable.bucket[b].items[i].mark_flag == lib.qcgc_hbtable.mark_flag_ref)
-        return False
+        return lib.qcgc_hbtable_is_marked(o)
 
 if __name__ == "__main__":
     unittest.main()
@@ -0,0 +1,198 @@
+from support import lib,ffi
+from qcgc_test import QCGCTest
+import os
+import unittest
+
+# refs[0] and refs[2] of a myobject_t, the first word holds the header and
+# the type id
+LAYOUT = 1
+BITMAP = (1 << 1) | (1 << 3)
+
+class LayoutTestCase(QCGCTest):
+    def setUp(self):
+        super(LayoutTestCase, self).setUp()
+        lib.qcgc_register_layout(LAYOUT, BITMAP)
+
+    def allocate_layout(self):
+        """Object with 3 reference fields that qcgc_trace_cb does not know
+        about (type id 0)"""
+        o = self.allocate(3 * ffi.sizeof("myobject_t *"))
+        lib.qcgc_set_layout(ffi.cast("object_t *", o), LAYOUT)
+        return o
+
+    def link(self, obj, index, ref):
+        lib.qcgc_write(ffi.cast("object_t *", obj))
+        obj.refs[index] = ffi.cast("myobject_t *", ref)
+
+    def test_register(self):
+        self.assertEqual(lib.qcgc_layout_state.bitmaps[0], 0)
+        self.assertEqual(lib.qcgc_layout_state.bitmaps[LAYOUT], BITMAP)
+        lib.qcgc_register_layout(lib.QCGC_LAYOUT_COUNT - 1, 1 << 63)
+        self.assertEqual(
+                lib.qcgc_layout_state.bitmaps[lib.QCGC_LAYOUT_COUNT - 1],
+                1 << 63)
+
+    def test_set_layout(self):
+        o = self.allocate(1)
+        flags = o.hdr.flags
+        lib.qcgc_set_layout(ffi.cast("object_t *", o), 7)
+        self.assertEqual(o.hdr.flags >> lib.QCGC_LAYOUT_SHIFT, 7)
+        self.assertEqual(o.hdr.flags & ((1 << lib.QCGC_LAYOUT_SHIFT) - 1),
+                flags)
+        lib.qcgc_set_layout(ffi.cast("object_t *", o), 0)
+        self.assertEqual(o.hdr.flags, flags)
+
+    def test_mark(self):
+        root = self.allocate_layout()
+        self.push_root(root)
+        a = self.allocate_layout()
+        b = self.allocate(1)
+        skipped = self.allocate(1)
+        self.link(root, 0, a)
+        self.link(root, 1, skipped)     # Not in the layout
+        self.link(root, 2, b)
+        c = self.allocate(1)
+        self.link(a, 2, c)
+
+        lib.qcgc_mark()
+
+        for p in [root, a, b, c]:
+            self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)),
+                    lib.BLOCK_BLACK)
+        self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", skipped)),
+                lib.BLOCK_WHITE)
+
+    def test_mixed(self):
+        # Layout objects referenced by callback traced objects and vice versa
+        root = self.allocate_ref(1)
+        self.push_root(root)
+        a = self.allocate_layout()
+        self.set_ref(root, 0, a)
+        b = self.allocate_ref(1)
+        self.link(a, 0, b)
+        c = self.allocate(1)
+        self.set_ref(b, 0, c)
+
+        lib.qcgc_collect()
+
+        for p in [root, a, b, c]:
+            self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)),
+                    lib.BLOCK_WHITE)
+        self.assertEqual(b.refs[0], c)
+
+    def test_incmark(self):
+        objects = list()
+        prev = ffi.NULL
+        for _ in range(1000):
+            o = self.allocate_layout()
+            o.refs[0] = prev
+            prev = o
+            objects.append(o)
+        self.push_root(prev)
+        lib.bump_ptr_reset()
+
+        lib.qcgc_incmark()
+        self.assertEqual(lib.qcgc_state.phase, lib.GC_MARK)
+        while lib.qcgc_state.phase == lib.GC_MARK:
+            lib.qcgc_incmark()
+
+        for p in objects:
+            self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)),
+                    lib.BLOCK_BLACK)
+
+    def test_huge_and_prebuilt(self):
+        o = self.allocate_prebuilt(3 * ffi.sizeof("myobject_t *"))
+        lib.qcgc_set_layout(ffi.cast("object_t *", o), LAYOUT)
+        h = self.allocate(lib.qcgc_arena_size)
+        lib.qcgc_set_layout(ffi.cast("object_t *", h), LAYOUT)
+        p = self.allocate(1)
+        self.link(o, 0, h)
+        self.link(h, 2, p)
+
+        lib.qcgc_mark()
+
+        self.assertTrue(lib.qcgc_hbtable_is_marked(ffi.cast("object_t *", h)))
+        self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)),
+                lib.BLOCK_BLACK)
+
+class LayoutParallelMarkTestCase(LayoutTestCase):
+    def setUp(self):
+        os.environ["QCGC_MARK_THREADS"] = "4"
+        super(LayoutParallelMarkTestCase, self).setUp()
+
+    def tearDown(self):
+        super(LayoutParallelMarkTestCase, self).tearDown()
+        del os.environ["QCGC_MARK_THREADS"]
+
+class LayoutGenerationalTestCase(LayoutTestCase):
+    def setUp(self):
+        os.environ["QCGC_GENERATIONAL"] = "1"
+        super(LayoutGenerationalTestCase, self).setUp()
+
+    def tearDown(self):
+        super(LayoutGenerationalTestCase, self).tearDown()
+        del os.environ["QCGC_GENERATIONAL"]
+
+    def test_minor_collect(self):
+        old = self.allocate_layout()
+        self.push_root(old)
+        lib.qcgc_minor_collect()
+        self.assertFalse(lib.qcgc_generation_is_young(
+            ffi.cast("object_t *", old)))
+
+        # Remembered set and young objects are traced by the layout
+        young = self.allocate_layout()
+        self.link(old, 0, young)
+        skipped = self.allocate(1)
+        self.link(old, 1, skipped)
+        child = self.allocate(1)
+        young.refs[2] = child
+
+        lib.qcgc_minor_collect()
+
+        for p in [young, child]:
+            self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)),
+                    lib.BLOCK_WHITE)
+        self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", skipped)),
+                lib.BLOCK_FREE)
+
+class LayoutCompactionTestCase(LayoutTestCase):
+    def setUp(self):
+        os.environ["QCGC_COMPACTION"] = "1"
+        super(LayoutCompactionTestCase, self).setUp()
+
+    def tearDown(self):
+        super(LayoutCompactionTestCase, self).tearDown()
+        del os.environ["QCGC_COMPACTION"]
+
+    def test_forward(self):
+        # Sparse arenas of layout objects, only refs[2] forms the list
+        count = 0
+        i = 0
+        prev = ffi.NULL
+        while lib.arenas().count <= 3:
+            o = self.allocate(self.arena_object_size)
+            lib.qcgc_set_layout(ffi.cast("object_t *", o), LAYOUT)
+            if i % 8 == 0:
+                o.refs[2] = prev
+                prev = o
+                count += 1
+            i += 1
+        self.push_root(prev)
+        lib.bump_ptr_reset()
+
+        lib.qcgc_collect()
+
+        self.assertEqual(lib.qcgc_compaction_state.evacuated_objects, count)
+        o = ffi.cast("myobject_t *", lib._qcgc_shadowstack.base[0])
+        length = 0
+        while o != ffi.NULL:
+            self.assertEqual(o.hdr.flags >> lib.QCGC_LAYOUT_SHIFT, LAYOUT)
+            self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", o)),
+                    lib.BLOCK_WHITE)
+            o = o.refs[2]
+            length += 1
+        self.assertEqual(length, count)
+
+if __name__ == "__main__":
+    unittest.main()
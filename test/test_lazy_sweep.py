@@ -0,0 +1,108 @@
+from support import lib,ffi
+from qcgc_test import QCGCTest
+import os
+import unittest
+
+class LazySweepTestCase(QCGCTest):
+    def setUp(self):
+        os.environ["QCGC_LAZY_SWEEP"] = "1"
+        super(LazySweepTestCase, self).setUp()
+
+    def tearDown(self):
+        super(LazySweepTestCase, self).tearDown()
+        del os.environ["QCGC_LAZY_SWEEP"]
+
+    def fill_arenas(self):
+        """Spread alive and dead objects over several arenas"""
+        alive = list()
+        dead = list()
+        for i in range(600):
+            p = self.allocate(self.arena_object_size)
+            if i % 2 == 0:
+                self.push_root(p)
+                alive.append(p)
+            else:
+                dead.append(p)
+        self.assertGreater(lib.arenas().count, 2)
+        return alive, dead
+
+    def test_knob(self):
+        self.assertEqual(lib.qcgc_state.lazy_sweep, 1)
+
+    def test_sweep_defers_arenas(self):
+        alive, dead = self.fill_arenas()
+        lib.bump_ptr_reset()
+        lib.qcgc_mark()
+        lib.qcgc_sweep()
+
+        self.assertEqual(lib.qcgc_state.phase, lib.GC_PAUSE)
+        self.assertEqual(lib.unswept_arenas().count, lib.arenas().count)
+        for p in alive:
+            self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)),
+                    lib.BLOCK_BLACK)
+
+        lib.qcgc_lazy_sweep_finish()
+
+        self.assertEqual(lib.unswept_arenas().count, 0)
+        for p in alive:
+            self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)),
+                    lib.BLOCK_WHITE)
+        for p in dead:
+            self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)),
+                    lib.BLOCK_FREE)
+
+    def test_bump_arena_swept(self):
+        p = self.allocate(1)
+        self.push_root(p)
+        lib.qcgc_mark()
+        lib.qcgc_sweep()
+
+        self.assertEqual(lib.unswept_arenas().count, lib.arenas().count - 1)
+        self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)),
+                lib.BLOCK_WHITE)
+
+    def test_fit_allocate_sweeps_on_demand(self):
+        self.fill_arenas()
+        lib.bump_ptr_reset()
+        lib.qcgc_mark()
+        lib.qcgc_sweep()
+        unswept = lib.unswept_arenas().count
+
+        p = lib.qcgc_fit_allocate(self.arena_object_size)
+
+        self.assertNotEqual(p, ffi.NULL)
+        self.assertLess(lib.unswept_arenas().count, unswept)
+        self.assertGreater(lib.unswept_arenas().count, 0)
+
+    def test_mark_finishes_sweep(self):
+        alive, dead = self.fill_arenas()
+        lib.bump_ptr_reset()
+        lib.qcgc_mark()
+        lib.qcgc_sweep()
+        self.assertGreater(lib.unswept_arenas().count, 0)
+
+        lib.qcgc_mark()
+
+        self.assertEqual(lib.unswept_arenas().count, 0)
+        for p in alive:
+            self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)),
+                    lib.BLOCK_BLACK)
+        for p in dead:
+            self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)),
+                    lib.BLOCK_FREE)
+
+    def test_weakrefs(self):
+        alive, dead = self.fill_arenas()
+        wr_to_alive = self.allocate_weakref(alive[0])
+        wr_to_dead = self.allocate_weakref(dead[0])
+        self.push_root(wr_to_alive)
+        self.push_root(wr_to_dead)
+        lib.bump_ptr_reset()
+        lib.qcgc_collect()
+
+        self.assertGreater(lib.unswept_arenas().count, 0)
+        self.assertEqual(self.get_ref(wr_to_alive, 0), alive[0])
+        self.assertEqual(self.get_ref(wr_to_dead, 0), ffi.NULL)
+
+if __name__ == "__main__":
+    unittest.main()
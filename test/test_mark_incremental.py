@@ -1,5 +1,6 @@
 from support import lib,ffi
 from qcgc_test import QCGCTest
+import os
 import unittest
 
 class MarkIncTestCase(QCGCTest):
@@ -130,6 +131,62 @@ class MarkIncTestCase(QCGCTest):
         for p in unreachable:
             self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)), lib.BLOCK_WHITE)
 
+class TimedMarkIncTestCase(QCGCTest):
+    def setUp(self):
+        os.environ["QCGC_INCMARK_BUDGET_NS"] = "1"
+        super(TimedMarkIncTestCase, self).setUp()
+
+    def tearDown(self):
+        super(TimedMarkIncTestCase, self).tearDown()
+        del os.environ["QCGC_INCMARK_BUDGET_NS"]
+
+    def test_knob(self):
+        self.assertEqual(lib.qcgc_state.incmark_budget_ns, 1)
+
+    def test_budget_spent(self):
+        for _ in range(1000):
+            self.push_root(self.allocate(1))
+        lib.qcgc_incmark()
+        self.assertEqual(lib.qcgc_state.marked_objects,
+                lib.QCGC_INCMARK_CLOCK_INTERVAL)
+        self.assertEqual(lib.qcgc_state.phase, lib.GC_MARK)
+
+    def test_work_carries_over(self):
+        reachable = list()
+        unreachable = list()
+        # Spread the gray objects over several arenas
+        while lib.arenas().count < 3:
+            p, objs = self.gen_structure_1()
+            self.push_root(p)
+            reachable.extend(objs)
+            p, objs = self.gen_structure_1()
+            unreachable.extend(objs)
+            self.allocate(self.arena_object_size)
+
+        cursors = set()
+        steps = 0
+        lib.qcgc_incmark()
+        while lib.qcgc_state.phase == lib.GC_MARK:
+            cursors.add(lib.qcgc_state.incmark_cursor)
+            lib.qcgc_incmark()
+            steps += 1
+        self.assertGreater(steps, 1)
+        self.assertGreater(len(cursors), 1)
+
+        for p in reachable:
+            self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)), lib.BLOCK_BLACK)
+
+        for p in unreachable:
+            self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)), lib.BLOCK_WHITE)
+
+    def test_large_budget(self):
+        lib.qcgc_state.incmark_budget_ns = 10**9
+        for _ in range(10):
+            p, objs = self.gen_structure_1()
+            self.push_root(p)
+        lib.qcgc_incmark()
+        self.assertEqual(lib.qcgc_state.phase, lib.GC_COLLECT)
+
 def mark_all_inc():
     lib.qcgc_incmark()
     while(lib.qcgc_state.phase == lib.GC_MARK):
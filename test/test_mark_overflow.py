@@ -0,0 +1,125 @@
+from support import lib,ffi
+from qcgc_test import QCGCTest
+import os
+import unittest
+
+class MarkOverflowTestCase(QCGCTest):
+    limit = 1
+
+    def setUp(self):
+        os.environ["QCGC_GRAY_STACK_LIMIT"] = str(self.limit)
+        super(MarkOverflowTestCase, self).setUp()
+
+    def tearDown(self):
+        super(MarkOverflowTestCase, self).tearDown()
+        del os.environ["QCGC_GRAY_STACK_LIMIT"]
+
+    def wide_graph(self, width=20, depth=2):
+        """Every object references width new ones, width**depth leaves"""
+        objects = list()
+        def build(level):
+            if level == depth:
+                o = self.allocate(1)
+            else:
+                o = self.allocate_ref(width)
+                for i in range(width):
+                    o.refs[i] = build(level + 1)
+            objects.append(o)
+            return o
+        root = build(0)
+        self.push_root(root)
+        lib.bump_ptr_reset()
+        return objects
+
+    def check_marked(self, objects):
+        self.assertEqual(lib.qcgc_state.phase, lib.GC_COLLECT)
+        self.assertFalse(lib.qcgc_state.gray_overflow)
+        for o in objects:
+            self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", o)),
+                    lib.BLOCK_BLACK)
+            self.assertEqual(o.hdr.flags & lib.QCGC_GRAY_FLAG, 0)
+        for i in range(lib.arenas().count):
+            self.assertEqual(lib.arena_overflowed(lib.arenas().items[i]), 0)
+
+    def test_knob(self):
+        self.assertEqual(lib.qcgc_gray_pool.limit, self.limit)
+
+    def test_bounded_push(self):
+        stack = ffi.new("gray_stack_t **")
+        for i in range(self.limit * lib.QCGC_MARK_LIST_SEGMENT_SIZE):
+            self.assertTrue(lib.qcgc_gray_stack_push_bounded(stack,
+                ffi.cast("object_t *", i + 1)))
+        self.assertFalse(lib.qcgc_gray_stack_push_bounded(stack,
+            ffi.cast("object_t *", 1)))
+        # Unbounded pushes still succeed
+        stack[0] = lib.qcgc_gray_stack_push(stack[0], ffi.cast("object_t *", 1))
+        self.assertEqual(lib.qcgc_gray_stack_count(stack[0]),
+                self.limit * lib.QCGC_MARK_LIST_SEGMENT_SIZE + 1)
+        lib.qcgc_gray_stack_free(stack[0])
+
+    def test_mark(self):
+        objects = self.wide_graph()
+        lib.qcgc_gray_pool.peak = 0
+        lib.qcgc_mark()
+        self.check_marked(objects)
+        self.assertLessEqual(lib.qcgc_gray_pool.peak, self.limit)
+        lib.qcgc_sweep()
+        for o in objects:
+            self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", o)),
+                    lib.BLOCK_WHITE)
+
+    def test_incmark(self):
+        objects = self.wide_graph()
+        lib.qcgc_gray_pool.peak = 0
+        steps = 0
+        while lib.qcgc_state.phase != lib.GC_COLLECT:
+            lib.qcgc_incmark()
+            steps += 1
+            self.assertLess(steps, 1000)
+        self.check_marked(objects)
+        self.assertLessEqual(lib.qcgc_gray_pool.peak, self.limit)
+
+    def test_write_barrier(self):
+        o = self.allocate_ref(1)
+        self.push_root(o)
+        lib.bump_ptr_reset()
+        lib.qcgc_incmark()
+        self.assertEqual(o.hdr.flags & lib.QCGC_GRAY_FLAG, 0)
+
+        # Gray stacks are full
+        stack = ffi.new("gray_stack_t **")
+        while lib.qcgc_gray_stack_push_bounded(stack, ffi.cast("object_t *", 1)):
+            pass
+        p = self.allocate(1)
+        self.set_ref(o, 0, p)
+        arena = lib.qcgc_arena_addr(ffi.cast("cell_t *", o))
+        self.assertNotEqual(o.hdr.flags & lib.QCGC_GRAY_FLAG, 0)
+        self.assertEqual(lib.arena_gray_stack(arena), ffi.NULL)
+        self.assertEqual(lib.arena_overflowed(arena), 1)
+        self.assertTrue(lib.qcgc_state.gray_overflow)
+        self.assertEqual(lib.qcgc_state.phase, lib.GC_MARK)
+        lib.qcgc_gray_stack_free(stack[0])
+
+        lib.qcgc_mark()
+        self.check_marked([o, p])
+
+class MarkOverflowParallelTestCase(MarkOverflowTestCase):
+    def setUp(self):
+        os.environ["QCGC_MARK_THREADS"] = "4"
+        super(MarkOverflowParallelTestCase, self).setUp()
+
+    def tearDown(self):
+        super(MarkOverflowParallelTestCase, self).tearDown()
+        del os.environ["QCGC_MARK_THREADS"]
+
+    def test_mark(self):
+        objects = self.wide_graph()
+        lib.qcgc_mark()
+        self.check_marked(objects)
+
+class MarkOverflowDefaultTestCase(QCGCTest):
+    def test_knob(self):
+        self.assertEqual(lib.qcgc_gray_pool.limit, lib.QCGC_GRAY_STACK_LIMIT)
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,103 @@
+from support import lib,ffi
+from qcgc_test import QCGCTest
+import os
+import unittest
+
+class MarkPrefetchTestCase(QCGCTest):
+    def setUp(self):
+        os.environ["QCGC_MARK_PREFETCH"] = "8"
+        super(MarkPrefetchTestCase, self).setUp()
+
+    def tearDown(self):
+        super(MarkPrefetchTestCase, self).tearDown()
+        del os.environ["QCGC_MARK_PREFETCH"]
+
+    def test_knob(self):
+        self.assertEqual(lib.qcgc_state.mark_prefetch, 8)
+
+    def test_structures(self):
+        reachable = list()
+        unreachable = list()
+        for i in range(20):
+            p, objs = self.gen_structure_1()
+            self.push_root(p)
+            reachable.extend(objs)
+            objects = self.gen_circular_structure(i + 1)
+            self.push_root(objects[0])
+            reachable.extend(objects)
+
+            p, objs = self.gen_structure_1()
+            unreachable.extend(objs)
+            unreachable.extend(self.gen_circular_structure(i + 1))
+
+        lib.qcgc_mark()
+
+        self.assertEqual(lib.qcgc_state.gray_stack_size, 0)
+        self.assertEqual(lib.qcgc_state.phase, lib.GC_COLLECT)
+        self.assertEqual(lib.qcgc_state.marked_objects, len(reachable))
+        for p in reachable:
+            self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)), lib.BLOCK_BLACK)
+            self.assertEqual(p.hdr.flags & lib.QCGC_GRAY_FLAG, 0)
+        for p in unreachable:
+            self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)), lib.BLOCK_WHITE)
+
+    def test_wide(self):
+        # More children than FIFO entries, some of them twice
+        root = self.allocate_ref(1000)
+        self.push_root(root)
+        children = list()
+        for i in range(500):
+            p = self.allocate_ref(1)
+            self.set_ref(root, 2 * i, p)
+            self.set_ref(root, 2 * i + 1, p)
+            q = self.allocate(self.arena_object_size)
+            self.set_ref(p, 0, q)
+            children.append(p)
+            children.append(q)
+
+        lib.qcgc_mark()
+
+        for p in children:
+            self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)), lib.BLOCK_BLACK)
+            self.assertEqual(p.hdr.flags & lib.QCGC_GRAY_FLAG, 0)
+
+    def test_huge_medium_and_prebuilt(self):
+        o = self.allocate_prebuilt_ref(2)
+        h = self.allocate_ref(lib.qcgc_arena_size // ffi.sizeof("myobject_t *"))
+        m = self.allocate_ref(2**lib.QCGC_LARGE_ALLOC_THRESHOLD_EXP
+                // ffi.sizeof("myobject_t *"))
+        p = self.allocate_ref(1)
+        q = self.allocate(1)
+        self.set_ref(o, 0, h)
+        self.set_ref(o, 1, m)
+        self.set_ref(h, 0, p)
+        self.set_ref(m, 0, o)
+        self.set_ref(p, 0, q)
+
+        lib.qcgc_mark()
+
+        self.assertTrue(lib.qcgc_hbtable_is_marked(ffi.cast("object_t *", h)))
+        self.assertTrue(lib.qcgc_medium_is_marked(ffi.cast("object_t *", m)))
+        self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)), lib.BLOCK_BLACK)
+        self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", q)), lib.BLOCK_BLACK)
+
+    def test_incmark_unaffected(self):
+        objects = self.gen_circular_structure(1000)
+        self.push_root(objects[0])
+        lib.qcgc_incmark()
+        self.assertEqual(lib.qcgc_state.phase, lib.GC_MARK)
+        lib.qcgc_mark()
+        for p in objects:
+            self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)), lib.BLOCK_BLACK)
+
+    def test_collect_twice(self):
+        objects = self.gen_circular_structure(100)
+        self.push_root(objects[0])
+        lib.qcgc_collect()
+        lib.qcgc_collect()
+        for p in objects:
+            self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)), lib.BLOCK_WHITE)
+        self.pop_root()
+
+if __name__ == "__main__":
+    unittest.main()
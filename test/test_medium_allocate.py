@@ -0,0 +1,128 @@
+import unittest
+from support import lib,ffi
+from qcgc_test import QCGCTest
+
+class MediumAllocateTestCase(QCGCTest):
+    def allocate_medium(self, size):
+        o = self.allocate(size - self.header_size)
+        return ffi.cast("object_t *", o)
+
+    def segment(self, o):
+        return ffi.cast("medium_segment_t *",
+                lib.qcgc_arena_addr(ffi.cast("cell_t *", o)))
+
+    def page(self, o):
+        offset = int(ffi.cast("uintptr_t", o)) & (lib.qcgc_arena_size - 1)
+        return self.segment(o).pages[offset // lib.qcgc_medium_page_size]
+
+    def test_size_classes(self):
+        small = self.allocate_medium(2**lib.QCGC_LARGE_ALLOC_THRESHOLD_EXP - 16)
+        medium = self.allocate_medium(2**lib.QCGC_LARGE_ALLOC_THRESHOLD_EXP)
+        largest = self.allocate_medium(lib.qcgc_medium_max_size)
+        huge = self.allocate_medium(lib.qcgc_medium_max_size + 1)
+
+        self.assertFalse(lib.qcgc_medium_is_segment(
+            lib.qcgc_arena_addr(ffi.cast("cell_t *", small))))
+        for o in [medium, largest]:
+            self.assertTrue(lib.qcgc_medium_is_segment(
+                lib.qcgc_arena_addr(ffi.cast("cell_t *", o))))
+            self.assertFalse(lib.qcgc_hbtable_has(o))
+        self.assertTrue(lib.qcgc_hbtable_has(huge))
+        self.assertEqual(2, lib.qcgc_medium_state.segments.count)
+
+    def test_page_spans(self):
+        size = 2**lib.QCGC_LARGE_ALLOC_THRESHOLD_EXP + 1024
+        pages = -(-size // lib.qcgc_medium_page_size)
+        o = self.allocate_medium(size)
+        p = self.allocate_medium(size)
+
+        segment = self.segment(o)
+        self.assertEqual(segment, self.segment(p))
+        self.assertEqual(lib.qcgc_medium_pages - lib.QCGC_MEDIUM_FIRST_PAGE
+                - 2 * pages, segment.free_pages)
+        self.assertEqual(int(ffi.cast("uintptr_t", o))
+                % lib.qcgc_medium_page_size, 0)
+        self.assertEqual(ffi.cast("char *", p) - ffi.cast("char *", o),
+                pages * lib.qcgc_medium_page_size)
+        self.assertEqual(lib.BLOCK_WHITE, self.page(o))
+        first = (int(ffi.cast("uintptr_t", o)) & (lib.qcgc_arena_size - 1)) \
+                // lib.qcgc_medium_page_size
+        for i in range(1, pages):
+            self.assertEqual(lib.BLOCK_EXTENT, segment.pages[first + i])
+
+    def test_mark_sweep(self):
+        size = 2**lib.QCGC_LARGE_ALLOC_THRESHOLD_EXP
+        alive = self.allocate_medium(size)
+        self.push_root(alive)
+        dead = self.allocate_medium(size)
+        segment = self.segment(alive)
+        free_pages = segment.free_pages
+
+        lib.qcgc_mark()
+        self.assertEqual(lib.BLOCK_BLACK, self.page(alive))
+        self.assertEqual(lib.BLOCK_WHITE, self.page(dead))
+        self.assertFalse(lib.qcgc_medium_mark(alive))
+        lib.qcgc_sweep()
+
+        self.assertEqual(lib.BLOCK_WHITE, self.page(alive))
+        self.assertEqual(lib.BLOCK_FREE, self.page(dead))
+        self.assertEqual(free_pages + size // lib.qcgc_medium_page_size,
+                segment.free_pages)
+
+        # Freed pages are reused
+        self.assertEqual(dead, self.allocate_medium(size))
+
+    def test_empty_segment_freed(self):
+        self.allocate_medium(2**lib.QCGC_LARGE_ALLOC_THRESHOLD_EXP)
+        self.assertEqual(1, lib.qcgc_medium_state.segments.count)
+        lib.qcgc_collect()
+        self.assertEqual(0, lib.qcgc_medium_state.segments.count)
+
+    def test_trace_references(self):
+        count = 2**lib.QCGC_LARGE_ALLOC_THRESHOLD_EXP // ffi.sizeof("myobject_t *")
+        o = self.allocate_ref(count)
+        self.assertTrue(lib.qcgc_medium_is_segment(
+            lib.qcgc_arena_addr(ffi.cast("cell_t *", o))))
+        self.push_root(o)
+        p = self.allocate(1)
+        self.set_ref(o, count - 1, p)
+
+        lib.qcgc_mark()
+
+        self.assertTrue(lib.qcgc_medium_is_marked(ffi.cast("object_t *", o)))
+        self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)),
+                lib.BLOCK_BLACK)
+
+    def test_write_barrier(self):
+        o = self.allocate_ref(2**lib.QCGC_LARGE_ALLOC_THRESHOLD_EXP
+                // ffi.sizeof("myobject_t *"))
+        self.push_root(o)
+        lib.qcgc_incmark()
+        self.assertTrue(lib.qcgc_medium_is_marked(ffi.cast("object_t *", o)))
+        self.assertFalse(self.gp_gray_stack_has(o))
+
+        p = self.allocate(1)
+        self.set_ref(o, 0, p)
+        self.assertTrue(self.gp_gray_stack_has(o))
+
+        lib.qcgc_incmark()
+        self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)),
+                lib.BLOCK_BLACK)
+
+    def test_weakref(self):
+        size = 2**lib.QCGC_LARGE_ALLOC_THRESHOLD_EXP
+        alive = self.allocate_medium(size)
+        self.push_root(alive)
+        dead = self.allocate_medium(size)
+        wr_to_alive = self.allocate_weakref(alive)
+        wr_to_dead = self.allocate_weakref(dead)
+        self.push_root(wr_to_alive)
+        self.push_root(wr_to_dead)
+
+        lib.qcgc_collect()
+
+        self.assertEqual(self.get_ref(wr_to_alive, 0), alive)
+        self.assertEqual(self.get_ref(wr_to_dead, 0), ffi.NULL)
+
+if __name__ == "__main__":
+    unittest.main()
@@ -22,8 +22,24 @@ class ObjectTestCase(QCGCTest):
         lib.qcgc_state.phase = lib.GC_MARK
         lib.qcgc_write(ffi.cast("object_t *", o))
         self.assertEqual(ffi.cast("object_t *", o).flags & lib.QCGC_GRAY_FLAG, lib.QCGC_GRAY_FLAG)
-        self.assertEqual(lib.arena_gray_stack(arena).count, 1)
-        self.assertEqual(lib.arena_gray_stack(arena).items[0], o)
+        self.assertEqual(lib.qcgc_gray_stack_count(lib.arena_gray_stack(arena)), 1)
+        self.assertEqual(self.gray_stack_items(lib.arena_gray_stack(arena)), [o])
+
+    def test_write_barrier_gray(self):
+        # Gray objects only take the inlined check
+        o = self.allocate(16)
+        self.push_root(o)
+        arena = lib.qcgc_arena_addr(ffi.cast("cell_t *", o))
+        self.set_blocktype(ffi.cast("cell_t *", o), lib.BLOCK_BLACK)
+        lib.qcgc_state.phase = lib.GC_MARK
+        self.assertEqual(o.hdr.flags & lib.QCGC_GRAY_FLAG, lib.QCGC_GRAY_FLAG)
+        lib.qcgc_write(ffi.cast("object_t *", o))
+        self.assertEqual(lib.arena_gray_stack(arena), ffi.NULL)
+
+        o.hdr.flags = o.hdr.flags & ~lib.QCGC_GRAY_FLAG
+        lib._qcgc_write_slowpath(ffi.cast("object_t *", o))
+        self.assertEqual(o.hdr.flags & lib.QCGC_GRAY_FLAG, lib.QCGC_GRAY_FLAG)
+        self.assertEqual(lib.qcgc_gray_stack_count(lib.arena_gray_stack(arena)), 1)
 
 if __name__ == "__main__":
     unittest.main()
@@ -0,0 +1,155 @@
+from support import lib,ffi
+from qcgc_test import QCGCTest
+import os
+import unittest
+
+class PacerTestCase(QCGCTest):
+    min_cells = lib.qcgc_arena_size // 16
+
+    def collect(self):
+        # Return the rest of the bump block to the free lists, such that it
+        # is not counted as live
+        lib.qcgc_reset_bump_ptr()
+        lib.qcgc_collect()
+
+    def fill(self, count):
+        for _ in range(count):
+            self.push_root(self.allocate(self.arena_object_size))
+
+    def budget(self):
+        return lib.qcgc_state.heap_goal - lib.qcgc_state.live_cells
+
+    def test_knob(self):
+        self.assertEqual(lib.qcgc_state.gc_percent, lib.QCGC_GC_PERCENT)
+
+    def test_initial_goal(self):
+        self.assertEqual(lib.qcgc_state.live_cells, 0)
+        self.assertEqual(lib.qcgc_state.heap_goal, self.min_cells)
+        self.assertEqual(lib.qcgc_state.incmark_threshold,
+                self.min_cells // (lib.qcgc_state.incmark_to_sweep + 1))
+
+    def test_goal_from_live_cells(self):
+        self.fill(1000)
+        self.collect()
+
+        live_cells = lib.arenas().count * (lib.qcgc_arena_cells_count -
+                lib.qcgc_arena_first_cell_index) - lib.qcgc_state.free_cells
+        self.assertEqual(lib.qcgc_state.live_cells, live_cells)
+        self.assertGreaterEqual(live_cells,
+                1000 * lib.bytes_to_cells(self.header_size +
+                    self.arena_object_size))
+        budget = max(live_cells * lib.qcgc_state.gc_percent // 100,
+                self.min_cells)
+        self.assertEqual(lib.qcgc_state.heap_goal, live_cells + budget)
+        self.assertEqual(lib.qcgc_state.incmark_threshold,
+                budget // (lib.qcgc_state.incmark_to_sweep + 1))
+
+    def test_goal_scales_with_heap(self):
+        self.fill(1000)
+        self.collect()
+        small = self.budget()
+
+        self.fill(1000)
+        self.collect()
+        self.assertGreater(self.budget(), small)
+
+        # Shrinks again when objects die
+        for _ in range(2000):
+            self.pop_root()
+        self.collect()
+        self.assertEqual(self.budget(), self.min_cells)
+
+    def test_medium_objects_are_live(self):
+        o = self.allocate(2**lib.QCGC_LARGE_ALLOC_THRESHOLD_EXP)
+        self.push_root(o)
+        self.collect()
+        self.assertGreaterEqual(lib.qcgc_state.live_cells,
+                2**lib.QCGC_LARGE_ALLOC_THRESHOLD_EXP // 16)
+
+    def test_mark_work(self):
+        for _ in range(1000):
+            self.push_root(self.allocate(1))
+        self.collect()
+        self.assertEqual(lib.qcgc_state.mark_work, 1000)
+        self.assertEqual(lib.qcgc_state.marked_objects, 0)
+
+    def test_incmark_share(self):
+        for _ in range(1000):
+            self.push_root(self.allocate(1))
+        self.collect()
+
+        lib.qcgc_incmark()
+        share = 1000 // lib.qcgc_state.incmark_to_sweep
+        self.assertEqual(lib.qcgc_state.marked_objects, share)
+        self.assertEqual(lib.qcgc_state.phase, lib.GC_MARK)
+
+        lib.qcgc_mark()
+        self.assertEqual(lib.qcgc_state.marked_objects, 1000)
+        lib.qcgc_sweep()
+
+    def test_cycle_ends_at_goal(self):
+        self.fill(1000)
+        self.collect()
+        budget = self.budget()
+
+        # Allocate garbage until the next full collection, which may overshoot
+        # the goal by one bump block per step
+        allocated = 0
+        size = self.arena_object_size
+        cells = lib.bytes_to_cells(self.header_size + size)
+        started = False
+        while not started or lib.qcgc_state.incmark_since_sweep != 0:
+            self.allocate(size)
+            allocated += cells
+            started = started or lib.qcgc_state.incmark_since_sweep != 0
+            self.assertLessEqual(allocated,
+                    budget + (lib.qcgc_state.incmark_to_sweep + 1) *
+                    lib.qcgc_arena_cells_count)
+        self.assertGreaterEqual(allocated, budget)
+
+class PacerOffTestCase(QCGCTest):
+    def setUp(self):
+        os.environ["QCGC_GC_PERCENT"] = "0"
+        super(PacerOffTestCase, self).setUp()
+
+    def tearDown(self):
+        super(PacerOffTestCase, self).tearDown()
+        del os.environ["QCGC_GC_PERCENT"]
+
+    def test_fixed_threshold(self):
+        self.assertEqual(lib.qcgc_state.gc_percent, 0)
+        threshold = lib.qcgc_state.incmark_threshold
+        self.assertEqual(threshold, lib.qcgc_arena_size // 16)
+        for _ in range(1000):
+            self.push_root(self.allocate(self.arena_object_size))
+        lib.qcgc_collect()
+        self.assertEqual(lib.qcgc_state.incmark_threshold, threshold)
+        self.assertEqual(lib.qcgc_state.heap_goal, 0)
+
+class PacerExplicitThresholdTestCase(QCGCTest):
+    def setUp(self):
+        os.environ["QCGC_INCMARK"] = "1000"
+        super(PacerExplicitThresholdTestCase, self).setUp()
+
+    def tearDown(self):
+        super(PacerExplicitThresholdTestCase, self).tearDown()
+        del os.environ["QCGC_INCMARK"]
+
+    def test_threshold_wins(self):
+        self.assertEqual(lib.qcgc_state.gc_percent, 0)
+        self.assertEqual(lib.qcgc_state.incmark_threshold, 1000)
+        for _ in range(1000):
+            self.push_root(self.allocate(self.arena_object_size))
+        lib.qcgc_collect()
+        self.assertEqual(lib.qcgc_state.incmark_threshold, 1000)
+
+    def test_both_set(self):
+        lib.qcgc_destroy()
+        os.environ["QCGC_GC_PERCENT"] = "100"
+        lib.qcgc_initialize()
+        del os.environ["QCGC_GC_PERCENT"]
+        self.assertEqual(lib.qcgc_state.gc_percent, 100)
+        self.assertNotEqual(lib.qcgc_state.incmark_threshold, 1000)
+
+if __name__ == "__main__":
+    unittest.main()
@@ -1,5 +1,6 @@
 from support import lib,ffi
 from qcgc_test import QCGCTest
+import random
 import unittest
 
 class SweepTestCase(QCGCTest):
@@ -24,7 +25,8 @@ class SweepTestCase(QCGCTest):
             self.assertEqual(0, lib.small_free_list(i).count)
 
         for i in range(lib.qcgc_large_free_lists):
-            self.assertEqual(0, lib.large_free_list(i).count)
+            for j in range(lib.qcgc_large_free_list_split):
+                self.assertEqual(0, lib.large_free_list(i, j).count)
 
     def test_arena_sweep_black(self):
         arena = lib.qcgc_arena_create()
@@ -46,9 +48,13 @@ class SweepTestCase(QCGCTest):
         for i in range(lib.qcgc_small_free_lists):
             self.assertEqual(0, lib.small_free_list(i).count)
 
-        for i in range(lib.qcgc_large_free_lists - 1):
-            self.assertEqual(0, lib.large_free_list(i).count)
-        self.assertEqual(1, lib.large_free_list(lib.qcgc_large_free_lists - 1).count)
+        for i in range(lib.qcgc_large_free_lists):
+            for j in range(lib.qcgc_large_free_list_split):
+                if (i, j) == (lib.qcgc_large_free_lists - 1,
+                        lib.qcgc_large_free_list_split - 1):
+                    self.assertEqual(1, lib.large_free_list(i, j).count)
+                else:
+                    self.assertEqual(0, lib.large_free_list(i, j).count)
 
 
     def test_arena_sweep_mixed(self):
@@ -107,7 +113,80 @@ class SweepTestCase(QCGCTest):
                 self.assertEqual(0, lib.small_free_list(i).count)
 
         for i in range(lib.qcgc_large_free_lists):
-            self.assertEqual(0, lib.large_free_list(i).count)
+            for j in range(lib.qcgc_large_free_list_split):
+                self.assertEqual(0, lib.large_free_list(i, j).count)
+
+    def test_arena_sweep_random(self):
+        kernels = [lib.sweep_bitmaps_generic]
+        if lib._cpu_supports_avx2():
+            kernels.append(lib.sweep_bitmaps_avx2)
+        for kernel in kernels:
+            lib.sweep_bitmaps = kernel
+            try:
+                self.check_arena_sweep_random(random.Random(0))
+            finally:
+                lib.sweep_bitmaps = ffi.NULL
+
+    def check_arena_sweep_random(self, rng):
+        arena = lib.qcgc_arena_create()
+        first = lib.qcgc_arena_first_cell_index
+        cells = lib.qcgc_arena_cells_count
+
+        # Coalesced layout of random blocks
+        layout = list()
+        cell = first
+        while cell < cells:
+            types = [lib.BLOCK_BLACK, lib.BLOCK_WHITE]
+            if not layout or layout[-1][1] != lib.BLOCK_FREE:
+                types.append(lib.BLOCK_FREE)
+            layout.append((cell, rng.choice(types)))
+            cell += rng.choice([1, 1, 2, 3, 7, 31, 32, 70, 200])
+
+        for (cell, blocktype) in layout:
+            p = ffi.addressof(lib.arena_cells(arena)[cell])
+            self.set_blocktype(p, blocktype)
+
+        # Expected free blocks, ending at the next surviving block
+        expected = list()
+        start = None
+        for (cell, blocktype) in layout:
+            if blocktype == lib.BLOCK_BLACK:
+                if start is not None:
+                    expected.append((start, cell - start))
+                    start = None
+            elif start is None:
+                start = cell
+
+        self.assertFalse(lib.qcgc_arena_sweep(arena))
+
+        for (cell, blocktype) in layout:
+            p = ffi.addressof(lib.arena_cells(arena)[cell])
+            if blocktype == lib.BLOCK_BLACK:
+                self.assertEqual(self.get_blocktype(p), lib.BLOCK_WHITE)
+            elif any(start == cell for (start, _) in expected):
+                self.assertEqual(self.get_blocktype(p), lib.BLOCK_FREE)
+            elif start is not None and cell == start:
+                self.assertEqual(self.get_blocktype(p), lib.BLOCK_FREE)
+            else:
+                self.assertEqual(self.get_blocktype(p), lib.BLOCK_EXTENT)
+
+        free_blocks = list()
+        for i in range(lib.qcgc_small_free_lists):
+            l = lib.small_free_list(i)
+            for j in range(l.count):
+                free_blocks.append((lib.qcgc_arena_cell_index(l.items[j]), i + 1))
+        for i in range(lib.qcgc_large_free_lists):
+            for j in range(lib.qcgc_large_free_list_split):
+                l = lib.large_free_list(i, j)
+                for k in range(l.count):
+                    free_blocks.append((lib.qcgc_arena_cell_index(
+                        l.items[k].ptr), l.items[k].size))
+        if start is not None:
+            expected.append((start, cells - start))
+        self.assertEqual(sorted(free_blocks), expected)
+
+        lib.qcgc_fit_allocator_empty_lists()
+        lib.qcgc_arena_destroy(arena)
 
     @unittest.skip("Sweeping was reworked")
     def test_arena_sweep_no_double_add(self):
@@ -134,7 +213,8 @@ class SweepTestCase(QCGCTest):
                 self.assertEqual(0, lib.small_free_list(i).count)
 
         for i in range(lib.qcgc_large_free_lists):
-            self.assertEqual(0, lib.large_free_list(i).count)
+            for j in range(lib.qcgc_large_free_list_split):
+                self.assertEqual(0, lib.large_free_list(i, j).count)
 
         # Now mark the black blocks black again
         layout = [ (0, lib.BLOCK_BLACK)
@@ -157,7 +237,8 @@ class SweepTestCase(QCGCTest):
                 self.assertEqual(0, lib.small_free_list(i).count)
 
         for i in range(lib.qcgc_large_free_lists):
-            self.assertEqual(0, lib.large_free_list(i).count)
+            for j in range(lib.qcgc_large_free_list_split):
+                self.assertEqual(0, lib.large_free_list(i, j).count)
 
     @unittest.skip("Bump pointer not set to free")
     def test_arena_sweep_no_bump_ptr_coalescing(self):
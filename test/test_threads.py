@@ -0,0 +1,85 @@
+from support import lib,ffi
+from qcgc_test import QCGCTest
+import threading
+import unittest
+
+class ThreadsTestCase(QCGCTest):
+    def run_threads(self, target, count):
+        errors = list()
+        def run():
+            lib.qcgc_register_thread()
+            try:
+                target()
+            except Exception as e:
+                errors.append(e)
+            finally:
+                lib.qcgc_unregister_thread()
+        threads = [threading.Thread(target=run) for _ in range(count)]
+        # The main thread is registered, leave the heap while waiting
+        lib.qcgc_enter_native()
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        lib.qcgc_leave_native()
+        self.assertEqual(errors, [])
+
+    def test_register(self):
+        def target():
+            self.assertEqual(self.ss_size(), 0)
+            self.assertEqual(lib._qcgc_bump_allocator.ptr, ffi.NULL)
+            p = self.allocate(1)
+            self.push_root(p)
+            self.assertEqual(self.ss_size(), 1)
+            self.pop_root()
+        self.run_threads(target, 1)
+
+    def test_own_shadowstack(self):
+        p = self.allocate(1)
+        self.push_root(p)
+        self.run_threads(lambda: self.assertEqual(self.ss_size(), 0), 2)
+        self.assertEqual(self.ss_size(), 1)
+        self.pop_root()
+
+    def test_collect_all_roots(self):
+        def target():
+            objects = list()
+            for i in range(500):
+                p = self.allocate_ref(1)
+                self.push_root(p)
+                objects.append(p)
+                # Garbage
+                self.allocate(2)
+                if i % 100 == 0:
+                    lib.qcgc_collect()
+            lib.qcgc_collect()
+            for p in objects:
+                self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)),
+                        lib.BLOCK_WHITE)
+            for _ in objects:
+                self.pop_root()
+        self.run_threads(target, 4)
+
+    def test_bump_blocks_aligned(self):
+        def target():
+            for _ in range(100):
+                p = self.allocate(1)
+                self.push_root(p)
+                lib.qcgc_safepoint()
+            if lib._qcgc_bump_allocator.ptr != ffi.NULL:
+                self.assertEqual(lib.qcgc_arena_cell_index(
+                    lib._qcgc_bump_allocator.end) % 8, 0)
+            for _ in range(100):
+                self.pop_root()
+        self.run_threads(target, 3)
+
+    def test_main_thread_roots(self):
+        p = self.allocate(1)
+        self.push_root(p)
+        self.run_threads(lambda: lib.qcgc_collect(), 2)
+        self.assertEqual(self.get_blocktype(ffi.cast("cell_t *", p)),
+                lib.BLOCK_WHITE)
+        self.pop_root()
+
+if __name__ == "__main__":
+    unittest.main()